@@ -329,6 +329,7 @@ wdattach(struct device *parent, struct device *self, void *aux)
 	 */
 	wd->sc_dk.dk_name = wd->sc_dev.dv_xname;
 	bufq_init(&wd->sc_bufq, BUFQ_DEFAULT);
+	bufq_setkick(&wd->sc_bufq, wdstart, wd);
 	wd->sc_sdhook = shutdownhook_establish(wd_shutdown, wd);
 	if (wd->sc_sdhook == NULL)
 		printf("%s: WARNING: unable to establish shutdown hook\n",
@@ -898,6 +899,18 @@ wdioctl(dev_t dev, u_long xfer, caddr_t addr, int flag, struct proc *p)
 			wd->sc_flags &= ~WDF_WLABEL;
 		goto exit;
 
+	case DIOCGBUFQ:
+		*(int *)addr = wd->sc_bufq.bufq_type;
+		goto exit;
+
+	case DIOCSBUFQ:
+		if ((flag & FWRITE) == 0) {
+			error = EBADF;
+			goto exit;
+		}
+		error = bufq_switch(&wd->sc_bufq, *(int *)addr);
+		goto exit;
+
 #ifdef notyet
 	case DIOCWFORMAT:
 		if ((flag & FWRITE) == 0)
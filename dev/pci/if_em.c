@@ -173,6 +173,7 @@ int  em_detach(struct device *, int);
 int  em_activate(struct device *, int);
 int  em_intr(void *);
 void em_start(struct ifnet *);
+void em_mqstart(struct ifnet *, u_int);
 int  em_ioctl(struct ifnet *, u_long, caddr_t);
 void em_watchdog(struct ifnet *);
 void em_init(void *);
@@ -210,6 +211,8 @@ void em_receive_checksum(struct em_softc *, struct em_rx_desc *,
 #ifdef EM_CSUM_OFFLOAD
 void em_transmit_checksum_setup(struct em_softc *, struct mbuf *,
 				u_int32_t *, u_int32_t *);
+int  em_tso_setup(struct em_softc *, struct mbuf *,
+		  u_int32_t *, u_int32_t *);
 #endif
 void em_iff(struct em_softc *);
 #ifdef EM_DEBUG
@@ -534,7 +537,7 @@ em_start(struct ifnet *ifp)
 {
 	struct mbuf    *m_head;
 	struct em_softc *sc = ifp->if_softc;
-	int		post = 0;
+	int		post = 0, error;
 
 	if ((ifp->if_flags & (IFF_OACTIVE | IFF_RUNNING)) != IFF_RUNNING)
 		return;
@@ -553,9 +556,16 @@ em_start(struct ifnet *ifp)
 		if (m_head == NULL)
 			break;
 
-		if (em_encap(sc, m_head)) {
-			ifp->if_flags |= IFF_OACTIVE;
-			break;
+		if ((error = em_encap(sc, m_head)) != 0) {
+			if (error == ENOBUFS || error == ENOMEM) {
+				ifp->if_flags |= IFF_OACTIVE;
+				break;
+			}
+			/* cannot ever be mapped, do not stall on it */
+			IFQ_DEQUEUE(&ifp->if_snd, m_head);
+			m_freem(m_head);
+			ifp->if_oerrors++;
+			continue;
 		}
 
 		IFQ_DEQUEUE(&ifp->if_snd, m_head);
@@ -586,6 +596,17 @@ em_start(struct ifnet *ifp)
 	}
 }
 
+/*
+ * The driver runs a single transmit ring, so the only transmit queue
+ * registered with the stack is if_snd.
+ */
+void
+em_mqstart(struct ifnet *ifp, u_int queue)
+{
+	if (queue == 0)
+		em_start(ifp);
+}
+
 /*********************************************************************
  *  Ioctl entry point
  *
@@ -1075,6 +1096,12 @@ em_encap(struct em_softc *sc, struct mbuf *m_head)
 	map = tx_buffer->map;
 
 	error = bus_dmamap_load_mbuf(sc->txtag, map, m_head, BUS_DMA_NOWAIT);
+	if (error == EFBIG && (m_head->m_pkthdr.csum_flags & M_TCP_TSO)) {
+		/* a TSO burst may span more clusters than we can scatter */
+		if ((error = m_defrag(m_head, M_DONTWAIT)) == 0)
+			error = bus_dmamap_load_mbuf(sc->txtag, map, m_head,
+			    BUS_DMA_NOWAIT);
+	}
 	if (error != 0) {
 		sc->no_tx_dma_setup++;
 		goto loaderr;
@@ -1085,7 +1112,13 @@ em_encap(struct em_softc *sc, struct mbuf *m_head)
 		goto fail;
 
 #ifdef EM_CSUM_OFFLOAD
-	if (sc->hw.mac_type >= em_82543)
+	if (m_head->m_pkthdr.csum_flags & M_TCP_TSO) {
+		if (em_tso_setup(sc, m_head, &txd_upper, &txd_lower)) {
+			bus_dmamap_unload(sc->txtag, map);
+			error = EINVAL;
+			goto loaderr;
+		}
+	} else if (sc->hw.mac_type >= em_82543)
 		em_transmit_checksum_setup(sc, m_head, &txd_upper, &txd_lower);
 	else
 		txd_upper = txd_lower = 0;
@@ -1804,6 +1837,7 @@ em_setup_interface(struct em_softc *sc)
 		sc->hw.max_frame_size - ETHER_HDR_LEN - ETHER_CRC_LEN;
 	IFQ_SET_MAXLEN(&ifp->if_snd, sc->num_tx_desc - 1);
 	IFQ_SET_READY(&ifp->if_snd);
+	if_txq_attach(ifp, 1, em_mqstart);
 
 	m_clsetwms(ifp, MCLBYTES, 4, sc->num_rx_desc);
 
@@ -1817,8 +1851,16 @@ em_setup_interface(struct em_softc *sc)
 #ifdef EM_CSUM_OFFLOAD
 	if (sc->hw.mac_type >= em_82543)
 		ifp->if_capabilities |= IFCAP_CSUM_TCPv4|IFCAP_CSUM_UDPv4;
+	if (sc->hw.mac_type >= em_82571 && sc->hw.mac_type != em_82575 &&
+	    sc->hw.mac_type != em_82580)
+		ifp->if_capabilities |= IFCAP_TSOv4;
 #endif
 
+	/* LRO relies on the receive checksums */
+	if (sc->hw.mac_type >= em_82543)
+		ifp->if_capabilities |= IFCAP_LRO;
+	tcp_lro_init(&sc->lro, ifp);
+
 	/* 
 	 * Specify the media types supported by this adapter and register
 	 * callbacks to update media and link information
@@ -2082,7 +2124,7 @@ em_setup_transmit_structures(struct em_softc *sc)
 
 	tx_buffer = sc->tx_buffer_area;
 	for (i = 0; i < sc->num_tx_desc; i++) {
-		error = bus_dmamap_create(sc->txtag, MAX_JUMBO_FRAME_SIZE,
+		error = bus_dmamap_create(sc->txtag, EM_TSO_SIZE,
 			    EM_MAX_SCATTER, MAX_JUMBO_FRAME_SIZE, 0,
 			    BUS_DMA_NOWAIT, &tx_buffer->map);
 		if (error != 0) {
@@ -2316,6 +2358,81 @@ em_transmit_checksum_setup(struct em_softc *sc, struct mbuf *mp,
 	sc->num_tx_desc_avail--;
 	sc->next_avail_tx_desc = curr_txd;
 }
+
+/*********************************************************************
+ *
+ *  Set up a context descriptor for TCP segmentation offload.  The
+ *  stack leaves the pseudo header checksum without the length in
+ *  th_sum, which is what the hardware wants.
+ *
+ **********************************************************************/
+int
+em_tso_setup(struct em_softc *sc, struct mbuf *mp,
+    u_int32_t *txd_upper, u_int32_t *txd_lower)
+{
+	struct em_context_desc *TXD;
+	struct em_buffer *tx_buffer;
+	struct ip ip;
+	struct tcphdr th;
+	int curr_txd, ehdrlen, ip_hlen, hdr_len;
+
+	/* the headers may span mbufs, copy rather than drop the burst */
+	ehdrlen = ETHER_HDR_LEN;
+	if (mp->m_pkthdr.len < ehdrlen + sizeof(struct ip))
+		return (EINVAL);
+	m_copydata(mp, ehdrlen, sizeof(ip), (caddr_t)&ip);
+	ip_hlen = ip.ip_hl << 2;
+	if (ip.ip_p != IPPROTO_TCP ||
+	    mp->m_pkthdr.len < ehdrlen + ip_hlen + sizeof(struct tcphdr))
+		return (EINVAL);
+	m_copydata(mp, ehdrlen + ip_hlen, sizeof(th), (caddr_t)&th);
+	hdr_len = ehdrlen + ip_hlen + (th.th_off << 2);
+	if (mp->m_pkthdr.len < hdr_len)
+		return (EINVAL);
+
+	/* the hardware fills in length and checksum of each segment */
+	ip.ip_len = 0;
+	ip.ip_sum = 0;
+	if (m_copyback(mp, ehdrlen, sizeof(ip), &ip, M_NOWAIT))
+		return (EINVAL);
+
+	curr_txd = sc->next_avail_tx_desc;
+	tx_buffer = &sc->tx_buffer_area[curr_txd];
+	TXD = (struct em_context_desc *) &sc->tx_desc_base[curr_txd];
+
+	TXD->lower_setup.ip_fields.ipcss = ehdrlen;
+	TXD->lower_setup.ip_fields.ipcso =
+	    ehdrlen + offsetof(struct ip, ip_sum);
+	TXD->lower_setup.ip_fields.ipcse = htole16(ehdrlen + ip_hlen - 1);
+
+	TXD->upper_setup.tcp_fields.tucss = ehdrlen + ip_hlen;
+	TXD->upper_setup.tcp_fields.tucso =
+	    ehdrlen + ip_hlen + offsetof(struct tcphdr, th_sum);
+	TXD->upper_setup.tcp_fields.tucse = htole16(0);
+
+	TXD->tcp_seg_setup.fields.status = 0;
+	TXD->tcp_seg_setup.fields.hdr_len = hdr_len;
+	TXD->tcp_seg_setup.fields.mss = htole16(mp->m_pkthdr.tso_segsz);
+	TXD->cmd_and_length = htole32(sc->txd_cmd | E1000_TXD_CMD_DEXT |
+	    E1000_TXD_CMD_TSE | E1000_TXD_CMD_IP | E1000_TXD_CMD_TCP |
+	    (mp->m_pkthdr.len - hdr_len));
+
+	tx_buffer->m_head = NULL;
+	tx_buffer->next_eop = -1;
+
+	if (++curr_txd == sc->num_tx_desc)
+		curr_txd = 0;
+
+	sc->num_tx_desc_avail--;
+	sc->next_avail_tx_desc = curr_txd;
+
+	/* the next checksum packet has to load its context again */
+	sc->active_checksum_context = OFFLOAD_NONE;
+
+	*txd_upper = (E1000_TXD_POPTS_IXSM | E1000_TXD_POPTS_TXSM) << 8;
+	*txd_lower = E1000_TXD_CMD_DEXT | E1000_TXD_DTYP_D | E1000_TXD_CMD_TSE;
+	return (0);
+}
 #endif /* EM_CSUM_OFFLOAD */
 
 /**********************************************************************
@@ -2896,7 +3013,10 @@ em_rxeof(struct em_softc *sc, int count)
 				}
 #endif
 
-				ether_input_mbuf(ifp, m);
+				if (ISSET(ifp->if_xflags, IFXF_LRO))
+					tcp_lro_rx(&sc->lro, m);
+				else
+					ether_input_mbuf(ifp, m);
 
 				sc->fmp = NULL;
 				sc->lmp = NULL;
@@ -2922,6 +3042,8 @@ em_rxeof(struct em_softc *sc, int count)
 			i = 0;
 	}
 	sc->next_rx_desc_to_check = i;
+
+	tcp_lro_flush_all(&sc->lro);
 }
 
 /*********************************************************************
@@ -61,6 +61,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <netinet/ip.h>
 #include <netinet/if_ether.h>
 #include <netinet/tcp.h>
+#include <netinet/tcp_lro.h>
 #include <netinet/udp.h>
 #endif
 
@@ -389,6 +390,9 @@ struct em_softc {
 	struct mbuf		*fmp;
 	struct mbuf		*lmp;
 
+	/* Received TCP segments being aggregated */
+	struct lro_ctrl		lro;
+
 	/* Misc stats maintained by the driver */
 	unsigned long		dropped_pkts;
 	unsigned long		mbuf_alloc_failed;
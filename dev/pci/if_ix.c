@@ -78,6 +78,7 @@ int	ixgbe_probe(struct device *, void *, void *);
 void	ixgbe_attach(struct device *, struct device *, void *);
 int	ixgbe_detach(struct device *, int);
 void	ixgbe_start(struct ifnet *);
+void	ixgbe_mqstart(struct ifnet *, u_int);
 void	ixgbe_start_locked(struct tx_ring *, struct ifnet *);
 int	ixgbe_ioctl(struct ifnet *, u_long, caddr_t);
 void	ixgbe_watchdog(struct ifnet *);
@@ -92,7 +93,7 @@ int	ixgbe_allocate_queues(struct ix_softc *);
 void	ixgbe_free_pci_resources(struct ix_softc *);
 void	ixgbe_local_timer(void *);
 int	ixgbe_hardware_init(struct ix_softc *);
-void	ixgbe_setup_interface(struct ix_softc *);
+int	ixgbe_setup_interface(struct ix_softc *);
 
 int	ixgbe_allocate_transmit_buffers(struct tx_ring *);
 int	ixgbe_setup_transmit_structures(struct ix_softc *);
@@ -283,7 +284,8 @@ ixgbe_attach(struct device *parent, struct device *self, void *aux)
 		goto err_late;
 
 	/* Setup OS specific network interface */
-	ixgbe_setup_interface(sc);
+	if (ixgbe_setup_interface(sc))
+		goto err_late;
 
 	/* Initialize statistics */
 	ixgbe_update_stats_counters(sc);
@@ -358,9 +360,10 @@ ixgbe_start_locked(struct tx_ring *txr, struct ifnet * ifp)
 {
 	struct mbuf  		*m_head;
 	struct ix_softc		*sc = txr->sc;
-	int			 post = 0;
+	struct ifaltq		*ifq = IF_TXQ(ifp, txr->me);
+	int			 post = 0, error;
 
-	if ((ifp->if_flags & (IFF_RUNNING|IFF_OACTIVE)) != IFF_RUNNING)
+	if (!(ifp->if_flags & IFF_RUNNING) || txr->oactive)
 		return;
 
 	if (!sc->link_active)
@@ -371,16 +374,23 @@ ixgbe_start_locked(struct tx_ring *txr, struct ifnet * ifp)
 	    BUS_DMASYNC_POSTREAD | BUS_DMASYNC_POSTWRITE);
 
 	for (;;) {
-		IFQ_POLL(&ifp->if_snd, m_head);
+		IFQ_POLL(ifq, m_head);
 		if (m_head == NULL)
 			break;
 
-		if (ixgbe_encap(txr, m_head)) {
-			ifp->if_flags |= IFF_OACTIVE;
-			break;
+		if ((error = ixgbe_encap(txr, m_head)) != 0) {
+			if (error == ENOBUFS || error == ENOMEM) {
+				txr->oactive = 1;
+				break;
+			}
+			/* cannot ever be mapped, do not stall on it */
+			IFQ_DEQUEUE(ifq, m_head);
+			m_freem(m_head);
+			ifp->if_oerrors++;
+			continue;
 		}
 
-		IFQ_DEQUEUE(&ifp->if_snd, m_head);
+		IFQ_DEQUEUE(ifq, m_head);
 
 #if NBPFILTER > 0
 		if (ifp->if_bpf)
@@ -410,29 +420,27 @@ ixgbe_start_locked(struct tx_ring *txr, struct ifnet * ifp)
 
 void
 ixgbe_start(struct ifnet *ifp)
+{
+	ixgbe_mqstart(ifp, 0);
+}
+
+/*
+ * Each transmit queue of the interface feeds the ring of the same
+ * index; the stack spreads flows over them.
+ */
+void
+ixgbe_mqstart(struct ifnet *ifp, u_int queue)
 {
 	struct ix_softc *sc = ifp->if_softc;
-	struct tx_ring	*txr = sc->tx_rings;
-	uint32_t queue = 0;
+	struct tx_ring	*txr;
 
-#if 0
-	/*
-	 * This is really just here for testing
-	 * TX multiqueue, ultimately what is
-	 * needed is the flow support in the stack
-	 * and appropriate logic here to deal with
-	 * it. -jfv
-	 */
-	if (sc->num_tx_queues > 1)
-		queue = (curcpu % sc->num_tx_queues);
-#endif
+	if (queue >= sc->num_tx_queues)
+		return;
 
 	txr = &sc->tx_rings[queue];
 
 	if (ifp->if_flags & IFF_RUNNING)
 		ixgbe_start_locked(txr, ifp);
-
-	return;
 }
 
 /*********************************************************************
@@ -721,7 +729,8 @@ ixgbe_init(void *arg)
 #else
 	{
 		ixgbe_set_ivar(sc, 0, 0, 0);
-		ixgbe_set_ivar(sc, 0, 0, 1);
+		for (i = 0; i < sc->num_tx_queues; i++)
+			ixgbe_set_ivar(sc, i, 0, 1);
 	}
 #endif
 
@@ -760,7 +769,7 @@ ixgbe_legacy_irq(void *arg)
 	struct rx_ring	*rxr = sc->rx_rings;
 	struct ixgbe_hw	*hw = &sc->hw;
 	uint32_t	 reg_eicr;
-	int		 refill = 0;
+	int		 i, refill = 0;
 
 	reg_eicr = IXGBE_READ_REG(&sc->hw, IXGBE_EICR);
 	if (reg_eicr == 0)
@@ -768,7 +777,8 @@ ixgbe_legacy_irq(void *arg)
 
 	if (ifp->if_flags & IFF_RUNNING) {
 		ixgbe_rxeof(rxr, -1);
-		ixgbe_txeof(txr);
+		for (i = 0; i < sc->num_tx_queues; i++)
+			ixgbe_txeof(&txr[i]);
 		refill = 1;
 	}
 
@@ -794,8 +804,11 @@ ixgbe_legacy_irq(void *arg)
 		    rxr->last_rx_desc_filled);
 	}
 
-	if (ifp->if_flags & IFF_RUNNING && !IFQ_IS_EMPTY(&ifp->if_snd))
-		ixgbe_start_locked(txr, ifp);
+	for (i = 0; i < sc->num_tx_queues; i++) {
+		if (ifp->if_flags & IFF_RUNNING &&
+		    !IFQ_IS_EMPTY(IF_TXQ(ifp, i)))
+			ixgbe_start_locked(&txr[i], ifp);
+	}
 
 	return (1);
 }
@@ -907,6 +920,12 @@ ixgbe_encap(struct tx_ring *txr, struct mbuf *m_head)
 	 */
 	error = bus_dmamap_load_mbuf(txr->txdma.dma_tag, map,
 	    m_head, BUS_DMA_NOWAIT);
+	if (error == EFBIG && (m_head->m_pkthdr.csum_flags & M_TCP_TSO)) {
+		/* a TSO burst may span more clusters than we can scatter */
+		if ((error = m_defrag(m_head, M_DONTWAIT)) == 0)
+			error = bus_dmamap_load_mbuf(txr->txdma.dma_tag, map,
+			    m_head, BUS_DMA_NOWAIT);
+	}
 
 	if (error == ENOMEM) {
 		sc->no_tx_dma_setup++;
@@ -928,16 +947,17 @@ ixgbe_encap(struct tx_ring *txr, struct mbuf *m_head)
 	 * this becomes the first descriptor of 
 	 * a packet.
 	 */
-#ifdef notyet
-	if (ixgbe_tso_setup(txr, m_head, &paylen)) {
+	if (m_head->m_pkthdr.csum_flags & M_TCP_TSO) {
+		if (!ixgbe_tso_setup(txr, m_head, &paylen)) {
+			error = EINVAL;
+			goto xmit_fail;
+		}
 		cmd_type_len |= IXGBE_ADVTXD_DCMD_TSE;
 		olinfo_status |= IXGBE_TXD_POPTS_IXSM << 8;
 		olinfo_status |= IXGBE_TXD_POPTS_TXSM << 8;
 		olinfo_status |= paylen << IXGBE_ADVTXD_PAYLEN_SHIFT;
 		++sc->tso_tx;
-	} else
-#endif
-	if (ixgbe_tx_ctx_setup(txr, m_head))
+	} else if (ixgbe_tx_ctx_setup(txr, m_head))
 		olinfo_status |= IXGBE_TXD_POPTS_IXSM << 8;
 
 	/* Record payload length */
@@ -1347,8 +1367,8 @@ ixgbe_allocate_pci_resources(struct ix_softc *sc)
 		sc->res[i] = NULL;
 	}
 
-	/* Legacy defaults */
-	sc->num_tx_queues = 1;
+	/* Legacy defaults, but one transmit ring per cpu */
+	sc->num_tx_queues = min(ncpusfound, IF_MAXTXQ);
 	sc->num_rx_queues = 1;
 
 #ifdef notyet
@@ -1427,7 +1447,7 @@ ixgbe_hardware_init(struct ix_softc *sc)
  *  Setup networking device structure and register an interface.
  *
  **********************************************************************/
-void
+int
 ixgbe_setup_interface(struct ix_softc *sc)
 {
 	struct ixgbe_hw *hw = &sc->hw;
@@ -1446,7 +1466,16 @@ ixgbe_setup_interface(struct ix_softc *sc)
 	    ETHER_HDR_LEN - ETHER_CRC_LEN;
 	IFQ_SET_MAXLEN(&ifp->if_snd, sc->num_tx_desc - 1);
 	IFQ_SET_READY(&ifp->if_snd);
-	
+	/*
+	 * The rings and interrupt setup are sized by num_tx_queues,
+	 * so there is no falling back to fewer transmit queues here.
+	 */
+	if (if_txq_attach(ifp, sc->num_tx_queues, ixgbe_mqstart) != 0) {
+		printf(": couldn't allocate transmit queues
+");
+		return (ENOMEM);
+	}
+
 	m_clsetwms(ifp, MCLBYTES, 4, sc->num_rx_desc);
 
 	ifp->if_capabilities = IFCAP_VLAN_MTU;
@@ -1457,7 +1486,7 @@ ixgbe_setup_interface(struct ix_softc *sc)
 
 #ifdef IX_CSUM_OFFLOAD
 	ifp->if_capabilities |= IFCAP_CSUM_TCPv4 | IFCAP_CSUM_UDPv4 |
-	    IFCAP_CSUM_IPv4;
+	    IFCAP_CSUM_IPv4 | IFCAP_TSOv4 | IFCAP_LRO;
 #endif
 
 	sc->max_frame_size =
@@ -1484,8 +1513,7 @@ ixgbe_setup_interface(struct ix_softc *sc)
 	if_attach(ifp);
 	ether_ifattach(ifp);
 
-
-	return;
+	return (0);
 }
 
 int
@@ -1645,6 +1673,7 @@ ixgbe_allocate_queues(struct ix_softc *sc)
 		/* Set up some basics */
 		rxr->sc = sc;
 		rxr->me = i;
+		tcp_lro_init(&rxr->lro, &sc->arpcom.ac_if);
 
 		/* Initialize the TX side lock */
 		mtx_init(&rxr->rx_mtx, IPL_NET);
@@ -1759,6 +1788,7 @@ ixgbe_setup_transmit_ring(struct tx_ring *txr)
 
 	/* Set number of descriptors available */
 	txr->tx_avail = sc->num_tx_desc;
+	txr->oactive = 0;
 
 	bus_dmamap_sync(txr->txdma.dma_tag, txr->txdma.dma_map,
 	    0, txr->txdma.dma_map->dm_mapsize,
@@ -2065,7 +2095,6 @@ ixgbe_tx_ctx_setup(struct tx_ring *txr, struct mbuf *mp)
         return (offload);
 }
 
-#ifdef notyet
 /**********************************************************************
  *
  *  Setup work for hardware segmentation offload (TSO) on
@@ -2083,51 +2112,56 @@ ixgbe_tso_setup(struct tx_ring *txr, struct mbuf *mp, uint32_t *paylen)
 	int ctxd, ehdrlen,  hdrlen, ip_hlen, tcp_hlen;
 #if NVLAN > 0
 	uint16_t vtag = 0;
-	struct ether_vlan_header *eh;
-#else
-	struct ether_header *eh;
+	uint16_t etype;
 #endif
-	struct ip *ip;
-	struct tcphdr *th;
-
-	if (((mp->m_pkthdr.csum_flags & CSUM_TSO) == 0) ||
-	    (mp->m_pkthdr.len <= IXGBE_TX_BUFFER_SIZE))
-	        return FALSE;
+	struct ip ip;
+	struct tcphdr th;
 
 	/*
+	 * The headers need not be in the first mbuf, they are read and
+	 * written back by copying.  The packet cannot be pulled up while
+	 * it is still on the send queue, and dropping it would stall the
+	 * connection.
+	 *
 	 * Determine where frame payload starts.
 	 * Jump over vlan headers if already present
 	 */
-#if NVLAN > 0
-	eh = mtod(mp, struct ether_vlan_header *);
-	if (eh->evl_encap_proto == htons(ETHERTYPE_VLAN)) 
-		ehdrlen = ETHER_HDR_LEN + ETHER_VLAN_ENCAP_LEN;
-	else
-		ehdrlen = ETHER_HDR_LEN;
-#else
-	eh = mtod(mp, struct ether_header *);
 	ehdrlen = ETHER_HDR_LEN;
+#if NVLAN > 0
+	if (mp->m_pkthdr.len < ETHER_HDR_LEN)
+		return FALSE;
+	m_copydata(mp, offsetof(struct ether_header, ether_type),
+	    sizeof(etype), (caddr_t)&etype);
+	if (etype == htons(ETHERTYPE_VLAN))
+		ehdrlen += ETHER_VLAN_ENCAP_LEN;
 #endif
 
-        /* Ensure we have at least the IP+TCP header in the first mbuf. */
-        if (mp->m_len < ehdrlen + sizeof(struct ip) + sizeof(struct tcphdr))
+	if (mp->m_pkthdr.len < ehdrlen + sizeof(struct ip))
+		return FALSE;
+	m_copydata(mp, ehdrlen, sizeof(ip), (caddr_t)&ip);
+	if (ip.ip_p != IPPROTO_TCP)
+		return FALSE;   /* 0 */
+	ip_hlen = ip.ip_hl << 2;
+	if (mp->m_pkthdr.len < ehdrlen + ip_hlen + sizeof(struct tcphdr))
+		return FALSE;
+	m_copydata(mp, ehdrlen + ip_hlen, sizeof(th), (caddr_t)&th);
+	tcp_hlen = th.th_off << 2;
+	hdrlen = ehdrlen + ip_hlen + tcp_hlen;
+	if (mp->m_pkthdr.len < hdrlen)
+		return FALSE;
+
+	ip.ip_len = 0;
+	ip.ip_sum = 0;
+	th.th_sum = in_cksum_phdr(ip.ip_src.s_addr,
+	    ip.ip_dst.s_addr, htons(IPPROTO_TCP));
+	if (m_copyback(mp, ehdrlen, sizeof(ip), &ip, M_NOWAIT) ||
+	    m_copyback(mp, ehdrlen + ip_hlen, sizeof(th), &th, M_NOWAIT))
 		return FALSE;
 
 	ctxd = txr->next_avail_tx_desc;
 	tx_buffer = &txr->tx_buffers[ctxd];
 	TXD = (struct ixgbe_adv_tx_context_desc *) &txr->tx_base[ctxd];
 
-	ip = (struct ip *)(mp->m_data + ehdrlen);
-	if (ip->ip_p != IPPROTO_TCP)
-		return FALSE;   /* 0 */
-	ip->ip_len = 0;
-	ip->ip_sum = 0;
-	ip_hlen = ip->ip_hl << 2;
-	th = (struct tcphdr *)((caddr_t)ip + ip_hlen);
-	th->th_sum = in_pseudo(ip->ip_src.s_addr,
-	    ip->ip_dst.s_addr, htons(IPPROTO_TCP));
-	tcp_hlen = th->th_off << 2;
-	hdrlen = ehdrlen + ip_hlen + tcp_hlen;
 	/* This is used in the transmit desc in encap */
 	*paylen = mp->m_pkthdr.len - hdrlen;
 
@@ -2141,14 +2175,13 @@ ixgbe_tso_setup(struct tx_ring *txr, struct mbuf *mp, uint32_t *paylen)
 
 	vlan_macip_lens |= ehdrlen << IXGBE_ADVTXD_MACLEN_SHIFT;
 	vlan_macip_lens |= ip_hlen;
-	TXD->vlan_macip_lens |= htole32(vlan_macip_lens);
+	TXD->vlan_macip_lens = htole32(vlan_macip_lens);
 
 	/* ADV DTYPE TUCMD */
 	type_tucmd_mlhl |= IXGBE_ADVTXD_DCMD_DEXT | IXGBE_ADVTXD_DTYP_CTXT;
 	type_tucmd_mlhl |= IXGBE_ADVTXD_TUCMD_L4T_TCP;
 	type_tucmd_mlhl |= IXGBE_ADVTXD_TUCMD_IPV4;
-	TXD->type_tucmd_mlhl |= htole32(type_tucmd_mlhl);
-
+	TXD->type_tucmd_mlhl = htole32(type_tucmd_mlhl);
 
 	/* MSS L4LEN IDX */
 	mss_l4len_idx |= (mp->m_pkthdr.tso_segsz << IXGBE_ADVTXD_MSS_SHIFT);
@@ -2166,15 +2199,6 @@ ixgbe_tso_setup(struct tx_ring *txr, struct mbuf *mp, uint32_t *paylen)
 	return TRUE;
 }
 
-#else
-/* This makes it easy to keep the code common */
-int
-ixgbe_tso_setup(struct tx_ring *txr, struct mbuf *mp, uint32_t *paylen)
-{
-	return (FALSE);
-}
-#endif
-
 /**********************************************************************
  *
  *  Examine each tx_buffer in the used queue. If the hardware is done
@@ -2188,6 +2212,7 @@ ixgbe_txeof(struct tx_ring *txr)
 	struct ix_softc			*sc = txr->sc;
 	struct ifnet			*ifp = &sc->arpcom.ac_if;
 	uint				 first, last, done, num_avail;
+	int				 i;
 	struct ixgbe_tx_buf		*tx_buffer;
 	struct ixgbe_legacy_tx_desc *tx_desc;
 
@@ -2256,19 +2281,23 @@ ixgbe_txeof(struct tx_ring *txr)
 	txr->next_tx_to_clean = first;
 
 	/*
-	 * If we have enough room, clear IFF_OACTIVE to tell the stack that
-	 * it is OK to send packets. If there are no pending descriptors,
+	 * If we have enough room, clear the ring's oactive flag so that
+	 * its queue is serviced again. If there are no pending descriptors,
 	 * clear the timeout. Otherwise, if some descriptors have been freed,
 	 * restart the timeout.
 	 */
 	if (num_avail > IXGBE_TX_CLEANUP_THRESHOLD) {
-		ifp->if_flags &= ~IFF_OACTIVE;
+		txr->oactive = 0;
 
 		/* If all are clean turn off the timer */
 		if (num_avail == sc->num_tx_desc) {
-			ifp->if_timer = 0;
 			txr->watchdog_timer = 0;
 			txr->tx_avail = num_avail;
+			for (i = 0; i < sc->num_tx_queues; i++)
+				if (sc->tx_rings[i].watchdog_timer != 0)
+					break;
+			if (i == sc->num_tx_queues)
+				ifp->if_timer = 0;
 			return FALSE;
 		}
 		/* Some were cleaned, so reset timer */
@@ -2540,53 +2569,54 @@ ixgbe_initialize_receive_units(struct ix_softc *sc)
 
 	rxcsum = IXGBE_READ_REG(&sc->hw, IXGBE_RXCSUM);
 
-	if (sc->num_rx_queues > 1) {
-		/* set up random bits */
-		arc4random_buf(&random, sizeof(random));
-		switch (sc->num_rx_queues) {
-			case 8:
-			case 4:
-				reta = 0x00010203;
-				break;
-			case 2:
-				reta = 0x00010001;
-				break;
-			default:
-				reta = 0x00000000;
-		}
+	/*
+	 * RSS is enabled even with a single receive queue so that the
+	 * hardware hands us a flow hash with every packet.
+	 */
+	arc4random_buf(&random, sizeof(random));
+	switch (sc->num_rx_queues) {
+		case 8:
+		case 4:
+			reta = 0x00010203;
+			break;
+		case 2:
+			reta = 0x00010001;
+			break;
+		default:
+			reta = 0x00000000;
+	}
 
-		/* Set up the redirection table */
-		for (i = 0; i < 32; i++) {
-			IXGBE_WRITE_REG(&sc->hw, IXGBE_RETA(i), reta);
-			if (sc->num_rx_queues > 4) {
-				++i;
-				IXGBE_WRITE_REG(&sc->hw,
-				    IXGBE_RETA(i), 0x04050607);
-			}
+	/* Set up the redirection table */
+	for (i = 0; i < 32; i++) {
+		IXGBE_WRITE_REG(&sc->hw, IXGBE_RETA(i), reta);
+		if (sc->num_rx_queues > 4) {
+			++i;
+			IXGBE_WRITE_REG(&sc->hw,
+			    IXGBE_RETA(i), 0x04050607);
 		}
-
-		/* Now fill our hash function seeds */
-		for (i = 0; i < 10; i++)
-			IXGBE_WRITE_REG_ARRAY(&sc->hw,
-			    IXGBE_RSSRK(0), i, random[i]);
-
-		mrqc = IXGBE_MRQC_RSSEN
-		    /* Perform hash on these packet types */
-		    | IXGBE_MRQC_RSS_FIELD_IPV4
-		    | IXGBE_MRQC_RSS_FIELD_IPV4_TCP
-		    | IXGBE_MRQC_RSS_FIELD_IPV4_UDP
-		    | IXGBE_MRQC_RSS_FIELD_IPV6_EX_TCP
-		    | IXGBE_MRQC_RSS_FIELD_IPV6_EX
-		    | IXGBE_MRQC_RSS_FIELD_IPV6
-		    | IXGBE_MRQC_RSS_FIELD_IPV6_TCP
-		    | IXGBE_MRQC_RSS_FIELD_IPV6_UDP
-		    | IXGBE_MRQC_RSS_FIELD_IPV6_EX_UDP;
-		IXGBE_WRITE_REG(&sc->hw, IXGBE_MRQC, mrqc);
-
-		/* RSS and RX IPP Checksum are mutually exclusive */
-		rxcsum |= IXGBE_RXCSUM_PCSD;
 	}
 
+	/* Now fill our hash function seeds */
+	for (i = 0; i < 10; i++)
+		IXGBE_WRITE_REG_ARRAY(&sc->hw,
+		    IXGBE_RSSRK(0), i, random[i]);
+
+	mrqc = IXGBE_MRQC_RSSEN
+	    /* Perform hash on these packet types */
+	    | IXGBE_MRQC_RSS_FIELD_IPV4
+	    | IXGBE_MRQC_RSS_FIELD_IPV4_TCP
+	    | IXGBE_MRQC_RSS_FIELD_IPV4_UDP
+	    | IXGBE_MRQC_RSS_FIELD_IPV6_EX_TCP
+	    | IXGBE_MRQC_RSS_FIELD_IPV6_EX
+	    | IXGBE_MRQC_RSS_FIELD_IPV6
+	    | IXGBE_MRQC_RSS_FIELD_IPV6_TCP
+	    | IXGBE_MRQC_RSS_FIELD_IPV6_UDP
+	    | IXGBE_MRQC_RSS_FIELD_IPV6_EX_UDP;
+	IXGBE_WRITE_REG(&sc->hw, IXGBE_MRQC, mrqc);
+
+	/* RSS and RX IPP Checksum are mutually exclusive */
+	rxcsum |= IXGBE_RXCSUM_PCSD;
+
 	if (ifp->if_capabilities & IFCAP_CSUM_IPv4)
 		rxcsum |= IXGBE_RXCSUM_PCSD;
 
@@ -2785,6 +2815,12 @@ ixgbe_rxeof(struct rx_ring *rxr, int count)
 
 				ixgbe_rx_checksum(sc, staterr, m);
 
+				if (letoh16(rxdesc->wb.lower.lo_dword.hs_rss.
+				    pkt_info) & IXGBE_RXDADV_RSSTYPE_MASK)
+					m->m_pkthdr.flowid = M_FLOWID_VALID |
+					    (letoh32(rxdesc->wb.lower.hi_dword.
+					    rss) & M_FLOWID_MASK);
+
 #if NVLAN > 0
 				if (staterr & IXGBE_RXD_STAT_VP) {
 					m->m_pkthdr.ether_vtag =
@@ -2798,7 +2834,10 @@ ixgbe_rxeof(struct rx_ring *rxr, int count)
 					    BPF_DIRECTION_IN);
 #endif
 
-				ether_input_mbuf(ifp, m);
+				if (ISSET(ifp->if_xflags, IFXF_LRO))
+					tcp_lro_rx(&rxr->lro, m);
+				else
+					ether_input_mbuf(ifp, m);
 
 				rxr->fmp = NULL;
 				rxr->lmp = NULL;
@@ -2828,6 +2867,8 @@ ixgbe_rxeof(struct rx_ring *rxr, int count)
 	}
 	rxr->next_to_check = i;
 
+	tcp_lro_flush_all(&rxr->lro);
+
 	if (!(staterr & IXGBE_RXD_STAT_DD))
 		return FALSE;
 
@@ -39,9 +39,7 @@
 
 #include <dev/pci/ixgbe.h>
 
-#if 0
-#include "tcp_lro.h"
-#endif
+#include <netinet/tcp_lro.h>
 
 /* Tunables */
 
@@ -119,11 +117,7 @@
 #define IXGBE_82598_SCATTER		100
 #define IXGBE_82599_SCATTER		32
 #define IXGBE_MSIX_BAR			3
-#if 0
 #define IXGBE_TSO_SIZE			65535
-#else
-#define IXGBE_TSO_SIZE			IXGBE_MAX_FRAME_SIZE
-#endif
 #define IXGBE_TX_BUFFER_SIZE		((uint32_t) 1514)
 #define IXGBE_RX_HDR_SIZE		((uint32_t) 256)
 #define CSUM_OFFLOAD			7	/* Bits in csum flags */
@@ -192,6 +186,7 @@ struct tx_ring {
 	uint32_t		next_tx_to_clean;
 	struct ixgbe_tx_buf	*tx_buffers;
 	volatile uint16_t	tx_avail;
+	int			oactive;
 	uint32_t		txd_cmd;
 	bus_dma_tag_t		txtag;
 	/* Soft Stats */
@@ -214,9 +209,7 @@ struct rx_ring {
 	uint32_t		payload;
 	union ixgbe_adv_rx_desc	*rx_base;
 	struct ixgbe_dma_alloc	rxdma;
-#if 0
 	struct lro_ctrl		lro;
-#endif
         unsigned int		last_rx_desc_filled;
         unsigned int		next_to_check;
 	int			rx_ndescs;
@@ -817,5 +817,7 @@ struct sysent sysent[] = {
 	    sys_getrtable },			/* 311 = getrtable */
 	{ 4, s(struct sys_getdirentries_args), 0,
 	    sys_getdirentries },		/* 312 = getdirentries */
+	{ 6, s(struct sys_sendfile_args), 0,
+	    sys_sendfile },			/* 313 = sendfile */
 };
 
@@ -24,6 +24,8 @@
 #include <sys/buf.h>
 #include <sys/errno.h>
 #include <sys/queue.h>
+#include <sys/tree.h>
+#include <sys/timeout.h>
 
 #include <sys/disklabel.h>
 
@@ -39,6 +41,7 @@ struct bufq_impl {
 	struct buf	*(*impl_dequeue)(void *);
 	void		 (*impl_requeue)(void *, struct buf *);
 	int		 (*impl_peek)(void *);
+	void		 (*impl_done)(void *, struct buf *);
 };
 
 void		*bufq_disksort_create(void);
@@ -55,6 +58,14 @@ struct buf	*bufq_fifo_dequeue(void *);
 void		 bufq_fifo_requeue(void *, struct buf *);
 int		 bufq_fifo_peek(void *);
 
+void		*bufq_deadline_create(void);
+void		 bufq_deadline_destroy(void *);
+void		 bufq_deadline_queue(void *, struct buf *);
+struct buf	*bufq_deadline_dequeue(void *);
+void		 bufq_deadline_requeue(void *, struct buf *);
+int		 bufq_deadline_peek(void *);
+void		 bufq_deadline_done(void *, struct buf *);
+
 const struct bufq_impl bufq_impls[BUFQ_HOWMANY] = {
 	{
 		bufq_disksort_create,
@@ -62,7 +73,8 @@ const struct bufq_impl bufq_impls[BUFQ_HOWMANY] = {
 		bufq_disksort_queue,
 		bufq_disksort_dequeue,
 		bufq_disksort_requeue,
-		bufq_disksort_peek
+		bufq_disksort_peek,
+		NULL
 	},
 	{
 		bufq_fifo_create,
@@ -70,19 +82,31 @@ const struct bufq_impl bufq_impls[BUFQ_HOWMANY] = {
 		bufq_fifo_queue,
 		bufq_fifo_dequeue,
 		bufq_fifo_requeue,
-		bufq_fifo_peek
+		bufq_fifo_peek,
+		NULL
+	},
+	{
+		bufq_deadline_create,
+		bufq_deadline_destroy,
+		bufq_deadline_queue,
+		bufq_deadline_dequeue,
+		bufq_deadline_requeue,
+		bufq_deadline_peek,
+		bufq_deadline_done
 	}
 };
 
 int
 bufq_init(struct bufq *bq, int type)
 {
-	if (type > BUFQ_HOWMANY)
+	if (type >= BUFQ_HOWMANY)
 		panic("bufq_init: type %i unknown", type);
 
 	mtx_init(&bq->bufq_mtx, IPL_BIO);
 	bq->bufq_type = type;
 	bq->bufq_impl = &bufq_impls[type];
+	bq->bufq_kick = NULL;
+	bq->bufq_kickarg = NULL;
 	bq->bufq_data = bq->bufq_impl->impl_create();
 	if (bq->bufq_data == NULL) {
 		/*
@@ -109,8 +133,12 @@ bufq_switch(struct bufq *bq, int type)
 	void		*odata;
 	int		otype;
 	struct buf	*bp;
+	void		(*kick)(void *);
 	int		ret;
 
+	if (type < 0 || type >= BUFQ_HOWMANY)
+		return (EINVAL);
+
 	mtx_enter(&bq->bufq_mtx);
 	ret = (bq->bufq_type == type);
 	mtx_leave(&bq->bufq_mtx);
@@ -126,8 +154,12 @@ bufq_switch(struct bufq *bq, int type)
 		odata = bq->bufq_data;
 		otype = bq->bufq_type;
 
+		/* Without a kick the old discipline won't hold bufs back. */
+		kick = bq->bufq_kick;
+		bq->bufq_kick = NULL;
 		while ((bp = bufq_impls[otype].impl_dequeue(odata)) != NULL)
 			bufq_impls[type].impl_queue(data, bp);
+		bq->bufq_kick = kick;
 
 		bq->bufq_data = data;
 		bq->bufq_type = type;
@@ -143,6 +175,21 @@ bufq_switch(struct bufq *bq, int type)
 	return (0);
 }
 
+/*
+ * Register the routine that gets the driver to dequeue again.  A
+ * discipline may hold back bufs for a short while and uses it to
+ * restart the driver once it lets go of them.  It is called at
+ * splbio().
+ */
+void
+bufq_setkick(struct bufq *bq, void (*kick)(void *), void *arg)
+{
+	mtx_enter(&bq->bufq_mtx);
+	bq->bufq_kick = kick;
+	bq->bufq_kickarg = arg;
+	mtx_leave(&bq->bufq_mtx);
+}
+
 void
 bufq_destroy(struct bufq *bq)
 {
@@ -210,8 +257,15 @@ void
 bufq_drain(struct bufq *bq)
 {
 	struct buf	*bp;
+	void		(*kick)(void *);
 	int		 s;
 
+	/* Without a kick the discipline won't hold bufs back. */
+	mtx_enter(&bq->bufq_mtx);
+	kick = bq->bufq_kick;
+	bq->bufq_kick = NULL;
+	mtx_leave(&bq->bufq_mtx);
+
 	while ((bp = bufq_dequeue(bq)) != NULL) {
 		bp->b_error = ENXIO;
 		bp->b_flags |= B_ERROR;
@@ -219,12 +273,18 @@ bufq_drain(struct bufq *bq)
 		biodone(bp);
 		splx(s);
 	}
+
+	mtx_enter(&bq->bufq_mtx);
+	bq->bufq_kick = kick;
+	mtx_leave(&bq->bufq_mtx);
 }
 
 void
 bufq_done(struct bufq *bq, struct buf *bp)
 {
 	mtx_enter(&bq->bufq_mtx);
+	if (bq->bufq_impl->impl_done != NULL)
+		bq->bufq_impl->impl_done(bq->bufq_data, bp);
 	bq->bufq_outstanding--;
 	KASSERT(bq->bufq_outstanding >= 0);
 	if (bq->bufq_stop && bq->bufq_outstanding == 0)
@@ -389,3 +449,255 @@ bufq_fifo_peek(void *data)
 
 	return (SIMPLEQ_FIRST(head) != NULL);
 }
+
+/*
+ * deadline implementation
+ *
+ * Reads and writes are queued apart, each both in block order and in
+ * arrival order.  Requests are dispatched in ascending block order in
+ * batches of BQDL_BATCH; a batch starts from the oldest request of its
+ * direction if that one is past its deadline.  Reads are preferred,
+ * but writes are passed over at most BQDL_STARVED times in a row.
+ *
+ * After a synchronous read completes, the reader is likely to come
+ * back with a nearby request right away, so writes are held back for
+ * BQDL_ANTIC ticks before the disk heads off to serve them.  This
+ * needs the driver to have registered a kick with bufq_setkick().
+ */
+
+#define BQDL_READ	0
+#define BQDL_WRITE	1
+#define BQDL_READEXP	(hz / 2)		/* read deadline */
+#define BQDL_WRITEEXP	(hz * 5)		/* write deadline */
+#define BQDL_BATCH	16			/* requests per batch */
+#define BQDL_STARVED	2			/* read batches before writes */
+#define BQDL_ANTIC	MAX(hz / 150, 1)	/* anticipation window */
+
+#define b_dlsort	b_bufq.bufq_data_deadline.bqdl_sort
+#define b_dlfifo	b_bufq.bufq_data_deadline.bqdl_fifo
+#define b_dlexpire	b_bufq.bufq_data_deadline.bqdl_expire
+
+RB_HEAD(bufq_deadline_tree, buf);
+TAILQ_HEAD(bufq_deadline_fifo, buf);
+
+struct bufq_deadline_dir {
+	struct bufq_deadline_tree	 dd_sort;
+	struct bufq_deadline_fifo	 dd_fifo;
+	struct buf			*dd_next;	/* elevator position */
+	int				 dd_count;
+};
+
+struct bufq_deadline_head {
+	struct bufq_deadline_dir	 dl_dir[2];
+	struct bufq_deadline_fifo	 dl_requeue;	/* pushed back */
+	struct bufq			*dl_bq;
+	struct timeout			 dl_antic;
+	int				 dl_batch;	/* left in batch */
+	int				 dl_curdir;
+	int				 dl_starved;	/* writes passed over */
+	int				 dl_reading;	/* sync read done */
+	int				 dl_lastread;	/* ticks at that time */
+};
+
+int		 bufq_deadline_cmp(struct buf *, struct buf *);
+int		 bufq_deadline_antic(struct bufq_deadline_head *);
+void		 bufq_deadline_kick(void *);
+
+RB_PROTOTYPE(bufq_deadline_tree, buf, b_dlsort, bufq_deadline_cmp);
+RB_GENERATE(bufq_deadline_tree, buf, b_dlsort, bufq_deadline_cmp);
+
+int
+bufq_deadline_cmp(struct buf *a, struct buf *b)
+{
+	if (a->b_blkno < b->b_blkno)
+		return (-1);
+	if (a->b_blkno > b->b_blkno)
+		return (1);
+	if (a < b)
+		return (-1);
+	return (a > b);
+}
+
+void *
+bufq_deadline_create(void)
+{
+	struct bufq_deadline_head	*dl;
+	int				 i;
+
+	dl = malloc(sizeof(*dl), M_DEVBUF, M_NOWAIT | M_ZERO);
+	if (dl == NULL)
+		return (NULL);
+
+	for (i = BQDL_READ; i <= BQDL_WRITE; i++) {
+		RB_INIT(&dl->dl_dir[i].dd_sort);
+		TAILQ_INIT(&dl->dl_dir[i].dd_fifo);
+	}
+	TAILQ_INIT(&dl->dl_requeue);
+	timeout_set(&dl->dl_antic, bufq_deadline_kick, dl);
+
+	return (dl);
+}
+
+void
+bufq_deadline_destroy(void *data)
+{
+	struct bufq_deadline_head	*dl = data;
+
+	timeout_del(&dl->dl_antic);
+	free(dl, M_DEVBUF);
+}
+
+void
+bufq_deadline_queue(void *data, struct buf *bp)
+{
+	struct bufq_deadline_head	*dl = data;
+	struct bufq_deadline_dir	*dd;
+
+	/* bufq_queue() has pointed the buf at its bufq. */
+	dl->dl_bq = bp->b_bq;
+
+	if (ISSET(bp->b_flags, B_READ)) {
+		dd = &dl->dl_dir[BQDL_READ];
+		bp->b_dlexpire = ticks + BQDL_READEXP;
+	} else {
+		dd = &dl->dl_dir[BQDL_WRITE];
+		bp->b_dlexpire = ticks + BQDL_WRITEEXP;
+	}
+
+	RB_INSERT(bufq_deadline_tree, &dd->dd_sort, bp);
+	TAILQ_INSERT_TAIL(&dd->dd_fifo, bp, b_dlfifo);
+	dd->dd_count++;
+}
+
+struct buf *
+bufq_deadline_dequeue(void *data)
+{
+	struct bufq_deadline_head	*dl = data;
+	struct bufq_deadline_dir	*dd, *rd, *wd;
+	struct buf			*bp;
+	int				 dir;
+
+	if ((bp = TAILQ_FIRST(&dl->dl_requeue)) != NULL) {
+		TAILQ_REMOVE(&dl->dl_requeue, bp, b_dlfifo);
+		return (bp);
+	}
+
+	/* Carry on with the current batch while it lasts. */
+	dd = &dl->dl_dir[dl->dl_curdir];
+	if (dl->dl_batch > 0 && dd->dd_next != NULL) {
+		bp = dd->dd_next;
+		goto dispatch;
+	}
+
+	rd = &dl->dl_dir[BQDL_READ];
+	wd = &dl->dl_dir[BQDL_WRITE];
+	if (rd->dd_count > 0 &&
+	    (wd->dd_count == 0 || dl->dl_starved < BQDL_STARVED)) {
+		if (wd->dd_count > 0)
+			dl->dl_starved++;
+		dir = BQDL_READ;
+	} else if (wd->dd_count > 0) {
+		if (rd->dd_count == 0 && bufq_deadline_antic(dl))
+			return (NULL);
+		dl->dl_starved = 0;
+		dl->dl_reading = 0;
+		dir = BQDL_WRITE;
+	} else
+		return (NULL);
+
+	/* Start at the elevator position unless the oldest has expired. */
+	dd = &dl->dl_dir[dir];
+	bp = TAILQ_FIRST(&dd->dd_fifo);
+	if (dd->dd_next != NULL && ticks - bp->b_dlexpire < 0)
+		bp = dd->dd_next;
+	dl->dl_curdir = dir;
+	dl->dl_batch = BQDL_BATCH;
+
+dispatch:
+	dd->dd_next = RB_NEXT(bufq_deadline_tree, &dd->dd_sort, bp);
+	RB_REMOVE(bufq_deadline_tree, &dd->dd_sort, bp);
+	TAILQ_REMOVE(&dd->dd_fifo, bp, b_dlfifo);
+	dd->dd_count--;
+	dl->dl_batch--;
+
+	return (bp);
+}
+
+void
+bufq_deadline_requeue(void *data, struct buf *bp)
+{
+	struct bufq_deadline_head	*dl = data;
+
+	dl->dl_bq = bp->b_bq;
+	TAILQ_INSERT_HEAD(&dl->dl_requeue, bp, b_dlfifo);
+}
+
+int
+bufq_deadline_peek(void *data)
+{
+	struct bufq_deadline_head	*dl = data;
+
+	return (!TAILQ_EMPTY(&dl->dl_requeue) ||
+	    dl->dl_dir[BQDL_READ].dd_count > 0 ||
+	    dl->dl_dir[BQDL_WRITE].dd_count > 0);
+}
+
+void
+bufq_deadline_done(void *data, struct buf *bp)
+{
+	struct bufq_deadline_head	*dl = data;
+
+	if (ISSET(bp->b_flags, B_READ) && !ISSET(bp->b_flags, B_ASYNC)) {
+		dl->dl_reading = 1;
+		dl->dl_lastread = ticks;
+	}
+}
+
+/*
+ * Should writes be held back waiting for the next synchronous read?
+ * If so, make sure the driver is restarted when the window closes.
+ */
+int
+bufq_deadline_antic(struct bufq_deadline_head *dl)
+{
+	struct buf	*bp;
+	int		 left;
+
+	if (!dl->dl_reading || dl->dl_bq == NULL ||
+	    dl->dl_bq->bufq_kick == NULL)
+		return (0);
+
+	/* Never wait past the deadline of the oldest write. */
+	bp = TAILQ_FIRST(&dl->dl_dir[BQDL_WRITE].dd_fifo);
+	if (ticks - bp->b_dlexpire >= 0)
+		return (0);
+
+	left = BQDL_ANTIC - (ticks - dl->dl_lastread);
+	if (left <= 0)
+		return (0);
+
+	if (!timeout_pending(&dl->dl_antic))
+		timeout_add(&dl->dl_antic, left);
+	return (1);
+}
+
+void
+bufq_deadline_kick(void *arg)
+{
+	struct bufq_deadline_head	*dl = arg;
+	struct bufq			*bq = dl->dl_bq;
+	void				(*kick)(void *);
+	void				*kickarg;
+	int				 s;
+
+	mtx_enter(&bq->bufq_mtx);
+	kick = bq->bufq_kick;
+	kickarg = bq->bufq_kickarg;
+	mtx_leave(&bq->bufq_mtx);
+
+	if (kick != NULL) {
+		s = splbio();
+		(*kick)(kickarg);
+		splx(s);
+	}
+}
@@ -959,6 +959,7 @@ fdcopy(struct proc *p)
 		newfdp->fd_knlistsize = -1;
 		newfdp->fd_knhash = NULL;
 		newfdp->fd_knhashmask = 0;
+		newfdp->fd_knhashcount = 0;
 	}
 
 	fpp = newfdp->fd_ofiles;
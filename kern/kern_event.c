@@ -79,7 +79,9 @@ struct fileops kqueueops = {
 };
 
 void	knote_attach(struct knote *kn, struct filedesc *fdp);
+void	knote_hashresize(struct filedesc *fdp);
 void	knote_drop(struct knote *kn, struct proc *p, struct filedesc *fdp);
+void	knote_activate(struct knote *kn);
 void	knote_enqueue(struct knote *kn);
 void	knote_dequeue(struct knote *kn);
 #define knote_alloc() ((struct knote *)pool_get(&knote_pool, PR_WAITOK))
@@ -111,13 +113,7 @@ struct	pool kqueue_pool;
 int kq_ntimeouts = 0;
 int kq_timeoutmax = (4 * 1024);
 
-#define KNOTE_ACTIVATE(kn) do {						\
-	kn->kn_status |= KN_ACTIVE;					\
-	if ((kn->kn_status & (KN_QUEUED | KN_DISABLED)) == 0)		\
-		knote_enqueue(kn);					\
-} while(0)
-
-#define	KN_HASHSIZE		64		/* XXX should be tunable */
+#define	KN_HASHSIZE		64		/* initial size, grows with use */
 #define KN_HASH(val, mask)	(((val) ^ (val >> 8)) & (mask))
 
 extern struct filterops sig_filtops;
@@ -136,6 +132,7 @@ struct filterops *sysfilt_ops[] = {
 	&proc_filtops,			/* EVFILT_PROC */
 	&sig_filtops,			/* EVFILT_SIGNAL */
 	&timer_filtops,			/* EVFILT_TIMER */
+	&file_filtops,			/* EVFILT_SPLICE */
 };
 
 void kqueue_init(void);
@@ -312,7 +309,7 @@ filt_timerexpire(void *knx)
 	int tticks;
 
 	kn->kn_data++;
-	KNOTE_ACTIVATE(kn);
+	knote_activate(kn);
 
 	if ((kn->kn_flags & EV_ONESHOT) == 0) {
 		tv.tv_sec = kn->kn_sdata / 1000;
@@ -430,6 +427,7 @@ sys_kqueue(struct proc *p, void *v, register_t *retval)
 	fp->f_type = DTYPE_KQUEUE;
 	fp->f_ops = &kqueueops;
 	kq = pool_get(&kqueue_pool, PR_WAITOK|PR_ZERO);
+	mtx_init(&kq->kq_mtx, IPL_HIGH);
 	TAILQ_INIT(&kq->kq_head);
 	fp->f_data = (caddr_t)kq;
 	*retval = fd;
@@ -620,7 +618,7 @@ kqueue_register(struct kqueue *kq, struct kevent *kev, struct proc *p)
 
 		s = splhigh();
 		if (kn->kn_fop->f_event(kn, 0))
-			KNOTE_ACTIVATE(kn);
+			knote_activate(kn);
 		splx(s);
 
 	} else if (kev->flags & EV_DELETE) {
@@ -631,18 +629,21 @@ kqueue_register(struct kqueue *kq, struct kevent *kev, struct proc *p)
 
 	if ((kev->flags & EV_DISABLE) &&
 	    ((kn->kn_status & KN_DISABLED) == 0)) {
-		s = splhigh();
+		mtx_enter(&kq->kq_mtx);
 		kn->kn_status |= KN_DISABLED;
-		splx(s);
+		mtx_leave(&kq->kq_mtx);
 	}
 
 	if ((kev->flags & EV_ENABLE) && (kn->kn_status & KN_DISABLED)) {
-		s = splhigh();
+		mtx_enter(&kq->kq_mtx);
 		kn->kn_status &= ~KN_DISABLED;
 		if ((kn->kn_status & KN_ACTIVE) &&
-		    ((kn->kn_status & KN_QUEUED) == 0))
+		    ((kn->kn_status & KN_QUEUED) == 0)) {
 			knote_enqueue(kn);
-		splx(s);
+			mtx_leave(&kq->kq_mtx);
+			kqueue_wakeup(kq);
+		} else
+			mtx_leave(&kq->kq_mtx);
 	}
 
 done:
@@ -659,7 +660,7 @@ kqueue_scan(struct file *fp, int maxevents, struct kevent *ulistp,
 	struct kevent *kevp;
 	struct timeval atv, rtv, ttv;
 	struct knote *kn, marker;
-	int s, count, timeout, nkev = 0, error = 0;
+	int count, timeout, nkev = 0, error = 0;
 
 	count = maxevents;
 	if (count == 0)
@@ -702,15 +703,16 @@ retry:
 
 start:
 	kevp = kq->kq_kev;
-	s = splhigh();
+	mtx_enter(&kq->kq_mtx);
 	if (kq->kq_count == 0) {
 		if (timeout < 0) {
 			error = EWOULDBLOCK;
+			mtx_leave(&kq->kq_mtx);
 		} else {
 			kq->kq_state |= KQ_SLEEP;
-			error = tsleep(kq, PSOCK | PCATCH, "kqread", timeout);
+			error = msleep(kq, &kq->kq_mtx,
+			    PSOCK | PCATCH | PNORELOCK, "kqread", timeout);
 		}
-		splx(s);
 		if (error == 0)
 			goto retry;
 		/* don't restart after signals... */
@@ -726,7 +728,7 @@ start:
 		kn = TAILQ_FIRST(&kq->kq_head);
 		TAILQ_REMOVE(&kq->kq_head, kn, kn_tqe);
 		if (kn == &marker) {
-			splx(s);
+			mtx_leave(&kq->kq_mtx);
 			if (count == maxevents)
 				goto retry;
 			goto done;
@@ -748,10 +750,10 @@ start:
 		if (kn->kn_flags & EV_ONESHOT) {
 			kn->kn_status &= ~KN_QUEUED;
 			kq->kq_count--;
-			splx(s);
+			mtx_leave(&kq->kq_mtx);
 			kn->kn_fop->f_detach(kn);
 			knote_drop(kn, p, p->p_fd);
-			s = splhigh();
+			mtx_enter(&kq->kq_mtx);
 		} else if (kn->kn_flags & EV_CLEAR) {
 			kn->kn_data = 0;
 			kn->kn_fflags = 0;
@@ -762,19 +764,19 @@ start:
 		}
 		count--;
 		if (nkev == KQ_NEVENTS) {
-			splx(s);
+			mtx_leave(&kq->kq_mtx);
 			error = copyout((caddr_t)&kq->kq_kev, (caddr_t)ulistp,
 			    sizeof(struct kevent) * nkev);
 			ulistp += nkev;
 			nkev = 0;
 			kevp = kq->kq_kev;
-			s = splhigh();
+			mtx_enter(&kq->kq_mtx);
 			if (error)
 				break;
 		}
 	}
 	TAILQ_REMOVE(&kq->kq_head, &marker, kn_tqe);
-	splx(s);
+	mtx_leave(&kq->kq_mtx);
 done:
 	if (nkev != 0)
 		error = copyout((caddr_t)&kq->kq_kev, (caddr_t)ulistp,
@@ -815,8 +817,8 @@ kqueue_poll(struct file *fp, int events, struct proc *p)
 {
 	struct kqueue *kq = (struct kqueue *)fp->f_data;
 	int revents = 0;
-	int s = splhigh();
 
+	mtx_enter(&kq->kq_mtx);
 	if (events & (POLLIN | POLLRDNORM)) {
 		if (kq->kq_count) {
 			revents |= events & (POLLIN | POLLRDNORM);
@@ -825,7 +827,7 @@ kqueue_poll(struct file *fp, int events, struct proc *p)
 			kq->kq_state |= KQ_SEL;
 		}
 	}
-	splx(s);
+	mtx_leave(&kq->kq_mtx);
 	return (revents);
 }
 
@@ -878,6 +880,7 @@ kqueue_close(struct file *fp, struct proc *p)
 					kn->kn_fop->f_detach(kn);
 		/* XXX non-fd release of kn->kn_ptr */
 					knote_free(kn);
+					fdp->fd_knhashcount--;
 					*knp = kn0;
 				} else {
 					knp = &SLIST_NEXT(kn, kn_link);
@@ -892,18 +895,25 @@ kqueue_close(struct file *fp, struct proc *p)
 	return (0);
 }
 
+/*
+ * Must be called without kq_mtx held, the wakeups may end up
+ * activating knotes on other kqueues.
+ */
 void
 kqueue_wakeup(struct kqueue *kq)
 {
+	int state;
+
+	mtx_enter(&kq->kq_mtx);
+	state = kq->kq_state;
+	kq->kq_state &= ~(KQ_SLEEP | KQ_SEL);
+	mtx_leave(&kq->kq_mtx);
 
-	if (kq->kq_state & KQ_SLEEP) {
-		kq->kq_state &= ~KQ_SLEEP;
+	if (state & KQ_SLEEP)
 		wakeup(kq);
-	}
-	if (kq->kq_state & KQ_SEL) {
-		kq->kq_state &= ~KQ_SEL;
+	if (state & KQ_SEL)
 		selwakeup(&kq->kq_sel);
-	} else
+	else
 		KNOTE(&kq->kq_sel.si_note, 0);
 }
 
@@ -917,7 +927,27 @@ knote(struct klist *list, long hint)
 
 	SLIST_FOREACH(kn, list, kn_selnext)
 		if (kn->kn_fop->f_event(kn, hint))
-			KNOTE_ACTIVATE(kn);
+			knote_activate(kn);
+}
+
+/*
+ * mark a knote active and queue it on its kqueue unless it is already
+ * queued or disabled.
+ */
+void
+knote_activate(struct knote *kn)
+{
+	struct kqueue *kq = kn->kn_kq;
+
+	mtx_enter(&kq->kq_mtx);
+	kn->kn_status |= KN_ACTIVE;
+	if ((kn->kn_status & (KN_QUEUED | KN_DISABLED)) == 0) {
+		knote_enqueue(kn);
+		mtx_leave(&kq->kq_mtx);
+		kqueue_wakeup(kq);
+		return;
+	}
+	mtx_leave(&kq->kq_mtx);
 }
 
 /*
@@ -969,7 +999,10 @@ knote_attach(struct knote *kn, struct filedesc *fdp)
 		if (fdp->fd_knhashmask == 0)
 			fdp->fd_knhash = hashinit(KN_HASHSIZE, M_TEMP,
 			    M_WAITOK, &fdp->fd_knhashmask);
+		else if (fdp->fd_knhashcount > fdp->fd_knhashmask)
+			knote_hashresize(fdp);
 		list = &fdp->fd_knhash[KN_HASH(kn->kn_id, fdp->fd_knhashmask)];
+		fdp->fd_knhashcount++;
 		goto done;
 	}
 
@@ -994,6 +1027,36 @@ done:
 	kn->kn_status = 0;
 }
 
+/*
+ * Keep the chains of the non-fd knote hash short by doubling it
+ * whenever it holds more knotes than buckets.
+ */
+void
+knote_hashresize(struct filedesc *fdp)
+{
+	struct klist *hash, *ohash = fdp->fd_knhash;
+	struct knote *kn;
+	u_long mask, i;
+
+	hash = hashinit((fdp->fd_knhashmask + 1) * 2, M_TEMP, M_WAITOK,
+	    &mask);
+	if (fdp->fd_knhash != ohash) {
+		/* someone else resized while we slept */
+		free(hash, M_TEMP);
+		return;
+	}
+	for (i = 0; i <= fdp->fd_knhashmask; i++) {
+		while ((kn = SLIST_FIRST(&ohash[i])) != NULL) {
+			SLIST_REMOVE_HEAD(&ohash[i], kn_link);
+			SLIST_INSERT_HEAD(&hash[KN_HASH(kn->kn_id, mask)], kn,
+			    kn_link);
+		}
+	}
+	fdp->fd_knhash = hash;
+	fdp->fd_knhashmask = mask;
+	free(ohash, M_TEMP);
+}
+
 /*
  * should be called at spl == 0, since we don't want to hold spl
  * while calling closef and free.
@@ -1009,8 +1072,12 @@ knote_drop(struct knote *kn, struct proc *p, struct filedesc *fdp)
 		list = &fdp->fd_knhash[KN_HASH(kn->kn_id, fdp->fd_knhashmask)];
 
 	SLIST_REMOVE(list, kn, knote, kn_link);
+	if (!kn->kn_fop->f_isfd)
+		fdp->fd_knhashcount--;
+	mtx_enter(&kn->kn_kq->kq_mtx);
 	if (kn->kn_status & KN_QUEUED)
 		knote_dequeue(kn);
+	mtx_leave(&kn->kn_kq->kq_mtx);
 	if (kn->kn_fop->f_isfd) {
 		FREF(kn->kn_fp);
 		closef(kn->kn_fp, p);
@@ -1018,34 +1085,34 @@ knote_drop(struct knote *kn, struct proc *p, struct filedesc *fdp)
 	knote_free(kn);
 }
 
-
+/*
+ * The pending queue is protected by kq_mtx, callers of knote_enqueue()
+ * do the kqueue_wakeup() once they have released it.
+ */
 void
 knote_enqueue(struct knote *kn)
 {
 	struct kqueue *kq = kn->kn_kq;
-	int s = splhigh();
 
+	MUTEX_ASSERT_LOCKED(&kq->kq_mtx);
 	KASSERT((kn->kn_status & KN_QUEUED) == 0);
 
 	TAILQ_INSERT_TAIL(&kq->kq_head, kn, kn_tqe);
 	kn->kn_status |= KN_QUEUED;
 	kq->kq_count++;
-	splx(s);
-	kqueue_wakeup(kq);
 }
 
 void
 knote_dequeue(struct knote *kn)
 {
 	struct kqueue *kq = kn->kn_kq;
-	int s = splhigh();
 
+	MUTEX_ASSERT_LOCKED(&kq->kq_mtx);
 	KASSERT(kn->kn_status & KN_QUEUED);
 
 	TAILQ_REMOVE(&kq->kq_head, kn, kn_tqe);
 	kn->kn_status &= ~KN_QUEUED;
 	kq->kq_count--;
-	splx(s);
 }
 
 void
@@ -1054,7 +1121,9 @@ klist_invalidate(struct klist *list)
 	struct knote *kn;
 
 	SLIST_FOREACH(kn, list, kn_selnext) {
+		mtx_enter(&kn->kn_kq->kq_mtx);
 		kn->kn_status |= KN_DETACHED;
+		mtx_leave(&kn->kn_kq->kq_mtx);
 		kn->kn_flags |= EV_EOF | EV_ONESHOT;
 	}
 }
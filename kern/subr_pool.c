@@ -41,6 +41,8 @@
 #include <sys/syslog.h>
 #include <sys/sysctl.h>
 
+#include <machine/cpu.h>
+
 #include <uvm/uvm.h>
 #include <dev/rndvar.h>
 
@@ -55,6 +57,15 @@
  * header. The memory for building the page list is either taken from
  * the allocated pages themselves (for small pool items) or taken from
  * an internal pool of page headers (`phpool').
+ *
+ * Pools created with PR_CACHE additionally keep a small stack of free
+ * items per CPU in front of the page lists.  Items are kept in
+ * magazines of POOL_CACHE_MAGSIZE entries: each CPU owns a current and
+ * a spare magazine, and full and empty magazines are swapped with a
+ * per-pool depot under `pr_cache_mtx'.  Only when the depot can not
+ * help is `pr_mtx' taken and the page lists touched.  The per-CPU state
+ * relies on the caller running at the pool's spl, like the rest of the
+ * pool code does, so no other lock is needed to protect it.
  */
 
 /* List of all pools */
@@ -63,6 +74,9 @@ TAILQ_HEAD(,pool) pool_head = TAILQ_HEAD_INITIALIZER(pool_head);
 /* Private pool for page header structures */
 struct pool phpool;
 
+/* Private pool for per-CPU cache magazines */
+struct pool pcmagpool;
+
 struct pool_item_header {
 	/* Page headers */
 	LIST_ENTRY(pool_item_header)
@@ -119,6 +133,13 @@ struct pool_item_header *pool_alloc_item_header(struct pool *, caddr_t , int);
 void	*pool_allocator_alloc(struct pool *, int, int *);
 void	 pool_allocator_free(struct pool *, void *);
 
+void	 pool_cache_init(struct pool *);
+void	*pool_cache_get(struct pool *);
+int	 pool_cache_put(struct pool *, void *);
+int	 pool_cache_drain(struct pool *);
+void	 pool_cache_magput(struct pool *, struct pool_cache_mag *);
+void	 pool_cache_destroy(struct pool *);
+
 /*
  * XXX - quick hack. For pools with large items we want to use a special
  *       allocator. For now, instead of having the allocator figure out
@@ -403,6 +424,15 @@ pool_init(struct pool *pp, size_t size, u_int align, u_int ioff, int flags,
 	/* pglistalloc/constraint parameters */
 	pp->pr_crange = &kp_dirty;
 
+	pp->pr_cache = NULL;
+	mtx_init(&pp->pr_cache_mtx, IPL_NONE);
+	SLIST_INIT(&pp->pr_cache_full);
+	SLIST_INIT(&pp->pr_cache_empty);
+	pp->pr_cache_nfull = 0;
+	pp->pr_cache_nempty = 0;
+	if ((pp->pr_roflags & (PR_CACHE | PR_DEBUG)) == PR_CACHE)
+		pool_cache_init(pp);
+
 	/* Insert this into the list of all pools. */
 	TAILQ_INSERT_HEAD(&pool_head, pp, pr_poollist);
 }
@@ -412,6 +442,7 @@ pool_setipl(struct pool *pp, int ipl)
 {
 	pp->pr_ipl = ipl;
 	mtx_init(&pp->pr_mtx, ipl);
+	mtx_init(&pp->pr_cache_mtx, ipl);
 }
 
 /*
@@ -422,6 +453,9 @@ pool_destroy(struct pool *pp)
 {
 	struct pool_item_header *ph;
 
+	if (pp->pr_cache != NULL)
+		pool_cache_destroy(pp);
+
 #ifdef DIAGNOSTIC
 	if (pp->pr_nout != 0)
 		panic("pool_destroy: pool busy: still out: %u", pp->pr_nout);
@@ -458,7 +492,7 @@ pool_alloc_item_header(struct pool *pp, caddr_t storage, int flags)
 void *
 pool_get(struct pool *pp, int flags)
 {
-	void *v;
+	void *v = NULL;
 
 	KASSERT(flags & (PR_WAITOK | PR_NOWAIT));
 
@@ -467,9 +501,22 @@ pool_get(struct pool *pp, int flags)
 		assertwaitok();
 #endif /* DIAGNOSTIC */
 
-	mtx_enter(&pp->pr_mtx);
-	v = pool_do_get(pp, flags);
-	mtx_leave(&pp->pr_mtx);
+	if (pp->pr_cache != NULL)
+		v = pool_cache_get(pp);
+	if (v == NULL) {
+		/* Items parked in the depot count against the hard limit. */
+		if (pp->pr_cache != NULL && pp->pr_nout >= pp->pr_hardlimit)
+			pool_cache_drain(pp);
+		mtx_enter(&pp->pr_mtx);
+		v = pool_do_get(pp, flags);
+		mtx_leave(&pp->pr_mtx);
+	}
+	if (v == NULL && pp->pr_cache != NULL && pool_cache_drain(pp)) {
+		/* Out of pages, but the depot gave some items back. */
+		mtx_enter(&pp->pr_mtx);
+		v = pool_do_get(pp, flags);
+		mtx_leave(&pp->pr_mtx);
+	}
 	if (v == NULL)
 		return (v);
 
@@ -691,9 +738,11 @@ pool_put(struct pool *pp, void *v)
 {
 	if (pp->pr_dtor)
 		pp->pr_dtor(pp->pr_arg, v);
-	mtx_enter(&pp->pr_mtx);
-	pool_do_put(pp, v);
-	mtx_leave(&pp->pr_mtx);
+	if (pp->pr_cache == NULL || pool_cache_put(pp, v) != 0) {
+		mtx_enter(&pp->pr_mtx);
+		pool_do_put(pp, v);
+		mtx_leave(&pp->pr_mtx);
+	}
 	pp->pr_nput++;
 }
 
@@ -1036,6 +1085,9 @@ pool_reclaim(struct pool *pp)
 	struct pool_item_header *ph, *phnext;
 	struct pool_pagelist pq;
 
+	if (pp->pr_cache != NULL)
+		pool_cache_drain(pp);
+
 	LIST_INIT(&pq);
 
 	mtx_enter(&pp->pr_mtx);
@@ -1085,6 +1137,249 @@ pool_reclaim_all(void)
 		pool_reclaim(pp);
 }
 
+/*
+ * Set up the per-CPU caches of a PR_CACHE pool.
+ */
+void
+pool_cache_init(struct pool *pp)
+{
+	if (pcmagpool.pr_size == 0) {
+		pool_init(&pcmagpool, sizeof(struct pool_cache_mag), 0, 0,
+		    0, "pcmagpl", NULL);
+		pool_setipl(&pcmagpool, IPL_HIGH);
+	}
+
+	pp->pr_cache = malloc(MAXCPUS * sizeof(struct pool_cache), M_DEVBUF,
+	    M_WAITOK | M_ZERO);
+}
+
+/*
+ * Take an item from the current CPU's cache.  Returns NULL if neither
+ * the CPU nor the depot has one, in which case the caller has to go to
+ * the pool itself.
+ */
+void *
+pool_cache_get(struct pool *pp)
+{
+	struct pool_cache *pc = &pp->pr_cache[CPU_INFO_UNIT(curcpu())];
+	struct pool_cache_mag *pm, *full, *empty;
+
+	pm = pc->pc_cur;
+	if (pm == NULL || pm->pm_nitems == 0) {
+		if (pc->pc_prev != NULL && pc->pc_prev->pm_nitems > 0) {
+			/* The spare is full, use it. */
+			pc->pc_cur = pc->pc_prev;
+			pc->pc_prev = pm;
+		} else {
+			/* Trade the empty spare for a full depot magazine. */
+			mtx_enter(&pp->pr_cache_mtx);
+			if ((full = SLIST_FIRST(&pp->pr_cache_full)) == NULL) {
+				mtx_leave(&pp->pr_cache_mtx);
+				pc->pc_getmiss++;
+				return (NULL);
+			}
+			SLIST_REMOVE_HEAD(&pp->pr_cache_full, pm_list);
+			pp->pr_cache_nfull--;
+			empty = pc->pc_prev;
+			if (empty != NULL &&
+			    pp->pr_cache_nempty < POOL_CACHE_DEPOTMAX) {
+				SLIST_INSERT_HEAD(&pp->pr_cache_empty,
+				    empty, pm_list);
+				pp->pr_cache_nempty++;
+				empty = NULL;
+			}
+			mtx_leave(&pp->pr_cache_mtx);
+
+			if (empty != NULL)
+				pool_put(&pcmagpool, empty);
+			pc->pc_prev = pm;
+			pc->pc_cur = full;
+		}
+		pm = pc->pc_cur;
+	}
+
+	pc->pc_gethit++;
+	return (pm->pm_items[--pm->pm_nitems]);
+}
+
+/*
+ * Stash an item in the current CPU's cache.  Returns non-zero if there
+ * was no room or somebody is waiting for an item, in which case the
+ * caller has to give it to the pool.
+ */
+int
+pool_cache_put(struct pool *pp, void *v)
+{
+	struct pool_cache *pc = &pp->pr_cache[CPU_INFO_UNIT(curcpu())];
+	struct pool_cache_mag *pm, *empty;
+
+	if (v == NULL)
+		panic("pool_put of NULL");
+
+	/* Let pool_do_put() hand the item to a sleeper. */
+	if (pp->pr_flags & PR_WANTED) {
+		pc->pc_putmiss++;
+		return (1);
+	}
+
+	pm = pc->pc_cur;
+	if (pm == NULL || pm->pm_nitems == POOL_CACHE_MAGSIZE) {
+		if (pc->pc_prev != NULL &&
+		    pc->pc_prev->pm_nitems < POOL_CACHE_MAGSIZE) {
+			/* The spare is empty, use it. */
+			pc->pc_cur = pc->pc_prev;
+			pc->pc_prev = pm;
+		} else if (pc->pc_prev != NULL &&
+		    pp->pr_cache_nfull >= POOL_CACHE_DEPOTMAX) {
+			/* The depot is full, return the spare's items. */
+			empty = pc->pc_prev;
+			pool_cache_magput(pp, empty);
+			pc->pc_prev = pm;
+			pc->pc_cur = empty;
+		} else {
+			/* Trade the full spare for an empty magazine. */
+			mtx_enter(&pp->pr_cache_mtx);
+			empty = SLIST_FIRST(&pp->pr_cache_empty);
+			if (empty != NULL) {
+				SLIST_REMOVE_HEAD(&pp->pr_cache_empty,
+				    pm_list);
+				pp->pr_cache_nempty--;
+			}
+			mtx_leave(&pp->pr_cache_mtx);
+
+			if (empty == NULL) {
+				empty = pool_get(&pcmagpool, PR_NOWAIT);
+				if (empty == NULL) {
+					pc->pc_putmiss++;
+					return (1);
+				}
+				empty->pm_nitems = 0;
+			}
+
+			if (pc->pc_prev != NULL) {
+				mtx_enter(&pp->pr_cache_mtx);
+				SLIST_INSERT_HEAD(&pp->pr_cache_full,
+				    pc->pc_prev, pm_list);
+				pp->pr_cache_nfull++;
+				mtx_leave(&pp->pr_cache_mtx);
+			}
+
+			pc->pc_prev = pm;
+			pc->pc_cur = empty;
+		}
+		pm = pc->pc_cur;
+	}
+
+	pm->pm_items[pm->pm_nitems++] = v;
+	pc->pc_puthit++;
+	return (0);
+}
+
+/*
+ * Give the items in a magazine back to the pool, leaving it empty.
+ */
+void
+pool_cache_magput(struct pool *pp, struct pool_cache_mag *pm)
+{
+	mtx_enter(&pp->pr_mtx);
+	while (pm->pm_nitems > 0)
+		pool_do_put(pp, pm->pm_items[--pm->pm_nitems]);
+	mtx_leave(&pp->pr_mtx);
+}
+
+/*
+ * Give the items held in the depot back to the pool and release
+ * its magazines.  Magazines loaded on a CPU are left alone.
+ *
+ * Returns non-zero if any items were returned.
+ */
+int
+pool_cache_drain(struct pool *pp)
+{
+	struct pool_cache_maglist pl;
+	struct pool_cache_mag *pm;
+	int rv = 0;
+
+	SLIST_INIT(&pl);
+
+	mtx_enter(&pp->pr_cache_mtx);
+	while ((pm = SLIST_FIRST(&pp->pr_cache_full)) != NULL) {
+		SLIST_REMOVE_HEAD(&pp->pr_cache_full, pm_list);
+		SLIST_INSERT_HEAD(&pl, pm, pm_list);
+	}
+	while ((pm = SLIST_FIRST(&pp->pr_cache_empty)) != NULL) {
+		SLIST_REMOVE_HEAD(&pp->pr_cache_empty, pm_list);
+		SLIST_INSERT_HEAD(&pl, pm, pm_list);
+	}
+	pp->pr_cache_nfull = 0;
+	pp->pr_cache_nempty = 0;
+	mtx_leave(&pp->pr_cache_mtx);
+
+	while ((pm = SLIST_FIRST(&pl)) != NULL) {
+		SLIST_REMOVE_HEAD(&pl, pm_list);
+		if (pm->pm_nitems > 0) {
+			pool_cache_magput(pp, pm);
+			rv = 1;
+		}
+		pool_put(&pcmagpool, pm);
+	}
+
+	return (rv);
+}
+
+/*
+ * Number of items actually in use, i.e. handed out by the pool and not
+ * sitting in one of its caches.  The per-CPU counts are read without
+ * locking, so this is only good for heuristics.
+ */
+u_int
+pool_inuse(struct pool *pp)
+{
+	struct pool_cache *pc;
+	u_int n;
+	int i;
+
+	if (pp->pr_cache == NULL)
+		return (pp->pr_nout);
+
+	n = pp->pr_cache_nfull * POOL_CACHE_MAGSIZE;
+	for (i = 0; i < MAXCPUS; i++) {
+		pc = &pp->pr_cache[i];
+		if (pc->pc_cur != NULL)
+			n += pc->pc_cur->pm_nitems;
+		if (pc->pc_prev != NULL)
+			n += pc->pc_prev->pm_nitems;
+	}
+	return (n < pp->pr_nout ? pp->pr_nout - n : 0);
+}
+
+/*
+ * Tear down the per-CPU caches of a pool that is being destroyed.
+ */
+void
+pool_cache_destroy(struct pool *pp)
+{
+	struct pool_cache *pc;
+	int i;
+
+	mtx_enter(&pp->pr_cache_mtx);
+	for (i = 0; i < MAXCPUS; i++) {
+		pc = &pp->pr_cache[i];
+		if (pc->pc_cur != NULL)
+			SLIST_INSERT_HEAD(&pp->pr_cache_full, pc->pc_cur,
+			    pm_list);
+		if (pc->pc_prev != NULL)
+			SLIST_INSERT_HEAD(&pp->pr_cache_full, pc->pc_prev,
+			    pm_list);
+	}
+	mtx_leave(&pp->pr_cache_mtx);
+
+	pool_cache_drain(pp);
+
+	free(pp->pr_cache, M_DEVBUF);
+	pp->pr_cache = NULL;
+}
+
 #ifdef DDB
 #include <machine/db_machdep.h>
 #include <ddb/db_interface.h>
@@ -1148,6 +1443,24 @@ pool_print1(struct pool *pp, const char *modif, int (*pr)(const char *, ...))
 	(*pr)("\tnpagealloc %lu, npagefree %lu, hiwat %u, nidle %lu\n",
 	    pp->pr_npagealloc, pp->pr_npagefree, pp->pr_hiwat, pp->pr_nidle);
 
+	if (pp->pr_cache != NULL) {
+		struct pool_cache *pc;
+		int i;
+
+		(*pr)("\n\tdepot: nfull %u, nempty %u\n",
+		    pp->pr_cache_nfull, pp->pr_cache_nempty);
+		for (i = 0; i < MAXCPUS; i++) {
+			pc = &pp->pr_cache[i];
+			if (pc->pc_gethit + pc->pc_getmiss +
+			    pc->pc_puthit + pc->pc_putmiss == 0)
+				continue;
+			(*pr)("\tcpu%d: gethit %lu, getmiss %lu, "
+			    "puthit %lu, putmiss %lu\n", i,
+			    pc->pc_gethit, pc->pc_getmiss,
+			    pc->pc_puthit, pc->pc_putmiss);
+		}
+	}
+
 	if (print_pagelist == 0)
 		return;
 
@@ -1363,17 +1676,22 @@ pool_walk(struct pool *pp, int full, int (*pr)(const char *, ...),
 #endif
 
 /*
- * We have three different sysctls.
+ * We have four different sysctls.
  * kern.pool.npools - the number of pools.
  * kern.pool.pool.<pool#> - the pool struct for the pool#.
  * kern.pool.name.<pool#> - the name for pool#.
+ * kern.pool.cache.<pool#> - per-CPU cache counters for pool#.
  */
 int
 sysctl_dopool(int *name, u_int namelen, char *where, size_t *sizep)
 {
 	struct pool *pp, *foundpool = NULL;
+	struct kinfo_pool_cache kpc;
+	struct pool_cache *pc;
+	struct cpu_info *ci;
+	CPU_INFO_ITERATOR cii;
 	size_t buflen = where != NULL ? *sizep : 0;
-	int npools = 0, s;
+	int npools = 0, s, i, n, error;
 	unsigned int lookfor;
 	size_t len;
 
@@ -1393,6 +1711,11 @@ sysctl_dopool(int *name, u_int namelen, char *where, size_t *sizep)
 			return (EINVAL);
 		lookfor = name[1];
 		break;
+	case KERN_POOL_CACHE:
+		if (namelen != 2)
+			return (EINVAL);
+		lookfor = name[1];
+		break;
 	default:
 		return (EINVAL);
 	}
@@ -1423,6 +1746,36 @@ sysctl_dopool(int *name, u_int namelen, char *where, size_t *sizep)
 		return copyout(foundpool->pr_wchan, where, len);
 	case KERN_POOL_POOL:
 		return copyout(foundpool, where, buflen);
+	case KERN_POOL_CACHE:
+		if (foundpool->pr_cache == NULL)
+			return (EOPNOTSUPP);
+		n = 0;
+		CPU_INFO_FOREACH(cii, ci)
+			n++;
+		len = n * sizeof(kpc);
+		if (where == NULL) {
+			*sizep = len;
+			return (0);
+		}
+		if (*sizep < len)
+			return (ENOMEM);
+		*sizep = len;
+		i = 0;
+		CPU_INFO_FOREACH(cii, ci) {
+			if (i >= n)
+				break;
+			pc = &foundpool->pr_cache[CPU_INFO_UNIT(ci)];
+			kpc.pc_gethit = pc->pc_gethit;
+			kpc.pc_getmiss = pc->pc_getmiss;
+			kpc.pc_puthit = pc->pc_puthit;
+			kpc.pc_putmiss = pc->pc_putmiss;
+			error = copyout(&kpc, where + i * sizeof(kpc),
+			    sizeof(kpc));
+			if (error)
+				return (error);
+			i++;
+		}
+		return (0);
 	}
 	/* NOTREACHED */
 	return (0); /* XXX - Stupid gcc */
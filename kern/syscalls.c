@@ -422,4 +422,5 @@ char *syscallnames[] = {
 	"setrtable",			/* 310 = setrtable */
 	"getrtable",			/* 311 = getrtable */
 	"getdirentries",			/* 312 = getdirentries */
+	"sendfile",			/* 313 = sendfile */
 };
@@ -140,14 +140,14 @@ mbinit(void)
 {
 	int i;
 
-	pool_init(&mbpool, MSIZE, 0, 0, 0, "mbpl", NULL);
+	pool_init(&mbpool, MSIZE, 0, 0, PR_CACHE, "mbpl", NULL);
 	pool_set_constraints(&mbpool, &kp_dma);
 	pool_setlowat(&mbpool, mblowat);
 
 	for (i = 0; i < nitems(mclsizes); i++) {
 		snprintf(mclnames[i], sizeof(mclnames[0]), "mcl%dk",
 		    mclsizes[i] >> 10);
-		pool_init(&mclpools[i], mclsizes[i], 0, 0, 0,
+		pool_init(&mclpools[i], mclsizes[i], 0, 0, PR_CACHE,
 		    mclnames[i], NULL);
 		pool_set_constraints(&mclpools[i], &kp_dma); 
 		pool_setlowat(&mclpools[i], mcllowat);
@@ -1345,6 +1345,7 @@ m_print(void *v, int (*pr)(const char *, ...))
 		    SLIST_FIRST(&m->m_pkthdr.tags), m->m_pkthdr.tagsset);
 		(*pr)("m_pkthdr.csum_flags: %hx\tm_pkthdr.ether_vtag: %hu\n",
 		    m->m_pkthdr.csum_flags, m->m_pkthdr.ether_vtag);
+		(*pr)("m_pkthdr.tso_segsz: %hu\n", m->m_pkthdr.tso_segsz);
 		(*pr)("m_pkthdr.pf.flags: %b\n",
 		    m->m_pkthdr.pf.flags, "\20\1GENERATED\2FRAGCACHE"
 		    "\3TRANSLATE_LOCALHOST\4DIVERTED\5DIVERTED_PACKET"
@@ -51,8 +51,14 @@
 #include <net/route.h>
 #include <sys/pool.h>
 
-int	sosplice(struct socket *, int, off_t);
+int	sosplice(struct socket *, int, off_t, struct timeval *, int);
+void	sosplicelink(struct socket *, struct socket *, off_t,
+	    struct timeval *, int);
+int	sosplicelock(struct socket *, struct socket *, int,
+	    struct sockbuf **, int *);
+void	sospliceunlock(struct sockbuf **, int);
 void	sounsplice(struct socket *, struct socket *, int);
+void	soidle(void *);
 int	somove(struct socket *, int);
 
 void	filt_sordetach(struct knote *kn);
@@ -60,6 +66,7 @@ int	filt_soread(struct knote *kn, long hint);
 void	filt_sowdetach(struct knote *kn);
 int	filt_sowrite(struct knote *kn, long hint);
 int	filt_solisten(struct knote *kn, long hint);
+int	filt_sosplice(struct knote *kn, long hint);
 
 struct filterops solisten_filtops =
 	{ 1, NULL, filt_sordetach, filt_solisten };
@@ -67,6 +74,8 @@ struct filterops soread_filtops =
 	{ 1, NULL, filt_sordetach, filt_soread };
 struct filterops sowrite_filtops =
 	{ 1, NULL, filt_sowdetach, filt_sowrite };
+struct filterops sosplice_filtops =
+	{ 1, NULL, filt_sordetach, filt_sosplice };
 
 
 #ifndef SOMINCONN
@@ -83,6 +92,7 @@ soinit(void)
 {
 
 	pool_init(&socket_pool, sizeof(struct socket), 0, 0, 0, "sockpl", NULL);
+	sendfile_init();
 }
 
 /*
@@ -991,12 +1001,20 @@ sorflush(struct socket *so)
 }
 
 #ifdef SOCKET_SPLICE
+/*
+ * Splice the receive buffer of so to the send buffer of the socket
+ * given by fd.  With SPLICE_BIDIR the drain is spliced back to so as
+ * well, both directions share the idle timeout and a FIN received on
+ * either side is passed on to the other one.
+ */
 int
-sosplice(struct socket *so, int fd, off_t max)
+sosplice(struct socket *so, int fd, off_t max, struct timeval *tv,
+    int flags)
 {
 	struct file	*fp;
 	struct socket	*sosp;
-	int		 s, error = 0;
+	struct sockbuf	*sbs[4];
+	int		 s, nsb, error = 0;
 
 	if ((so->so_proto->pr_flags & PR_SPLICE) == 0)
 		return (EPROTONOSUPPORT);
@@ -1008,28 +1026,35 @@ sosplice(struct socket *so, int fd, off_t max)
 	/* If no fd is given, unsplice by removing existing link. */
 	if (fd < 0) {
 		s = splsoftnet();
-		if (so->so_splice)
-			sounsplice(so, so->so_splice, 1);
+		if ((sosp = so->so_splice) != NULL) {
+			if ((so->so_spliceflags & SOSP_BIDIR) &&
+			    sosp->so_splice == so)
+				sounsplice(sosp, so, 1);
+			sounsplice(so, sosp, 1);
+		}
 		splx(s);
 		return (0);
 	}
 
 	if (max && max < 0)
 		return (EINVAL);
+	if (tv && (tv->tv_sec < 0 || tv->tv_usec < 0 ||
+	    tv->tv_usec >= 1000000))
+		return (EINVAL);
+	if (flags & ~SPLICE_BIDIR)
+		return (EINVAL);
 
 	/* Find sosp, the drain socket where data will be spliced into. */
 	if ((error = getsock(curproc->p_fd, fd, &fp)) != 0)
 		return (error);
 	sosp = fp->f_data;
-
-	/* Lock both receive and send buffer. */
-	if ((error = sblock(&so->so_rcv,
-	    (so->so_state & SS_NBIO) ? M_NOWAIT : M_WAITOK)) != 0) {
+	if ((flags & SPLICE_BIDIR) && sosp == so) {
 		FRELE(fp);
-		return (error);
+		return (EINVAL);
 	}
-	if ((error = sblock(&sosp->so_snd, M_WAITOK)) != 0) {
-		sbunlock(&so->so_rcv);
+
+	/* Lock both receive and send buffer, in both directions if needed. */
+	if ((error = sosplicelock(so, sosp, flags, sbs, &nsb)) != 0) {
 		FRELE(fp);
 		return (error);
 	}
@@ -1039,6 +1064,11 @@ sosplice(struct socket *so, int fd, off_t max)
 		error = EBUSY;
 		goto release;
 	}
+	if ((flags & SPLICE_BIDIR) &&
+	    (sosp->so_splice || so->so_spliceback)) {
+		error = EBUSY;
+		goto release;
+	}
 	if (sosp->so_proto->pr_usrreq != so->so_proto->pr_usrreq) {
 		error = EPROTONOSUPPORT;
 		goto release;
@@ -1053,10 +1083,9 @@ sosplice(struct socket *so, int fd, off_t max)
 	}
 
 	/* Splice so and sosp together. */
-	so->so_splice = sosp;
-	sosp->so_spliceback = so;
-	so->so_splicelen = 0;
-	so->so_splicemax = max;
+	sosplicelink(so, sosp, max, tv, flags);
+	if (flags & SPLICE_BIDIR)
+		sosplicelink(sosp, so, max, tv, flags);
 
 	/*
 	 * To prevent softnet interrupt from calling somove() while
@@ -1066,25 +1095,130 @@ sosplice(struct socket *so, int fd, off_t max)
 		so->so_rcv.sb_flags |= SB_SPLICE;
 		sosp->so_snd.sb_flags |= SB_SPLICE;
 	}
+	if ((flags & SPLICE_BIDIR) && sosp->so_splice == so &&
+	    somove(sosp, M_WAIT)) {
+		sosp->so_rcv.sb_flags |= SB_SPLICE;
+		so->so_snd.sb_flags |= SB_SPLICE;
+	}
 
  release:
 	splx(s);
-	sbunlock(&sosp->so_snd);
-	sbunlock(&so->so_rcv);
+	sospliceunlock(sbs, nsb);
 	FRELE(fp);
 	return (error);
 }
 
+/*
+ * Lock the socket buffers needed to splice so to sosp, and with
+ * SPLICE_BIDIR sosp back to so.  Two processes splicing the same pair
+ * of sockets, possibly in opposite directions, must not wait for each
+ * other's buffers in a cycle.  So the buffers of the socket at the
+ * lower address are always taken first, receive before send buffer.
+ * On success the locked buffers are returned in sbs, in locking order.
+ */
+int
+sosplicelock(struct socket *so, struct socket *sosp, int flags,
+    struct sockbuf **sbs, int *nsbp)
+{
+	struct socket *first, *second;
+	int i, n = 0, error = 0;
+
+	if (so <= sosp) {
+		first = so;
+		second = sosp;
+	} else {
+		first = sosp;
+		second = so;
+	}
+	if (first == so || (flags & SPLICE_BIDIR))
+		sbs[n++] = &first->so_rcv;
+	if (first == sosp || (flags & SPLICE_BIDIR))
+		sbs[n++] = &first->so_snd;
+	if (second != first) {
+		if (second == so || (flags & SPLICE_BIDIR))
+			sbs[n++] = &second->so_rcv;
+		if (second == sosp || (flags & SPLICE_BIDIR))
+			sbs[n++] = &second->so_snd;
+	}
+
+	for (i = 0; i < n; i++) {
+		if ((error = sblock(sbs[i], (so->so_state & SS_NBIO) ?
+		    M_NOWAIT : M_WAITOK)) != 0) {
+			sospliceunlock(sbs, i);
+			return (error);
+		}
+	}
+	*nsbp = n;
+	return (0);
+}
+
+void
+sospliceunlock(struct sockbuf **sbs, int n)
+{
+	while (n > 0)
+		sbunlock(sbs[--n]);
+}
+
+void
+sosplicelink(struct socket *so, struct socket *sosp, off_t max,
+    struct timeval *tv, int flags)
+{
+	splsoftassert(IPL_SOFTNET);
+
+	so->so_splice = sosp;
+	sosp->so_spliceback = so;
+	so->so_splicelen = 0;
+	so->so_splicemax = max;
+	so->so_spliceflags = (flags & SPLICE_BIDIR) ? SOSP_BIDIR : 0;
+	if (tv)
+		so->so_idletv = *tv;
+	else
+		timerclear(&so->so_idletv);
+	timeout_set(&so->so_idleto, soidle, so);
+	if (timerisset(&so->so_idletv))
+		timeout_add_tv(&so->so_idleto, &so->so_idletv);
+}
+
 void
 sounsplice(struct socket *so, struct socket *sosp, int wakeup)
 {
 	splsoftassert(IPL_SOFTNET);
 
+	timeout_del(&so->so_idleto);
 	sosp->so_snd.sb_flags &= ~SB_SPLICE;
 	so->so_rcv.sb_flags &= ~SB_SPLICE;
 	so->so_splice = sosp->so_spliceback = NULL;
-	if (wakeup && soreadable(so))
-		sorwakeup(so);
+	so->so_spliceflags |= SOSP_DONE;
+	if (wakeup) {
+		if (soreadable(so))
+			sorwakeup(so);
+		else
+			KNOTE(&so->so_rcv.sb_sel.si_note, 0);
+	}
+}
+
+/*
+ * Nothing has been moved for the idle time.  A bidirectional splice
+ * is only idle if neither direction moved data, so both go together.
+ */
+void
+soidle(void *arg)
+{
+	struct socket *so = arg;
+	struct socket *sosp;
+	int s;
+
+	s = splsoftnet();
+	if ((sosp = so->so_splice) != NULL) {
+		if ((so->so_spliceflags & SOSP_BIDIR) &&
+		    sosp->so_splice == so) {
+			sosp->so_error = ETIMEDOUT;
+			sounsplice(sosp, so, 1);
+		}
+		so->so_error = ETIMEDOUT;
+		sounsplice(so, sosp, 1);
+	}
+	splx(s);
 }
 
 /*
@@ -1100,7 +1234,8 @@ somove(struct socket *so, int wait)
 	struct mbuf	*m = NULL, **mp;
 	u_long		 len, off, oobmark;
 	long		 space;
-	int		 error = 0, maxreached = 0;
+	off_t		 splicelen = so->so_splicelen;
+	int		 error = 0, maxreached = 0, eof;
 	short		 state;
 
 	splsoftassert(IPL_SOFTNET);
@@ -1270,9 +1405,24 @@ somove(struct socket *so, int wait)
 	sosp->so_state &= ~SS_ISSENDING;
 	if (error)
 		so->so_error = error;
-	if (((so->so_state & SS_CANTRCVMORE) && so->so_rcv.sb_cc == 0) ||
-	    (sosp->so_state & SS_CANTSENDMORE) || maxreached || error) {
+
+	/* Data has moved, restart the idle timeout of both directions. */
+	if (so->so_splicelen != splicelen && timerisset(&so->so_idletv)) {
+		timeout_add_tv(&so->so_idleto, &so->so_idletv);
+		if ((so->so_spliceflags & SOSP_BIDIR) && sosp->so_splice == so)
+			timeout_add_tv(&sosp->so_idleto, &sosp->so_idletv);
+	}
+
+	eof = (so->so_state & SS_CANTRCVMORE) && so->so_rcv.sb_cc == 0;
+	if (eof || (sosp->so_state & SS_CANTSENDMORE) || maxreached ||
+	    error) {
 		sounsplice(so, sosp, 1);
+		/* Pass the FIN on, the relay has no userland to do it. */
+		if (eof && !maxreached && !error &&
+		    (so->so_spliceflags & SOSP_BIDIR) &&
+		    (sosp->so_state & SS_CANTSENDMORE) == 0)
+			(void) (*sosp->so_proto->pr_usrreq)(sosp,
+			    PRU_SHUTDOWN, NULL, NULL, NULL, NULL);
 		return (0);
 	}
 	return (1);
@@ -1452,16 +1602,25 @@ sosetopt(struct socket *so, int level, int optname, struct mbuf *m0)
 #ifdef SOCKET_SPLICE
 		case SO_SPLICE:
 			if (m == NULL) {
-				error = sosplice(so, -1, 0);
+				error = sosplice(so, -1, 0, NULL, 0);
 			} else if (m->m_len < sizeof(int)) {
 				error = EINVAL;
 				goto bad;
+			} else if (m->m_len < offsetof(struct splice,
+			    sp_idle)) {
+				error = sosplice(so, *mtod(m, int *), 0,
+				    NULL, 0);
 			} else if (m->m_len < sizeof(struct splice)) {
-				error = sosplice(so, *mtod(m, int *), 0);
+				/* binaries from before sp_idle existed */
+				error = sosplice(so,
+				    mtod(m, struct splice *)->sp_fd,
+				    mtod(m, struct splice *)->sp_max, NULL, 0);
 			} else {
 				error = sosplice(so,
 				    mtod(m, struct splice *)->sp_fd,
-				    mtod(m, struct splice *)->sp_max);
+				    mtod(m, struct splice *)->sp_max,
+				    &mtod(m, struct splice *)->sp_idle,
+				    mtod(m, struct splice *)->sp_flags);
 			}
 			break;
 #endif /* SOCKET_SPLICE */
@@ -1637,6 +1796,12 @@ soo_kqfilter(struct file *fp, struct knote *kn)
 		kn->kn_fop = &sowrite_filtops;
 		sb = &so->so_snd;
 		break;
+#ifdef SOCKET_SPLICE
+	case EVFILT_SPLICE:
+		kn->kn_fop = &sosplice_filtops;
+		sb = &so->so_rcv;
+		break;
+#endif /* SOCKET_SPLICE */
 	default:
 		return (1);
 	}
@@ -1726,3 +1891,25 @@ filt_solisten(struct knote *kn, long hint)
 	kn->kn_data = so->so_qlen;
 	return (so->so_qlen != 0);
 }
+
+#ifdef SOCKET_SPLICE
+/*
+ * Fires once the splice with this socket as source has finished.
+ * The data field holds the bytes moved in that direction, clamped
+ * to what fits, getsockopt(SO_SPLICE) returns the full count.
+ */
+/*ARGSUSED*/
+int
+filt_sosplice(struct knote *kn, long hint)
+{
+	struct socket *so = (struct socket *)kn->kn_fp->f_data;
+
+	kn->kn_data = so->so_splicelen > INT_MAX ? INT_MAX :
+	    so->so_splicelen;
+	if ((so->so_spliceflags & SOSP_DONE) == 0)
+		return (0);
+	kn->kn_flags |= EV_EOF;
+	kn->kn_fflags = so->so_error;
+	return (1);
+}
+#endif /* SOCKET_SPLICE */
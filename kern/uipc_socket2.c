@@ -151,7 +151,7 @@ sonewconn(struct socket *head, int connstatus)
 
 	splsoftassert(IPL_SOFTNET);
 
-	if (mclpools[0].pr_nout > mclpools[0].pr_hardlimit * 95 / 100)
+	if (pool_inuse(&mclpools[0]) > mclpools[0].pr_hardlimit * 95 / 100)
 		return ((struct socket *)0);
 	if (head->so_qlen + head->so_q0len > head->so_qlimit * 3)
 		return ((struct socket *)0);
@@ -409,12 +409,16 @@ int
 sbchecklowmem(void)
 {
 	static int sblowmem;
+	u_int mclinuse, mbinuse;
 
-	if (mclpools[0].pr_nout < mclpools[0].pr_hardlimit * 60 / 100 ||
-	    mbpool.pr_nout < mbpool.pr_hardlimit * 60 / 100)
+	/* items parked in the pool caches are free memory */
+	mclinuse = pool_inuse(&mclpools[0]);
+	mbinuse = pool_inuse(&mbpool);
+	if (mclinuse < mclpools[0].pr_hardlimit * 60 / 100 ||
+	    mbinuse < mbpool.pr_hardlimit * 60 / 100)
 		sblowmem = 0;
-	if (mclpools[0].pr_nout > mclpools[0].pr_hardlimit * 80 / 100 ||
-	    mbpool.pr_nout > mbpool.pr_hardlimit * 80 / 100)
+	if (mclinuse > mclpools[0].pr_hardlimit * 80 / 100 ||
+	    mbinuse > mbpool.pr_hardlimit * 80 / 100)
 		sblowmem = 1;
 	return (sblowmem);
 }
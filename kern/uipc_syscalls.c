@@ -52,8 +52,13 @@
 #endif
 
 #include <sys/mount.h>
+#include <sys/vnode.h>
+#include <sys/workq.h>
 #include <sys/syscallargs.h>
 
+#include <uvm/uvm_extern.h>
+#include <uvm/uvm_loan.h>
+
 #include <net/route.h>
 
 /*
@@ -61,6 +66,10 @@
  */
 extern	struct fileops socketops;
 
+int	sendfile_loadpages(struct vnode *, off_t, size_t, struct mbuf **);
+void	sendfile_free(caddr_t, u_int, void *);
+void	sendfile_release(void *, void *);
+
 int
 sys_socket(struct proc *p, void *v, register_t *retval)
 {
@@ -544,6 +553,242 @@ bad:
 	return (error);
 }
 
+/*
+ * File to socket transfer without copying the data.  The file pages
+ * are loaned from the vnode object, entered read-only into kernel
+ * virtual memory and attached to the mbufs as external storage, so the
+ * socket layer and drivers see the page cache itself.  The loan keeps
+ * the pages resident until the last mbuf referencing them is freed.
+ * The mappings live in a submap of their own so that data parked in
+ * socket buffers cannot eat up kernel_map; a sender that finds it full
+ * sleeps interruptibly until some of it is released.
+ */
+#define SENDFILE_MAPSIZE	(64 * MAXPHYS)
+
+struct vm_map *sendfile_map;
+int sendfile_mapwant;
+
+struct sendfile_loan {
+	struct workq_task	 sl_wqt;
+	vaddr_t			 sl_kva;
+	vsize_t			 sl_size;
+	int			 sl_npages;
+	struct vm_page		*sl_pages[MAXPHYS / PAGE_SIZE + 1];
+};
+
+void
+sendfile_init(void)
+{
+	vaddr_t minaddr, maxaddr;
+
+	minaddr = vm_map_min(kernel_map);
+	sendfile_map = uvm_km_suballoc(kernel_map, &minaddr, &maxaddr,
+	    SENDFILE_MAPSIZE, 0, FALSE, NULL);
+}
+
+int
+sys_sendfile(struct proc *p, void *v, register_t *retval)
+{
+	struct sys_sendfile_args /* {
+		syscallarg(int) fd;
+		syscallarg(int) s;
+		syscallarg(off_t) offset;
+		syscallarg(size_t) nbytes;
+		syscallarg(off_t *) sbytes;
+		syscallarg(int) flags;
+	} */ *uap = v;
+	struct file *fp, *sfp = NULL;
+	struct vnode *vp;
+	struct socket *so;
+	struct vattr va;
+	struct mbuf *m;
+	off_t off, sbytes = 0;
+	size_t len, resid;
+	int error;
+
+	if (SCARG(uap, flags) != 0)
+		return (EINVAL);
+	if ((off = SCARG(uap, offset)) < 0)
+		return (EINVAL);
+
+	if ((error = getvnode(p->p_fd, SCARG(uap, fd), &fp)) != 0)
+		return (error);
+	vp = (struct vnode *)fp->f_data;
+	if (vp->v_type != VREG || (fp->f_flag & FREAD) == 0) {
+		error = EINVAL;
+		goto out;
+	}
+	if ((error = getsock(p->p_fd, SCARG(uap, s), &sfp)) != 0) {
+		sfp = NULL;
+		goto out;
+	}
+	so = sfp->f_data;
+	if (so->so_type != SOCK_STREAM) {
+		error = EINVAL;
+		goto out;
+	}
+
+	if ((error = VOP_GETATTR(vp, &va, p->p_ucred, p)) != 0)
+		goto out;
+	if (off >= va.va_size)
+		goto done;
+	resid = va.va_size - off;
+	if (SCARG(uap, nbytes) != 0 && SCARG(uap, nbytes) < resid)
+		resid = SCARG(uap, nbytes);
+
+	while (resid > 0) {
+		/*
+		 * A prepackaged chain is sent atomically, so a chunk must
+		 * never exceed the send buffer.
+		 */
+		len = resid;
+		if (len > MAXPHYS)
+			len = MAXPHYS;
+		if (len > so->so_snd.sb_hiwat)
+			len = so->so_snd.sb_hiwat;
+		if (len < resid && len > PAGE_SIZE)
+			len -= (off + len) & PAGE_MASK;
+
+		if ((error = sendfile_loadpages(vp, off, len, &m)) != 0)
+			break;
+		error = sosend(so, NULL, NULL, m, NULL, 0);
+		if (error)
+			break;
+
+		off += len;
+		sbytes += len;
+		resid -= len;
+		fp->f_rxfer++;
+		fp->f_rbytes += len;
+		sfp->f_wxfer++;
+		sfp->f_wbytes += len;
+	}
+	if (error) {
+		if (sbytes != 0 && (error == ERESTART ||
+		    error == EINTR || error == EWOULDBLOCK))
+			error = 0;
+		if (error == EPIPE)
+			ptsignal(p, SIGPIPE, STHREAD);
+	}
+
+done:
+	if (SCARG(uap, sbytes) != NULL) {
+		int cerror;
+
+		cerror = copyout(&sbytes, SCARG(uap, sbytes), sizeof(sbytes));
+		if (error == 0)
+			error = cerror;
+	}
+out:
+	if (sfp != NULL)
+		FRELE(sfp);
+	FRELE(fp);
+	return (error);
+}
+
+/*
+ * Loan len bytes of the file at off and wrap them in a single mbuf.
+ */
+int
+sendfile_loadpages(struct vnode *vp, off_t off, size_t len,
+    struct mbuf **mp)
+{
+	struct sendfile_loan *sl;
+	struct uvm_object *uobj;
+	struct mbuf *m;
+	vaddr_t va;
+	voff_t foff;
+	vsize_t size;
+	int i, error;
+
+	foff = trunc_page(off);
+	size = round_page(off + len) - foff;
+
+	sl = malloc(sizeof(*sl), M_TEMP, M_WAITOK);
+	sl->sl_npages = atop(size);
+	sl->sl_size = size;
+
+	while ((sl->sl_kva = uvm_km_valloc(sendfile_map, size)) == 0) {
+		sendfile_mapwant = 1;
+		error = tsleep(&sendfile_map, PSOCK | PCATCH, "sfmap", 0);
+		if (error)
+			goto bad;
+	}
+
+	/*
+	 * Map the file temporarily so that uvm_loan() can fault the
+	 * pages in and take its reference on them.
+	 */
+	if ((uobj = uvn_attach(vp, VM_PROT_READ)) == NULL) {
+		error = ENOMEM;
+		goto badkva;
+	}
+	va = vm_map_min(kernel_map);
+	error = uvm_map(kernel_map, &va, size, uobj, foff, 0,
+	    UVM_MAPFLAG(UVM_PROT_READ, UVM_PROT_READ, UVM_INH_NONE,
+	    UVM_ADV_SEQUENTIAL, 0));
+	if (error) {
+		uobj->pgops->pgo_detach(uobj);
+		goto badkva;
+	}
+	error = uvm_loan(kernel_map, va, size, (void **)sl->sl_pages,
+	    UVM_LOAN_TOPAGE);
+	uvm_unmap(kernel_map, va, va + size);
+	if (error)
+		goto badkva;
+
+	for (i = 0; i < sl->sl_npages; i++)
+		pmap_kenter_pa(sl->sl_kva + ptoa(i),
+		    VM_PAGE_TO_PHYS(sl->sl_pages[i]), VM_PROT_READ);
+	pmap_update(pmap_kernel());
+
+	MGETHDR(m, M_WAIT, MT_DATA);
+	MEXTADD(m, sl->sl_kva, size, 0, sendfile_free, sl);
+	m->m_data += off - foff;
+	m->m_len = m->m_pkthdr.len = len;
+	m->m_pkthdr.rcvif = NULL;
+	*mp = m;
+	return (0);
+
+badkva:
+	uvm_km_free(sendfile_map, sl->sl_kva, size);
+	if (sendfile_mapwant) {
+		sendfile_mapwant = 0;
+		wakeup(&sendfile_map);
+	}
+bad:
+	free(sl, M_TEMP);
+	return (error);
+}
+
+/*
+ * The last reference to the mbuf storage may go away in interrupt
+ * context, so return the pages from the system workq.
+ */
+void
+sendfile_free(caddr_t buf, u_int size, void *arg)
+{
+	struct sendfile_loan *sl = arg;
+
+	workq_queue_task(NULL, &sl->sl_wqt, 0, sendfile_release, sl, NULL);
+}
+
+void
+sendfile_release(void *arg1, void *arg2)
+{
+	struct sendfile_loan *sl = arg1;
+
+	pmap_kremove(sl->sl_kva, sl->sl_size);
+	pmap_update(pmap_kernel());
+	uvm_km_free(sendfile_map, sl->sl_kva, sl->sl_size);
+	uvm_unloanpage(sl->sl_pages, sl->sl_npages);
+	free(sl, M_TEMP);
+	if (sendfile_mapwant) {
+		sendfile_mapwant = 0;
+		wakeup(&sendfile_map);
+	}
+}
+
 int
 sys_recvfrom(struct proc *p, void *v, register_t *retval)
 {
@@ -63,11 +63,23 @@
 
 /*
  * Definitions for the buffer free lists.
+ *
+ * Clean buffers are managed with 2Q: a block read for the first time
+ * goes on BQ_CLEAN, and only a block that is read again shortly after
+ * being evicted from there goes on BQ_HOT.  BQ_CLEAN is limited to
+ * BQ_CLEANPCT percent of the cache as long as BQ_HOT has buffers, so
+ * a large sequential scan only cycles through BQ_CLEAN and leaves the
+ * hot blocks alone.  The "shortly after" is tracked by ghosts: the
+ * identity of recently evicted BQ_CLEAN buffers, without their data.
  */
-#define	BQUEUES		2		/* number of free buffer queues */
+#define	BQUEUES		3		/* number of free buffer queues */
 
 #define	BQ_DIRTY	0		/* LRU queue with dirty buffers */
 #define	BQ_CLEAN	1		/* LRU queue with clean buffers */
+#define	BQ_HOT		2		/* LRU queue with reused clean buffers */
+
+#define	BQ_CLEANPCT	25		/* BQ_CLEAN share when BQ_HOT is used */
+#define	BQ_GHOSTPCT	50		/* pages remembered by ghosts */
 
 TAILQ_HEAD(bqueues, buf) bufqueues[BQUEUES];
 int needbuffer;
@@ -89,6 +101,51 @@ void buf_put(struct buf *);
 struct buf *bio_doread(struct vnode *, daddr64_t, int, int);
 struct buf *buf_get(struct vnode *, daddr64_t, size_t);
 void bread_cluster_callback(struct buf *);
+int bread_cluster_ra(struct vnode *, daddr64_t, daddr64_t, int);
+
+/*
+ * Read-ahead window of a sequential stream, in bytes.
+ */
+#define	BREAD_RAMIN	MAXPHYS
+#define	BREAD_RAMAX	(16 * MAXPHYS)
+
+/*
+ * Ghosts of buffers evicted from BQ_CLEAN, hashed by vnode and block.
+ * The vnode's v_id is kept as well, so a recycled vnode does not
+ * inherit the history of its previous identity.
+ */
+struct bufghost {
+	LIST_ENTRY(bufghost)	bg_hash;
+	TAILQ_ENTRY(bufghost)	bg_list;
+	struct vnode		*bg_vp;
+	u_int			bg_vid;
+	daddr64_t		bg_blkno;
+	long			bg_npages;
+};
+
+LIST_HEAD(bufghosthead, bufghost) *bufghosthash;
+u_long bufghostmask;
+TAILQ_HEAD(, bufghost) bufghostq = TAILQ_HEAD_INITIALIZER(bufghostq);
+long bufghostpages;
+struct pool bufghostpool;
+
+#define	BUFGHOST_HASH(vp, blkno)					\
+	(&bufghosthash[(((u_long)(vp) >> 8) ^ (u_long)(blkno)) & bufghostmask])
+
+struct buf *bufcache_getcleanbuf(void);
+void bufcache_evict(struct buf *);
+void bufcache_ghost_add(struct buf *);
+int bufcache_ghost_hit(struct vnode *, daddr64_t);
+struct buf *bufcache_getdirtybuf(void);
+struct mount *buf_mount(struct buf *);
+void buf_mntdirty(struct buf *);
+void buf_mntclean(struct buf *);
+
+/*
+ * A writer on a mount point holding too many dirty pages sleeps for up
+ * to this many ticks in bdwrite().
+ */
+#define BUF_THROTTLE_TICKS	(hz / 10)
 
 /*
  * We keep a few counters to monitor the utilization of the buffer cache
@@ -97,10 +154,11 @@ void bread_cluster_callback(struct buf *);
  *  numdirtypages - number of pages on BQ_DIRTY queue.
  *  lodirtypages  - low water mark for buffer cleaning daemon.
  *  hidirtypages  - high water mark for buffer cleaning daemon.
- *  numcleanpages - number of pages on BQ_CLEAN queue.
+ *  numcleanpages - number of pages on BQ_CLEAN and BQ_HOT queues.
  *		    Used to track the need to speedup the cleaner and 
  *		    as a reserve for special processes like syncer.
- *  maxcleanpages - the highest page count on BQ_CLEAN.
+ *  numhotpages   - number of those pages on BQ_HOT.
+ *  maxcleanpages - the highest page count on BQ_CLEAN and BQ_HOT.
  */
 
 struct bcachestats bcstats;
@@ -121,6 +179,8 @@ vsize_t bufkvm;
 
 struct proc *cleanerproc;
 int bd_req;			/* Sleep point for cleaner daemon. */
+struct mount *bd_mount;		/* Mount the cleaner should flush first. */
+long bd_mntpages;		/* Pages charged to all mount points. */
 
 void
 bremfree(struct buf *bp)
@@ -145,9 +205,10 @@ bremfree(struct buf *bp)
 	}
 	if (!ISSET(bp->b_flags, B_DELWRI)) {
 		bcstats.numcleanpages -= atop(bp->b_bufsize);
-	} else {
+		if (ISSET(bp->b_flags, B_HOT))
+			bcstats.numhotpages -= atop(bp->b_bufsize);
+	} else
 		bcstats.numdirtypages -= atop(bp->b_bufsize);
-	}
 	TAILQ_REMOVE(dp, bp, b_freelist);
 	bcstats.freebufs--;
 }
@@ -174,6 +235,8 @@ buf_put(struct buf *bp)
 
 	LIST_REMOVE(bp, b_list);
 	bcstats.numbufs--;
+	if (ISSET(bp->b_flags, B_READAHEAD))
+		bcstats.readaheadwaste++;
 	if (backoffpages) {
 		backoffpages -= atop(bp->b_bufsize);
 		if (backoffpages < 0)
@@ -246,6 +309,12 @@ bufinit(void)
 	for (dp = bufqueues; dp < &bufqueues[BQUEUES]; dp++)
 		TAILQ_INIT(dp);
 
+	pool_init(&bufghostpool, sizeof(struct bufghost), 0, 0, 0,
+	    "bufghostpl", NULL);
+	pool_setipl(&bufghostpool, IPL_BIO);
+	bufghosthash = hashinit(MAX(bufpages / 8, 64), M_VNODE, M_WAITOK,
+	    &bufghostmask);
+
 	/*
 	 * hmm - bufkvm is an argument because it's static, while
 	 * bufpages is global because it can change while running.
@@ -298,16 +367,9 @@ bufadjust(int newbufpages)
 	 * free them up to get back down. this may possibly consume
 	 * all our clean pages...
 	 */
-	while ((bp = TAILQ_FIRST(&bufqueues[BQ_CLEAN])) &&
-	    (bcstats.numbufpages > bufpages)) {
-		bremfree(bp);
-		if (bp->b_vp) {
-			RB_REMOVE(buf_rb_bufs,
-			    &bp->b_vp->v_bufs_tree, bp);
-			brelvp(bp);
-		}
-		buf_put(bp);
-	}
+	while ((bp = bufcache_getcleanbuf()) &&
+	    (bcstats.numbufpages > bufpages))
+		bufcache_evict(bp);
 
 	/*
 	 * Wake up cleaner if we're getting low on pages. We might
@@ -486,32 +548,105 @@ bread_cluster_callback(struct buf *bp)
 	}
 }
 
+/*
+ * Read blkno and keep a read-ahead window in flight for the stream it
+ * belongs to.  A read that continues a stream opens its window, and
+ * the window doubles every time half of it has been consumed, up to
+ * BREAD_RAMAX.  Any other read starts a new stream without read-ahead
+ * in the least recently used slot, so random access never reads
+ * ahead while other sequential readers of the file keep going.
+ */
 int
-bread_cluster(struct vnode *vp, daddr64_t blkno, int size, struct buf **rbpp)
+bread_cluster(struct vnode *vp, struct cluster_info *ci, daddr64_t blkno,
+    int size, struct buf **rbpp)
 {
-	struct buf *bp, **xbpp;
-	int howmany, maxra, i, inc;
-	daddr64_t sblkno;
+	struct cluster_stream *cs, tcs;
+	daddr64_t raend;
+	int i, n;
 
 	*rbpp = bio_doread(vp, blkno, size, 0);
 
-	if (size != round_page(size))
+	if (size != round_page(size) || size > BREAD_RAMIN)
 		goto out;
 
-	if (VOP_BMAP(vp, blkno + 1, NULL, &sblkno, &maxra))
-		goto out;
+	for (i = 0; i < CI_NSTREAMS; i++) {
+		cs = &ci->ci_rs[i];
+		if (blkno == cs->cs_lastr || blkno == cs->cs_lastr + 1)
+			break;
+	}
+	if (i == CI_NSTREAMS) {
+		i = CI_NSTREAMS - 1;
+		cs = &ci->ci_rs[i];
+		cs->cs_ralen = 0;
+		cs->cs_ranext = blkno + 1;
+	} else if (blkno == cs->cs_lastr + 1 && cs->cs_ralen == 0) {
+		cs->cs_ralen = BREAD_RAMIN / size;
+		cs->cs_ranext = blkno + 1;
+	}
+	cs->cs_lastr = blkno;
+
+	/* Move the stream to the front. */
+	tcs = *cs;
+	for (; i > 0; i--)
+		ci->ci_rs[i] = ci->ci_rs[i - 1];
+	ci->ci_rs[0] = tcs;
+	cs = &ci->ci_rs[0];
 
-	maxra++; 
-	if (sblkno == -1 || maxra < 2)
+	if (cs->cs_ralen == 0)
 		goto out;
+	if (cs->cs_ranext < blkno + 1)
+		cs->cs_ranext = blkno + 1;
+	if (cs->cs_ranext > blkno + 1 + cs->cs_ralen / 2)
+		goto out;
+
+	/* Refill, widening the window unless this is the first fill. */
+	if (cs->cs_ranext != blkno + 1 && cs->cs_ralen < BREAD_RAMAX / size)
+		cs->cs_ralen *= 2;
+	raend = blkno + 1 + cs->cs_ralen;
+	while (cs->cs_ranext < raend) {
+		n = bread_cluster_ra(vp, cs->cs_ranext, raend - cs->cs_ranext,
+		    size);
+		if (n == 0)
+			break;
+		cs->cs_ranext += n;
+	}
+
+out:
+	return (biowait(*rbpp));
+}
+
+/*
+ * Start one clustered asynchronous read of up to n blocks at blkno,
+ * limited by MAXPHYS and the contiguous run on disk.  Returns the
+ * number of blocks the window advanced by, 0 if nothing can be read.
+ */
+int
+bread_cluster_ra(struct vnode *vp, daddr64_t blkno, daddr64_t n, int size)
+{
+	struct buf *bp, **xbpp;
+	int howmany, maxra, i, inc;
+	daddr64_t sblkno;
+
+	/* Already cached or in flight, step over it. */
+	if (incore(vp, blkno))
+		return (1);
+
+	if (VOP_BMAP(vp, blkno, NULL, &sblkno, &maxra))
+		return (0);
+
+	maxra++;
+	if (sblkno == -1)
+		return (0);
 
 	howmany = MAXPHYS / size;
 	if (howmany > maxra)
 		howmany = maxra;
+	if (howmany > n)
+		howmany = n;
 
 	xbpp = malloc((howmany + 1) * sizeof(struct buf *), M_TEMP, M_NOWAIT);
 	if (xbpp == NULL)
-		goto out;
+		return (0);
 
 	for (i = howmany - 1; i >= 0; i--) {
 		size_t sz;
@@ -522,14 +657,14 @@ bread_cluster(struct vnode *vp, daddr64_t blkno, int size, struct buf **rbpp)
 		 */
 		sz = i == 0 ? howmany * size : 0;
 
-		xbpp[i] = buf_get(vp, blkno + i + 1, sz);
+		xbpp[i] = buf_get(vp, blkno + i, sz);
 		if (xbpp[i] == NULL) {
 			for (++i; i < howmany; i++) {
 				SET(xbpp[i]->b_flags, B_INVAL);
 				brelse(xbpp[i]);
 			}
 			free(xbpp, M_TEMP);
-			goto out;
+			return (0);
 		}
 	}
 
@@ -542,7 +677,7 @@ bread_cluster(struct vnode *vp, daddr64_t blkno, int size, struct buf **rbpp)
 	for (i = 1; i < howmany; i++) {
 		bcstats.pendingreads++;
 		bcstats.numreads++;
-		SET(xbpp[i]->b_flags, B_READ | B_ASYNC);
+		SET(xbpp[i]->b_flags, B_READ | B_ASYNC | B_READAHEAD);
 		xbpp[i]->b_blkno = sblkno + (i * inc);
 		xbpp[i]->b_bufsize = xbpp[i]->b_bcount = size;
 		xbpp[i]->b_data = NULL;
@@ -550,22 +685,22 @@ bread_cluster(struct vnode *vp, daddr64_t blkno, int size, struct buf **rbpp)
 		xbpp[i]->b_poffs = bp->b_poffs + (i * size);
 	}
 
-	KASSERT(bp->b_lblkno == blkno + 1);
+	KASSERT(bp->b_lblkno == blkno);
 	KASSERT(bp->b_vp == vp);
 
 	bp->b_blkno = sblkno;
-	SET(bp->b_flags, B_READ | B_ASYNC | B_CALL);
+	SET(bp->b_flags, B_READ | B_ASYNC | B_CALL | B_READAHEAD);
 
 	bp->b_saveaddr = (void *)xbpp;
 	bp->b_iodone = bread_cluster_callback;
 
 	bcstats.pendingreads++;
 	bcstats.numreads++;
+	bcstats.numreadahead += howmany;
 	VOP_STRATEGY(bp);
 	curproc->p_stats->p_ru.ru_inblock++;
 
-out:
-	return (biowait(*rbpp));
+	return (howmany);
 }
 
 /*
@@ -706,6 +841,122 @@ bawrite(struct buf *bp)
 	VOP_BWRITE(bp);
 }
 
+/*
+ * Return the mount point a buffer's dirty pages are charged to.
+ */
+struct mount *
+buf_mount(struct buf *bp)
+{
+	struct vnode *vp = bp->b_vp;
+
+	if (vp == NULL)
+		return (NULL);
+	return (vp->v_type == VBLK ? vp->v_specmountpoint : vp->v_mount);
+}
+
+/*
+ * Charge the pages of a buffer going onto BQ_DIRTY to its mount point.
+ * The charge stays until the buffer has been written, i.e. until
+ * biodone(), or its dirty contents are thrown away, so a mount's count
+ * includes the writes still in flight to its device.  The mount and
+ * page count are remembered in the buffer so the same amount is
+ * credited back even if the buffer is resized meanwhile.
+ * Must be called at splbio().
+ */
+void
+buf_mntdirty(struct buf *bp)
+{
+	struct mount *mp;
+
+	splassert(IPL_BIO);
+
+	if (bp->b_dirtymp != NULL || (mp = buf_mount(bp)) == NULL)
+		return;
+	bp->b_dirtymp = mp;
+	bp->b_dirtypages = atop(bp->b_bufsize);
+	mp->mnt_dirtypages += bp->b_dirtypages;
+	bd_mntpages += bp->b_dirtypages;
+}
+
+/*
+ * Must be called at splbio()
+ */
+void
+buf_mntclean(struct buf *bp)
+{
+	struct mount *mp = bp->b_dirtymp;
+
+	splassert(IPL_BIO);
+
+	if (mp == NULL)
+		return;
+	bp->b_dirtymp = NULL;
+	mp->mnt_dirtypages -= bp->b_dirtypages;
+	bd_mntpages -= bp->b_dirtypages;
+#ifdef DIAGNOSTIC
+	if (mp->mnt_dirtypages < 0 || bd_mntpages < 0)
+		panic("buf_mntclean: negative dirty pages");
+#endif
+	/* The mount may go away once its last dirty buffer is gone. */
+	if (mp == bd_mount && mp->mnt_dirtypages == 0) {
+		bd_mount = NULL;
+		wakeup(&bd_mount);
+	}
+}
+
+/*
+ * Does this mount point hold more than its share of the dirty pages?
+ * Nobody is held back below lodirtypages; above it, a mount owning
+ * more than half of the pages charged to all mounts, queued or being
+ * written, is considered the offender.
+ */
+int
+buf_toodirty(struct mount *mp)
+{
+	return (bcstats.numdirtypages > lodirtypages &&
+	    mp->mnt_dirtypages * 2 > bd_mntpages);
+}
+
+/*
+ * Slow down a process dirtying buffers on a mount point that holds too
+ * many dirty pages, so that writers on other mounts are not starved of
+ * buffers.  If no other mount has dirty pages there is nobody to
+ * protect and the writer is left alone.  The delay grows from one tick
+ * at lodirtypages to BUF_THROTTLE_TICKS at hidirtypages.  The cleaner
+ * is pointed at the offending mount and wakes us early once the mount
+ * no longer holds more than its share.  Called from vn_write() after
+ * the vnode is unlocked, never from the buffer code, so the writer
+ * does not sleep with vnode locks held or in a softdep sequence.
+ */
+void
+buf_throttle(struct mount *mp)
+{
+	struct proc *p = curproc;
+	long over, range;
+	int s, ticks;
+
+	if (mp == NULL || p == NULL || ISSET(p->p_flag, P_SYSTEM))
+		return;
+
+	s = splbio();
+	if (!buf_toodirty(mp) || mp->mnt_dirtypages == bd_mntpages) {
+		splx(s);
+		return;
+	}
+	over = bcstats.numdirtypages - lodirtypages;
+	range = MAX(hidirtypages - lodirtypages, 1);
+	ticks = MIN(over, range) * BUF_THROTTLE_TICKS / range;
+	if (ticks < 1)
+		ticks = 1;
+
+	mp->mnt_throttled++;
+	bcstats.throttled++;
+	bd_mount = mp;
+	wakeup(&bd_req);
+	tsleep(&bd_mount, PRIBIO, "dirtythr", ticks);
+	splx(s);
+}
+
 /*
  * Must be called at splbio()
  */
@@ -777,6 +1028,8 @@ brelse(struct buf *bp)
 		if (ISSET(bp->b_flags, B_DELWRI)) {
 			CLR(bp->b_flags, B_DELWRI);
 		}
+		buf_mntclean(bp);
+		CLR(bp->b_flags, B_HOT);
 
 		if (bp->b_vp) {
 			RB_REMOVE(buf_rb_bufs, &bp->b_vp->v_bufs_tree,
@@ -820,12 +1073,18 @@ brelse(struct buf *bp)
 		 */
 
 		if (!ISSET(bp->b_flags, B_DELWRI)) {
+			buf_mntclean(bp);
 			bcstats.numcleanpages += atop(bp->b_bufsize);
 			if (maxcleanpages < bcstats.numcleanpages)
 				maxcleanpages = bcstats.numcleanpages;
-			bufq = &bufqueues[BQ_CLEAN];
+			if (ISSET(bp->b_flags, B_HOT)) {
+				bcstats.numhotpages += atop(bp->b_bufsize);
+				bufq = &bufqueues[BQ_HOT];
+			} else
+				bufq = &bufqueues[BQ_CLEAN];
 		} else {
 			bcstats.numdirtypages += atop(bp->b_bufsize);
+			buf_mntdirty(bp);
 			bufq = &bufqueues[BQ_DIRTY];
 		}
 		if (ISSET(bp->b_flags, B_AGE)) {
@@ -922,6 +1181,10 @@ start:
 
 		if (!ISSET(bp->b_flags, B_INVAL)) {
 			bcstats.cachehits++;
+			if (ISSET(bp->b_flags, B_READAHEAD)) {
+				CLR(bp->b_flags, B_READAHEAD);
+				bcstats.readaheadhits++;
+			}
 			SET(bp->b_flags, B_CACHE);
 			bremfree(bp);
 			buf_acquire(bp);
@@ -990,14 +1253,8 @@ buf_get(struct vnode *vp, daddr64_t blkno, size_t size)
 		 */
 		if (bcstats.numcleanpages > hicleanpages) {
 			while (bcstats.numcleanpages > locleanpages) {
-				bp = TAILQ_FIRST(&bufqueues[BQ_CLEAN]);
-				bremfree(bp);
-				if (bp->b_vp) {
-					RB_REMOVE(buf_rb_bufs,
-					    &bp->b_vp->v_bufs_tree, bp);
-					brelvp(bp);
-				}
-				buf_put(bp);
+				bp = bufcache_getcleanbuf();
+				bufcache_evict(bp);
 			}
 		}
 
@@ -1010,15 +1267,8 @@ buf_get(struct vnode *vp, daddr64_t blkno, size_t size)
 		    || backoffpages) {
 			int freemax = 5;
 			int i = freemax;
-			while ((bp = TAILQ_FIRST(&bufqueues[BQ_CLEAN])) && i--) {
-				bremfree(bp);
-				if (bp->b_vp) {
-					RB_REMOVE(buf_rb_bufs,
-					    &bp->b_vp->v_bufs_tree, bp);
-					brelvp(bp);
-				}
-				buf_put(bp);
-			}
+			while ((bp = bufcache_getcleanbuf()) && i--)
+				bufcache_evict(bp);
 			if (freemax == i &&
 			    (bcstats.numbufpages + npages > bufpages)) {
 				needbuffer++;
@@ -1063,6 +1313,9 @@ buf_get(struct vnode *vp, daddr64_t blkno, size_t size)
 		bgetvp(vp, bp);
 		if (RB_INSERT(buf_rb_bufs, &vp->v_bufs_tree, bp))
 			panic("buf_get: dup lblk vp %p bp %p", vp, bp);
+		bcstats.cachemisses++;
+		if (bufcache_ghost_hit(vp, blkno))
+			SET(bp->b_flags, B_HOT);
 	} else {
 		bp->b_vnbufs.le_next = NOLIST;
 		SET(bp->b_flags, B_INVAL);
@@ -1082,6 +1335,125 @@ buf_get(struct vnode *vp, daddr64_t blkno, size_t size)
 	return (bp);
 }
 
+/*
+ * Return the clean buffer to reuse next, without removing it.
+ * Invalid buffers go first, then BQ_CLEAN while it holds more than
+ * its share of the cache, then BQ_HOT.
+ */
+struct buf *
+bufcache_getcleanbuf(void)
+{
+	struct buf *bp;
+	int64_t coldpages;
+
+	splassert(IPL_BIO);
+
+	bp = TAILQ_FIRST(&bufqueues[BQ_CLEAN]);
+	if (bp != NULL && ISSET(bp->b_flags, B_INVAL))
+		return (bp);
+	coldpages = bcstats.numcleanpages - bcstats.numhotpages;
+	if (bp != NULL && coldpages > bufpages * BQ_CLEANPCT / 100)
+		return (bp);
+	if (!TAILQ_EMPTY(&bufqueues[BQ_HOT]))
+		return (TAILQ_FIRST(&bufqueues[BQ_HOT]));
+	return (bp);
+}
+
+/*
+ * Take a clean buffer off its free list and free it, leaving a ghost
+ * behind if it was only used once.
+ */
+void
+bufcache_evict(struct buf *bp)
+{
+	splassert(IPL_BIO);
+
+	bremfree(bp);
+	if (bp->b_vp) {
+		if (!ISSET(bp->b_flags, B_HOT | B_INVAL))
+			bufcache_ghost_add(bp);
+		RB_REMOVE(buf_rb_bufs, &bp->b_vp->v_bufs_tree, bp);
+		brelvp(bp);
+	}
+	buf_put(bp);
+}
+
+void
+bufcache_ghost_add(struct buf *bp)
+{
+	struct bufghost *bg;
+
+	splassert(IPL_BIO);
+
+	bg = pool_get(&bufghostpool, PR_NOWAIT);
+	if (bg == NULL)
+		return;
+	bg->bg_vp = bp->b_vp;
+	bg->bg_vid = bp->b_vp->v_id;
+	bg->bg_blkno = bp->b_lblkno;
+	bg->bg_npages = atop(bp->b_bufsize);
+	LIST_INSERT_HEAD(BUFGHOST_HASH(bg->bg_vp, bg->bg_blkno), bg, bg_hash);
+	TAILQ_INSERT_TAIL(&bufghostq, bg, bg_list);
+	bufghostpages += bg->bg_npages;
+
+	while (bufghostpages > bufpages * BQ_GHOSTPCT / 100 &&
+	    (bg = TAILQ_FIRST(&bufghostq)) != NULL) {
+		TAILQ_REMOVE(&bufghostq, bg, bg_list);
+		LIST_REMOVE(bg, bg_hash);
+		bufghostpages -= bg->bg_npages;
+		pool_put(&bufghostpool, bg);
+	}
+}
+
+/*
+ * A block is being read into the cache again.  If it was evicted
+ * from BQ_CLEAN recently, consume the ghost and report a hit.
+ */
+int
+bufcache_ghost_hit(struct vnode *vp, daddr64_t blkno)
+{
+	struct bufghost *bg;
+	int hit;
+
+	splassert(IPL_BIO);
+
+	LIST_FOREACH(bg, BUFGHOST_HASH(vp, blkno), bg_hash)
+		if (bg->bg_vp == vp && bg->bg_blkno == blkno)
+			break;
+	if (bg == NULL)
+		return (0);
+
+	TAILQ_REMOVE(&bufghostq, bg, bg_list);
+	LIST_REMOVE(bg, bg_hash);
+	bufghostpages -= bg->bg_npages;
+	hit = (bg->bg_vid == vp->v_id);
+	pool_put(&bufghostpool, bg);
+	if (hit)
+		bcstats.ghosthits++;
+	return (hit);
+}
+
+/*
+ * Pick the next buffer for the cleaner.  Buffers of the mount point
+ * being throttled go first; as that mount holds more than half of the
+ * dirty pages, the scan for one of its buffers is short.
+ * Must be called at splbio().
+ */
+struct buf *
+bufcache_getdirtybuf(void)
+{
+	struct buf *bp;
+
+	splassert(IPL_BIO);
+
+	if (bd_mount != NULL) {
+		TAILQ_FOREACH(bp, &bufqueues[BQ_DIRTY], b_freelist)
+			if (bp->b_dirtymp == bd_mount)
+				return (bp);
+	}
+	return (TAILQ_FIRST(&bufqueues[BQ_DIRTY]));
+}
+
 /*
  * Buffer cleaning daemon.
  */
@@ -1096,12 +1468,17 @@ buf_daemon(struct proc *p)
 
 	s = splbio();
 	for (;;) {
-		if (bcstats.numdirtypages < hidirtypages)
+		/* Release throttled writers when their mount is caught up. */
+		if (bd_mount != NULL && !buf_toodirty(bd_mount))
+			bd_mount = NULL;
+		if (bd_mount == NULL)
+			wakeup(&bd_mount);
+		if (bcstats.numdirtypages < hidirtypages && bd_mount == NULL)
 			tsleep(&bd_req, PRIBIO - 7, "cleaner", 0);
 
 		getmicrouptime(&starttime);
 
-		while ((bp = TAILQ_FIRST(&bufqueues[BQ_DIRTY]))) {
+		while ((bp = bufcache_getdirtybuf())) {
 			struct timeval tv;
 
 			if (bcstats.numdirtypages < lodirtypages)
@@ -1126,6 +1503,7 @@ buf_daemon(struct proc *p)
 				SET(bp->b_flags, B_DEFERRED);
 				s = splbio();
 				bcstats.numdirtypages += atop(bp->b_bufsize);
+				buf_mntdirty(bp);
 				binstailfree(bp, &bufqueues[BQ_DIRTY]);
 				bcstats.freebufs++;
 				buf_release(bp);
@@ -1208,6 +1586,7 @@ biodone(struct buf *bp)
 
 	if (!ISSET(bp->b_flags, B_READ)) {
 		CLR(bp->b_flags, B_WRITEINPROG);
+		buf_mntclean(bp);
 		vwakeup(bp->b_vp);
 	}
 	if (bcstats.numbufs &&
@@ -1245,5 +1624,13 @@ bcstats_print(int (*pr)(const char *, ...))
 	    bcstats.numbufpages, bcstats.numfreepages, bcstats.numdirtypages);
 	(*pr)("pendingreads %lld, pendingwrites %lld\n",
 	    bcstats.pendingreads, bcstats.pendingwrites);
+	(*pr)("cachehits %lld, cachemisses %lld, ghosthits %lld, "
+	    "hotpages %lld\n", bcstats.cachehits, bcstats.cachemisses,
+	    bcstats.ghosthits, bcstats.numhotpages);
+	(*pr)("readahead %lld, readaheadhits %lld, readaheadwaste %lld\n",
+	    bcstats.numreadahead, bcstats.readaheadhits,
+	    bcstats.readaheadwaste);
+	(*pr)("throttled %lld, writebehind %lld\n",
+	    bcstats.throttled, bcstats.writebehind);
 }
 #endif
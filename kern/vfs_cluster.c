@@ -55,7 +55,8 @@ struct cluster_save *cluster_collectbufs(struct vnode *, struct cluster_info *,
  *	1. Write is not sequential (write asynchronously)
  *	Write is sequential:
  *	2.	beginning of cluster - begin cluster
- *	3.	middle of a cluster - add to cluster
+ *	3.	middle of a cluster - add to cluster, or write it
+ *		behind if the mount point holds too many dirty pages
  *	4.	end of a cluster - asynchronously write cluster
  */
 void
@@ -152,6 +153,17 @@ cluster_write(struct buf *bp, struct cluster_info *ci, u_quad_t filesize)
 		    ci->ci_clen + 1, lbn);
 		ci->ci_clen = 0;
 		ci->ci_cstart = lbn + 1;
+	} else if (buf_toodirty(vp->v_mount)) {
+		/*
+		 * In the middle of a cluster, but the mount point
+		 * holds too many dirty pages.  Push what we have of
+		 * the cluster now instead of waiting for it to fill.
+		 */
+		cluster_wbuild(vp, bp, bp->b_bcount, ci->ci_cstart,
+		    lbn - ci->ci_cstart + 1, lbn);
+		ci->ci_clen -= lbn + 1 - ci->ci_cstart;
+		ci->ci_cstart = lbn + 1;
+		bcstats.writebehind++;
 	} else
 		/*
 		 * In the middle of a cluster, so just delay the
@@ -1285,14 +1285,81 @@ vfs_sysctl(int *name, u_int namelen, void *oldp, size_t *oldlenp, void *newp,
 
 		free(tmpvfsp, M_TEMP);
 		return (ret);
-	case VFS_BCACHESTAT:	/* buffer cache statistics */
-		ret = sysctl_rdstruct(oldp, oldlenp, newp, &bcstats,
-		    sizeof(struct bcachestats));
+	case VFS_BCACHESTAT: {	/* buffer cache statistics */
+		size_t len = sizeof(struct bcachestats);
+
+		/*
+		 * Counters are only ever appended, so give binaries built
+		 * against a smaller struct bcachestats the part they know.
+		 */
+		if (oldp != NULL && *oldlenp < len)
+			len = *oldlenp - *oldlenp % sizeof(int64_t);
+		ret = sysctl_rdstruct(oldp, oldlenp, newp, &bcstats, len);
 		return(ret);
 	}
+	case VFS_DIRTYSTAT:	/* dirty pages per mount point */
+		if (newp)
+			return (EPERM);
+		return (sysctl_dirtystat(oldp, oldlenp, p));
+	}
 	return (EOPNOTSUPP);
 }
 
+#define KINFO_MOUNTSLOP	4
+/*
+ * Dump the dirty buffer cache pages of each mount point (via sysctl).
+ */
+int
+sysctl_dirtystat(char *where, size_t *sizep, struct proc *p)
+{
+	struct mntdirtystat md;
+	struct mount *mp, *nmp;
+	char *bp = where, *ewhere;
+	int error, nmounts = 0;
+
+	if (where == NULL) {
+		CIRCLEQ_FOREACH(mp, &mountlist, mnt_list)
+			nmounts++;
+		*sizep = (nmounts + KINFO_MOUNTSLOP) *
+		    sizeof(struct mntdirtystat);
+		return (0);
+	}
+	ewhere = where + *sizep;
+
+	for (mp = CIRCLEQ_FIRST(&mountlist); mp != CIRCLEQ_END(&mountlist);
+	    mp = nmp) {
+		if (vfs_busy(mp, VB_READ|VB_NOWAIT)) {
+			nmp = CIRCLEQ_NEXT(mp, mnt_list);
+			continue;
+		}
+		if (bp + sizeof(struct mntdirtystat) > ewhere) {
+			*sizep = bp - where;
+			vfs_unbusy(mp);
+			return (ENOMEM);
+		}
+		bzero(&md, sizeof(md));
+		/* Don't let non-root see filesystem id (for NFS security) */
+		if (suser(p, 0) == 0)
+			md.md_fsid = mp->mnt_stat.f_fsid;
+		md.md_dirtypages = mp->mnt_dirtypages;
+		md.md_throttled = mp->mnt_throttled;
+		strlcpy(md.md_mntonname, mp->mnt_stat.f_mntonname,
+		    sizeof(md.md_mntonname));
+		if ((error = copyout(&md, bp, sizeof(md))) != 0) {
+			vfs_unbusy(mp);
+			return (error);
+		}
+		bp += sizeof(struct mntdirtystat);
+
+		nmp = CIRCLEQ_NEXT(mp, mnt_list);
+		vfs_unbusy(mp);
+	}
+
+	*sizep = bp - where;
+
+	return (0);
+}
+
 int kinfo_vdebug = 1;
 #define KINFO_VNODESLOP	10
 /*
@@ -311,6 +311,7 @@ vn_write(struct file *fp, off_t *poff, struct uio *uio, struct ucred *cred)
 {
 	struct vnode *vp = (struct vnode *)fp->f_data;
 	struct proc *p = uio->uio_procp;
+	struct mount *mp;
 	int error, ioflag = IO_UNIT;
 	size_t count;
 
@@ -330,6 +331,10 @@ vn_write(struct file *fp, off_t *poff, struct uio *uio, struct ucred *cred)
 	else
 		*poff += count - uio->uio_resid;
 	VOP_UNLOCK(vp, 0, p);
+
+	/* Pace the writer now that it no longer holds the vnode. */
+	mp = vp->v_type == VBLK ? vp->v_specmountpoint : vp->v_mount;
+	buf_throttle(mp);
 	return (error);
 }
 
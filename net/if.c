@@ -90,7 +90,9 @@
 
 #ifdef INET
 #include <netinet/in.h>
+#include <netinet/in_systm.h>
 #include <netinet/in_var.h>
+#include <netinet/ip.h>
 #include <netinet/if_ether.h>
 #include <netinet/igmp.h>
 #ifdef MROUTING
@@ -102,6 +104,7 @@
 #ifndef INET
 #include <netinet/in.h>
 #endif
+#include <netinet6/in6_var.h>
 #include <netinet6/in6_ifattach.h>
 #include <netinet6/nd6.h>
 #include <netinet/ip6.h>
@@ -470,6 +473,11 @@ if_start(struct ifnet *ifp)
 
 	splassert(IPL_NET);
 
+	if (ifp->if_mqstart != NULL) {
+		if_start_txq(ifp, 0);
+		return;
+	}
+
 	if (ifp->if_snd.ifq_len >= min(8, ifp->if_snd.ifq_maxlen) &&
 	    !ISSET(ifp->if_flags, IFF_OACTIVE)) {
 		if (ISSET(ifp->if_xflags, IFXF_TXREADY)) {
@@ -491,17 +499,188 @@ void
 nettxintr(void)
 {
 	struct ifnet *ifp;
+	u_int32_t pending;
+	u_int i;
 	int s;
 
 	s = splnet();
 	while ((ifp = TAILQ_FIRST(&iftxlist)) != NULL) {
 		TAILQ_REMOVE(&iftxlist, ifp, if_txlist);
 		CLR(ifp->if_xflags, IFXF_TXREADY);
-		ifp->if_start(ifp);
+		if (ifp->if_mqstart == NULL) {
+			ifp->if_start(ifp);
+			continue;
+		}
+		pending = ifp->if_txqpending;
+		ifp->if_txqpending = 0;
+		for (i = 0; pending != 0; i++, pending >>= 1)
+			if (pending & 1)
+				ifp->if_mqstart(ifp, i);
 	}
 	splx(s);
 }
 
+/*
+ * Register the transmit queues of an interface with several hardware
+ * transmit rings.  Must be called after the maximum length of if_snd
+ * has been set and before the interface is attached.  Each queue is
+ * started independently through the driver's mqstart routine.
+ */
+int
+if_txq_attach(struct ifnet *ifp, u_int ntxq,
+    void (*mqstart)(struct ifnet *, u_int))
+{
+	u_int i;
+
+	if (ntxq == 0 || ntxq > IF_MAXTXQ)
+		return (EINVAL);
+
+	if (ntxq > 1) {
+		ifp->if_txqs = malloc((ntxq - 1) * sizeof(struct ifaltq),
+		    M_DEVBUF, M_NOWAIT | M_ZERO);
+		if (ifp->if_txqs == NULL)
+			return (ENOMEM);
+		for (i = 0; i < ntxq - 1; i++)
+			IFQ_SET_MAXLEN(&ifp->if_txqs[i],
+			    ifp->if_snd.ifq_maxlen);
+	}
+
+	ifp->if_ntxq = ntxq;
+	ifp->if_txqpending = 0;
+	ifp->if_mqstart = mqstart;
+
+	return (0);
+}
+
+/*
+ * Pick the transmit queue for an outgoing packet from its flow hash,
+ * so that the packets of one flow stay in order on one ring.
+ */
+u_int
+if_txq_select(struct ifnet *ifp, struct mbuf *m)
+{
+	if (ifp->if_ntxq <= 1)
+		return (0);
+#ifdef ALTQ
+	if (ALTQ_IS_ENABLED(&ifp->if_snd))
+		return (0);
+#endif
+	if ((m->m_pkthdr.flowid & M_FLOWID_VALID) == 0)
+		return (0);
+
+	return ((m->m_pkthdr.flowid & M_FLOWID_MASK) % ifp->if_ntxq);
+}
+
+/*
+ * Start a transmit queue of a multiqueue interface.  Like if_start(),
+ * short queues are left to nettxintr() to batch up work.
+ */
+void
+if_start_txq(struct ifnet *ifp, u_int txq)
+{
+	struct ifaltq *ifq = IF_TXQ(ifp, txq);
+
+	splassert(IPL_NET);
+
+	if (ifp->if_mqstart == NULL) {
+		if_start(ifp);
+		return;
+	}
+
+	if (ifq->ifq_len >= min(8, ifq->ifq_maxlen)) {
+		CLR(ifp->if_txqpending, 1 << txq);
+		ifp->if_mqstart(ifp, txq);
+		return;
+	}
+
+	SET(ifp->if_txqpending, 1 << txq);
+	if (!ISSET(ifp->if_xflags, IFXF_TXREADY)) {
+		SET(ifp->if_xflags, IFXF_TXREADY);
+		TAILQ_INSERT_TAIL(&iftxlist, ifp, if_txlist);
+		schednetisr(NETISR_TX);
+	}
+}
+
+/*
+ * Compute a flow hash for a packet that does not carry one yet, from
+ * the addresses and, if present, the TCP or UDP ports.  The headers
+ * are pulled up first so that every packet of a flow hashes the same
+ * no matter how the driver laid it out.  Returns NULL if the mbuf
+ * chain had to be freed.
+ */
+struct mbuf *
+if_flowid(struct mbuf *m, int af)
+{
+	u_int32_t h;
+	u_int16_t *ports;
+	int len;
+#ifdef INET
+	struct ip *ip;
+#endif
+#ifdef INET6
+	struct ip6_hdr *ip6;
+	int i;
+#endif
+
+	if (m->m_pkthdr.flowid & M_FLOWID_VALID)
+		return (m);
+
+	switch (af) {
+#ifdef INET
+	case AF_INET:
+		if (m->m_pkthdr.len < sizeof(*ip))
+			return (m);
+		if (m->m_len < sizeof(*ip) &&
+		    (m = m_pullup(m, sizeof(*ip))) == NULL)
+			return (NULL);
+		ip = mtod(m, struct ip *);
+		h = ip->ip_src.s_addr ^ ip->ip_dst.s_addr;
+		len = (ip->ip_hl << 2) + 2 * sizeof(*ports);
+		if ((ip->ip_p == IPPROTO_TCP || ip->ip_p == IPPROTO_UDP) &&
+		    (ip->ip_off & htons(IP_MF | IP_OFFMASK)) == 0 &&
+		    m->m_pkthdr.len >= len) {
+			if (m->m_len < len && (m = m_pullup(m, len)) == NULL)
+				return (NULL);
+			ip = mtod(m, struct ip *);
+			ports = (u_int16_t *)(mtod(m, caddr_t) +
+			    (ip->ip_hl << 2));
+			h ^= ports[0] ^ ports[1];
+		}
+		break;
+#endif
+#ifdef INET6
+	case AF_INET6:
+		if (m->m_pkthdr.len < sizeof(*ip6))
+			return (m);
+		if (m->m_len < sizeof(*ip6) &&
+		    (m = m_pullup(m, sizeof(*ip6))) == NULL)
+			return (NULL);
+		ip6 = mtod(m, struct ip6_hdr *);
+		h = ip6->ip6_flow & IPV6_FLOWLABEL_MASK;
+		for (i = 0; i < 4; i++)
+			h ^= ip6->ip6_src.s6_addr32[i] ^
+			    ip6->ip6_dst.s6_addr32[i];
+		len = sizeof(*ip6) + 2 * sizeof(*ports);
+		if ((ip6->ip6_nxt == IPPROTO_TCP ||
+		    ip6->ip6_nxt == IPPROTO_UDP) &&
+		    m->m_pkthdr.len >= len) {
+			if (m->m_len < len && (m = m_pullup(m, len)) == NULL)
+				return (NULL);
+			ip6 = mtod(m, struct ip6_hdr *);
+			ports = (u_int16_t *)(ip6 + 1);
+			h ^= ports[0] ^ ports[1];
+		}
+		break;
+#endif
+	default:
+		return (m);
+	}
+
+	h ^= h >> 16;
+	m->m_pkthdr.flowid = M_FLOWID_VALID | (h & M_FLOWID_MASK);
+	return (m);
+}
+
 /*
  * Detach an interface from everything in the kernel.  Also deallocate
  * private resources.
@@ -515,9 +694,11 @@ if_detach(struct ifnet *ifp)
 	struct ifg_list *ifg;
 	int s = splnet();
 	struct domain *dp;
+	u_int i;
 
 	ifp->if_flags &= ~IFF_OACTIVE;
 	ifp->if_start = if_detached_start;
+	ifp->if_mqstart = NULL;
 	ifp->if_ioctl = if_detached_ioctl;
 	ifp->if_watchdog = if_detached_watchdog;
 
@@ -580,10 +761,12 @@ do { \
 } while (0)
 #ifdef INET
 	IF_DETACH_QUEUES(arpintrq);
-	IF_DETACH_QUEUES(ipintrq);
+	for (i = 0; i < IPINTRQS; i++)
+		if_detach_queues(ifp, IPINTRQ(i));
 #endif
 #ifdef INET6
-	IF_DETACH_QUEUES(ip6intrq);
+	for (i = 0; i < IP6INTRQS; i++)
+		if_detach_queues(ifp, IP6INTRQ(i));
 #endif
 #ifdef NETATALK
 	IF_DETACH_QUEUES(atintrq1);
@@ -636,6 +819,15 @@ do { \
 	free(ifp->if_linkstatehooks, M_TEMP);
 	free(ifp->if_detachhooks, M_TEMP);
 
+	if (ifp->if_txqs != NULL) {
+		for (i = 0; i < ifp->if_ntxq - 1; i++)
+			IF_PURGE(&ifp->if_txqs[i]);
+		free(ifp->if_txqs, M_DEVBUF);
+		ifp->if_txqs = NULL;
+	}
+	ifp->if_ntxq = 0;
+	ifp->if_txqpending = 0;
+
 	for (dp = domains; dp; dp = dp->dom_next) {
 		if (dp->dom_ifdetach && ifp->if_afdata[dp->dom_family])
 			(*dp->dom_ifdetach)(ifp,
@@ -1087,6 +1279,7 @@ void
 if_down(struct ifnet *ifp)
 {
 	struct ifaddr *ifa;
+	u_int i;
 
 	splsoftassert(IPL_SOFTNET);
 
@@ -1096,6 +1289,9 @@ if_down(struct ifnet *ifp)
 		pfctlinput(PRC_IFDOWN, ifa->ifa_addr);
 	}
 	IFQ_PURGE(&ifp->if_snd);
+	for (i = 1; i < ifp->if_ntxq; i++)
+		IF_PURGE(IF_TXQ(ifp, i));
+	ifp->if_txqpending = 0;
 #if NCARP > 0
 	if (ifp->if_carp)
 		carp_carpdev_state(ifp);
@@ -1383,6 +1579,12 @@ ifioctl(struct socket *so, u_long cmd, caddr_t data, struct proc *p)
 		}
 #endif
 
+		if (ISSET(ifr->ifr_flags, IFXF_LRO) &&
+		    (ifp->if_capabilities & IFCAP_LRO) == 0) {
+			ifr->ifr_flags &= ~IFXF_LRO;
+			error = ENOTSUP;
+		}
+
 		ifp->if_xflags = (ifp->if_xflags & IFXF_CANTCHANGE) |
 			(ifr->ifr_flags & ~IFXF_CANTCHANGE);
 		rt_ifmsg(ifp);
@@ -282,6 +282,12 @@ struct ifnet {				/* and the entries */
 	struct	ifaltq if_snd;		/* output queue (includes altq) */
 	struct sockaddr_dl *if_sadl;	/* pointer to our sockaddr_dl */
 
+					/* start routine per transmit queue */
+	void	(*if_mqstart)(struct ifnet *, u_int);
+	struct	ifaltq *if_txqs;	/* transmit queues after if_snd */
+	u_int	if_ntxq;		/* number of transmit queues */
+	u_int32_t if_txqpending;	/* queues waiting for nettxintr */
+
 	void	*if_afdata[AF_MAX];
 };
 #define	if_mtu		if_data.ifi_mtu
@@ -331,6 +337,7 @@ struct ifnet {				/* and the entries */
 #define	IFXF_INET6_PRIVACY	0x4		/* autoconf privacy extension */
 #define	IFXF_MPLS		0x8		/* supports MPLS */
 #define	IFXF_WOL		0x10		/* wake on lan enabled */
+#define	IFXF_LRO		0x20		/* TCP large receive enabled */
 
 #define	IFXF_CANTCHANGE \
 	(IFXF_TXREADY)
@@ -354,6 +361,8 @@ struct ifnet {				/* and the entries */
 #define	IFCAP_CSUM_UDPv6	0x00000100	/* can do IPv6/UDP checksums */
 #define	IFCAP_CSUM_TCPv4_Rx	0x00000200	/* can do IPv4/TCP (Rx only) */
 #define	IFCAP_CSUM_UDPv4_Rx	0x00000400	/* can do IPv4/UDP (Rx only) */
+#define	IFCAP_TSOv4		0x00000800	/* can do IPv4/TCP segmentation */
+#define	IFCAP_LRO		0x00001000	/* can do TCP large receive */
 #define	IFCAP_WOL		0x00008000	/* can do wake on lan */
 
 /*
@@ -362,6 +371,15 @@ struct ifnet {				/* and the entries */
  * (defined above).  Entries are added to and deleted from these structures
  * by these macros, which should be called with ipl raised to splnet().
  */
+/*
+ * Interfaces with several hardware transmit rings register one software
+ * queue per ring with if_txq_attach().  Queue 0 is always if_snd; ALTQ
+ * on if_snd forces all traffic onto it.
+ */
+#define	IF_MAXTXQ		8
+#define	IF_TXQ(ifp, i)		((i) == 0 ? &(ifp)->if_snd : \
+				    &(ifp)->if_txqs[(i) - 1])
+
 #define	IF_QFULL(ifq)		((ifq)->ifq_len >= (ifq)->ifq_maxlen)
 #define	IF_DROP(ifq)		((ifq)->ifq_drops++)
 #define	IF_ENQUEUE(ifq, m)						\
@@ -822,6 +840,10 @@ int	if_delgroup(struct ifnet *, const char *);
 void	if_group_routechange(struct sockaddr *, struct sockaddr *);
 struct	ifnet *ifunit(const char *);
 void	if_start(struct ifnet *);
+void	if_start_txq(struct ifnet *, u_int);
+int	if_txq_attach(struct ifnet *, u_int, void (*)(struct ifnet *, u_int));
+u_int	if_txq_select(struct ifnet *, struct mbuf *);
+struct	mbuf *if_flowid(struct mbuf *, int);
 void	ifnewlladdr(struct ifnet *);
 
 struct	ifaddr *ifa_ifwithaddr(struct sockaddr *, u_int);
@@ -232,6 +232,7 @@ ether_output(ifp0, m0, dst, rt0)
 	struct ether_header *eh;
 	struct arpcom *ac = (struct arpcom *)ifp0;
 	short mflags;
+	u_int txq;
 	struct ifnet *ifp = ifp0;
 
 #ifdef DIAGNOSTIC
@@ -421,6 +422,11 @@ ether_output(ifp0, m0, dst, rt0)
 	if (mcopy)
 		(void) looutput(ifp, mcopy, dst, rt);
 
+	/* Spread flows over the transmit queues of multiqueue devices. */
+	if (ifp->if_ntxq > 1 &&
+	    (m = if_flowid(m, dst->sa_family)) == NULL)
+		senderr(ENOBUFS);
+
 	/*
 	 * Add local net header.  If no space in first mbuf,
 	 * allocate another.
@@ -486,12 +492,13 @@ ether_output(ifp0, m0, dst, rt0)
 #endif
 	mflags = m->m_flags;
 	len = m->m_pkthdr.len;
+	txq = if_txq_select(ifp, m);
 	s = splnet();
 	/*
 	 * Queue message on interface, and start output if interface
 	 * not yet active.
 	 */
-	IFQ_ENQUEUE(&ifp->if_snd, m, NULL, error);
+	IFQ_ENQUEUE(IF_TXQ(ifp, txq), m, NULL, error);
 	if (error) {
 		/* mbuf is already freed */
 		splx(s);
@@ -504,7 +511,7 @@ ether_output(ifp0, m0, dst, rt0)
 #endif /* NCARP > 0 */
 	if (mflags & M_MCAST)
 		ifp->if_omcasts++;
-	if_start(ifp);
+	if_start_txq(ifp, txq);
 	splx(s);
 	return (error);
 
@@ -697,7 +704,12 @@ decapsulate:
 #ifdef INET
 	case ETHERTYPE_IP:
 		schednetisr(NETISR_IP);
-		inq = &ipintrq;
+		/* only needed to pick an input queue, keep a NIC's hash */
+		if (IPINTRQS > 1 &&
+		    (m->m_pkthdr.flowid & M_FLOWID_VALID) == 0 &&
+		    (m = if_flowid(m, AF_INET)) == NULL)
+			goto done;
+		inq = IPINTRQ_SELECT(m);
 		break;
 
 	case ETHERTYPE_ARP:
@@ -720,7 +732,11 @@ decapsulate:
 	 */
 	case ETHERTYPE_IPV6:
 		schednetisr(NETISR_IPV6);
-		inq = &ip6intrq;
+		if (IP6INTRQS > 1 &&
+		    (m->m_pkthdr.flowid & M_FLOWID_VALID) == 0 &&
+		    (m = if_flowid(m, AF_INET6)) == NULL)
+			goto done;
+		inq = IP6INTRQ_SELECT(m);
 		break;
 #endif /* INET6 */
 #ifdef NETATALK
@@ -222,8 +222,8 @@ struct pfsync_softc {
 	struct timeout		 sc_bulkfail_tmo;
 
 	u_int32_t		 sc_ureq_received;
-	struct pf_state		*sc_bulk_next;
-	struct pf_state		*sc_bulk_last;
+	struct pf_state_cmp	 sc_bulk_cookie;
+	int			 sc_bulk_first;
 	struct timeout		 sc_bulk_tmo;
 
 	TAILQ_HEAD(, tdb)	 sc_tdb_q;
@@ -953,6 +953,7 @@ pfsync_in_upd(caddr_t buf, int len, int count, int flags)
 			pf_state_peer_ntoh(&sp->dst, &st->dst);
 			st->expire = ntohl(sp->expire) + time_second;
 			st->timeout = sp->timeout;
+			pf_state_wheel_insert(st, pf_state_expires(st));
 		}
 		st->pfsync_time = time_uptime;
 
@@ -1027,6 +1028,7 @@ pfsync_in_upd_c(caddr_t buf, int len, int count, int flags)
 			pf_state_peer_ntoh(&up->dst, &st->dst);
 			st->expire = ntohl(up->expire) + time_second;
 			st->timeout = up->timeout;
+			pf_state_wheel_insert(st, pf_state_expires(st));
 		}
 		st->pfsync_time = time_uptime;
 
@@ -1288,8 +1290,6 @@ pfsyncioctl(struct ifnet *ifp, u_long cmd, caddr_t data)
 
 			/* cancel bulk update */
 			timeout_del(&sc->sc_bulk_tmo);
-			sc->sc_bulk_next = NULL;
-			sc->sc_bulk_last = NULL;
 		}
 		splx(s);
 		break;
@@ -2153,10 +2153,7 @@ pfsync_bulk_start(void)
 		pfsync_bulk_status(PFSYNC_BUS_END);
 	else {
 		sc->sc_ureq_received = time_uptime;
-
-		if (sc->sc_bulk_next == NULL)
-			sc->sc_bulk_next = TAILQ_FIRST(&state_list);
-		sc->sc_bulk_last = sc->sc_bulk_next;
+		sc->sc_bulk_first = 1;
 
 		pfsync_bulk_status(PFSYNC_BUS_START);
 		timeout_add(&sc->sc_bulk_tmo, 0);
@@ -2173,9 +2170,16 @@ pfsync_bulk_update(void *arg)
 
 	s = splsoftnet();
 
-	st = sc->sc_bulk_next;
-
 	for (;;) {
+		st = pf_state_next_byid(&sc->sc_bulk_cookie,
+		    sc->sc_bulk_first);
+		sc->sc_bulk_first = 0;
+		if (st == NULL) {
+			/* we're done */
+			pfsync_bulk_status(PFSYNC_BUS_END);
+			break;
+		}
+
 		if (st->sync_state == PFSYNC_S_NONE &&
 		    st->timeout < PFTM_MAX &&
 		    st->pfsync_time <= sc->sc_ureq_received) {
@@ -2183,22 +2187,9 @@ pfsync_bulk_update(void *arg)
 			i++;
 		}
 
-		st = TAILQ_NEXT(st, entry_list);
-		if (st == NULL)
-			st = TAILQ_FIRST(&state_list);
-
-		if (st == sc->sc_bulk_last) {
-			/* we're done */
-			sc->sc_bulk_next = NULL;
-			sc->sc_bulk_last = NULL;
-			pfsync_bulk_status(PFSYNC_BUS_END);
-			break;
-		}
-
 		if (i > 1 && (sc->sc_if.if_mtu - sc->sc_len) <
 		    sizeof(struct pfsync_state)) {
 			/* we've filled a packet */
-			sc->sc_bulk_next = st;
 			timeout_add(&sc->sc_bulk_tmo, 1);
 			break;
 		}
@@ -2291,9 +2282,7 @@ pfsync_state_in_use(struct pf_state *st)
 	if (sc == NULL)
 		return (0);
 
-	if (st->sync_state != PFSYNC_S_NONE ||
-	    st == sc->sc_bulk_next ||
-	    st == sc->sc_bulk_last)
+	if (st->sync_state != PFSYNC_S_NONE)
 		return (1);
 
 	return (0);
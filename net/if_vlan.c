@@ -424,15 +424,17 @@ vlan_config(struct ifvlan *ifv, struct ifnet *p, u_int16_t tag)
 	if (p->if_capabilities & IFCAP_VLAN_HWTAGGING)
 		ifv->ifv_if.if_capabilities = p->if_capabilities &
 		    (IFCAP_CSUM_IPv4|IFCAP_CSUM_TCPv4|
-		    IFCAP_CSUM_UDPv4);
+		    IFCAP_CSUM_UDPv4|IFCAP_TSOv4);
 		/* (IFCAP_CSUM_TCPv6|IFCAP_CSUM_UDPv6); */
 
 	/*
 	 * Hardware VLAN tagging only works with the default VLAN
-	 * ethernet type (0x8100).
+	 * ethernet type (0x8100).  Otherwise the tag is put in the
+	 * frame, where the parent's TSO setup does not expect it.
 	 */
 	if (ifv->ifv_type != ETHERTYPE_VLAN)
-		ifv->ifv_if.if_capabilities &= ~IFCAP_VLAN_HWTAGGING;
+		ifv->ifv_if.if_capabilities &=
+		    ~(IFCAP_VLAN_HWTAGGING|IFCAP_TSOv4);
 
 	/*
 	 * Set up our ``Ethernet address'' to reflect the underlying
@@ -43,6 +43,7 @@
 #include <sys/param.h>
 #include <sys/systm.h>
 #include <sys/mbuf.h>
+#include <sys/malloc.h>
 #include <sys/filio.h>
 #include <sys/socket.h>
 #include <sys/socketvar.h>
@@ -103,6 +104,23 @@
 /* state tables */
 struct pf_state_tree	 pf_statetbl;
 
+/*
+ * Hash index in front of pf_statetbl.  Like the tree it is only
+ * touched at splsoftnet under the kernel lock, which also keeps the
+ * keys returned by lookups valid while the caller uses them.  The
+ * tree is kept for walks that want the keys in order.
+ */
+#define PF_STATE_HASH_MIN	256
+#define PF_STATE_HASH_MAX	(1 << 20)
+#define PF_STATE_HASH_LOAD	2	/* keys per bucket before growing */
+
+LIST_HEAD(pf_state_hashhead, pf_state_key);
+
+struct pf_state_hashhead *pf_state_hashtbl;
+u_int32_t		 pf_state_hashmask;
+u_int32_t		 pf_state_hash_seed;
+u_int32_t		 pf_state_hash_count;
+
 struct pf_altqqueue	 pf_altqs[2];
 struct pf_altqqueue	*pf_altqs_active;
 struct pf_altqqueue	*pf_altqs_inactive;
@@ -120,10 +138,27 @@ int			 pf_tcp_iss_off;
 struct pf_anchor_stackframe {
 	struct pf_ruleset			*rs;
 	struct pf_rule				*r;
+	struct pf_rule_cls			*ce;
 	struct pf_anchor_node			*parent;
 	struct pf_anchor			*child;
 } pf_anchor_stack[64];
 
+int			 pf_rule_index_enable = 1;
+
+/* leaves of the rule tree are sized relative to the rules they cover */
+#define PF_RULE_TREE_FACTOR	8
+#define PF_RULE_TREE_SLACK	1024
+
+/* stands for interfaces no rule is bound to when building the tree */
+struct pfi_kif		 pf_rule_tree_otherif;
+
+#define PF_RULE_NEXT(r, rc)						\
+	((rc) == NULL || (rc)->ce == NULL ?				\
+	    TAILQ_NEXT((r), entries) : (++(rc)->ce)->rule)
+#define PF_RULE_SKIP(r, rc, i)						\
+	((rc) == NULL || (rc)->ce == NULL ?				\
+	    (r)->skip[(i)].ptr : ((rc)->ce = (rc)->ce->skip[(i)])->rule)
+
 /* cannot fold into pf_pdesc directly, unknown storage size outside pf.c */
 union pf_headers {
 	struct tcphdr		tcp;
@@ -230,6 +265,38 @@ void			 pf_print_state_parts(struct pf_state *,
 			    struct pf_state_key *, struct pf_state_key *);
 int			 pf_addr_wrap_neq(struct pf_addr_wrap *,
 			    struct pf_addr_wrap *);
+int			 pf_rule_class(sa_family_t, u_int8_t);
+u_int32_t		 pf_state_key_hash(struct pf_state_key_cmp *);
+struct pf_state_key	*pf_state_hash_find(struct pf_state_key_cmp *);
+struct pf_state_key	*pf_state_hash_insert(struct pf_state_key *);
+void			 pf_state_hash_remove(struct pf_state_key *);
+void			 pf_state_hash_resize(void);
+void			 pf_state_wheel_remove(struct pf_state *);
+void			 pf_state_wheel_rebase(u_int32_t);
+u_int32_t		 pf_state_wheel_rescan(u_int32_t);
+int			 pf_state_wheel_scaled(void);
+int			 pf_rule_tree_ports(struct pf_rule *, u_int16_t *,
+			    u_int16_t *);
+int			 pf_rule_tree_ifmatch(struct pf_rule *,
+			    struct pfi_kif *);
+int			 pf_rule_tree_portmatch(struct pf_rule *, u_int16_t,
+			    u_int16_t);
+void			 pf_rule_tree_leaf(struct pf_rule_cls *,
+			    struct pf_rule **, u_int32_t, struct pfi_kif *,
+			    int, u_int16_t, u_int16_t);
+u_int32_t		 pf_rule_tree_split(struct pf_rule **, u_int32_t,
+			    struct pfi_kif *, u_int16_t *);
+u_int32_t		 pf_rule_tree_count(struct pf_rule **, u_int32_t,
+			    struct pfi_kif *, int, u_int16_t *, u_int32_t);
+int			 pf_rule_tree_inode(struct pf_rule_inode *,
+			    struct pf_rule **, u_int32_t, struct pfi_kif *,
+			    int, u_int16_t *);
+int			 pf_rule_tree_class(struct pf_rule_tree *, int,
+			    struct pf_rule **, u_int32_t, struct pfi_kif **,
+			    u_int16_t *);
+void			 pf_rule_tree_inode_free(struct pf_rule_inode *);
+struct pf_rule		*pf_rule_first(struct pf_ruleset *,
+			    struct pf_rule_cursor *);
 int			 pf_compare_state_keys(struct pf_state_key *,
 			    struct pf_state_key *, struct pfi_kif *, u_int);
 struct pf_state		*pf_find_state(struct pfi_kif *,
@@ -308,6 +375,38 @@ struct pf_src_tree tree_src_tracking;
 struct pf_state_tree_id tree_id;
 struct pf_state_queue state_list;
 
+/*
+ * States sit in a two level timer wheel by the time they are expected
+ * to expire.  Packets only move s->expire forward; when a slot comes
+ * due each of its states is checked and either purged or put back at
+ * its new expiry, so a longer timeout re-buckets lazily.  Expiry that
+ * moves earlier has to be caught up front: a state changing timeout
+ * goes through pf_state_wheel_update(), while a shorter default
+ * timeout, or global adaptive scaling that has tightened by more than
+ * an eighth of its range, starts a rescan of the state list.  The
+ * rescan walks at most as many states per purge run as the purge
+ * itself checks, so it is spread over one purge interval.  Existing
+ * states keep the rules they were created by, so a ruleset commit
+ * does not move any expiry.  States of rules with their own adaptive
+ * settings are never bucketed more than PF_WHEEL_ADAPTIVE seconds out.
+ * The first level holds the seconds of the current block, the second
+ * one whole blocks of PF_WHEEL0_SIZE seconds.
+ */
+#define PF_WHEEL0_SIZE		256
+#define PF_WHEEL1_SIZE		256
+#define PF_WHEEL_SPAN		(PF_WHEEL0_SIZE * PF_WHEEL1_SIZE)
+#define PF_WHEEL_ADAPTIVE	30
+
+LIST_HEAD(pf_state_wheelslot, pf_state);
+struct pf_state_wheelslot pf_wheel0[PF_WHEEL0_SIZE];
+struct pf_state_wheelslot pf_wheel1[PF_WHEEL1_SIZE];
+u_int32_t		 pf_wheel_time;		/* last second purged */
+u_int32_t		 pf_wheel_states;	/* states at last rebuild */
+int			 pf_wheel_rescan;	/* expiries moved earlier */
+struct pf_state		*pf_wheel_cursor;	/* next to rescan */
+u_int64_t		 pf_purge_time;		/* usecs purging */
+u_int64_t		 pf_purge_checks;	/* states checked by purge */
+
 RB_GENERATE(pf_src_tree, pf_src_node, entry, pf_src_compare);
 RB_GENERATE(pf_state_tree, pf_state_key, entry, pf_state_compare_key);
 RB_GENERATE(pf_state_tree_id, pf_state,
@@ -502,6 +601,7 @@ pf_src_connlimit(struct pf_state **state)
 					st->timeout = PFTM_PURGE;
 					st->src.state = st->dst.state =
 					    TCPS_CLOSED;
+					pf_state_wheel_update(st);
 					killed++;
 				}
 			}
@@ -515,6 +615,7 @@ pf_src_connlimit(struct pf_state **state)
 	/* kill this state */
 	(*state)->timeout = PFTM_PURGE;
 	(*state)->src.state = (*state)->dst.state = TCPS_CLOSED;
+	pf_state_wheel_update(*state);
 	return (1);
 }
 
@@ -671,6 +772,134 @@ pf_state_compare_id(struct pf_state *a, struct pf_state *b)
 	return (0);
 }
 
+static __inline u_int32_t
+pf_state_hash_mix(u_int32_t h, u_int32_t v)
+{
+	h ^= v;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	return (h);
+}
+
+u_int32_t
+pf_state_key_hash(struct pf_state_key_cmp *key)
+{
+	u_int32_t	h = pf_state_hash_seed;
+	int		i, n;
+
+	n = (key->af == AF_INET6) ? 4 : 1;
+	for (i = 0; i < n; i++) {
+		h = pf_state_hash_mix(h, key->addr[0].addr32[i]);
+		h = pf_state_hash_mix(h, key->addr[1].addr32[i]);
+	}
+	h = pf_state_hash_mix(h, key->port[0] << 16 | key->port[1]);
+	h = pf_state_hash_mix(h,
+	    key->rdomain << 16 | key->af << 8 | key->proto);
+	return (h);
+}
+
+void
+pf_state_hash_init(void)
+{
+	u_int32_t	size, i;
+
+	size = PF_STATE_HASH_MIN;
+	while (size < PF_STATE_HASH_MAX && size * PF_STATE_HASH_LOAD <
+	    pf_pool_limits[PF_LIMIT_STATES].limit)
+		size <<= 1;
+
+	pf_state_hashtbl = malloc(size * sizeof(*pf_state_hashtbl),
+	    M_PF, M_WAITOK);
+	for (i = 0; i < size; i++)
+		LIST_INIT(&pf_state_hashtbl[i]);
+	pf_state_hashmask = size - 1;
+	pf_state_hash_seed = arc4random();
+}
+
+struct pf_state_key *
+pf_state_hash_find(struct pf_state_key_cmp *key)
+{
+	struct pf_state_key	*sk;
+	u_int32_t		 h;
+
+	h = pf_state_key_hash(key);
+	LIST_FOREACH(sk, &pf_state_hashtbl[h & pf_state_hashmask], hentry)
+		if (sk->hash == h && pf_state_compare_key(sk,
+		    (struct pf_state_key *)key) == 0)
+			break;
+
+	return (sk);
+}
+
+/* returns the existing key on collision, NULL if sk was inserted */
+struct pf_state_key *
+pf_state_hash_insert(struct pf_state_key *sk)
+{
+	struct pf_state_hashhead	*head;
+	struct pf_state_key		*cur;
+
+	sk->hash = pf_state_key_hash((struct pf_state_key_cmp *)sk);
+	head = &pf_state_hashtbl[sk->hash & pf_state_hashmask];
+	LIST_FOREACH(cur, head, hentry)
+		if (cur->hash == sk->hash &&
+		    pf_state_compare_key(cur, sk) == 0)
+			break;
+	if (cur == NULL) {
+		LIST_INSERT_HEAD(head, sk, hentry);
+		pf_state_hash_count++;
+	}
+
+	return (cur);
+}
+
+void
+pf_state_hash_remove(struct pf_state_key *sk)
+{
+	LIST_REMOVE(sk, hentry);
+	pf_state_hash_count--;
+}
+
+/*
+ * Grow the hash table once the keys outnumber the buckets by
+ * PF_STATE_HASH_LOAD.  Called from the purge thread, which may sleep
+ * for the allocation; the rehash itself runs at splsoftnet.
+ */
+void
+pf_state_hash_resize(void)
+{
+	struct pf_state_hashhead	*nt, *ot;
+	struct pf_state_key		*sk;
+	u_int32_t			 count, size, osize, i;
+	int				 s;
+
+	count = pf_state_hash_count;
+	osize = pf_state_hashmask + 1;
+	if (osize >= PF_STATE_HASH_MAX || count <= osize * PF_STATE_HASH_LOAD)
+		return;
+
+	size = osize;
+	while (size < PF_STATE_HASH_MAX && size * PF_STATE_HASH_LOAD < count)
+		size <<= 1;
+	nt = malloc(size * sizeof(*nt), M_PF, M_WAITOK);
+	for (i = 0; i < size; i++)
+		LIST_INIT(&nt[i]);
+
+	s = splsoftnet();
+	ot = pf_state_hashtbl;
+	for (i = 0; i < osize; i++)
+		while ((sk = LIST_FIRST(&ot[i])) != NULL) {
+			LIST_REMOVE(sk, hentry);
+			LIST_INSERT_HEAD(&nt[sk->hash & (size - 1)], sk,
+			    hentry);
+		}
+	pf_state_hashtbl = nt;
+	pf_state_hashmask = size - 1;
+	splx(s);
+
+	free(ot, M_PF);
+}
+
 int
 pf_state_key_attach(struct pf_state_key *sk, struct pf_state *s, int idx)
 {
@@ -679,7 +908,7 @@ pf_state_key_attach(struct pf_state_key *sk, struct pf_state *s, int idx)
 	struct pf_state		*olds = NULL;
 
 	KASSERT(s->key[idx] == NULL);
-	if ((cur = RB_INSERT(pf_state_tree, &pf_statetbl, sk)) != NULL) {
+	if ((cur = pf_state_hash_insert(sk)) != NULL) {
 		/* key exists. check for same kif, if none, add to key */
 		TAILQ_FOREACH(si, &cur->states, entry)
 			if (si->s->kif == s->kif &&
@@ -718,8 +947,10 @@ pf_state_key_attach(struct pf_state_key *sk, struct pf_state *s, int idx)
 			}
 		pool_put(&pf_state_key_pl, sk);
 		s->key[idx] = cur;
-	} else
+	} else {
+		RB_INSERT(pf_state_tree, &pf_statetbl, sk);
 		s->key[idx] = sk;
+	}
 
 	if ((si = pool_get(&pf_state_item_pl, PR_NOWAIT)) == NULL) {
 		pf_state_key_detach(s, idx);
@@ -770,6 +1001,7 @@ pf_state_key_detach(struct pf_state *s, int idx)
 	}
 
 	if (TAILQ_EMPTY(&s->key[idx]->states)) {
+		pf_state_hash_remove(s->key[idx]);
 		RB_REMOVE(pf_state_tree, &pf_statetbl, s->key[idx]);
 		if (s->key[idx]->reverse)
 			s->key[idx]->reverse->reverse = NULL;
@@ -885,6 +1117,7 @@ pf_state_insert(struct pfi_kif *kif, struct pf_state_key *skw,
 		return (-1);
 	}
 	TAILQ_INSERT_TAIL(&state_list, s, entry_list);
+	pf_state_wheel_insert(s, pf_state_expires(s));
 	pf_status.fcounters[FCNT_STATE_INSERT]++;
 	pf_status.states++;
 	pfi_kif_ref(kif, PFI_KIF_REF_STATE);
@@ -902,6 +1135,33 @@ pf_find_state_byid(struct pf_state_cmp *key)
 	return (RB_FIND(pf_state_tree_id, &tree_id, (struct pf_state *)key));
 }
 
+/*
+ * Walk the states in id order.  The cookie only holds the id of the
+ * last state returned, so states may come and go between calls and
+ * nothing has to be pinned while the caller sleeps.
+ */
+struct pf_state *
+pf_state_next_byid(struct pf_state_cmp *cookie, int first)
+{
+	struct pf_state	*s;
+
+	if (first)
+		s = RB_MIN(pf_state_tree_id, &tree_id);
+	else {
+		s = RB_NFIND(pf_state_tree_id, &tree_id,
+		    (struct pf_state *)cookie);
+		if (s != NULL && pf_state_compare_id(s,
+		    (struct pf_state *)cookie) == 0)
+			s = RB_NEXT(pf_state_tree_id, &tree_id, s);
+	}
+	if (s != NULL) {
+		cookie->id = s->id;
+		cookie->creatorid = s->creatorid;
+	}
+
+	return (s);
+}
+
 int
 pf_compare_state_keys(struct pf_state_key *a, struct pf_state_key *b,
     struct pfi_kif *kif, u_int dir)
@@ -957,8 +1217,7 @@ pf_find_state(struct pfi_kif *kif, struct pf_state_key_cmp *key, u_int dir,
 	   ((struct inpcb *)m->m_pkthdr.pf.inp)->inp_pf_sk)
 	       sk = ((struct inpcb *)m->m_pkthdr.pf.inp)->inp_pf_sk;
 	else {
-		if ((sk = RB_FIND(pf_state_tree, &pf_statetbl,
-		    (struct pf_state_key *)key)) == NULL)
+		if ((sk = pf_state_hash_find(key)) == NULL)
 			return (NULL);
 		if (dir == PF_OUT && m->m_pkthdr.pf.statekey &&
 		    pf_compare_state_keys(m->m_pkthdr.pf.statekey, sk,
@@ -995,7 +1254,7 @@ pf_find_state_all(struct pf_state_key_cmp *key, u_int dir, int *more)
 
 	pf_status.fcounters[FCNT_STATE_SEARCH]++;
 
-	sk = RB_FIND(pf_state_tree, &pf_statetbl, (struct pf_state_key *)key);
+	sk = pf_state_hash_find(key);
 
 	if (sk != NULL) {
 		TAILQ_FOREACH(si, &sk->states, entry)
@@ -1024,6 +1283,8 @@ pf_purge_thread(void *v)
 	for (;;) {
 		tsleep(pf_purge_thread, PWAIT, "pftm", 1 * hz);
 
+		pf_state_hash_resize();
+
 		s = splsoftnet();
 
 		/* process a fraction of the state table every second */
@@ -1148,6 +1409,8 @@ pf_unlink_state(struct pf_state *cur)
 	pfsync_delete_state(cur);
 #endif
 	cur->timeout = PFTM_UNLINKED;
+	/* have the next purge run free it */
+	pf_state_wheel_insert(cur, time_second);
 	pf_src_tree_remove_state(cur);
 	pf_detach_state(cur);
 }
@@ -1162,10 +1425,14 @@ pf_free_state(struct pf_state *cur)
 	splsoftassert(IPL_SOFTNET);
 
 #if NPFSYNC > 0
-	if (pfsync_state_in_use(cur))
+	if (pfsync_state_in_use(cur)) {
+		/* try again in the next purge run */
+		pf_state_wheel_insert(cur, time_second + 1);
 		return;
+	}
 #endif
 	KASSERT(cur->timeout == PFTM_UNLINKED);
+	pf_state_wheel_remove(cur);
 	if (--cur->rule.ptr->states_cur <= 0 &&
 	    cur->rule.ptr->src_nodes <= 0)
 		pf_rm_rule(NULL, cur->rule.ptr);
@@ -1181,6 +1448,8 @@ pf_free_state(struct pf_state *cur)
 	}
 	pf_normalize_tcp_cleanup(cur);
 	pfi_kif_unref(cur->kif, PFI_KIF_REF_STATE);
+	if (pf_wheel_cursor == cur)
+		pf_wheel_cursor = TAILQ_NEXT(cur, entry_list);
 	TAILQ_REMOVE(&state_list, cur, entry_list);
 	if (cur->tag)
 		pf_tag_unref(cur->tag);
@@ -1189,45 +1458,191 @@ pf_free_state(struct pf_state *cur)
 	pf_status.states--;
 }
 
+void
+pf_state_wheel_insert(struct pf_state *s, u_int32_t when)
+{
+	u_int32_t	next = pf_wheel_time + 1;
+	u_int32_t	block;
+
+	if (s->wheel_expire)
+		LIST_REMOVE(s, entry_wheel);
+	if (when < next)
+		when = next;
+	/* per rule adaptive scaling is not tracked, keep it close */
+	if (s->rule.ptr->timeout[PFTM_ADAPTIVE_START] &&
+	    when - next > PF_WHEEL_ADAPTIVE)
+		when = next + PF_WHEEL_ADAPTIVE;
+	block = next / PF_WHEEL0_SIZE;
+	if (when / PF_WHEEL0_SIZE == block)
+		LIST_INSERT_HEAD(&pf_wheel0[when % PF_WHEEL0_SIZE], s,
+		    entry_wheel);
+	else {
+		/* too far out, look at it again at the wheel's end */
+		if (when / PF_WHEEL0_SIZE - block >= PF_WHEEL1_SIZE)
+			when = (block + PF_WHEEL1_SIZE - 1) * PF_WHEEL0_SIZE;
+		LIST_INSERT_HEAD(&pf_wheel1[(when / PF_WHEEL0_SIZE) %
+		    PF_WHEEL1_SIZE], s, entry_wheel);
+	}
+	s->wheel_expire = when;
+	s->wheel_timeout = s->timeout;
+}
+
+void
+pf_state_wheel_remove(struct pf_state *s)
+{
+	if (s->wheel_expire == 0)
+		return;
+	LIST_REMOVE(s, entry_wheel);
+	s->wheel_expire = 0;
+}
+
+/*
+ * Called when a state may expire earlier than the slot it sits in,
+ * i.e. when its timeout changed.  Later expiry is left to the purge.
+ */
+void
+pf_state_wheel_update(struct pf_state *s)
+{
+	u_int32_t	when;
+
+	if (s->timeout == s->wheel_timeout)
+		return;
+	when = pf_state_expires(s);
+	if (when < s->wheel_expire)
+		pf_state_wheel_insert(s, when);
+	else
+		s->wheel_timeout = s->timeout;
+}
+
+/*
+ * The clock jumped, put every state back relative to now.
+ */
+void
+pf_state_wheel_rebase(u_int32_t now)
+{
+	struct pf_state		*cur;
+
+	pf_wheel_time = now - 1;
+	pf_wheel_states = pf_status.states;
+	pf_wheel_rescan = 0;
+	pf_wheel_cursor = NULL;
+	TAILQ_FOREACH(cur, &state_list, entry_list)
+		pf_state_wheel_insert(cur, cur->timeout == PFTM_UNLINKED ?
+		    now : pf_state_expires(cur));
+}
+
+/*
+ * Expiries moved earlier, pull states whose slot is now too late
+ * forward.  Picks up where the last run stopped; a new request
+ * restarts from the head of the list.  Returns the states looked at.
+ */
+u_int32_t
+pf_state_wheel_rescan(u_int32_t maxcheck)
+{
+	struct pf_state		*cur;
+	u_int32_t		 when, checked = 0;
+
+	if (pf_wheel_rescan || pf_state_wheel_scaled()) {
+		pf_wheel_states = pf_status.states;
+		pf_wheel_rescan = 0;
+		pf_wheel_cursor = TAILQ_FIRST(&state_list);
+	}
+	while ((cur = pf_wheel_cursor) != NULL && checked++ < maxcheck) {
+		pf_wheel_cursor = TAILQ_NEXT(cur, entry_list);
+		if (cur->timeout == PFTM_UNLINKED)
+			continue;
+		when = pf_state_expires(cur);
+		if (when < cur->wheel_expire)
+			pf_state_wheel_insert(cur, when);
+	}
+	return (checked);
+}
+
+/*
+ * Global adaptive timeouts shrink with every state added, but a state
+ * is only looked at when its slot comes due.  Ask for a rebuild once
+ * the state count has grown by an eighth of the adaptive range since
+ * the last one, which bounds how late any state is purged to an
+ * eighth of its timeout.
+ */
+int
+pf_state_wheel_scaled(void)
+{
+	u_int32_t	start = pf_default_rule.timeout[PFTM_ADAPTIVE_START];
+	u_int32_t	end = pf_default_rule.timeout[PFTM_ADAPTIVE_END];
+	u_int32_t	states = pf_status.states;
+
+	if (states < pf_wheel_states)
+		pf_wheel_states = states;
+	if (!end || start >= end || states <= start)
+		return (0);
+	return (states - MAX(pf_wheel_states, start) > (end - start) / 8);
+}
+
 void
 pf_purge_expired_states(u_int32_t maxcheck)
 {
-	static struct pf_state	*cur = NULL;
-	struct pf_state		*next;
+	struct pf_state_wheelslot *slot;
+	struct pf_state		*cur;
+	struct timeval		 start, end;
+	u_int32_t		 now = time_second, t, checked = 0;
 	int			 locked = 0;
 
-	while (maxcheck--) {
-		/* wrap to start of list when we hit the end */
-		if (cur == NULL) {
-			cur = TAILQ_FIRST(&state_list);
-			if (cur == NULL)
-				break;	/* list empty */
-		}
-
-		/* get next state, as cur may get deleted */
-		next = TAILQ_NEXT(cur, entry_list);
+	microuptime(&start);
 
-		if (cur->timeout == PFTM_UNLINKED) {
-			/* free unlinked state */
-			if (! locked) {
-				rw_enter_write(&pf_consistency_lock);
-				locked = 1;
-			}
-			pf_free_state(cur);
-		} else if (pf_state_expires(cur) <= time_second) {
-			/* unlink and free expired state */
-			pf_unlink_state(cur);
-			if (! locked) {
-				rw_enter_write(&pf_consistency_lock);
-				locked = 1;
-			}
-			pf_free_state(cur);
+	if (now < pf_wheel_time || now - pf_wheel_time >= PF_WHEEL_SPAN)
+		pf_state_wheel_rebase(now);
+	else
+		checked = pf_state_wheel_rescan(maxcheck);
+	maxcheck += checked;
+
+	while (pf_wheel_time < now) {
+		t = pf_wheel_time + 1;
+		slot = &pf_wheel0[t % PF_WHEEL0_SIZE];
+		while ((cur = LIST_FIRST(slot)) != NULL) {
+			/* leave the rest of the slot for the next run */
+			if (checked++ >= maxcheck)
+				goto done;
+			pf_state_wheel_remove(cur);
+
+			if (cur->timeout == PFTM_UNLINKED) {
+				/* free unlinked state */
+				if (! locked) {
+					rw_enter_write(&pf_consistency_lock);
+					locked = 1;
+				}
+				pf_free_state(cur);
+			} else if (pf_state_expires(cur) <= now) {
+				/* unlink and free expired state */
+				pf_unlink_state(cur);
+				if (! locked) {
+					rw_enter_write(&pf_consistency_lock);
+					locked = 1;
+				}
+				pf_free_state(cur);
+			} else
+				pf_state_wheel_insert(cur,
+				    pf_state_expires(cur));
+		}
+		pf_wheel_time = t;
+
+		/* entering a new block, spread it over the first level */
+		if ((t + 1) % PF_WHEEL0_SIZE == 0) {
+			slot = &pf_wheel1[((t + 1) / PF_WHEEL0_SIZE) %
+			    PF_WHEEL1_SIZE];
+			while ((cur = LIST_FIRST(slot)) != NULL)
+				pf_state_wheel_insert(cur, cur->wheel_expire);
 		}
-		cur = next;
 	}
 
+ done:
 	if (locked)
 		rw_exit_write(&pf_consistency_lock);
+
+	microuptime(&end);
+	timersub(&end, &start, &end);
+	pf_purge_time += (u_int64_t)end.tv_sec * 1000000 + end.tv_usec;
+	pf_purge_checks += checked;
 }
 
 int
@@ -1489,6 +1904,485 @@ pf_calc_skip_steps(struct pf_rulequeue *rules)
 		PF_SET_SKIP_STEPS(i);
 }
 
+int
+pf_rule_class(sa_family_t af, u_int8_t proto)
+{
+	int c;
+
+	switch (proto) {
+	case IPPROTO_TCP:
+		c = PF_RC_TCP;
+		break;
+	case IPPROTO_UDP:
+		c = PF_RC_UDP;
+		break;
+	case IPPROTO_ICMP:
+		c = (af == AF_INET) ? PF_RC_ICMP : PF_RC_OTHER;
+		break;
+	case IPPROTO_ICMPV6:
+		c = (af == AF_INET6) ? PF_RC_ICMP : PF_RC_OTHER;
+		break;
+	default:
+		c = PF_RC_OTHER;
+		break;
+	}
+	return ((af == AF_INET6) ? PF_RC_NPROTO + c : c);
+}
+
+/*
+ * Destination ports a rule can match, as an inclusive interval in host
+ * byte order.  Returns 0 if the rule's port test does not reduce to
+ * one interval, -1 if it can never match.
+ */
+int
+pf_rule_tree_ports(struct pf_rule *r, u_int16_t *lo, u_int16_t *hi)
+{
+	u_int16_t	a1 = ntohs(r->dst.port[0]);
+	u_int16_t	a2 = ntohs(r->dst.port[1]);
+
+	switch (r->dst.port_op) {
+	case PF_OP_EQ:
+		*lo = *hi = a1;
+		return (1);
+	case PF_OP_RRG:
+		*lo = a1;
+		*hi = a2;
+		break;
+	case PF_OP_IRG:
+		if (a1 == 0xffff || a2 == 0)
+			return (-1);
+		*lo = a1 + 1;
+		*hi = a2 - 1;
+		break;
+	case PF_OP_LT:
+		if (a1 == 0)
+			return (-1);
+		*lo = 0;
+		*hi = a1 - 1;
+		break;
+	case PF_OP_LE:
+		*lo = 0;
+		*hi = a1;
+		break;
+	case PF_OP_GT:
+		if (a1 == 0xffff)
+			return (-1);
+		*lo = a1 + 1;
+		*hi = 0xffff;
+		break;
+	case PF_OP_GE:
+		*lo = a1;
+		*hi = 0xffff;
+		break;
+	default:
+		return (0);
+	}
+	return (*lo > *hi ? -1 : 1);
+}
+
+/*
+ * Can rule r match a packet on interface kif.  A NULL kif stands for
+ * any interface, pf_rule_tree_otherif for one no rule is bound to.
+ */
+int
+pf_rule_tree_ifmatch(struct pf_rule *r, struct pfi_kif *kif)
+{
+	if (kif == NULL || r->kif == NULL || r->kif->pfik_group != NULL)
+		return (1);
+	return ((r->kif == kif) != r->ifnot);
+}
+
+/* can rule r match a packet to a port in [lo, hi] */
+int
+pf_rule_tree_portmatch(struct pf_rule *r, u_int16_t lo, u_int16_t hi)
+{
+	u_int16_t	rlo, rhi;
+
+	switch (pf_rule_tree_ports(r, &rlo, &rhi)) {
+	case -1:
+		return (0);
+	case 0:
+		return (1);
+	}
+	return (rlo <= lo && hi <= rhi);
+}
+
+#define	PF_SET_LEAF_SKIP_STEPS(i)					\
+	do {								\
+		while (head[i] < j)					\
+			leaf[head[i]++].skip[i] = &leaf[j];		\
+	} while (0)
+
+/*
+ * Fill a leaf with the rules of chain that can match on interface kif
+ * and ports [lo, hi], and recalculate the skip steps along it.
+ */
+void
+pf_rule_tree_leaf(struct pf_rule_cls *leaf, struct pf_rule **chain,
+    u_int32_t n, struct pfi_kif *kif, int ports, u_int16_t lo, u_int16_t hi)
+{
+	struct pf_rule	*cur, *prev;
+	u_int32_t	 i, j, head[PF_SKIP_COUNT];
+
+	j = 0;
+	for (i = 0; i < n; i++)
+		if (pf_rule_tree_ifmatch(chain[i], kif) &&
+		    (!ports || pf_rule_tree_portmatch(chain[i], lo, hi)))
+			leaf[j++].rule = chain[i];
+	n = j;
+	leaf[n].rule = NULL;
+
+	/* same as pf_calc_skip_steps(), along the leaf */
+	for (i = 0; i < PF_SKIP_COUNT; ++i)
+		head[i] = 0;
+	for (j = 1; j < n; j++) {
+		cur = leaf[j].rule;
+		prev = leaf[j - 1].rule;
+		if (cur->kif != prev->kif || cur->ifnot != prev->ifnot)
+			PF_SET_LEAF_SKIP_STEPS(PF_SKIP_IFP);
+		if (cur->direction != prev->direction)
+			PF_SET_LEAF_SKIP_STEPS(PF_SKIP_DIR);
+		if (cur->onrdomain != prev->onrdomain ||
+		    cur->ifnot != prev->ifnot)
+			PF_SET_LEAF_SKIP_STEPS(PF_SKIP_RDOM);
+		if (cur->af != prev->af)
+			PF_SET_LEAF_SKIP_STEPS(PF_SKIP_AF);
+		if (cur->proto != prev->proto)
+			PF_SET_LEAF_SKIP_STEPS(PF_SKIP_PROTO);
+		if (cur->src.neg != prev->src.neg ||
+		    pf_addr_wrap_neq(&cur->src.addr, &prev->src.addr))
+			PF_SET_LEAF_SKIP_STEPS(PF_SKIP_SRC_ADDR);
+		if (cur->src.port[0] != prev->src.port[0] ||
+		    cur->src.port[1] != prev->src.port[1] ||
+		    cur->src.port_op != prev->src.port_op)
+			PF_SET_LEAF_SKIP_STEPS(PF_SKIP_SRC_PORT);
+		if (cur->dst.neg != prev->dst.neg ||
+		    pf_addr_wrap_neq(&cur->dst.addr, &prev->dst.addr))
+			PF_SET_LEAF_SKIP_STEPS(PF_SKIP_DST_ADDR);
+		if (cur->dst.port[0] != prev->dst.port[0] ||
+		    cur->dst.port[1] != prev->dst.port[1] ||
+		    cur->dst.port_op != prev->dst.port_op)
+			PF_SET_LEAF_SKIP_STEPS(PF_SKIP_DST_PORT);
+	}
+	j = n;
+	for (i = 0; i < PF_SKIP_COUNT; ++i)
+		PF_SET_LEAF_SKIP_STEPS(i);
+	for (i = 0; i < PF_SKIP_COUNT; ++i)
+		leaf[n].skip[i] = &leaf[n];
+}
+
+/*
+ * Split the destination ports seen by the rules of chain that apply
+ * on interface kif into intervals no such rule distinguishes.  Returns
+ * the number of intervals, their first ports are stored in los[].
+ */
+u_int32_t
+pf_rule_tree_split(struct pf_rule **chain, u_int32_t n, struct pfi_kif *kif,
+    u_int16_t *los)
+{
+	u_int32_t	 i, j, k, nlos;
+	u_int16_t	 lo, hi, b[2];
+
+	nlos = 1;
+	los[0] = 0;
+	for (i = 0; i < n; i++) {
+		if (!pf_rule_tree_ifmatch(chain[i], kif) ||
+		    pf_rule_tree_ports(chain[i], &lo, &hi) != 1)
+			continue;
+		b[0] = lo;
+		b[1] = hi + 1;
+		for (k = 0; k < (hi == 0xffff ? 1 : 2); k++) {
+			/* insert b[k] into the sorted los[] */
+			for (j = nlos; j > 0 && los[j - 1] > b[k]; j--)
+				;
+			if (j > 0 && los[j - 1] == b[k])
+				continue;
+			bcopy(&los[j], &los[j + 1], (nlos - j) * sizeof(*los));
+			los[j] = b[k];
+			nlos++;
+		}
+	}
+	return (nlos);
+}
+
+/*
+ * Number of leaf entries an interface node would need.  Counting stops
+ * as soon as it goes over limit.
+ */
+u_int32_t
+pf_rule_tree_count(struct pf_rule **chain, u_int32_t n, struct pfi_kif *kif,
+    int ports, u_int16_t *los, u_int32_t limit)
+{
+	u_int32_t	 i, p, nlos, cnt = 0;
+	u_int16_t	 hi;
+
+	nlos = 1;
+	if (ports)
+		nlos = pf_rule_tree_split(chain, n, kif, los);
+	for (p = 0; p < nlos && cnt <= limit; p++) {
+		hi = (p + 1 < nlos) ? los[p + 1] - 1 : 0xffff;
+		for (i = 0; i < n; i++)
+			if (pf_rule_tree_ifmatch(chain[i], kif) &&
+			    (!ports || pf_rule_tree_portmatch(chain[i],
+			    los[p], hi)))
+				cnt++;
+		cnt++;
+	}
+	return (cnt);
+}
+
+int
+pf_rule_tree_inode(struct pf_rule_inode *in, struct pf_rule **chain,
+    u_int32_t n, struct pfi_kif *kif, int ports, u_int16_t *los)
+{
+	u_int32_t	 i, p, nlos, cnt;
+	u_int16_t	 hi;
+
+	in->kif = (kif == &pf_rule_tree_otherif) ? NULL : kif;
+	nlos = 1;
+	los[0] = 0;
+	if (ports)
+		nlos = pf_rule_tree_split(chain, n, kif, los);
+	in->ports = malloc(nlos * sizeof(*in->ports), M_TEMP,
+	    M_WAITOK|M_CANFAIL|M_ZERO);
+	if (in->ports == NULL)
+		return (ENOMEM);
+	in->nports = nlos;
+	for (p = 0; p < nlos; p++) {
+		hi = (p + 1 < nlos) ? los[p + 1] - 1 : 0xffff;
+		cnt = 1;
+		for (i = 0; i < n; i++)
+			if (pf_rule_tree_ifmatch(chain[i], kif) &&
+			    (!ports || pf_rule_tree_portmatch(chain[i],
+			    los[p], hi)))
+				cnt++;
+		in->ports[p].lo = los[p];
+		in->ports[p].leaf = malloc(cnt * sizeof(struct pf_rule_cls),
+		    M_TEMP, M_WAITOK|M_CANFAIL);
+		if (in->ports[p].leaf == NULL)
+			return (ENOMEM);
+		pf_rule_tree_leaf(in->ports[p].leaf, chain, n, kif, ports,
+		    los[p], hi);
+	}
+	return (0);
+}
+
+/*
+ * Build the tree of one class.  The rules that can match are listed
+ * in chain[], their interfaces in kifs[].  Interface and port levels
+ * are only split while the leaves stay within a few times the size of
+ * the class, so a ruleset with many interfaces and port ranges cannot
+ * blow up.
+ */
+int
+pf_rule_tree_class(struct pf_rule_tree *t, int c, struct pf_rule **chain,
+    u_int32_t n, struct pfi_kif **kifs, u_int16_t *los)
+{
+	struct pfi_kif	*kif;
+	u_int32_t	 i, j, nkifs, cnt, budget;
+	int		 ports, error;
+
+	/* interfaces that rules bind to directly, in pointer order */
+	nkifs = 0;
+	for (i = 0; i < n; i++) {
+		kif = chain[i]->kif;
+		if (kif == NULL || kif->pfik_group != NULL)
+			continue;
+		for (j = nkifs; j > 0 && kifs[j - 1] > kif; j--)
+			;
+		if (j > 0 && kifs[j - 1] == kif)
+			continue;
+		bcopy(&kifs[j], &kifs[j + 1], (nkifs - j) * sizeof(*kifs));
+		kifs[j] = kif;
+		nkifs++;
+	}
+
+	ports = (c % PF_RC_NPROTO == PF_RC_TCP ||
+	    c % PF_RC_NPROTO == PF_RC_UDP);
+	budget = PF_RULE_TREE_FACTOR * (n + 1) + PF_RULE_TREE_SLACK;
+	for (;;) {
+		kif = nkifs ? &pf_rule_tree_otherif : NULL;
+		cnt = pf_rule_tree_count(chain, n, kif, ports, los, budget);
+		for (i = 0; i < nkifs && cnt <= budget; i++)
+			cnt += pf_rule_tree_count(chain, n, kifs[i], ports,
+			    los, budget - cnt);
+		if (cnt <= budget)
+			break;
+		if (ports)
+			ports = 0;
+		else if (nkifs)
+			nkifs = 0;
+		else
+			break;
+	}
+
+	if (nkifs) {
+		t->cls[c].ifs = malloc(nkifs * sizeof(struct pf_rule_inode),
+		    M_TEMP, M_WAITOK|M_CANFAIL|M_ZERO);
+		if (t->cls[c].ifs == NULL)
+			return (ENOMEM);
+		t->cls[c].nifs = nkifs;
+		for (i = 0; i < nkifs; i++)
+			if ((error = pf_rule_tree_inode(&t->cls[c].ifs[i],
+			    chain, n, kifs[i], ports, los)) != 0)
+				return (error);
+	}
+	kif = nkifs ? &pf_rule_tree_otherif : NULL;
+	return (pf_rule_tree_inode(&t->cls[c].any, chain, n, kif, ports, los));
+}
+
+/*
+ * Compile a rule list into a decision tree.  Sleeps for memory and
+ * fails only if the tree cannot be allocated at all, in which case
+ * the caller must not install the rules.  An empty list gets no tree.
+ */
+int
+pf_rule_tree_build(struct pf_rulequeue *rules, struct pf_rule_tree **tp)
+{
+	struct pf_rule_tree	*t;
+	struct pf_rule		*r, **all, **chain;
+	struct pfi_kif		**kifs;
+	u_int16_t		*los;
+	u_int32_t		 i, n, rcount;
+	sa_family_t		 af;
+	int			 c, error = 0;
+
+	*tp = NULL;
+	rcount = 0;
+	TAILQ_FOREACH(r, rules, entries)
+		rcount++;
+	if (rcount == 0)
+		return (0);
+
+	t = malloc(sizeof(*t), M_TEMP, M_WAITOK|M_CANFAIL|M_ZERO);
+	all = malloc(rcount * sizeof(*all), M_TEMP, M_WAITOK|M_CANFAIL);
+	chain = malloc(rcount * sizeof(*chain), M_TEMP, M_WAITOK|M_CANFAIL);
+	kifs = malloc(rcount * sizeof(*kifs), M_TEMP, M_WAITOK|M_CANFAIL);
+	los = malloc((2 * rcount + 1) * sizeof(*los), M_TEMP,
+	    M_WAITOK|M_CANFAIL);
+	if (t == NULL || all == NULL || chain == NULL || kifs == NULL ||
+	    los == NULL) {
+		error = ENOMEM;
+		goto done;
+	}
+
+	i = 0;
+	TAILQ_FOREACH(r, rules, entries)
+		all[i++] = r;
+
+	for (c = 0; c < PF_RC_COUNT; c++) {
+		/* the rules that can match a packet of this class */
+		af = (c >= PF_RC_NPROTO) ? AF_INET6 : AF_INET;
+		n = 0;
+		for (i = 0; i < rcount; i++) {
+			r = all[i];
+			if (r->af && r->af != af)
+				continue;
+			if (r->proto && pf_rule_class(af, r->proto) != c)
+				continue;
+			chain[n++] = r;
+		}
+		if ((error = pf_rule_tree_class(t, c, chain, n, kifs,
+		    los)) != 0)
+			break;
+	}
+
+ done:
+	if (los != NULL)
+		free(los, M_TEMP);
+	if (kifs != NULL)
+		free(kifs, M_TEMP);
+	if (chain != NULL)
+		free(chain, M_TEMP);
+	if (all != NULL)
+		free(all, M_TEMP);
+	if (error)
+		pf_rule_tree_free(t);
+	else
+		*tp = t;
+	return (error);
+}
+
+void
+pf_rule_tree_inode_free(struct pf_rule_inode *in)
+{
+	u_int32_t	p;
+
+	if (in->ports == NULL)
+		return;
+	for (p = 0; p < in->nports; p++)
+		if (in->ports[p].leaf != NULL)
+			free(in->ports[p].leaf, M_TEMP);
+	free(in->ports, M_TEMP);
+}
+
+void
+pf_rule_tree_free(struct pf_rule_tree *t)
+{
+	u_int32_t	i;
+	int		c;
+
+	if (t == NULL)
+		return;
+	for (c = 0; c < PF_RC_COUNT; c++) {
+		if (t->cls[c].ifs != NULL) {
+			for (i = 0; i < t->cls[c].nifs; i++)
+				pf_rule_tree_inode_free(&t->cls[c].ifs[i]);
+			free(t->cls[c].ifs, M_TEMP);
+		}
+		pf_rule_tree_inode_free(&t->cls[c].any);
+	}
+	free(t, M_TEMP);
+}
+
+/*
+ * Position the cursor at the start of the leaf for its packet in rs,
+ * or on the plain rule list if rs has no tree or the cursor has left
+ * the trees because a match rule rewrote the destination port.
+ */
+struct pf_rule *
+pf_rule_first(struct pf_ruleset *rs, struct pf_rule_cursor *rc)
+{
+	struct pf_rule_tree	*t = rs->rules.active.tree;
+	struct pf_rule_inode	*in;
+	int			 lo, hi, mid;
+
+	if (rc == NULL)
+		return (TAILQ_FIRST(rs->rules.active.ptr));
+	if (rc->cls < 0 || t == NULL) {
+		rc->ce = NULL;
+		return (TAILQ_FIRST(rs->rules.active.ptr));
+	}
+
+	in = &t->cls[rc->cls].any;
+	lo = 0;
+	hi = (int)t->cls[rc->cls].nifs - 1;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (t->cls[rc->cls].ifs[mid].kif == rc->kif) {
+			in = &t->cls[rc->cls].ifs[mid];
+			break;
+		}
+		if (t->cls[rc->cls].ifs[mid].kif < rc->kif)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	/* last interval starting at or below the port */
+	lo = 0;
+	hi = (int)in->nports - 1;
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (in->ports[mid].lo <= rc->dport)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	rc->ce = in->ports[lo].leaf;
+	return (rc->ce->rule);
+}
+
 int
 pf_addr_wrap_neq(struct pf_addr_wrap *aw1, struct pf_addr_wrap *aw2)
 {
@@ -2301,7 +3195,8 @@ pf_tag_packet(struct mbuf *m, int tag, int rtableid)
 
 void
 pf_step_into_anchor(int *depth, struct pf_ruleset **rs,
-    struct pf_rule **r, struct pf_rule **a, int *match)
+    struct pf_rule **r, struct pf_rule **a, int *match,
+    struct pf_rule_cursor *rc)
 {
 	struct pf_anchor_stackframe	*f;
 
@@ -2311,13 +3206,14 @@ pf_step_into_anchor(int *depth, struct pf_ruleset **rs,
 	if (*depth >= sizeof(pf_anchor_stack) /
 	    sizeof(pf_anchor_stack[0])) {
 		log(LOG_ERR, "pf_step_into_anchor: stack overflow\n");
-		*r = TAILQ_NEXT(*r, entries);
+		*r = PF_RULE_NEXT(*r, rc);
 		return;
 	} else if (*depth == 0 && a != NULL)
 		*a = *r;
 	f = pf_anchor_stack + (*depth)++;
 	f->rs = *rs;
 	f->r = *r;
+	f->ce = (rc != NULL) ? rc->ce : NULL;
 	if ((*r)->anchor_wildcard) {
 		f->parent = &(*r)->anchor->children;
 		if ((f->child = RB_MIN(pf_anchor_node, f->parent)) ==
@@ -2331,12 +3227,13 @@ pf_step_into_anchor(int *depth, struct pf_ruleset **rs,
 		f->child = NULL;
 		*rs = &(*r)->anchor->ruleset;
 	}
-	*r = TAILQ_FIRST((*rs)->rules.active.ptr);
+	*r = pf_rule_first(*rs, rc);
 }
 
 int
 pf_step_out_of_anchor(int *depth, struct pf_ruleset **rs,
-    struct pf_rule **r, struct pf_rule **a, int *match)
+    struct pf_rule **r, struct pf_rule **a, int *match,
+    struct pf_rule_cursor *rc)
 {
 	struct pf_anchor_stackframe	*f;
 	int quick = 0;
@@ -2354,7 +3251,7 @@ pf_step_out_of_anchor(int *depth, struct pf_ruleset **rs,
 			f->child = RB_NEXT(pf_anchor_node, f->parent, f->child);
 			if (f->child != NULL) {
 				*rs = &f->child->ruleset;
-				*r = TAILQ_FIRST((*rs)->rules.active.ptr);
+				*r = pf_rule_first(*rs, rc);
 				if (*r == NULL)
 					continue;
 				else
@@ -2367,7 +3264,9 @@ pf_step_out_of_anchor(int *depth, struct pf_ruleset **rs,
 		*rs = f->rs;
 		if (f->r->anchor->match || (match != NULL && *match))
 			quick = f->r->quick;
-		*r = TAILQ_NEXT(f->r, entries);
+		if (rc != NULL)
+			rc->ce = rc->cls < 0 ? NULL : f->ce;
+		*r = PF_RULE_NEXT(f->r, rc);
 	} while (*r == NULL);
 
 	return (quick);
@@ -2741,6 +3640,7 @@ pf_test_rule(struct pf_rule **rm, struct pf_state **sm, int direction,
 	int			 tag = -1;
 	int			 asd = 0;
 	int			 match = 0;
+	struct pf_rule_cursor	 rc;
 	int			 state_icmp = 0, icmp_dir, multi;
 	u_int16_t		 virtual_type, virtual_id;
 	u_int8_t		 icmptype = 0, icmpcode = 0;
@@ -2805,71 +3705,74 @@ pf_test_rule(struct pf_rule **rm, struct pf_state **sm, int direction,
 	pd->osport = pd->nsport;
 	pd->odport = pd->ndport;
 
-	r = TAILQ_FIRST(pf_main_ruleset.rules.active.ptr);
+	rc.cls = pf_rule_index_enable ? pf_rule_class(af, pd->proto) : -1;
+	rc.kif = kif;
+	rc.dport = ntohs(pd->ndport);
+	r = pf_rule_first(&pf_main_ruleset, &rc);
 	while (r != NULL) {
 		r->evaluations++;
 		if (pfi_kif_match(r->kif, kif) == r->ifnot)
-			r = r->skip[PF_SKIP_IFP].ptr;
+			r = PF_RULE_SKIP(r, &rc, PF_SKIP_IFP);
 		else if (r->direction && r->direction != direction)
-			r = r->skip[PF_SKIP_DIR].ptr;
+			r = PF_RULE_SKIP(r, &rc, PF_SKIP_DIR);
 		else if (r->onrdomain >= 0  &&
 		    (r->onrdomain == pd->rdomain) == r->ifnot)
-			r = r->skip[PF_SKIP_RDOM].ptr;
+			r = PF_RULE_SKIP(r, &rc, PF_SKIP_RDOM);
 		else if (r->af && r->af != af)
-			r = r->skip[PF_SKIP_AF].ptr;
+			r = PF_RULE_SKIP(r, &rc, PF_SKIP_AF);
 		else if (r->proto && r->proto != pd->proto)
-			r = r->skip[PF_SKIP_PROTO].ptr;
+			r = PF_RULE_SKIP(r, &rc, PF_SKIP_PROTO);
 		else if (PF_MISMATCHAW(&r->src.addr, &pd->nsaddr, af,
 		    r->src.neg, kif, act.rtableid))
-			r = r->skip[PF_SKIP_SRC_ADDR].ptr;
+			r = PF_RULE_SKIP(r, &rc, PF_SKIP_SRC_ADDR);
 		/* tcp/udp only. port_op always 0 in other cases */
 		else if (r->src.port_op && !pf_match_port(r->src.port_op,
 		    r->src.port[0], r->src.port[1], pd->nsport))
-			r = r->skip[PF_SKIP_SRC_PORT].ptr;
+			r = PF_RULE_SKIP(r, &rc, PF_SKIP_SRC_PORT);
 		else if (PF_MISMATCHAW(&r->dst.addr, &pd->ndaddr, af,
 		    r->dst.neg, NULL, act.rtableid))
-			r = r->skip[PF_SKIP_DST_ADDR].ptr;
+			r = PF_RULE_SKIP(r, &rc, PF_SKIP_DST_ADDR);
 		/* tcp/udp only. port_op always 0 in other cases */
 		else if (r->dst.port_op && !pf_match_port(r->dst.port_op,
 		    r->dst.port[0], r->dst.port[1], pd->ndport))
-			r = r->skip[PF_SKIP_DST_PORT].ptr;
+			r = PF_RULE_SKIP(r, &rc, PF_SKIP_DST_PORT);
 		/* icmp only. type always 0 in other cases */
 		else if (r->type && r->type != icmptype + 1)
-			r = TAILQ_NEXT(r, entries);
+			r = PF_RULE_NEXT(r, &rc);
 		/* icmp only. type always 0 in other cases */
 		else if (r->code && r->code != icmpcode + 1)
-			r = TAILQ_NEXT(r, entries);
+			r = PF_RULE_NEXT(r, &rc);
 		else if (r->tos && !(r->tos == pd->tos))
-			r = TAILQ_NEXT(r, entries);
+			r = PF_RULE_NEXT(r, &rc);
 		else if (r->rule_flag & PFRULE_FRAGMENT)
-			r = TAILQ_NEXT(r, entries);
+			r = PF_RULE_NEXT(r, &rc);
 		else if (pd->proto == IPPROTO_TCP &&
 		    (r->flagset & th->th_flags) != r->flags)
-			r = TAILQ_NEXT(r, entries);
+			r = PF_RULE_NEXT(r, &rc);
 		/* tcp/udp only. uid.op always 0 in other cases */
 		else if (r->uid.op && (pd->lookup.done || (pd->lookup.done =
 		    pf_socket_lookup(direction, pd), 1)) &&
 		    !pf_match_uid(r->uid.op, r->uid.uid[0], r->uid.uid[1],
 		    pd->lookup.uid))
-			r = TAILQ_NEXT(r, entries);
+			r = PF_RULE_NEXT(r, &rc);
 		/* tcp/udp only. gid.op always 0 in other cases */
 		else if (r->gid.op && (pd->lookup.done || (pd->lookup.done =
 		    pf_socket_lookup(direction, pd), 1)) &&
 		    !pf_match_gid(r->gid.op, r->gid.gid[0], r->gid.gid[1],
 		    pd->lookup.gid))
-			r = TAILQ_NEXT(r, entries);
+			r = PF_RULE_NEXT(r, &rc);
 		else if (r->prob &&
 		    r->prob <= arc4random_uniform(UINT_MAX - 1) + 1)
-			r = TAILQ_NEXT(r, entries);
+			r = PF_RULE_NEXT(r, &rc);
 		else if (r->match_tag && !pf_match_tag(m, r, &tag))
-			r = TAILQ_NEXT(r, entries);
+			r = PF_RULE_NEXT(r, &rc);
 		else if (r->rcv_kif && !pf_match_rcvif(m, r))
-			r = TAILQ_NEXT(r, entries);
+			r = PF_RULE_NEXT(r, &rc);
 		else if (r->os_fingerprint != PF_OSFP_ANY &&
 		    (pd->proto != IPPROTO_TCP || !pf_osfp_match(
 		    pf_osfp_fingerprint(pd, m, off, th),
 		    r->os_fingerprint)))
-			r = TAILQ_NEXT(r, entries);
+			r = PF_RULE_NEXT(r, &rc);
 		else {
 			if (r->tag)
 				tag = r->tag;
@@ -2892,6 +3795,16 @@ pf_test_rule(struct pf_rule **rm, struct pf_state **sm, int direction,
 						    PFRES_MEMORY);
 						goto cleanup;
 					}
+					/*
+					 * The leaves were chosen for the
+					 * old port.  Go on from here on
+					 * the plain rule lists, in this
+					 * ruleset and the enclosing ones.
+					 */
+					if (ntohs(pd->ndport) != rc.dport) {
+						rc.cls = -1;
+						rc.ce = NULL;
+					}
 					if (r->log || act.log & PF_LOG_MATCHES)
 						PFLOG_PACKET(kif, h, m, af,
 						    direction, reason, r,
@@ -2909,13 +3822,13 @@ pf_test_rule(struct pf_rule **rm, struct pf_state **sm, int direction,
 
 				if ((*rm)->quick)
 					break;
-				r = TAILQ_NEXT(r, entries);
+				r = PF_RULE_NEXT(r, &rc);
 			} else
 				pf_step_into_anchor(&asd, &ruleset,
-				    &r, &a, &match);
+				    &r, &a, &match, &rc);
 		}
 		if (r == NULL && pf_step_out_of_anchor(&asd, &ruleset,
-		    &r, &a, &match))
+		    &r, &a, &match, &rc))
 			break;
 	}
 	r = *rm;
@@ -3442,10 +4355,10 @@ pf_test_fragment(struct pf_rule **rm, int direction, struct pfi_kif *kif,
 				r = TAILQ_NEXT(r, entries);
 			} else
 				pf_step_into_anchor(&asd, &ruleset,
-				    &r, &a, &match);
+				    &r, &a, &match, NULL);
 		}
 		if (r == NULL && pf_step_out_of_anchor(&asd, &ruleset,
-		    &r, &a, &match))
+		    &r, &a, &match, NULL))
 			break;
 	}
 	r = *rm;
@@ -5171,6 +6084,12 @@ pf_route(struct mbuf **m, struct pf_rule *r, int dir, struct ifnet *oifp,
 
 	in_proto_cksum_out(m0, ifp);
 
+	if (m0->m_pkthdr.csum_flags & M_TCP_TSO) {
+		error = ip_tso_output(ifp, m0, sintosa(dst), NULL,
+		    ifp->if_mtu);
+		goto done;
+	}
+
 	if (ntohs(ip->ip_len) <= ifp->if_mtu) {
 		ip->ip_sum = 0;
 		if (ifp->if_capabilities & IFCAP_CSUM_IPv4) {
@@ -5847,6 +6766,7 @@ pf_test(int dir, struct ifnet *ifp, struct mbuf **m0,
 #if NPFSYNC > 0
 			pfsync_update_state(s);
 #endif /* NPFSYNC */
+			pf_state_wheel_update(s);
 			r = s->rule.ptr;
 			a = s->anchor.ptr;
 			pd.pflog |= s->log;
@@ -5869,6 +6789,7 @@ pf_test(int dir, struct ifnet *ifp, struct mbuf **m0,
 #if NPFSYNC > 0
 			pfsync_update_state(s);
 #endif /* NPFSYNC */
+			pf_state_wheel_update(s);
 			r = s->rule.ptr;
 			a = s->anchor.ptr;
 			pd.pflog |= s->log;
@@ -5885,6 +6806,7 @@ pf_test(int dir, struct ifnet *ifp, struct mbuf **m0,
 #if NPFSYNC > 0
 			pfsync_update_state(s);
 #endif /* NPFSYNC */
+			pf_state_wheel_update(s);
 			r = s->rule.ptr;
 			a = s->anchor.ptr;
 			pd.pflog |= s->log;
@@ -5907,6 +6829,7 @@ pf_test(int dir, struct ifnet *ifp, struct mbuf **m0,
 #if NPFSYNC > 0
 			pfsync_update_state(s);
 #endif /* NPFSYNC */
+			pf_state_wheel_update(s);
 			r = s->rule.ptr;
 			a = s->anchor.ptr;
 			pd.pflog |= s->log;
@@ -6138,6 +7061,7 @@ pf_test6(int fwdir, struct ifnet *ifp, struct mbuf **m0,
 #if NPFSYNC > 0
 			pfsync_update_state(s);
 #endif /* NPFSYNC */
+			pf_state_wheel_update(s);
 			r = s->rule.ptr;
 			a = s->anchor.ptr;
 			pd.pflog |= s->log;
@@ -6160,6 +7084,7 @@ pf_test6(int fwdir, struct ifnet *ifp, struct mbuf **m0,
 #if NPFSYNC > 0
 			pfsync_update_state(s);
 #endif /* NPFSYNC */
+			pf_state_wheel_update(s);
 			r = s->rule.ptr;
 			a = s->anchor.ptr;
 			pd.pflog |= s->log;
@@ -6183,6 +7108,7 @@ pf_test6(int fwdir, struct ifnet *ifp, struct mbuf **m0,
 #if NPFSYNC > 0
 			pfsync_update_state(s);
 #endif /* NPFSYNC */
+			pf_state_wheel_update(s);
 			r = s->rule.ptr;
 			a = s->anchor.ptr;
 			pd.pflog |= s->log;
@@ -6198,6 +7124,7 @@ pf_test6(int fwdir, struct ifnet *ifp, struct mbuf **m0,
 #if NPFSYNC > 0
 			pfsync_update_state(s);
 #endif /* NPFSYNC */
+			pf_state_wheel_update(s);
 			r = s->rule.ptr;
 			a = s->anchor.ptr;
 			pd.pflog |= s->log;
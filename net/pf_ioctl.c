@@ -160,10 +160,10 @@ pfattach(int num)
 	    "pfsrctrpl", NULL);
 	pool_init(&pf_sn_item_pl, sizeof(struct pf_sn_item), 0, 0, 0,
 	    "pfsnitempl", NULL);
-	pool_init(&pf_state_pl, sizeof(struct pf_state), 0, 0, 0, "pfstatepl",
-	    NULL);
-	pool_init(&pf_state_key_pl, sizeof(struct pf_state_key), 0, 0, 0,
-	    "pfstatekeypl", NULL);
+	pool_init(&pf_state_pl, sizeof(struct pf_state), 0, 0, PR_CACHE,
+	    "pfstatepl", NULL);
+	pool_init(&pf_state_key_pl, sizeof(struct pf_state_key), 0, 0,
+	    PR_CACHE, "pfstatekeypl", NULL);
 	pool_init(&pf_state_item_pl, sizeof(struct pf_state_item), 0, 0, 0,
 	    "pfstateitempl", NULL);
 	pool_init(&pf_rule_item_pl, sizeof(struct pf_rule_item), 0, 0, 0,
@@ -189,6 +189,7 @@ pfattach(int num)
 	pf_altqs_active = &pf_altqs[0];
 	pf_altqs_inactive = &pf_altqs[1];
 	TAILQ_INIT(&state_list);
+	pf_state_hash_init();
 
 	/* default rule should never be garbage collected */
 	pf_default_rule.entries.tqe_prev = &pf_default_rule.entries.tqe_next;
@@ -751,6 +752,7 @@ pf_commit_rules(u_int32_t ticket, char *anchor)
 	struct pf_ruleset	*rs;
 	struct pf_rule		*rule, **old_array;
 	struct pf_rulequeue	*old_rules;
+	struct pf_rule_tree	*tree, *old_tree;
 	int			 s, error;
 	u_int32_t		 old_rcount;
 
@@ -766,8 +768,17 @@ pf_commit_rules(u_int32_t ticket, char *anchor)
 			return (error);
 	}
 
+	/* Compile the new rules before anything is swapped. */
+	tree = NULL;
+	if (pf_rule_index_enable) {
+		error = pf_rule_tree_build(rs->rules.inactive.ptr, &tree);
+		if (error != 0)
+			return (error);
+	}
+
 	/* Swap rules, keep the old. */
 	s = splsoftnet();
+	old_tree = rs->rules.active.tree;
 	old_rules = rs->rules.active.ptr;
 	old_rcount = rs->rules.active.rcount;
 	old_array = rs->rules.active.ptr_array;
@@ -779,11 +790,13 @@ pf_commit_rules(u_int32_t ticket, char *anchor)
 	rs->rules.inactive.ptr_array = old_array;
 	rs->rules.inactive.rcount = old_rcount;
 
+	rs->rules.active.tree = tree;
+
 	rs->rules.active.ticket = rs->rules.inactive.ticket;
 	pf_calc_skip_steps(rs->rules.active.ptr);
 
-
 	/* Purge the old rule list. */
+	pf_rule_tree_free(old_tree);
 	while ((rule = TAILQ_FIRST(old_rules)) != NULL)
 		pf_rm_rule(old_rules, rule);
 	if (rs->rules.inactive.ptr_array)
@@ -879,6 +892,8 @@ pfioctl(dev_t dev, u_long cmd, caddr_t addr, int flags, struct proc *p)
 		case DIOCNATLOOK:
 		case DIOCSETDEBUG:
 		case DIOCGETSTATES:
+		case DIOCGETSTATESBATCH:
+		case DIOCGETPURGESTATS:
 		case DIOCGETTIMEOUT:
 		case DIOCCLRRULECTRS:
 		case DIOCGETLIMIT:
@@ -922,6 +937,8 @@ pfioctl(dev_t dev, u_long cmd, caddr_t addr, int flags, struct proc *p)
 		case DIOCGETSTATE:
 		case DIOCGETSTATUS:
 		case DIOCGETSTATES:
+		case DIOCGETSTATESBATCH:
+		case DIOCGETPURGESTATS:
 		case DIOCGETTIMEOUT:
 		case DIOCGETLIMIT:
 		case DIOCGETALTQS:
@@ -1245,6 +1262,10 @@ pfioctl(dev_t dev, u_long cmd, caddr_t addr, int flags, struct proc *p)
 			}
 		}
 
+		/* the tree points at the rules, walk the list meanwhile */
+		pf_rule_tree_free(ruleset->rules.active.tree);
+		ruleset->rules.active.tree = NULL;
+
 		if (pcr->action == PF_CHANGE_REMOVE) {
 			pf_rm_rule(ruleset->rules.active.ptr, oldrule);
 			ruleset->rules.active.rcount--;
@@ -1270,6 +1291,18 @@ pfioctl(dev_t dev, u_long cmd, caddr_t addr, int flags, struct proc *p)
 		ruleset->rules.active.ticket++;
 
 		pf_calc_skip_steps(ruleset->rules.active.ptr);
+		/*
+		 * The change has taken effect.  Without memory for a new
+		 * tree the ruleset is walked as a plain list until the
+		 * next change or commit.
+		 */
+		if (pf_rule_index_enable) {
+			struct pf_rule_tree	*tree = NULL;
+
+			if (pf_rule_tree_build(ruleset->rules.active.ptr,
+			    &tree) == 0)
+				ruleset->rules.active.tree = tree;
+		}
 		pf_remove_if_empty_ruleset(ruleset);
 
 		break;
@@ -1436,6 +1469,45 @@ pfioctl(dev_t dev, u_long cmd, caddr_t addr, int flags, struct proc *p)
 		break;
 	}
 
+	case DIOCGETSTATESBATCH: {
+		struct pfioc_states_batch *psb =
+		    (struct pfioc_states_batch *)addr;
+		struct pf_state		*state = NULL;
+		struct pfsync_state	*pstore;
+		u_int32_t		 nr, max;
+
+		if (psb->psb_len < 0 ||
+		    (unsigned)psb->psb_len < sizeof(*pstore)) {
+			error = EINVAL;
+			break;
+		}
+		max = psb->psb_len / sizeof(*pstore);
+		if (max > PF_STATES_BATCH_MAX)
+			max = PF_STATES_BATCH_MAX;
+
+		pstore = malloc(max * sizeof(*pstore), M_TEMP, M_WAITOK);
+
+		/* export the whole batch, then copy it out at once */
+		for (nr = 0; nr < max; nr++) {
+			state = pf_state_next_byid(&psb->psb_cookie,
+			    nr == 0 && (psb->psb_flags & PFSB_FIRST));
+			if (state == NULL)
+				break;
+			pfsync_state_export(&pstore[nr], state);
+		}
+
+		if (nr > 0)
+			error = copyout(pstore, psb->psb_states,
+			    nr * sizeof(*pstore));
+		free(pstore, M_TEMP);
+		if (error)
+			goto fail;
+
+		psb->psb_len = nr * sizeof(*pstore);
+		psb->psb_flags = (state == NULL) ? PFSB_DONE : 0;
+		break;
+	}
+
 	case DIOCGETSTATUS: {
 		struct pf_status *s = (struct pf_status *)addr;
 		bcopy(&pf_status, s, sizeof(struct pf_status));
@@ -1467,11 +1539,20 @@ pfioctl(dev_t dev, u_long cmd, caddr_t addr, int flags, struct proc *p)
 		bzero(pf_status.counters, sizeof(pf_status.counters));
 		bzero(pf_status.fcounters, sizeof(pf_status.fcounters));
 		bzero(pf_status.scounters, sizeof(pf_status.scounters));
+		pf_purge_time = pf_purge_checks = 0;
 		pf_status.since = time_second;
 		
 		break;
 	}
 
+	case DIOCGETPURGESTATS: {
+		struct pfioc_purge_stats *pp = (struct pfioc_purge_stats *)addr;
+
+		pp->pp_time = pf_purge_time;
+		pp->pp_checks = pf_purge_checks;
+		break;
+	}
+
 	case DIOCNATLOOK: {
 		struct pfioc_natlook	*pnl = (struct pfioc_natlook *)addr;
 		struct pf_state_key	*sk;
@@ -2280,6 +2361,12 @@ pfioctl(dev_t dev, u_long cmd, caddr_t addr, int flags, struct proc *p)
 			if (pf_default_rule.timeout[i] == PFTM_INTERVAL &&
 			    pf_default_rule.timeout[i] < old)
 				wakeup(pf_purge_thread);
+			/* any adaptive change may scale timeouts down */
+			if (pf_default_rule.timeout[i] < old ||
+			    (pf_default_rule.timeout[i] != old &&
+			    (i == PFTM_ADAPTIVE_START ||
+			    i == PFTM_ADAPTIVE_END)))
+				pf_wheel_rescan = 1;
 		}
 		pfi_xcommit();
 		pf_trans_set_commit();
@@ -2436,6 +2523,17 @@ pfioctl(dev_t dev, u_long cmd, caddr_t addr, int flags, struct proc *p)
 		break;
 	}
 
+	case DIOCSETRULEIDX: {
+		u_int32_t	*enable = (u_int32_t *)addr;
+
+		/*
+		 * Switching off is immediate, rulesets get compiled
+		 * when they are committed the next time.
+		 */
+		pf_rule_index_enable = (*enable != 0);
+		break;
+	}
+
 	default:
 		error = ENODEV;
 		break;
@@ -35,6 +35,7 @@
 #include <sys/socket.h>
 #include <sys/mbuf.h>
 #include <sys/kernel.h>
+#include <sys/malloc.h>
 #include <sys/pool.h>
 #include <sys/syslog.h>
 
@@ -94,6 +95,11 @@
 #define KENTRY_RNF_ROOT(ke) \
 		((((struct radix_node *)(ke))->rn_flags & RNF_ROOT) != 0)
 
+#define PFR_LPM(kt, af)	((af) == AF_INET ?			\
+    &(kt)->pfrkt_lpm4 : &(kt)->pfrkt_lpm6)
+#define PFR_LPM_MINSIZE		16
+#define PFR_LPM_PATCHMAX	64	/* rebuild for larger changes */
+
 #define NO_ADDRESSES		(-1)
 #define ENQUEUE_UNMARKED_ONLY	(1)
 #define INVERT_NEG_FLAG		(1)
@@ -181,6 +187,29 @@ int			 pfr_table_count(struct pfr_table *, int);
 int			 pfr_skip_table(struct pfr_table *,
 			    struct pfr_ktable *, int);
 struct pfr_kentry	*pfr_kentry_byidx(struct pfr_ktable *, int, int);
+struct pfr_lpm		*pfr_lpm_alloc(int);
+void			 pfr_lpm_free(struct pfr_lpm *);
+int			 pfr_lpm_grow(struct pfr_lpm *);
+int			 pfr_lpm_cmp(u_int32_t *, u_int32_t *, int);
+int			 pfr_lpm_inc(u_int32_t *, int);
+void			 pfr_lpm_prefix(struct pfr_kentry *, int, u_int32_t *,
+			    u_int32_t *);
+int			 pfr_lpm_find(struct pfr_lpm *, u_int32_t *);
+int			 pfr_lpm_mark(struct pfr_lpm *, u_int32_t *,
+			    struct pfr_kentry *);
+int			 pfr_lpm_split(struct pfr_lpm *, int, u_int32_t *);
+void			 pfr_lpm_compact(struct pfr_lpm *, int, int);
+int			 pfr_lpm_walk(struct radix_node *, void *, u_int);
+struct pfr_lpm		*pfr_lpm_create(struct radix_node_head *, int);
+void			 pfr_lpm_build(struct pfr_ktable *);
+void			 pfr_lpm_destroy(struct pfr_ktable *);
+int			 pfr_lpm_prepare(struct pfr_ktable *,
+			    struct pfr_kentryworkq *);
+void			 pfr_lpm_insert(struct pfr_ktable *,
+			    struct pfr_kentry *);
+void			 pfr_lpm_remove(struct pfr_ktable *,
+			    struct pfr_kentry *);
+struct pfr_kentry	*pfr_lpm_match(struct pfr_lpm *, struct pf_addr *);
 
 RB_PROTOTYPE(pfr_ktablehead, pfr_ktable, pfrkt_tree, pfr_ktable_compare);
 RB_GENERATE(pfr_ktablehead, pfr_ktable, pfrkt_tree, pfr_ktable_compare);
@@ -783,9 +812,14 @@ pfr_lookup_addr(struct pfr_ktable *kt, struct pfr_addr *ad, int exact)
 		if (ke && KENTRY_RNF_ROOT(ke))
 			ke = NULL;
 	} else {
-		ke = (struct pfr_kentry *)rn_match(&sa, head);
-		if (ke && KENTRY_RNF_ROOT(ke))
-			ke = NULL;
+		if (*PFR_LPM(kt, ad->pfra_af) != NULL)
+			ke = pfr_lpm_match(*PFR_LPM(kt, ad->pfra_af),
+			    SUNION2PF(&sa, ad->pfra_af));
+		else {
+			ke = (struct pfr_kentry *)rn_match(&sa, head);
+			if (ke && KENTRY_RNF_ROOT(ke))
+				ke = NULL;
+		}
 		if (exact && ke && KENTRY_NETWORK(ke))
 			ke = NULL;
 	}
@@ -853,8 +887,9 @@ pfr_insert_kentries(struct pfr_ktable *kt,
     struct pfr_kentryworkq *workq, long tzero)
 {
 	struct pfr_kentry	*p;
-	int			 rv, n = 0;
+	int			 rv, rebuild, n = 0;
 
+	rebuild = pfr_lpm_prepare(kt, workq);
 	SLIST_FOREACH(p, workq, pfrke_workq) {
 		rv = pfr_route_kentry(kt, p);
 		if (rv) {
@@ -868,6 +903,8 @@ pfr_insert_kentries(struct pfr_ktable *kt,
 		YIELD(n, 1);
 	}
 	kt->pfrkt_cnt += n;
+	if (rebuild)
+		pfr_lpm_build(kt);
 }
 
 int
@@ -898,14 +935,17 @@ pfr_remove_kentries(struct pfr_ktable *kt,
     struct pfr_kentryworkq *workq)
 {
 	struct pfr_kentry	*p;
-	int			 n = 0;
+	int			 rebuild, n = 0;
 
+	rebuild = pfr_lpm_prepare(kt, workq);
 	SLIST_FOREACH(p, workq, pfrke_workq) {
 		pfr_unroute_kentry(kt, p);
 		++n;
 		YIELD(n, 1);
 	}
 	kt->pfrkt_cnt -= n;
+	if (rebuild)
+		pfr_lpm_build(kt);
 	pfr_destroy_kentries(workq);
 }
 
@@ -915,6 +955,7 @@ pfr_clean_node_mask(struct pfr_ktable *kt,
 {
 	struct pfr_kentry	*p;
 
+	pfr_lpm_destroy(kt);
 	SLIST_FOREACH(p, workq, pfrke_workq) {
 		pfr_unroute_kentry(kt, p);
 	}
@@ -1000,6 +1041,8 @@ pfr_route_kentry(struct pfr_ktable *kt, struct pfr_kentry *ke)
 		rn = rn_addroute(&ke->pfrke_sa, &mask, head, ke->pfrke_node, 0);
 	} else
 		rn = rn_addroute(&ke->pfrke_sa, NULL, head, ke->pfrke_node, 0);
+	if (rn != NULL)
+		pfr_lpm_insert(kt, ke);
 	splx(s);
 
 	return (rn == NULL ? -1 : 0);
@@ -1024,6 +1067,8 @@ pfr_unroute_kentry(struct pfr_ktable *kt, struct pfr_kentry *ke)
 		rn = rn_delete(&ke->pfrke_sa, &mask, head, NULL);
 	} else
 		rn = rn_delete(&ke->pfrke_sa, NULL, head, NULL);
+	if (rn != NULL)
+		pfr_lpm_remove(kt, ke);
 	splx(s);
 
 	if (rn == NULL) {
@@ -1709,6 +1754,8 @@ pfr_commit_ktable(struct pfr_ktable *kt, long tzero)
 		SWAP(struct radix_node_head *, kt->pfrkt_ip6,
 		    shadow->pfrkt_ip6);
 		SWAP(int, kt->pfrkt_cnt, shadow->pfrkt_cnt);
+		pfr_lpm_destroy(kt);
+		pfr_lpm_build(kt);
 		pfr_clstats_ktable(kt, tzero, 1);
 	}
 	nflags = ((shadow->pfrkt_flags & PFR_TFLAG_USRMASK) |
@@ -1915,6 +1962,8 @@ pfr_create_ktable(struct pfr_table *tbl, long tzero, int attachruleset,
 		pfr_destroy_ktable(kt, 0);
 		return (NULL);
 	}
+	if (attachruleset)
+		pfr_lpm_build(kt);
 	kt->pfrkt_tzero = tzero;
 
 	return (kt);
@@ -1941,6 +1990,7 @@ pfr_destroy_ktable(struct pfr_ktable *kt, int flushaddr)
 		pfr_clean_node_mask(kt, &addrq);
 		pfr_destroy_kentries(&addrq);
 	}
+	pfr_lpm_destroy(kt);
 	if (kt->pfrkt_ip4 != NULL)
 		free((caddr_t)kt->pfrkt_ip4, M_RTABLE);
 	if (kt->pfrkt_ip6 != NULL)
@@ -1972,6 +2022,404 @@ pfr_lookup_table(struct pfr_table *tbl)
 	    (struct pfr_ktable *)tbl));
 }
 
+/*
+ * Table lookup copies.  Each one keeps the address space of a family
+ * as sorted intervals, so matching an address is a binary search over
+ * a flat array instead of a walk down the radix tree.  Single changes
+ * are patched in, large ones rebuild the copy from the tree.  A table
+ * without a copy, e.g. after running out of memory, uses the tree.
+ */
+struct pfr_lpm_build {
+	struct pfr_lpm		*b_pl;
+	struct pfr_kentry	*b_stack[129];	/* enclosing prefixes */
+	int			 b_depth;
+};
+
+struct pfr_lpm *
+pfr_lpm_alloc(int words)
+{
+	struct pfr_lpm	*pl;
+
+	pl = malloc(sizeof(*pl), M_RTABLE, M_NOWAIT|M_ZERO);
+	if (pl == NULL)
+		return (NULL);
+	pl->pl_words = words;
+	pl->pl_size = PFR_LPM_MINSIZE;
+	pl->pl_key = malloc(pl->pl_size * words * sizeof(*pl->pl_key),
+	    M_RTABLE, M_NOWAIT);
+	pl->pl_ent = malloc(pl->pl_size * sizeof(*pl->pl_ent),
+	    M_RTABLE, M_NOWAIT);
+	if (pl->pl_key == NULL || pl->pl_ent == NULL) {
+		pfr_lpm_free(pl);
+		return (NULL);
+	}
+	return (pl);
+}
+
+void
+pfr_lpm_free(struct pfr_lpm *pl)
+{
+	if (pl->pl_key != NULL)
+		free(pl->pl_key, M_RTABLE);
+	if (pl->pl_ent != NULL)
+		free(pl->pl_ent, M_RTABLE);
+	free(pl, M_RTABLE);
+}
+
+int
+pfr_lpm_grow(struct pfr_lpm *pl)
+{
+	u_int32_t		 *key;
+	struct pfr_kentry	**ent;
+	int			  size = pl->pl_size * 2;
+
+	key = malloc(size * pl->pl_words * sizeof(*key), M_RTABLE, M_NOWAIT);
+	ent = malloc(size * sizeof(*ent), M_RTABLE, M_NOWAIT);
+	if (key == NULL || ent == NULL) {
+		if (key != NULL)
+			free(key, M_RTABLE);
+		if (ent != NULL)
+			free(ent, M_RTABLE);
+		return (ENOMEM);
+	}
+	bcopy(pl->pl_key, key, pl->pl_cnt * pl->pl_words * sizeof(*key));
+	bcopy(pl->pl_ent, ent, pl->pl_cnt * sizeof(*ent));
+	free(pl->pl_key, M_RTABLE);
+	free(pl->pl_ent, M_RTABLE);
+	pl->pl_key = key;
+	pl->pl_ent = ent;
+	pl->pl_size = size;
+	return (0);
+}
+
+int
+pfr_lpm_cmp(u_int32_t *a, u_int32_t *b, int words)
+{
+	int	i;
+
+	for (i = 0; i < words; i++)
+		if (a[i] != b[i])
+			return (a[i] < b[i] ? -1 : 1);
+	return (0);
+}
+
+/* returns 1 if the address wrapped around past the last one */
+int
+pfr_lpm_inc(u_int32_t *k, int words)
+{
+	int	i;
+
+	for (i = words - 1; i >= 0; i--)
+		if (++k[i] != 0)
+			return (0);
+	return (1);
+}
+
+/* first and last address of an entry, in host byte order */
+void
+pfr_lpm_prefix(struct pfr_kentry *ke, int words, u_int32_t *s, u_int32_t *e)
+{
+	struct pf_addr	*a = SUNION2PF(&ke->pfrke_sa, ke->pfrke_af);
+	u_int32_t	 m;
+	int		 i, net = ke->pfrke_net;
+
+	for (i = 0; i < words; i++, net -= 32) {
+		if (net >= 32)
+			m = 0;
+		else if (net <= 0)
+			m = 0xffffffff;
+		else
+			m = 0xffffffff >> net;
+		s[i] = ntohl(a->addr32[i]) & ~m;
+		e[i] = s[i] | m;
+	}
+}
+
+/* index of the interval holding k */
+int
+pfr_lpm_find(struct pfr_lpm *pl, u_int32_t *k)
+{
+	int	lo = 0, hi = pl->pl_cnt - 1, mid, w = pl->pl_words;
+
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (pfr_lpm_cmp(&pl->pl_key[mid * w], k, w) <= 0)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return (lo);
+}
+
+/* while building: addresses from k on belong to ke */
+int
+pfr_lpm_mark(struct pfr_lpm *pl, u_int32_t *k, struct pfr_kentry *ke)
+{
+	int	w = pl->pl_words, n = pl->pl_cnt;
+
+	if (n > 0 && pfr_lpm_cmp(&pl->pl_key[(n - 1) * w], k, w) == 0) {
+		pl->pl_ent[n - 1] = ke;
+		if (n > 1 && pl->pl_ent[n - 2] == ke)
+			pl->pl_cnt--;
+		return (0);
+	}
+	if (n > 0 && pl->pl_ent[n - 1] == ke)
+		return (0);
+	if (n == pl->pl_size && pfr_lpm_grow(pl))
+		return (ENOMEM);
+	bcopy(k, &pl->pl_key[n * w], w * sizeof(*k));
+	pl->pl_ent[n] = ke;
+	pl->pl_cnt++;
+	return (0);
+}
+
+/* start a new interval at idx and k, with the owner of its predecessor */
+int
+pfr_lpm_split(struct pfr_lpm *pl, int idx, u_int32_t *k)
+{
+	int	w = pl->pl_words;
+
+	if (pl->pl_cnt == pl->pl_size && pfr_lpm_grow(pl))
+		return (ENOMEM);
+	memmove(&pl->pl_key[(idx + 1) * w], &pl->pl_key[idx * w],
+	    (pl->pl_cnt - idx) * w * sizeof(*k));
+	memmove(&pl->pl_ent[idx + 1], &pl->pl_ent[idx],
+	    (pl->pl_cnt - idx) * sizeof(*pl->pl_ent));
+	bcopy(k, &pl->pl_key[idx * w], w * sizeof(*k));
+	pl->pl_ent[idx] = pl->pl_ent[idx - 1];
+	pl->pl_cnt++;
+	return (0);
+}
+
+/* merge intervals from..to into their predecessor if they have its owner */
+void
+pfr_lpm_compact(struct pfr_lpm *pl, int from, int to)
+{
+	int	i, n, w = pl->pl_words;
+
+	if (from < 1)
+		from = 1;
+	if (to > pl->pl_cnt - 1)
+		to = pl->pl_cnt - 1;
+	for (i = n = from; i <= to; i++) {
+		if (pl->pl_ent[i] == pl->pl_ent[n - 1])
+			continue;
+		if (i != n) {
+			bcopy(&pl->pl_key[i * w], &pl->pl_key[n * w],
+			    w * sizeof(*pl->pl_key));
+			pl->pl_ent[n] = pl->pl_ent[i];
+		}
+		n++;
+	}
+	if (n > to)
+		return;
+	memmove(&pl->pl_key[n * w], &pl->pl_key[(to + 1) * w],
+	    (pl->pl_cnt - to - 1) * w * sizeof(*pl->pl_key));
+	memmove(&pl->pl_ent[n], &pl->pl_ent[to + 1],
+	    (pl->pl_cnt - to - 1) * sizeof(*pl->pl_ent));
+	pl->pl_cnt -= to + 1 - n;
+}
+
+/*
+ * The tree hands out entries by ascending address, more specific
+ * prefixes of the same address first.  Keep the prefixes enclosing
+ * the current address on a stack and start an interval whenever the
+ * innermost one changes.
+ */
+int
+pfr_lpm_walk(struct radix_node *rn, void *arg, u_int id)
+{
+	struct pfr_lpm_build	*b = arg;
+	struct pfr_lpm		*pl = b->b_pl;
+	struct pfr_kentry	*ke = (struct pfr_kentry *)rn, *top;
+	u_int32_t		 s[4], e[4], ts[4], te[4];
+	int			 i, w = pl->pl_words;
+
+	pfr_lpm_prefix(ke, w, s, e);
+	while (b->b_depth > 0) {
+		top = b->b_stack[b->b_depth - 1];
+		pfr_lpm_prefix(top, w, ts, te);
+		if (pfr_lpm_cmp(te, s, w) >= 0) {
+			if (pfr_lpm_cmp(ts, s, w) != 0)
+				break;
+			/* same address as the innermost, shorter prefix */
+			for (i = b->b_depth; i > 0 &&
+			    b->b_stack[i - 1]->pfrke_net > ke->pfrke_net; i--)
+				b->b_stack[i] = b->b_stack[i - 1];
+			b->b_stack[i] = ke;
+			b->b_depth++;
+			return (0);
+		}
+		b->b_depth--;
+		pfr_lpm_inc(te, w);
+		if (pfr_lpm_mark(pl, te, b->b_depth > 0 ?
+		    b->b_stack[b->b_depth - 1] : NULL))
+			return (ENOMEM);
+	}
+	b->b_stack[b->b_depth++] = ke;
+	return (pfr_lpm_mark(pl, s, ke));
+}
+
+struct pfr_lpm *
+pfr_lpm_create(struct radix_node_head *head, int words)
+{
+	struct pfr_lpm_build	 b;
+	struct pfr_lpm		*pl;
+	struct pfr_kentry	*top;
+	u_int32_t		 ts[4], te[4];
+
+	if ((pl = pfr_lpm_alloc(words)) == NULL)
+		return (NULL);
+	bzero(&b, sizeof(b));
+	b.b_pl = pl;
+	bzero(ts, sizeof(ts));
+	if (pfr_lpm_mark(pl, ts, NULL) ||
+	    rn_walktree(head, pfr_lpm_walk, &b))
+		goto fail;
+	while (b.b_depth > 0) {
+		top = b.b_stack[--b.b_depth];
+		pfr_lpm_prefix(top, words, ts, te);
+		if (pfr_lpm_inc(te, words))
+			break;	/* up to the end of the address space */
+		if (pfr_lpm_mark(pl, te, b.b_depth > 0 ?
+		    b.b_stack[b.b_depth - 1] : NULL))
+			goto fail;
+	}
+	return (pl);
+ fail:
+	pfr_lpm_free(pl);
+	return (NULL);
+}
+
+/* build the lookup copies kt is missing */
+void
+pfr_lpm_build(struct pfr_ktable *kt)
+{
+	if (kt->pfrkt_lpm4 == NULL)
+		kt->pfrkt_lpm4 = pfr_lpm_create(kt->pfrkt_ip4, 1);
+	if (kt->pfrkt_lpm6 == NULL)
+		kt->pfrkt_lpm6 = pfr_lpm_create(kt->pfrkt_ip6, 4);
+}
+
+void
+pfr_lpm_destroy(struct pfr_ktable *kt)
+{
+	if (kt->pfrkt_lpm4 != NULL) {
+		pfr_lpm_free(kt->pfrkt_lpm4);
+		kt->pfrkt_lpm4 = NULL;
+	}
+	if (kt->pfrkt_lpm6 != NULL) {
+		pfr_lpm_free(kt->pfrkt_lpm6);
+		kt->pfrkt_lpm6 = NULL;
+	}
+}
+
+/*
+ * Called before a batch of changes to kt.  Returns non-zero if the
+ * lookup copies have to be built once the batch is done.
+ */
+int
+pfr_lpm_prepare(struct pfr_ktable *kt, struct pfr_kentryworkq *workq)
+{
+	struct pfr_kentry	*p;
+	int			 n = 0;
+
+	if (kt->pfrkt_lpm4 == NULL || kt->pfrkt_lpm6 == NULL)
+		return (1);
+	SLIST_FOREACH(p, workq, pfrke_workq)
+		if (++n > PFR_LPM_PATCHMAX) {
+			pfr_lpm_destroy(kt);
+			return (1);
+		}
+	return (0);
+}
+
+void
+pfr_lpm_insert(struct pfr_ktable *kt, struct pfr_kentry *ke)
+{
+	struct pfr_lpm	**plp = PFR_LPM(kt, ke->pfrke_af), *pl = *plp;
+	u_int32_t	  s[4], e[4];
+	int		  i, j, k, w;
+
+	if (pl == NULL)
+		return;
+	w = pl->pl_words;
+	pfr_lpm_prefix(ke, w, s, e);
+	i = pfr_lpm_find(pl, s);
+	if (pfr_lpm_cmp(&pl->pl_key[i * w], s, w) != 0 &&
+	    pfr_lpm_split(pl, ++i, s))
+		goto fail;
+	j = pfr_lpm_find(pl, e);
+	if (!pfr_lpm_inc(e, w) && (j + 1 == pl->pl_cnt ||
+	    pfr_lpm_cmp(&pl->pl_key[(j + 1) * w], e, w) != 0) &&
+	    pfr_lpm_split(pl, j + 1, e))
+		goto fail;
+	/* ke takes over wherever the match was a shorter prefix */
+	for (k = i; k <= j; k++)
+		if (pl->pl_ent[k] == NULL ||
+		    pl->pl_ent[k]->pfrke_net < ke->pfrke_net)
+			pl->pl_ent[k] = ke;
+	pfr_lpm_compact(pl, i, j + 1);
+	return;
+ fail:
+	pfr_lpm_free(pl);
+	*plp = NULL;
+}
+
+/* ke has already been taken out of the radix tree */
+void
+pfr_lpm_remove(struct pfr_ktable *kt, struct pfr_kentry *ke)
+{
+	struct pfr_lpm		*pl = *PFR_LPM(kt, ke->pfrke_af);
+	struct radix_node_head	*head;
+	union sockaddr_union	 sa;
+	struct pfr_kentry	*q;
+	u_int32_t		 s[4], e[4];
+	int			 i, j, k, n, w;
+
+	if (pl == NULL)
+		return;
+	w = pl->pl_words;
+	pfr_lpm_prefix(ke, w, s, e);
+	i = pfr_lpm_find(pl, s);
+	j = pfr_lpm_find(pl, e);
+
+	bzero(&sa, sizeof(sa));
+	if (ke->pfrke_af == AF_INET) {
+		sa.sin.sin_len = sizeof(sa.sin);
+		sa.sin.sin_family = AF_INET;
+		head = kt->pfrkt_ip4;
+	} else {
+		sa.sin6.sin6_len = sizeof(sa.sin6);
+		sa.sin6.sin6_family = AF_INET6;
+		head = kt->pfrkt_ip6;
+	}
+	for (k = i; k <= j; k++) {
+		if (pl->pl_ent[k] != ke)
+			continue;
+		/* what matches the start of the interval matches all of it */
+		for (n = 0; n < w; n++)
+			SUNION2PF(&sa, ke->pfrke_af)->addr32[n] =
+			    htonl(pl->pl_key[k * w + n]);
+		q = (struct pfr_kentry *)rn_match(&sa, head);
+		if (q != NULL && KENTRY_RNF_ROOT(q))
+			q = NULL;
+		pl->pl_ent[k] = q;
+	}
+	pfr_lpm_compact(pl, i, j + 1);
+}
+
+struct pfr_kentry *
+pfr_lpm_match(struct pfr_lpm *pl, struct pf_addr *a)
+{
+	u_int32_t	k[4];
+	int		i;
+
+	for (i = 0; i < pl->pl_words; i++)
+		k[i] = ntohl(a->addr32[i]);
+	return (pl->pl_ent[pfr_lpm_find(pl, k)]);
+}
+
 int
 pfr_match_addr(struct pfr_ktable *kt, struct pf_addr *a, sa_family_t af)
 {
@@ -1986,6 +2434,10 @@ pfr_match_addr(struct pfr_ktable *kt, struct pf_addr *a, sa_family_t af)
 	switch (af) {
 #ifdef INET
 	case AF_INET:
+		if (kt->pfrkt_lpm4 != NULL) {
+			ke = pfr_lpm_match(kt->pfrkt_lpm4, a);
+			break;
+		}
 		pfr_sin.sin_addr.s_addr = a->addr32[0];
 		ke = (struct pfr_kentry *)rn_match(&pfr_sin, kt->pfrkt_ip4);
 		if (ke && KENTRY_RNF_ROOT(ke))
@@ -1994,6 +2446,10 @@ pfr_match_addr(struct pfr_ktable *kt, struct pf_addr *a, sa_family_t af)
 #endif /* INET */
 #ifdef INET6
 	case AF_INET6:
+		if (kt->pfrkt_lpm6 != NULL) {
+			ke = pfr_lpm_match(kt->pfrkt_lpm6, a);
+			break;
+		}
 		bcopy(a, &pfr_sin6.sin6_addr, sizeof(pfr_sin6.sin6_addr));
 		ke = (struct pfr_kentry *)rn_match(&pfr_sin6, kt->pfrkt_ip6);
 		if (ke && KENTRY_RNF_ROOT(ke))
@@ -2023,6 +2479,10 @@ pfr_update_stats(struct pfr_ktable *kt, struct pf_addr *a, sa_family_t af,
 	switch (af) {
 #ifdef INET
 	case AF_INET:
+		if (kt->pfrkt_lpm4 != NULL) {
+			ke = pfr_lpm_match(kt->pfrkt_lpm4, a);
+			break;
+		}
 		pfr_sin.sin_addr.s_addr = a->addr32[0];
 		ke = (struct pfr_kentry *)rn_match(&pfr_sin, kt->pfrkt_ip4);
 		if (ke && KENTRY_RNF_ROOT(ke))
@@ -2031,6 +2491,10 @@ pfr_update_stats(struct pfr_ktable *kt, struct pf_addr *a, sa_family_t af,
 #endif /* INET */
 #ifdef INET6
 	case AF_INET6:
+		if (kt->pfrkt_lpm6 != NULL) {
+			ke = pfr_lpm_match(kt->pfrkt_lpm6, a);
+			break;
+		}
 		bcopy(a, &pfr_sin6.sin6_addr, sizeof(pfr_sin6.sin6_addr));
 		ke = (struct pfr_kentry *)rn_match(&pfr_sin6, kt->pfrkt_ip6);
 		if (ke && KENTRY_RNF_ROOT(ke))
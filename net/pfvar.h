@@ -536,6 +536,18 @@ union pf_rule_ptr {
 	u_int32_t		 nr;
 };
 
+/*
+ * Rule classes of the compiled ruleset decision tree.  A packet can
+ * only match rules whose address family and protocol are compatible
+ * with it, so the class is the first level of the tree.
+ */
+#define PF_RC_TCP		0
+#define PF_RC_UDP		1
+#define PF_RC_ICMP		2
+#define PF_RC_OTHER		3
+#define PF_RC_NPROTO		4
+#define PF_RC_COUNT		(2 * PF_RC_NPROTO)	/* inet, inet6 */
+
 #define	PF_ANCHOR_NAME_SIZE	 64
 
 struct pf_rule {
@@ -652,6 +664,46 @@ struct pf_rule {
 	}			divert, divert_packet;
 };
 
+/*
+ * Decision tree over the active rules of a ruleset, built when the
+ * ruleset is committed.  The packet's class selects a list of
+ * interface nodes, its interface one of them and, for tcp and udp, its
+ * destination port an interval of that node.  Each interval leads to
+ * a leaf listing, in ruleset order, the rules that can match there,
+ * with skip steps recalculated along the leaf.  A NULL rule ends it.
+ */
+struct pf_rule_cls {
+	struct pf_rule		*rule;
+	struct pf_rule_cls	*skip[PF_SKIP_COUNT];
+};
+
+struct pf_rule_pnode {
+	u_int16_t		 lo;		/* first port, host order */
+	struct pf_rule_cls	*leaf;
+};
+
+struct pf_rule_inode {
+	struct pfi_kif		*kif;		/* NULL for any other */
+	struct pf_rule_pnode	*ports;		/* sorted, ports[0].lo == 0 */
+	u_int32_t		 nports;
+};
+
+struct pf_rule_tree {
+	struct {
+		struct pf_rule_inode	*ifs;	/* sorted by kif */
+		u_int32_t		 nifs;
+		struct pf_rule_inode	 any;
+	}			 cls[PF_RC_COUNT];
+};
+
+/* where a rule walk stands, ce is NULL when walking the plain list */
+struct pf_rule_cursor {
+	struct pf_rule_cls	*ce;
+	struct pfi_kif		*kif;
+	int			 cls;		/* -1 to walk the plain list */
+	u_int16_t		 dport;		/* host order */
+};
+
 /* rule flags */
 #define	PFRULE_DROP		0x0000
 #define	PFRULE_RETURNRST	0x0001
@@ -777,6 +829,8 @@ struct pf_state_key {
 	u_int8_t	 proto;
 
 	RB_ENTRY(pf_state_key)	 entry;
+	LIST_ENTRY(pf_state_key) hentry;
+	u_int32_t		 hash;
 	struct pf_statelisthead	 states;
 	struct pf_state_key	*reverse;
 	struct inpcb		*inp;
@@ -799,6 +853,7 @@ struct pf_state {
 	TAILQ_ENTRY(pf_state)	 sync_list;
 	TAILQ_ENTRY(pf_state)	 entry_list;
 	RB_ENTRY(pf_state)	 entry_id;
+	LIST_ENTRY(pf_state)	 entry_wheel;
 	struct pf_state_peer	 src;
 	struct pf_state_peer	 dst;
 	struct pf_rule_slist	 match_rules;
@@ -814,6 +869,7 @@ struct pf_state {
 	u_int32_t		 creation;
 	u_int32_t	 	 expire;
 	u_int32_t		 pfsync_time;
+	u_int32_t		 wheel_expire;	/* purge wheel slot, 0 if none */
 	u_int16_t		 qid;
 	u_int16_t		 pqid;
 	u_int16_t		 tag;
@@ -833,6 +889,7 @@ struct pf_state {
 
 	/* XXX */
 	u_int8_t		 sync_updates;
+	u_int8_t		 wheel_timeout;	/* timeout when put on wheel */
 
 	int			 rtableid[2];	/* rtables stack and wire */
 	u_int8_t		 min_ttl;
@@ -964,6 +1021,7 @@ struct pf_ruleset {
 		struct {
 			struct pf_rulequeue	*ptr;
 			struct pf_rule		**ptr_array;
+			struct pf_rule_tree	*tree;
 			u_int32_t		 rcount;
 			u_int32_t		 ticket;
 			int			 open;
@@ -1114,12 +1172,28 @@ struct pfr_kentry_all {
 
 SLIST_HEAD(pfr_ktableworkq, pfr_ktable);
 RB_HEAD(pfr_ktablehead, pfr_ktable);
+/*
+ * Lookup copy of the addresses of one family in a table: the address
+ * space cut into intervals sorted by their first address, each with
+ * the entry that is the longest match for all of it.  The radix tree
+ * stays the management copy.
+ */
+struct pfr_lpm {
+	u_int32_t		 *pl_key;	/* pl_words per interval */
+	struct pfr_kentry	**pl_ent;	/* NULL where nothing matches */
+	int			  pl_cnt;
+	int			  pl_size;
+	int			  pl_words;	/* 1 for inet, 4 for inet6 */
+};
+
 struct pfr_ktable {
 	struct pfr_tstats	 pfrkt_ts;
 	RB_ENTRY(pfr_ktable)	 pfrkt_tree;
 	SLIST_ENTRY(pfr_ktable)	 pfrkt_workq;
 	struct radix_node_head	*pfrkt_ip4;
 	struct radix_node_head	*pfrkt_ip6;
+	struct pfr_lpm		*pfrkt_lpm4;
+	struct pfr_lpm		*pfrkt_lpm6;
 	struct pfr_ktable	*pfrkt_shadow;
 	struct pfr_ktable	*pfrkt_root;
 	struct pf_ruleset	*pfrkt_rs;
@@ -1516,6 +1590,21 @@ struct pfioc_states {
 #define ps_states	ps_u.psu_states
 };
 
+struct pfioc_states_batch {
+	struct pf_state_cmp	 psb_cookie;	/* last state returned */
+	u_int32_t		 psb_flags;
+#define PFSB_FIRST		 0x01		/* start at the first state */
+#define PFSB_DONE		 0x02		/* no states left */
+	int			 psb_len;
+	struct pfsync_state	*psb_states;
+};
+#define PF_STATES_BATCH_MAX	512
+
+struct pfioc_purge_stats {
+	u_int64_t	 pp_time;	/* usecs spent purging states */
+	u_int64_t	 pp_checks;	/* states checked by purge */
+};
+
 struct pfioc_src_nodes {
 	int	psn_len;
 	union {
@@ -1674,6 +1763,9 @@ struct pfioc_iface {
 #define DIOCCLRIFFLAG	_IOWR('D', 90, struct pfioc_iface)
 #define DIOCKILLSRCNODES	_IOWR('D', 91, struct pfioc_src_node_kill)
 #define DIOCSETREASS	_IOWR('D', 92, u_int32_t)
+#define DIOCSETRULEIDX	_IOWR('D', 93, u_int32_t)
+#define DIOCGETSTATESBATCH	_IOWR('D', 94, struct pfioc_states_batch)
+#define DIOCGETPURGESTATS	_IOWR('D', 95, struct pfioc_purge_stats)
 
 #ifdef _KERNEL
 RB_HEAD(pf_src_tree, pf_src_node);
@@ -1703,6 +1795,11 @@ extern int			 pf_tbladdr_setup(struct pf_ruleset *,
 extern void			 pf_tbladdr_remove(struct pf_addr_wrap *);
 extern void			 pf_tbladdr_copyout(struct pf_addr_wrap *);
 extern void			 pf_calc_skip_steps(struct pf_rulequeue *);
+extern int			 pf_rule_tree_build(struct pf_rulequeue *,
+				    struct pf_rule_tree **);
+extern void			 pf_rule_tree_free(struct pf_rule_tree *);
+extern int			 pf_rule_index_enable;
+extern void			 pf_state_hash_init(void);
 extern struct pool		 pf_src_tree_pl, pf_sn_item_pl, pf_rule_pl;
 extern struct pool		 pf_state_pl, pf_state_key_pl, pf_state_item_pl,
 				    pf_altq_pl, pf_rule_item_pl;
@@ -1712,6 +1809,12 @@ extern void			 pf_purge_expired_src_nodes(int);
 extern void			 pf_purge_expired_states(u_int32_t);
 extern void			 pf_unlink_state(struct pf_state *);
 extern void			 pf_free_state(struct pf_state *);
+extern void			 pf_state_wheel_insert(struct pf_state *,
+				    u_int32_t);
+extern void			 pf_state_wheel_update(struct pf_state *);
+extern int			 pf_wheel_rescan;
+extern u_int64_t		 pf_purge_time;
+extern u_int64_t		 pf_purge_checks;
 extern int			 pf_state_insert(struct pfi_kif *,
 				    struct pf_state_key *,
 				    struct pf_state_key *,
@@ -1728,6 +1831,7 @@ void				 pf_state_rm_src_node(struct pf_state *,
 				    struct pf_src_node *);
 
 extern struct pf_state		*pf_find_state_byid(struct pf_state_cmp *);
+extern struct pf_state		*pf_state_next_byid(struct pf_state_cmp *, int);
 extern struct pf_state		*pf_find_state_all(struct pf_state_key_cmp *,
 				    u_int, int *);
 extern void			 pf_print_state(struct pf_state *);
@@ -1937,10 +2041,11 @@ struct pf_os_fingerprint *
 void			 pf_print_host(struct pf_addr *, u_int16_t, u_int8_t);
 
 void			 pf_step_into_anchor(int *, struct pf_ruleset **,
-			    struct pf_rule **, struct pf_rule **, int *);
+			    struct pf_rule **, struct pf_rule **, int *,
+			    struct pf_rule_cursor *);
 int			 pf_step_out_of_anchor(int *, struct pf_ruleset **,
 			     struct pf_rule **, struct pf_rule **,
-			     int *);
+			     int *, struct pf_rule_cursor *);
 
 int			 pf_get_transaddr(struct pf_rule *, struct pf_pdesc *,
 			    struct pf_src_node **);
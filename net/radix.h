@@ -106,6 +106,8 @@ extern struct radix_mask {
 	rn_mkfreelist = (m);						\
 } while (0)
 
+struct rt_fib;
+
 struct radix_node_head {
 	struct	radix_node *rnh_treetop;
 	int	rnh_addrsize;		/* permit, but not require fixed keys */
@@ -129,6 +131,7 @@ struct radix_node_head {
 	struct	radix_node rnh_nodes[3];/* empty tree for common case */
 	int	rnh_multipath;		/* multipath? */
 	u_int	rnh_rtabelid;
+	struct	rt_fib *rnh_fib;	/* lookup copy, see rtfib.c */
 };
 
 #ifdef _KERNEL
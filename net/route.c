@@ -113,10 +113,12 @@
 #include <sys/kernel.h>
 #include <sys/queue.h>
 #include <sys/pool.h>
+#include <sys/timeout.h>
 
 #include <net/if.h>
 #include <net/route.h>
 #include <net/raw_cb.h>
+#include <net/rtfib.h>
 
 #include <netinet/in.h>
 #include <netinet/in_var.h>
@@ -136,6 +138,7 @@ struct ifaddr	*encap_findgwifa(struct sockaddr *, u_int);
 
 struct	route_cb	   route_cb;
 struct	rtstat		   rtstat;
+u_int32_t		   rtgeneration;	/* bumped on forwarding changes */
 struct	radix_node_head	***rt_tables;
 u_int8_t		   af2rtafidx[AF_MAX+1];
 u_int8_t		   rtafidx_max;
@@ -200,6 +203,14 @@ rtable_init(struct radix_node_head ***table, u_int id)
 			(*table)[i]->rnh_rtabelid = id;
 	}
 
+	/* lookup tables for the forwarding path, radix if this fails */
+	for (dom = domains; dom != NULL; dom = dom->dom_next)
+		if (dom->dom_rtattach && (dom->dom_family == AF_INET ||
+		    dom->dom_family == AF_INET6))
+			(*table)[af2rtafidx[dom->dom_family]]->rnh_fib =
+			    rt_fib_create((*table)[af2rtafidx[dom->dom_family]],
+			    dom->dom_family);
+
 	return (0);
 }
 
@@ -211,6 +222,7 @@ route_init(void)
 	pool_init(&rtentry_pool, sizeof(struct rtentry), 0, 0, 0, "rtentpl",
 	    NULL);
 	rn_init();	/* initialize all zeroes, all ones, mask table */
+	rt_fib_init();
 
 	bzero(af2rtafidx, sizeof(af2rtafidx));
 	rtafidx_max = 1;	/* must have NULL at index 0, so start at 1 */
@@ -325,7 +337,7 @@ rtalloc1(struct sockaddr *dst, int flags, u_int tableid)
 	info.rti_info[RTAX_DST] = dst;
 
 	rnh = rt_gettable(dst->sa_family, tableid);
-	if (rnh && (rn = rnh->rnh_matchaddr((caddr_t)dst, rnh)) &&
+	if (rnh && (rn = rt_fib_matchaddr(dst, rnh)) &&
 	    ((rn->rn_flags & RNF_ROOT) == 0)) {
 		newrt = rt = (struct rtentry *)rn;
 		if ((rt->rt_flags & RTF_CLONING) &&
@@ -747,6 +759,8 @@ rtrequest1(int req, struct rt_addrinfo *info, u_int8_t prio,
 		    info->rti_info[RTAX_NETMASK], rnh, rn)) == NULL)
 			senderr(ESRCH);
 		rt = (struct rtentry *)rn;
+		rt_fib_update(rnh, rt);
+		RT_GENCHANGE(rt, RTM_DELETE);
 
 		/* clean up any cloned children */
 		if ((rt->rt_flags & RTF_CLONING) != 0)
@@ -974,6 +988,8 @@ rtrequest1(int req, struct rt_addrinfo *info, u_int8_t prio,
 				((struct rtentry *)rn)->rt_flags |= RTF_MPATH;
 		}
 #endif
+		rt_fib_update(rnh, rt);
+		RT_GENCHANGE(rt, RTM_ADD);
 
 		if (ifa->ifa_rtrequest)
 			ifa->ifa_rtrequest(req, rt, info);
@@ -1014,6 +1030,7 @@ rt_setgate(struct rtentry *rt0, struct sockaddr *dst, struct sockaddr *gate,
 		old = NULL;
 	}
 	Bcopy(gate, (rt->rt_gateway = (struct sockaddr *)(new + dlen)), glen);
+	RT_GENCHANGE(rt, RTM_CHANGE);
 	if (old) {
 		Bcopy(dst, new, dlen);
 		Free(old);
@@ -1535,12 +1552,18 @@ rt_if_linkstate_change(struct radix_node *rn, void *arg, u_int id)
 				/* bring route up */
 				rt->rt_flags |= RTF_UP;
 				rn_mpath_reprio(rn, rt->rt_priority & RTP_MASK);
+				rt_fib_update(rt_gettable(rt_key(rt)->sa_family,
+				    id), rt);
+				RT_GENCHANGE(rt, RTM_CHANGE);
 			}
 		} else {
 			if (rt->rt_flags & RTF_UP) {
 				/* take route done */
 				rt->rt_flags &= ~RTF_UP;
 				rn_mpath_reprio(rn, rt->rt_priority | RTP_DOWN);
+				rt_fib_update(rt_gettable(rt_key(rt)->sa_family,
+				    id), rt);
+				RT_GENCHANGE(rt, RTM_CHANGE);
 			}
 		}
 		if_group_routechange(rt_key(rt), rt_mask(rt));
@@ -355,6 +355,20 @@ void		 rtlabel_unref(u_int16_t);
 
 extern struct route_cb route_cb;
 extern struct rtstat rtstat;
+extern u_int32_t rtgeneration;
+
+/*
+ * Invalidate cached forwarding decisions after request req on rt.
+ * Any added or changed route, cloned ones included, may be a better
+ * match for a cached destination.  Only the removal of a cloned or
+ * ARP route is skipped: a cache entry can only hold such a route
+ * itself and notices it is gone since it loses RTF_UP.
+ */
+#define	RT_GENCHANGE(rt, req) do {					\
+	if ((req) != RTM_DELETE ||					\
+	    ((rt)->rt_flags & (RTF_CLONED|RTF_LLINFO)) == 0)		\
+		rtgeneration++;						\
+} while (0)
 extern const struct sockaddr_rtin rt_defmask4;
 
 struct	socket;
@@ -0,0 +1,500 @@
+/*	$OpenBSD$	*/
+
+/*
+ * Copyright (c) 2011 The OpenBSD Foundation
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/socket.h>
+#include <sys/malloc.h>
+#include <sys/pool.h>
+#include <sys/queue.h>
+#include <sys/timeout.h>
+
+#include <net/if.h>
+#include <net/route.h>
+#include <net/rtfib.h>
+
+#include <netinet/in.h>
+#ifdef INET6
+#include <netinet6/in6_var.h>
+#endif
+
+#define RTFIB_HASHSIZE	1024
+
+struct pool		 rtfibnode_pool;
+struct pool		 rtfibent_pool;
+
+int			 rt_fib_plen(struct rt_fib *, caddr_t);
+struct rt_fibhead	*rt_fib_bucket(struct rt_fib *, u_int8_t *, int);
+struct rt_fibent	*rt_fib_find(struct rt_fib *, u_int8_t *, int);
+struct rt_fibent	*rt_fib_cover(struct rt_fib *, u_int8_t *, int);
+struct radix_node	*rt_fib_findrn(struct rt_fib *,
+			    struct radix_node_head *, u_int8_t *, int);
+void			 rt_fib_rehash(struct rt_fib *);
+void			 rt_fib_fill(void **, struct rt_fibent *);
+void			 rt_fib_replace(void **, struct rt_fibent *,
+			    struct rt_fibent *);
+int			 rt_fib_apply(struct rt_fib *, struct rt_fibent *,
+			    int, struct rt_fibent *);
+int			 rt_fib_skip(struct rt_fib *, struct sockaddr *);
+void			 rt_fib_freenode(void *);
+void			 rt_fib_disable(struct rt_fib *);
+void			 rt_fib_rebuild(void *);
+int			 rt_fib_rebuild1(struct radix_node *, void *, u_int);
+
+void
+rt_fib_init(void)
+{
+	pool_init(&rtfibnode_pool, sizeof(struct rt_fibnode), 0, 0, 0,
+	    "rtfibnode", NULL);
+	pool_init(&rtfibent_pool, sizeof(struct rt_fibent), 0, 0, 0,
+	    "rtfibent", NULL);
+}
+
+struct rt_fib *
+rt_fib_create(struct radix_node_head *rnh, sa_family_t af)
+{
+	struct rt_fib	*fib;
+
+	if ((fib = malloc(sizeof(*fib), M_RTABLE, M_NOWAIT|M_ZERO)) == NULL)
+		return (NULL);
+
+	switch (af) {
+	case AF_INET:
+		fib->fib_alen = sizeof(struct in_addr);
+		fib->fib_aoff = offsetof(struct sockaddr_in, sin_addr);
+		break;
+#ifdef INET6
+	case AF_INET6:
+		fib->fib_alen = sizeof(struct in6_addr);
+		fib->fib_aoff = offsetof(struct sockaddr_in6, sin6_addr);
+		break;
+#endif
+	default:
+		free(fib, M_RTABLE);
+		return (NULL);
+	}
+	fib->fib_af = af;
+	fib->fib_rnh = rnh;
+	timeout_set(&fib->fib_rebuild, rt_fib_rebuild, fib);
+
+	fib->fib_top = malloc(RTFIB_TOPSIZE * sizeof(void *), M_RTABLE,
+	    M_NOWAIT|M_ZERO);
+	if (fib->fib_top == NULL) {
+		free(fib, M_RTABLE);
+		return (NULL);
+	}
+	fib->fib_hash = hashinit(RTFIB_HASHSIZE, M_RTABLE, M_NOWAIT,
+	    &fib->fib_hashmask);
+	if (fib->fib_hash == NULL) {
+		free(fib->fib_top, M_RTABLE);
+		free(fib, M_RTABLE);
+		return (NULL);
+	}
+
+	return (fib);
+}
+
+/*
+ * Route lookup for the forwarding path.  Returns the same node as
+ * rnh_matchaddr(), but never the RNF_ROOT ones.
+ */
+struct radix_node *
+rt_fib_matchaddr(struct sockaddr *dst, struct radix_node_head *rnh)
+{
+	struct rt_fib	*fib = rnh->rnh_fib;
+	u_int8_t	*addr;
+	void		*p;
+	int		 i;
+
+	if (fib == NULL || fib->fib_disabled || dst->sa_family != fib->fib_af ||
+	    rt_fib_skip(fib, dst))
+		return (rnh->rnh_matchaddr((caddr_t)dst, rnh));
+
+	addr = (u_int8_t *)dst + fib->fib_aoff;
+	p = fib->fib_top[addr[0] << 8 | addr[1]];
+	for (i = 2; RTFIB_ISNODE(p); i++)
+		p = RTFIB_NODE(p)->fn_ent[addr[i]];
+	if (p == NULL)
+		return (NULL);
+
+	/* cloned routes below a cloning one are only in the radix tree */
+	if (((struct rtentry *)((struct rt_fibent *)p)->fe_rn)->rt_flags &
+	    RTF_CLONING)
+		return (rnh->rnh_matchaddr((caddr_t)dst, rnh));
+	return (((struct rt_fibent *)p)->fe_rn);
+}
+
+/*
+ * Scoped IPv6 addresses carry their interface in the address only
+ * inside the kernel; leave them, and routes for them, to the radix
+ * tree rather than depend on that.
+ */
+int
+rt_fib_skip(struct rt_fib *fib, struct sockaddr *sa)
+{
+#ifdef INET6
+	if (fib->fib_af == AF_INET6 &&
+	    IN6_IS_SCOPE_EMBED(&((struct sockaddr_in6 *)sa)->sin6_addr))
+		return (1);
+#endif
+	return (0);
+}
+
+/*
+ * Length of a contiguous mask, the full address length for host
+ * routes, -1 if the mask has holes.
+ */
+int
+rt_fib_plen(struct rt_fib *fib, caddr_t mask)
+{
+	u_int8_t	*p, b;
+	int		 i, len, plen = 0;
+
+	if (mask == NULL)
+		return (fib->fib_alen * 8);
+
+	p = (u_int8_t *)mask + fib->fib_aoff;
+	len = *(u_char *)mask - fib->fib_aoff;
+	if (len > fib->fib_alen)
+		len = fib->fib_alen;
+	for (i = 0; i < len; i++) {
+		if (p[i] == 0xff) {
+			plen += 8;
+			continue;
+		}
+		for (b = p[i]; b & 0x80; b <<= 1)
+			plen++;
+		if (b != 0)
+			return (-1);
+		for (i++; i < len; i++)
+			if (p[i] != 0)
+				return (-1);
+	}
+	return (plen);
+}
+
+struct rt_fibhead *
+rt_fib_bucket(struct rt_fib *fib, u_int8_t *addr, int plen)
+{
+	u_int32_t	h = plen;
+	int		i;
+
+	for (i = 0; i < fib->fib_alen; i++)
+		h = h * 31 + addr[i];
+	return (&fib->fib_hash[h & fib->fib_hashmask]);
+}
+
+struct rt_fibent *
+rt_fib_find(struct rt_fib *fib, u_int8_t *addr, int plen)
+{
+	struct rt_fibent	*fe;
+
+	LIST_FOREACH(fe, rt_fib_bucket(fib, addr, plen), fe_hash)
+		if (fe->fe_plen == plen &&
+		    bcmp(fe->fe_addr, addr, fib->fib_alen) == 0)
+			return (fe);
+	return (NULL);
+}
+
+/* longest prefix strictly covering addr/plen */
+struct rt_fibent *
+rt_fib_cover(struct rt_fib *fib, u_int8_t *addr, int plen)
+{
+	struct rt_fibent	*fe;
+	u_int8_t		 a[16];
+
+	bcopy(addr, a, fib->fib_alen);
+	while (--plen >= 0) {
+		a[plen / 8] &= ~(0x80 >> (plen % 8));
+		if ((fe = rt_fib_find(fib, a, plen)) != NULL)
+			return (fe);
+	}
+	return (NULL);
+}
+
+/* first route of the prefix in its dupedkey chain, as rn_match sees it */
+struct radix_node *
+rt_fib_findrn(struct rt_fib *fib, struct radix_node_head *rnh,
+    u_int8_t *addr, int plen)
+{
+	struct sockaddr_storage	 ss;
+	struct radix_node	*rn;
+
+	bzero(&ss, sizeof(ss));
+	ss.ss_len = fib->fib_aoff + fib->fib_alen;
+	ss.ss_family = fib->fib_af;
+	bcopy(addr, (caddr_t)&ss + fib->fib_aoff, fib->fib_alen);
+
+	for (rn = rnh->rnh_matchaddr((caddr_t)&ss, rnh); rn != NULL;
+	    rn = rn->rn_dupedkey) {
+		if (rn->rn_flags & RNF_ROOT)
+			continue;
+		if (bcmp(rn->rn_key + fib->fib_aoff, addr, fib->fib_alen))
+			break;
+		if (rt_fib_plen(fib, rn->rn_mask) == plen)
+			return (rn);
+	}
+	return (NULL);
+}
+
+void
+rt_fib_rehash(struct rt_fib *fib)
+{
+	struct rt_fibhead	*oh;
+	struct rt_fibent	*fe;
+	u_long			 omask, i;
+
+	oh = fib->fib_hash;
+	omask = fib->fib_hashmask;
+	fib->fib_hash = hashinit((omask + 1) * 2, M_RTABLE, M_NOWAIT,
+	    &fib->fib_hashmask);
+	if (fib->fib_hash == NULL) {
+		/* keep the old one */
+		fib->fib_hash = oh;
+		fib->fib_hashmask = omask;
+		return;
+	}
+	for (i = 0; i <= omask; i++)
+		while ((fe = LIST_FIRST(&oh[i])) != NULL) {
+			LIST_REMOVE(fe, fe_hash);
+			LIST_INSERT_HEAD(rt_fib_bucket(fib, fe->fe_addr,
+			    fe->fe_plen), fe, fe_hash);
+		}
+	free(oh, M_RTABLE);
+}
+
+/* push fe into every slot below that only has a shorter prefix */
+void
+rt_fib_fill(void **slot, struct rt_fibent *fe)
+{
+	struct rt_fibnode	*fn;
+	int			 i;
+
+	if (RTFIB_ISNODE(*slot)) {
+		fn = RTFIB_NODE(*slot);
+		for (i = 0; i < RTFIB_NODESIZE; i++)
+			rt_fib_fill(&fn->fn_ent[i], fe);
+	} else if (*slot == NULL ||
+	    ((struct rt_fibent *)*slot)->fe_plen < fe->fe_plen)
+		*slot = fe;
+}
+
+void
+rt_fib_replace(void **slot, struct rt_fibent *fe, struct rt_fibent *cover)
+{
+	struct rt_fibnode	*fn;
+	int			 i;
+
+	if (RTFIB_ISNODE(*slot)) {
+		fn = RTFIB_NODE(*slot);
+		for (i = 0; i < RTFIB_NODESIZE; i++)
+			rt_fib_replace(&fn->fn_ent[i], fe, cover);
+	} else if (*slot == fe)
+		*slot = cover;
+}
+
+/*
+ * Add fe to the trie, or take it out again and put its cover, which
+ * may be NULL, in its place.  Above the level where the prefix ends
+ * the path gets expanded into child nodes, on removal nodes that
+ * became uniform are folded back into their parent slot.
+ */
+int
+rt_fib_apply(struct rt_fib *fib, struct rt_fibent *fe, int remove,
+    struct rt_fibent *cover)
+{
+	void			**ent, **path[RTFIB_MAXLEVELS];
+	struct rt_fibnode	*fn;
+	u_int8_t		*addr = fe->fe_addr;
+	int			 k, end, idx, n, i;
+
+	ent = fib->fib_top;
+	for (k = 0; ; k++) {
+		end = RTFIB_TOPBITS + k * RTFIB_STRIDE;
+		idx = (k == 0) ? (addr[0] << 8 | addr[1]) : addr[k + 1];
+		if (fe->fe_plen <= end) {
+			n = 1 << (end - fe->fe_plen);
+			for (i = idx; i < idx + n; i++) {
+				if (!remove)
+					rt_fib_fill(&ent[i], fe);
+				else
+					rt_fib_replace(&ent[i], fe, cover);
+			}
+			break;
+		}
+		if (!RTFIB_ISNODE(ent[idx])) {
+			if (remove)
+				break;
+			if ((fn = pool_get(&rtfibnode_pool, PR_NOWAIT)) ==
+			    NULL)
+				return (ENOMEM);
+			for (i = 0; i < RTFIB_NODESIZE; i++)
+				fn->fn_ent[i] = ent[idx];
+			ent[idx] = RTFIB_MKNODE(fn);
+		}
+		path[k] = &ent[idx];
+		ent = RTFIB_NODE(ent[idx])->fn_ent;
+	}
+
+	if (!remove)
+		return (0);
+
+	while (--k >= 0) {
+		fn = RTFIB_NODE(*path[k]);
+		for (i = 1; i < RTFIB_NODESIZE; i++)
+			if (fn->fn_ent[i] != fn->fn_ent[0])
+				break;
+		if (i < RTFIB_NODESIZE || RTFIB_ISNODE(fn->fn_ent[0]))
+			break;
+		*path[k] = fn->fn_ent[0];
+		pool_put(&rtfibnode_pool, fn);
+	}
+	return (0);
+}
+
+/*
+ * Bring the FIB in line with the radix tree after routes for the
+ * prefix of rt were added, deleted or reordered.
+ */
+void
+rt_fib_update(struct radix_node_head *rnh, struct rtentry *rt)
+{
+	struct rt_fib		*fib = rnh->rnh_fib;
+	struct rt_fibent	*fe;
+	struct radix_node	*rn;
+	u_int8_t		 addr[16];
+	int			 plen, i;
+
+	if (fib == NULL || fib->fib_disabled ||
+	    rt_key(rt)->sa_family != fib->fib_af)
+		return;
+
+	/*
+	 * ARP, ND and other cloned host routes would each expand a
+	 * path down to the last level; they are found through the
+	 * radix tree below their cloning parent instead.
+	 */
+	if ((rt->rt_flags & RTF_CLONED) || rt_fib_skip(fib, rt_key(rt)))
+		return;
+
+	splsoftassert(IPL_SOFTNET);
+
+	if ((plen = rt_fib_plen(fib, (caddr_t)rt_mask(rt))) < 0) {
+		/* non-contiguous masks are left to the radix tree */
+		rt_fib_disable(fib);
+		return;
+	}
+	bcopy((caddr_t)rt_key(rt) + fib->fib_aoff, addr, fib->fib_alen);
+	for (i = plen; i < fib->fib_alen * 8; i++)
+		addr[i / 8] &= ~(0x80 >> (i % 8));
+
+	fe = rt_fib_find(fib, addr, plen);
+	rn = rt_fib_findrn(fib, rnh, addr, plen);
+
+	if (fe != NULL && rn != NULL)
+		fe->fe_rn = rn;
+	else if (fe == NULL && rn != NULL) {
+		if ((fe = pool_get(&rtfibent_pool, PR_NOWAIT|PR_ZERO)) ==
+		    NULL) {
+			rt_fib_disable(fib);
+			return;
+		}
+		bcopy(addr, fe->fe_addr, fib->fib_alen);
+		fe->fe_plen = plen;
+		fe->fe_rn = rn;
+		LIST_INSERT_HEAD(rt_fib_bucket(fib, addr, plen), fe, fe_hash);
+		if (++fib->fib_count > 4 * (fib->fib_hashmask + 1))
+			rt_fib_rehash(fib);
+		if (rt_fib_apply(fib, fe, 0, NULL) != 0)
+			rt_fib_disable(fib);
+	} else if (fe != NULL && rn == NULL) {
+		LIST_REMOVE(fe, fe_hash);
+		fib->fib_count--;
+		rt_fib_apply(fib, fe, 1, rt_fib_cover(fib, addr, plen));
+		pool_put(&rtfibent_pool, fe);
+	}
+}
+
+void
+rt_fib_freenode(void *p)
+{
+	struct rt_fibnode	*fn;
+	int			 i;
+
+	if (!RTFIB_ISNODE(p))
+		return;
+	fn = RTFIB_NODE(p);
+	for (i = 0; i < RTFIB_NODESIZE; i++)
+		rt_fib_freenode(fn->fn_ent[i]);
+	pool_put(&rtfibnode_pool, fn);
+}
+
+/*
+ * Give up on the FIB for this table, lookups go to the radix tree
+ * until it has been rebuilt from scratch.
+ */
+void
+rt_fib_disable(struct rt_fib *fib)
+{
+	struct rt_fibent	*fe;
+	u_long			 i;
+
+	fib->fib_disabled = 1;
+	timeout_add_sec(&fib->fib_rebuild, RTFIB_REBUILD_SECS);
+	for (i = 0; i < RTFIB_TOPSIZE; i++) {
+		rt_fib_freenode(fib->fib_top[i]);
+		fib->fib_top[i] = NULL;
+	}
+	for (i = 0; i <= fib->fib_hashmask; i++)
+		while ((fe = LIST_FIRST(&fib->fib_hash[i])) != NULL) {
+			LIST_REMOVE(fe, fe_hash);
+			pool_put(&rtfibent_pool, fe);
+		}
+	fib->fib_count = 0;
+}
+
+/*
+ * Refill a disabled FIB from the radix tree.  If memory is still short
+ * or a non-contiguous mask is still there, it disables itself again
+ * and the next attempt is scheduled.
+ */
+void
+rt_fib_rebuild(void *arg)
+{
+	struct rt_fib		*fib = arg;
+	struct radix_node_head	*rnh = fib->fib_rnh;
+	int			 s;
+
+	s = splsoftnet();
+	if (fib->fib_disabled) {
+		fib->fib_disabled = 0;
+		(*rnh->rnh_walktree)(rnh, rt_fib_rebuild1, fib);
+	}
+	splx(s);
+}
+
+int
+rt_fib_rebuild1(struct radix_node *rn, void *arg, u_int id)
+{
+	struct rt_fib		*fib = arg;
+
+	if (fib->fib_disabled)
+		return (EAGAIN);
+	rt_fib_update(fib->fib_rnh, (struct rtentry *)rn);
+	return (0);
+}
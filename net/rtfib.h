@@ -0,0 +1,77 @@
+/*	$OpenBSD$	*/
+
+/*
+ * Copyright (c) 2011 The OpenBSD Foundation
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _NET_RTFIB_H_
+#define _NET_RTFIB_H_
+
+/*
+ * Lookup-only copy of an inet or inet6 routing table.  The radix tree
+ * stays the authoritative table; the FIB is a multibit trie with a
+ * 16 bit direct-indexed top level and 8 bit nodes below it, with every
+ * slot holding the longest prefix covering it (leaf pushing).  A
+ * lookup is one memory access per level and never backtracks.
+ */
+#define RTFIB_TOPBITS		16
+#define RTFIB_TOPSIZE		(1 << RTFIB_TOPBITS)
+#define RTFIB_STRIDE		8
+#define RTFIB_NODESIZE		(1 << RTFIB_STRIDE)
+#define RTFIB_MAXLEVELS		(1 + (128 - RTFIB_TOPBITS) / RTFIB_STRIDE)
+
+/* slots hold a prefix or, with the low bit set, a child node */
+#define RTFIB_ISNODE(p)		(((u_long)(p)) & 1)
+#define RTFIB_NODE(p)		((struct rt_fibnode *)((u_long)(p) & ~1UL))
+#define RTFIB_MKNODE(n)		((void *)((u_long)(n) | 1))
+
+struct rt_fibent {
+	LIST_ENTRY(rt_fibent)	 fe_hash;
+	struct radix_node	*fe_rn;		/* first route of the prefix */
+	u_int8_t		 fe_addr[16];	/* masked prefix */
+	u_int8_t		 fe_plen;
+};
+
+struct rt_fibnode {
+	void			*fn_ent[RTFIB_NODESIZE];
+};
+
+LIST_HEAD(rt_fibhead, rt_fibent);
+
+struct rt_fib {
+	void			**fib_top;	/* [RTFIB_TOPSIZE] */
+	struct rt_fibhead	*fib_hash;	/* prefixes by addr/plen */
+	u_long			 fib_hashmask;
+	u_int			 fib_count;
+	int			 fib_alen;	/* address length in bytes */
+	int			 fib_aoff;	/* address offset in sockaddr */
+	sa_family_t		 fib_af;
+	int			 fib_disabled;	/* use the radix tree */
+	struct radix_node_head	*fib_rnh;	/* table this is a copy of */
+	struct timeout		 fib_rebuild;	/* retry after disable */
+};
+
+#define RTFIB_REBUILD_SECS	10	/* delay before rebuilding */
+
+#ifdef _KERNEL
+void			 rt_fib_init(void);
+struct rt_fib		*rt_fib_create(struct radix_node_head *, sa_family_t);
+struct radix_node	*rt_fib_matchaddr(struct sockaddr *,
+			    struct radix_node_head *);
+void			 rt_fib_update(struct radix_node_head *,
+			    struct rtentry *);
+#endif /* _KERNEL */
+
+#endif /* _NET_RTFIB_H_ */
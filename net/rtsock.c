@@ -858,6 +858,7 @@ report:
 				rt->rt_labelid =
 				    rtlabel_name2id(rtlabel);
 			}
+			RT_GENCHANGE(rt, RTM_CHANGE);
 			if_group_routechange(dst, netmask);
 			/* FALLTHROUGH */
 		case RTM_LOCK:
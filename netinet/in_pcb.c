@@ -78,7 +78,9 @@
 #include <sys/socketvar.h>
 #include <sys/proc.h>
 #include <sys/domain.h>
+#include <sys/malloc.h>
 #include <sys/pool.h>
+#include <sys/sysctl.h>
 
 #include <net/if.h>
 #include <net/route.h>
@@ -121,18 +123,33 @@ int ipport_hilastauto = IPPORT_HILASTAUTO;
 struct pool inpcb_pool;
 int inpcb_pool_initialized = 0;
 
+#define	INPCBLISTENHASH(table, laddr, lport, rdom) \
+	&(table)->inpt_listentbl[(ntohl((laddr)->s_addr) + \
+	ntohs((lport)) + (rdom)) & (table->inpt_listenhash)]
+
 #define	INPCBHASH(table, faddr, fport, laddr, lport, rdom) \
+	((faddr)->s_addr == INADDR_ANY ? \
+	INPCBLISTENHASH(table, laddr, lport, rdom) : \
 	&(table)->inpt_hashtbl[(ntohl((faddr)->s_addr) + \
-	ntohs((fport)) + ntohs((lport)) + (rdom)) & (table->inpt_hash)]
+	ntohs((fport)) + ntohs((lport)) + (rdom)) & (table->inpt_hash)])
+
+#define	IN6PCBLISTENHASH(table, laddr, lport) \
+	&(table)->inpt_listentbl[(ntohl((laddr)->s6_addr32[0] ^ \
+	(laddr)->s6_addr32[3]) + ntohs((lport))) & (table->inpt_listenhash)]
 
 #define	IN6PCBHASH(table, faddr, fport, laddr, lport) \
+	(IN6_IS_ADDR_UNSPECIFIED(faddr) ? \
+	IN6PCBLISTENHASH(table, laddr, lport) : \
 	&(table)->inpt_hashtbl[(ntohl((faddr)->s6_addr32[0] ^ \
 	(faddr)->s6_addr32[3]) + ntohs((fport)) + ntohs((lport))) & \
-	(table->inpt_hash)]
+	(table->inpt_hash)])
 
 #define	INPCBLHASH(table, lport, rdom) \
 	&(table)->inpt_lhashtbl[(ntohs((lport)) + (rdom)) & table->inpt_lhash]
 
+void	in_pcbhashinsert(struct inpcb *);
+void	in_pcbresize(struct inpcbtable *, int);
+
 void
 in_pcbinit(table, hashsize)
 	struct inpcbtable *table;
@@ -148,9 +165,101 @@ in_pcbinit(table, hashsize)
 	    &table->inpt_lhash);
 	if (table->inpt_lhashtbl == NULL)
 		panic("in_pcbinit: hashinit failed for lport");
+	table->inpt_listentbl = hashinit(hashsize, M_PCB, M_NOWAIT,
+	    &table->inpt_listenhash);
+	if (table->inpt_listentbl == NULL)
+		panic("in_pcbinit: hashinit failed for listen");
+	table->inpt_count = 0;
+	table->inpt_growat = table->inpt_hash + 1;
 	table->inpt_lastport = 0;
 }
 
+/*
+ * Put inp on the lport hash and on the connected or listen hash,
+ * depending on its foreign address.  Called at splnet.
+ */
+void
+in_pcbhashinsert(struct inpcb *inp)
+{
+	struct inpcbtable *table = inp->inp_table;
+
+	LIST_INSERT_HEAD(INPCBLHASH(table, inp->inp_lport, inp->inp_rtableid),
+	    inp, inp_lhash);
+#ifdef INET6
+	if (inp->inp_flags & INP_IPV6) {
+		LIST_INSERT_HEAD(IN6PCBHASH(table, &inp->inp_faddr6,
+		    inp->inp_fport, &inp->inp_laddr6, inp->inp_lport),
+		    inp, inp_hash);
+	} else
+#endif /* INET6 */
+		LIST_INSERT_HEAD(INPCBHASH(table, &inp->inp_faddr,
+		    inp->inp_fport, &inp->inp_laddr, inp->inp_lport,
+		    rtable_l2(inp->inp_rtableid)), inp, inp_hash);
+}
+
+/*
+ * Rebuild all hash tables of table with hashsize buckets each.  If
+ * memory is short the old tables stay and we try again once the table
+ * has doubled.  Called at splnet.
+ */
+void
+in_pcbresize(struct inpcbtable *table, int hashsize)
+{
+	struct inpcbhead *hashtbl, *lhashtbl, *listentbl;
+	u_long hash, lhash, listenhash;
+	struct inpcb *inp;
+
+	hashtbl = hashinit(hashsize, M_PCB, M_NOWAIT, &hash);
+	lhashtbl = hashinit(hashsize, M_PCB, M_NOWAIT, &lhash);
+	listentbl = hashinit(hashsize, M_PCB, M_NOWAIT, &listenhash);
+	if (hashtbl == NULL || lhashtbl == NULL || listentbl == NULL) {
+		if (hashtbl != NULL)
+			free(hashtbl, M_PCB);
+		if (lhashtbl != NULL)
+			free(lhashtbl, M_PCB);
+		if (listentbl != NULL)
+			free(listentbl, M_PCB);
+		table->inpt_stat.inps_resizefail++;
+		table->inpt_growat = table->inpt_count * 2;
+		return;
+	}
+
+	free(table->inpt_hashtbl, M_PCB);
+	free(table->inpt_lhashtbl, M_PCB);
+	free(table->inpt_listentbl, M_PCB);
+	table->inpt_hashtbl = hashtbl;
+	table->inpt_lhashtbl = lhashtbl;
+	table->inpt_listentbl = listentbl;
+	table->inpt_hash = hash;
+	table->inpt_lhash = lhash;
+	table->inpt_listenhash = listenhash;
+	table->inpt_growat = hash + 1;
+
+	CIRCLEQ_FOREACH(inp, &table->inpt_queue, inp_queue)
+		in_pcbhashinsert(inp);
+	table->inpt_stat.inps_resize++;
+}
+
+/*
+ * Export the lookup statistics of table, read only.
+ */
+int
+in_pcbstat_sysctl(struct inpcbtable *table, void *oldp, size_t *oldlenp,
+    void *newp)
+{
+	struct inpcbtstat stat;
+	int s;
+
+	if (newp != NULL)
+		return (EPERM);
+	s = splnet();
+	stat = table->inpt_stat;
+	stat.inps_count = table->inpt_count;
+	stat.inps_hashsize = table->inpt_hash + 1;
+	splx(s);
+	return (sysctl_rdstruct(oldp, oldlenp, newp, &stat, sizeof(stat)));
+}
+
 struct baddynamicports baddynamicports;
 
 /*
@@ -198,15 +307,6 @@ in_pcballoc(so, v)
 	inp->inp_seclevel[SL_ESP_NETWORK] = ipsec_esp_network_default_level;
 	inp->inp_seclevel[SL_IPCOMP] = ipsec_ipcomp_default_level;
 	inp->inp_rtableid = curproc->p_p->ps_rtableid;
-	s = splnet();
-	CIRCLEQ_INSERT_HEAD(&table->inpt_queue, inp, inp_queue);
-	LIST_INSERT_HEAD(INPCBLHASH(table, inp->inp_lport,
-	    inp->inp_rtableid), inp, inp_lhash);
-	LIST_INSERT_HEAD(INPCBHASH(table, &inp->inp_faddr, inp->inp_fport,
-	    &inp->inp_laddr, inp->inp_lport, rtable_l2(inp->inp_rtableid)),
-	    inp, inp_hash);
-	splx(s);
-	so->so_pcb = inp;
 	inp->inp_hops = -1;
 
 #ifdef INET6
@@ -219,6 +319,13 @@ in_pcballoc(so, v)
 		inp->inp_flags = INP_IPV6;
 	inp->in6p_cksum = -1;
 #endif /* INET6 */
+	s = splnet();
+	CIRCLEQ_INSERT_HEAD(&table->inpt_queue, inp, inp_queue);
+	in_pcbhashinsert(inp);
+	if (++table->inpt_count > table->inpt_growat)
+		in_pcbresize(table, (table->inpt_hash + 1) * 2);
+	splx(s);
+	so->so_pcb = inp;
 	return (0);
 }
 
@@ -535,6 +642,7 @@ in_pcbdetach(v)
 	LIST_REMOVE(inp, inp_lhash);
 	LIST_REMOVE(inp, inp_hash);
 	CIRCLEQ_REMOVE(&inp->inp_table->inpt_queue, inp, inp_queue);
+	inp->inp_table->inpt_count--;
 	splx(s);
 	pool_put(&inpcb_pool, inp);
 }
@@ -902,27 +1010,12 @@ void
 in_pcbrehash(inp)
 	struct inpcb *inp;
 {
-	struct inpcbtable *table = inp->inp_table;
 	int s;
 
 	s = splnet();
 	LIST_REMOVE(inp, inp_lhash);
-	LIST_INSERT_HEAD(INPCBLHASH(table, inp->inp_lport, inp->inp_rtableid),
-	    inp, inp_lhash);
 	LIST_REMOVE(inp, inp_hash);
-#ifdef INET6
-	if (inp->inp_flags & INP_IPV6) {
-		LIST_INSERT_HEAD(IN6PCBHASH(table, &inp->inp_faddr6,
-		    inp->inp_fport, &inp->inp_laddr6, inp->inp_lport),
-		    inp, inp_hash);
-	} else {
-#endif /* INET6 */
-		LIST_INSERT_HEAD(INPCBHASH(table, &inp->inp_faddr,
-		    inp->inp_fport, &inp->inp_laddr, inp->inp_lport,
-		    rtable_l2(inp->inp_rtableid)), inp, inp_hash);
-#ifdef INET6
-	}
-#endif /* INET6 */
+	in_pcbhashinsert(inp);
 	splx(s);
 }
 
@@ -949,7 +1042,9 @@ in_pcbhashlookup(struct inpcbtable *table, struct in_addr faddr,
 
 	rdomain = rtable_l2(rdomain);	/* convert passed rtableid to rdomain */
 	head = INPCBHASH(table, &faddr, fport, &laddr, lport, rdomain);
+	table->inpt_stat.inps_lookups++;
 	LIST_FOREACH(inp, head, inp_hash) {
+		table->inpt_stat.inps_lookupwalk++;
 #ifdef INET6
 		if (inp->inp_flags & INP_IPV6)
 			continue;	/*XXX*/
@@ -971,6 +1066,8 @@ in_pcbhashlookup(struct inpcbtable *table, struct in_addr faddr,
 			break;
 		}
 	}
+	if (inp == NULL)
+		table->inpt_stat.inps_lookupmiss++;
 #ifdef DIAGNOSTIC
 	if (inp == NULL && in_pcbnotifymiss) {
 		printf("in_pcbhashlookup: faddr=%08x fport=%d laddr=%08x lport=%d rdom=%d\n",
@@ -991,7 +1088,9 @@ in6_pcbhashlookup(struct inpcbtable *table, struct in6_addr *faddr,
 	u_int16_t fport = fport_arg, lport = lport_arg;
 
 	head = IN6PCBHASH(table, faddr, fport, laddr, lport);
+	table->inpt_stat.inps_lookups++;
 	LIST_FOREACH(inp, head, inp_hash) {
+		table->inpt_stat.inps_lookupwalk++;
 		if (!(inp->inp_flags & INP_IPV6))
 			continue;
 		if (IN6_ARE_ADDR_EQUAL(&inp->inp_faddr6, faddr) &&
@@ -1009,6 +1108,8 @@ in6_pcbhashlookup(struct inpcbtable *table, struct in6_addr *faddr,
 			break;
 		}
 	}
+	if (inp == NULL)
+		table->inpt_stat.inps_lookupmiss++;
 #ifdef DIAGNOSTIC
 	if (inp == NULL && in_pcbnotifymiss) {
 		printf("in6_pcbhashlookup: faddr=");
@@ -1055,8 +1156,10 @@ in_pcblookup_listen(struct inpcbtable *table, struct in_addr laddr,
 		key2 = &zeroin_addr;
 	}
 
-	head = INPCBHASH(table, &zeroin_addr, 0, key1, lport, rdomain);
+	table->inpt_stat.inps_listenlookups++;
+	head = INPCBLISTENHASH(table, key1, lport, rdomain);
 	LIST_FOREACH(inp, head, inp_hash) {
+		table->inpt_stat.inps_listenwalk++;
 #ifdef INET6
 		if (inp->inp_flags & INP_IPV6)
 			continue;	/*XXX*/
@@ -1068,8 +1171,9 @@ in_pcblookup_listen(struct inpcbtable *table, struct in_addr laddr,
 			break;
 	}
 	if (inp == NULL && key1->s_addr != key2->s_addr) {
-		head = INPCBHASH(table, &zeroin_addr, 0, key2, lport, rdomain);
+		head = INPCBLISTENHASH(table, key2, lport, rdomain);
 		LIST_FOREACH(inp, head, inp_hash) {
+			table->inpt_stat.inps_listenwalk++;
 #ifdef INET6
 			if (inp->inp_flags & INP_IPV6)
 				continue;	/*XXX*/
@@ -1081,6 +1185,8 @@ in_pcblookup_listen(struct inpcbtable *table, struct in_addr laddr,
 				break;
 		}
 	}
+	if (inp == NULL)
+		table->inpt_stat.inps_listenmiss++;
 #ifdef DIAGNOSTIC
 	if (inp == NULL && in_pcbnotifymiss) {
 		printf("in_pcblookup_listen: laddr=%08x lport=%d\n",
@@ -1127,8 +1233,10 @@ in6_pcblookup_listen(struct inpcbtable *table, struct in6_addr *laddr,
 		key2 = &zeroin6_addr;
 	}
 
-	head = IN6PCBHASH(table, &zeroin6_addr, 0, key1, lport);
+	table->inpt_stat.inps_listenlookups++;
+	head = IN6PCBLISTENHASH(table, key1, lport);
 	LIST_FOREACH(inp, head, inp_hash) {
+		table->inpt_stat.inps_listenwalk++;
 		if (!(inp->inp_flags & INP_IPV6))
 			continue;
 		if (inp->inp_lport == lport && inp->inp_fport == 0 &&
@@ -1137,8 +1245,9 @@ in6_pcblookup_listen(struct inpcbtable *table, struct in6_addr *laddr,
 			break;
 	}
 	if (inp == NULL && ! IN6_ARE_ADDR_EQUAL(key1, key2)) {
-		head = IN6PCBHASH(table, &zeroin6_addr, 0, key2, lport);
+		head = IN6PCBLISTENHASH(table, key2, lport);
 		LIST_FOREACH(inp, head, inp_hash) {
+			table->inpt_stat.inps_listenwalk++;
 			if (!(inp->inp_flags & INP_IPV6))
 				continue;
 			if (inp->inp_lport == lport && inp->inp_fport == 0 &&
@@ -1147,6 +1256,8 @@ in6_pcblookup_listen(struct inpcbtable *table, struct in6_addr *laddr,
 				break;
 		}
 	}
+	if (inp == NULL)
+		table->inpt_stat.inps_listenmiss++;
 #ifdef DIAGNOSTIC
 	if (inp == NULL && in_pcbnotifymiss) {
 		printf("in6_pcblookup_listen: laddr= lport=%d\n",
@@ -150,11 +150,38 @@ struct inpcb {
 	int	inp_pipex;		/* pipex indication */
 };
 
+/*
+ * Lookup statistics of a pcb table.  inps_count and inps_hashsize are
+ * filled in when the structure is exported.
+ */
+struct inpcbtstat {
+	u_int32_t inps_lookups;		/* connected pcb lookups */
+	u_int32_t inps_lookupmiss;	/* ... which found nothing */
+	u_int32_t inps_lookupwalk;	/* ... pcbs visited */
+	u_int32_t inps_listenlookups;	/* listen pcb lookups */
+	u_int32_t inps_listenmiss;	/* ... which found nothing */
+	u_int32_t inps_listenwalk;	/* ... pcbs visited */
+	u_int32_t inps_resize;		/* hash tables grown */
+	u_int32_t inps_resizefail;	/* ... failed for lack of memory */
+	u_int32_t inps_count;		/* pcbs in the table */
+	u_int32_t inps_hashsize;	/* buckets per hash table */
+};
+
+/*
+ * Connected pcbs are hashed by both addresses and ports, pcbs with an
+ * unspecified foreign address live in the listen table hashed by
+ * local address, port and rdomain.  All hash tables are doubled
+ * online once there are more pcbs than buckets.
+ */
 struct inpcbtable {
 	CIRCLEQ_HEAD(, inpcb) inpt_queue;
 	LIST_HEAD(inpcbhead, inpcb) *inpt_hashtbl, *inpt_lhashtbl;
-	u_long	  inpt_hash, inpt_lhash;
+	struct	  inpcbhead *inpt_listentbl;
+	u_long	  inpt_hash, inpt_lhash, inpt_listenhash;
+	u_int	  inpt_count;		/* pcbs in the table */
+	u_int	  inpt_growat;		/* count to grow the hashes at */
 	u_int16_t inpt_lastport;
+	struct	  inpcbtstat inpt_stat;
 };
 
 /* flags in inp_flags: */
@@ -269,6 +296,7 @@ int	 in6_setsockaddr(struct inpcb *, struct mbuf *);
 int	 in6_setpeeraddr(struct inpcb *, struct mbuf *);
 #endif /* INET6 */
 void	 in_pcbinit(struct inpcbtable *, int);
+int	 in_pcbstat_sysctl(struct inpcbtable *, void *, size_t *, void *);
 struct inpcb *
 	 in_pcblookup(struct inpcbtable *, void *, u_int, void *,
 	    u_int, int, u_int);
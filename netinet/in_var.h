@@ -78,6 +78,22 @@ struct	in_aliasreq {
 TAILQ_HEAD(in_ifaddrhead, in_ifaddr);
 extern	struct	in_ifaddrhead in_ifaddr;
 extern	struct	ifqueue	ipintrq;		/* ip packet input queue */
+extern	struct	ifqueue	ipintrq_flow[];		/* flow hashed input queues */
+
+/*
+ * Packets carrying a flow hash are spread over IPINTRQS input queues,
+ * ipintrq being the first one and the only one for packets without.
+ * ipintr() drains them in turns of IPINTR_BATCH packets.  There is
+ * still a single consumer, so this only keeps flows from queueing
+ * behind each other; it does not process them in parallel.
+ */
+#define	IPINTRQS	4
+#define	IPINTR_BATCH	16
+#define	IPINTRQ(i)	((i) == 0 ? &ipintrq : &ipintrq_flow[(i) - 1])
+#define	IPINTRQ_SELECT(m)						\
+	(((m)->m_pkthdr.flowid & M_FLOWID_VALID) ?			\
+	    IPINTRQ(((m)->m_pkthdr.flowid & M_FLOWID_MASK) % IPINTRQS) :	\
+	    &ipintrq)
 extern	int	inetctlerrmap[];
 void	in_socktrim(struct sockaddr_in *);
 
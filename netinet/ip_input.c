@@ -138,6 +138,7 @@ u_char	ip_protox[IPPROTO_MAX];
 int	ipqmaxlen = IFQ_MAXLEN;
 struct	in_ifaddrhead in_ifaddr;
 struct	ifqueue ipintrq;
+struct	ifqueue ipintrq_flow[IPINTRQS - 1];
 
 struct pool ipqent_pool;
 struct pool ipq_pool;
@@ -206,7 +207,8 @@ ip_init()
 		    pr->pr_protocol < IPPROTO_MAX)
 			ip_protox[pr->pr_protocol] = pr - inetsw;
 	LIST_INIT(&ipq);
-	ipintrq.ifq_maxlen = ipqmaxlen;
+	for (i = 0; i < IPINTRQS; i++)
+		IPINTRQ(i)->ifq_maxlen = ipqmaxlen;
 	TAILQ_INIT(&in_ifaddr);
 	if (ip_mtudisc != 0)
 		ip_mtudisc_timeout_q =
@@ -225,30 +227,57 @@ ip_init()
 }
 
 struct	sockaddr_in ipaddr = { sizeof(ipaddr), AF_INET };
-struct	route ipforward_rt;
+
+/*
+ * Forwarding route cache, hashed by destination and routing domain.
+ * An entry is valid as long as no route it may depend on changed since
+ * it was filled, i.e. while its generation matches rtgeneration, and
+ * its route is still up.  Multipath routes are never reused, the path
+ * depends on the source address as well.
+ */
+#define IPFORWARD_CACHESIZE	256	/* power of 2 */
+struct ipforward_cache {
+	struct route	ifc_ro;
+	u_int32_t	ifc_gen;
+} ipforward_cache[IPFORWARD_CACHESIZE];
+
+struct route *ipforward_lookup(struct in_addr, u_int32_t *, u_int);
 
 void
 ipintr()
 {
+	struct ifqueue *ifq;
 	struct mbuf *m;
-	int s;
+	int i, n, s, more;
 
-	for (;;) {
-		/*
-		 * Get next datagram off input queue and get IP header
-		 * in first mbuf.
-		 */
-		s = splnet();
-		IF_DEQUEUE(&ipintrq, m);
-		splx(s);
-		if (m == NULL)
-			return;
+	/*
+	 * Service the input queues in turns, so a busy queue can not
+	 * hold up the flows hashed to the others.
+	 */
+	do {
+		more = 0;
+		for (i = 0; i < IPINTRQS; i++) {
+			ifq = IPINTRQ(i);
+			for (n = 0; n < IPINTR_BATCH; n++) {
+				/*
+				 * Get next datagram off input queue and get
+				 * IP header in first mbuf.
+				 */
+				s = splnet();
+				IF_DEQUEUE(ifq, m);
+				splx(s);
+				if (m == NULL)
+					break;
 #ifdef	DIAGNOSTIC
-		if ((m->m_flags & M_PKTHDR) == 0)
-			panic("ipintr no HDR");
+				if ((m->m_flags & M_PKTHDR) == 0)
+					panic("ipintr no HDR");
 #endif
-		ipv4_input(m);
-	}
+				ipv4_input(m);
+			}
+			if (n == IPINTR_BATCH)
+				more = 1;
+		}
+	} while (more);
 }
 
 /*
@@ -966,13 +995,14 @@ ip_freef(fp)
 /*
  * IP timer processing;
  * if a timer expires on a reassembly queue, discard it.
- * clear the forwarding cache, there might be a better route.
+ * release stale entries of the forwarding cache.
  */
 void
 ip_slowtimo()
 {
 	struct ipq *fp, *nfp;
-	int s = splsoftnet();
+	struct route *ro;
+	int i, s = splsoftnet();
 
 	for (fp = LIST_FIRST(&ipq); fp != LIST_END(&ipq); fp = nfp) {
 		nfp = LIST_NEXT(fp, ipq_q);
@@ -981,9 +1011,14 @@ ip_slowtimo()
 			ip_freef(fp);
 		}
 	}
-	if (ipforward_rt.ro_rt) {
-		RTFREE(ipforward_rt.ro_rt);
-		ipforward_rt.ro_rt = 0;
+	/* let go of routes the cache would not use again */
+	for (i = 0; i < IPFORWARD_CACHESIZE; i++) {
+		ro = &ipforward_cache[i].ifc_ro;
+		if (ro->ro_rt && (ipforward_cache[i].ifc_gen != rtgeneration ||
+		    (ro->ro_rt->rt_flags & RTF_UP) == 0)) {
+			RTFREE(ro->ro_rt);
+			ro->ro_rt = NULL;
+		}
 	}
 	splx(s);
 }
@@ -1247,25 +1282,53 @@ bad:
 struct in_ifaddr *
 ip_rtaddr(struct in_addr dst, u_int rtableid)
 {
-	struct sockaddr_in *sin;
+	struct route *ro;
 
-	sin = satosin(&ipforward_rt.ro_dst);
+	ro = ipforward_lookup(dst, NULL, rtableid);
+	if (ro->ro_rt == 0)
+		return ((struct in_ifaddr *)0);
+	return (ifatoia(ro->ro_rt->rt_ifa));
+}
 
-	if (ipforward_rt.ro_rt == 0 || dst.s_addr != sin->sin_addr.s_addr) {
-		if (ipforward_rt.ro_rt) {
-			RTFREE(ipforward_rt.ro_rt);
-			ipforward_rt.ro_rt = 0;
-		}
-		sin->sin_family = AF_INET;
-		sin->sin_len = sizeof(*sin);
-		sin->sin_addr = dst;
+/*
+ * Return the forwarding cache entry for dst, looking the route up
+ * if the entry is empty, for another destination or stale.
+ */
+struct route *
+ipforward_lookup(struct in_addr dst, u_int32_t *src, u_int rtableid)
+{
+	struct ipforward_cache *ifc;
+	struct route *ro;
+	struct sockaddr_in *sin;
+	u_int32_t h;
+
+	h = ntohl(dst.s_addr);
+	h ^= (h >> 16) ^ (h >> 8) ^ rtableid;
+	ifc = &ipforward_cache[h & (IPFORWARD_CACHESIZE - 1)];
+	ro = &ifc->ifc_ro;
+	sin = satosin(&ro->ro_dst);
+
+	if (ro->ro_rt && ifc->ifc_gen == rtgeneration &&
+	    (ro->ro_rt->rt_flags & (RTF_UP|RTF_MPATH)) == RTF_UP &&
+	    dst.s_addr == sin->sin_addr.s_addr &&
+	    rtableid == ro->ro_tableid) {
+		ipstat.ips_rtcachehit++;
+		return (ro);
+	}
+	ipstat.ips_rtcachemiss++;
 
-		ipforward_rt.ro_rt = rtalloc1(&ipforward_rt.ro_dst, RT_REPORT,
-		    rtableid);
+	if (ro->ro_rt) {
+		RTFREE(ro->ro_rt);
+		ro->ro_rt = 0;
 	}
-	if (ipforward_rt.ro_rt == 0)
-		return ((struct in_ifaddr *)0);
-	return (ifatoia(ipforward_rt.ro_rt->rt_ifa));
+	sin->sin_family = AF_INET;
+	sin->sin_len = sizeof(*sin);
+	sin->sin_addr = dst;
+	ro->ro_tableid = rtableid;
+
+	rtalloc_mpath(ro, src);
+	ifc->ifc_gen = rtgeneration;
+	return (ro);
 }
 
 /*
@@ -1463,7 +1526,7 @@ ip_forward(m, srcrt)
 	int srcrt;
 {
 	struct ip *ip = mtod(m, struct ip *);
-	struct sockaddr_in *sin;
+	struct route *ro;
 	struct rtentry *rt;
 	int error, type = 0, code = 0, destmtu = 0;
 	u_int rtableid = 0;
@@ -1488,25 +1551,10 @@ ip_forward(m, srcrt)
 
 	rtableid = m->m_pkthdr.rdomain;
 
-	sin = satosin(&ipforward_rt.ro_dst);
-	if ((rt = ipforward_rt.ro_rt) == 0 ||
-	    ip->ip_dst.s_addr != sin->sin_addr.s_addr ||
-	    rtableid != ipforward_rt.ro_tableid) {
-		if (ipforward_rt.ro_rt) {
-			RTFREE(ipforward_rt.ro_rt);
-			ipforward_rt.ro_rt = 0;
-		}
-		sin->sin_family = AF_INET;
-		sin->sin_len = sizeof(*sin);
-		sin->sin_addr = ip->ip_dst;
-		ipforward_rt.ro_tableid = rtableid;
-
-		rtalloc_mpath(&ipforward_rt, &ip->ip_src.s_addr);
-		if (ipforward_rt.ro_rt == 0) {
-			icmp_error(m, ICMP_UNREACH, ICMP_UNREACH_HOST, dest, 0);
-			return;
-		}
-		rt = ipforward_rt.ro_rt;
+	ro = ipforward_lookup(ip->ip_dst, &ip->ip_src.s_addr, rtableid);
+	if ((rt = ro->ro_rt) == 0) {
+		icmp_error(m, ICMP_UNREACH, ICMP_UNREACH_HOST, dest, 0);
+		return;
 	}
 
 	/*
@@ -1553,7 +1601,7 @@ ip_forward(m, srcrt)
 		}
 	}
 
-	error = ip_output(m, (struct mbuf *)NULL, &ipforward_rt,
+	error = ip_output(m, (struct mbuf *)NULL, ro,
 	    (IP_FORWARDING | (ip_directedbcast ? IP_ALLOWBROADCAST : 0)),
 	    (void *)NULL, (void *)NULL);
 	if (error)
@@ -1588,13 +1636,13 @@ ip_forward(m, srcrt)
 		code = ICMP_UNREACH_NEEDFRAG;
 
 #ifdef IPSEC
-		if (ipforward_rt.ro_rt) {
-			struct rtentry *rt = ipforward_rt.ro_rt;
+		if (ro->ro_rt) {
+			struct rtentry *rt = ro->ro_rt;
 
 			if (rt->rt_rmx.rmx_mtu)
 				destmtu = rt->rt_rmx.rmx_mtu;
 			else
-				destmtu = ipforward_rt.ro_rt->rt_ifp->if_mtu;
+				destmtu = ro->ro_rt->rt_ifp->if_mtu;
 		}
 #endif /*IPSEC*/
 		ipstat.ips_cantfrag++;
@@ -1624,10 +1672,10 @@ ip_forward(m, srcrt)
 		m_freem(mcopy);
  freert:
 #ifndef SMALL_KERNEL
-	if (ipmultipath && ipforward_rt.ro_rt &&
-	    (ipforward_rt.ro_rt->rt_flags & RTF_MPATH)) {
-		RTFREE(ipforward_rt.ro_rt);
-		ipforward_rt.ro_rt = 0;
+	if (ipmultipath && ro->ro_rt &&
+	    (ro->ro_rt->rt_flags & RTF_MPATH)) {
+		RTFREE(ro->ro_rt);
+		ro->ro_rt = 0;
 	}
 #endif
 	return;
@@ -1642,7 +1690,7 @@ ip_sysctl(name, namelen, oldp, oldlenp, newp, newlen)
 	void *newp;
 	size_t newlen;
 {
-	int error;
+	int error, i;
 #ifdef MROUTING
 	extern int ip_mrtproto;
 	extern struct mrtstat mrtstat;
@@ -1695,8 +1743,21 @@ ip_sysctl(name, namelen, oldp, oldlenp, newp, newlen)
 				       ipsec_def_comp,
 				       sizeof(ipsec_def_comp)));
 	case IPCTL_IFQUEUE:
-	        return (sysctl_ifq(name + 1, namelen - 1,
-		    oldp, oldlenp, newp, newlen, &ipintrq));
+		/* length and drops are reported over all input queues */
+		if (namelen == 2 &&
+		    (name[1] == IFQCTL_LEN || name[1] == IFQCTL_DROPS)) {
+			int sum = 0;
+
+			for (i = 0; i < IPINTRQS; i++)
+				sum += (name[1] == IFQCTL_LEN) ?
+				    IPINTRQ(i)->ifq_len : IPINTRQ(i)->ifq_drops;
+			return (sysctl_rdint(oldp, oldlenp, newp, sum));
+		}
+	        error = sysctl_ifq(name + 1, namelen - 1,
+		    oldp, oldlenp, newp, newlen, &ipintrq);
+		for (i = 1; i < IPINTRQS; i++)
+			IPINTRQ(i)->ifq_maxlen = ipintrq.ifq_maxlen;
+		return (error);
 	case IPCTL_STATS:
 		if (newp != NULL)
 			return (EPERM);
@@ -734,6 +734,15 @@ sendit:
 	    ro->ro_rt->rt_ifp)
 		mtu = ro->ro_rt->rt_ifp->if_hardmtu;
 
+	/*
+	 * TCP bursts are cut into segments by the interface, or by
+	 * us if it cannot, whatever their size.
+	 */
+	if (m->m_pkthdr.csum_flags & M_TCP_TSO) {
+		error = ip_tso_output(ifp, m, sintosa(dst), ro->ro_rt, mtu);
+		goto done;
+	}
+
 	/*
 	 * If small enough for interface, can just send directly.
 	 */
@@ -921,6 +930,77 @@ sendorfree:
 	return (error);
 }
 
+/*
+ * Send a TSO burst built by tcp_output().  Interfaces that can
+ * segment get it as is, otherwise it is chopped into segments here.
+ */
+int
+ip_tso_output(struct ifnet *ifp, struct mbuf *m, struct sockaddr *dst,
+    struct rtentry *rt, u_long mtu)
+{
+	struct ip *ip;
+	struct tcphdr *th;
+	struct mbuf *m0;
+	int hlen, thlen, error = 0;
+
+	ip = mtod(m, struct ip *);
+	hlen = ip->ip_hl << 2;
+	if (m->m_len < hlen + sizeof(struct tcphdr) &&
+	    (m = m_pullup(m, hlen + sizeof(struct tcphdr))) == NULL)
+		return (ENOBUFS);
+	ip = mtod(m, struct ip *);
+	th = (struct tcphdr *)((caddr_t)ip + hlen);
+	thlen = th->th_off << 2;
+	if (m->m_len < hlen + thlen &&
+	    (m = m_pullup(m, hlen + thlen)) == NULL)
+		return (ENOBUFS);
+	ip = mtod(m, struct ip *);
+
+	/*
+	 * The route mtu may have dropped since tcp picked the size.
+	 * Rather than dropping the whole burst, cut it in software
+	 * into segments that fit.
+	 */
+	if (hlen + thlen + m->m_pkthdr.tso_segsz > mtu) {
+		if (mtu <= hlen + thlen) {
+			ipstat.ips_cantfrag++;
+			m_freem(m);
+			return (EMSGSIZE);
+		}
+		m->m_pkthdr.tso_segsz = mtu - hlen - thlen;
+	} else if ((ifp->if_capabilities & (IFCAP_TSOv4|IFCAP_CSUM_TCPv4)) ==
+	    (IFCAP_TSOv4|IFCAP_CSUM_TCPv4) && ifp->if_bridge == NULL) {
+		ip->ip_sum = 0;
+		m->m_pkthdr.csum_flags |= M_IPV4_CSUM_OUT;
+		tcpstat.tcps_outhwtso++;
+		return ((*ifp->if_output)(ifp, m, dst, rt));
+	}
+
+	error = tcp_chop(m, ifp);
+	if (error)
+		return (error);
+	tcpstat.tcps_outswtso++;
+
+	for (; m; m = m0) {
+		m0 = m->m_nextpkt;
+		m->m_nextpkt = NULL;
+		if (error == 0) {
+			ip = mtod(m, struct ip *);
+			ip->ip_sum = 0;
+			if (ifp->if_capabilities & IFCAP_CSUM_IPv4) {
+				m->m_pkthdr.csum_flags |= M_IPV4_CSUM_OUT;
+				ipstat.ips_outhwcsum++;
+			} else
+				ip->ip_sum = in_cksum(m, hlen);
+			if (m->m_pkthdr.csum_flags & M_TCP_CSUM_OUT)
+				tcpstat.tcps_outhwcsum++;
+			error = (*ifp->if_output)(ifp, m, dst, rt);
+		} else
+			m_freem(m);
+	}
+	return (error);
+}
+
 /*
  * Insert IP options into preformed packet.
  * Adjust IP destination as required for IP source routing,
@@ -2128,6 +2208,10 @@ in_delayed_cksum(struct mbuf *m)
 void
 in_proto_cksum_out(struct mbuf *m, struct ifnet *ifp)
 {
+	/* bursts are summed per segment, see ip_tso_output() */
+	if (m->m_pkthdr.csum_flags & M_TCP_TSO)
+		return;
+
 	if (m->m_pkthdr.csum_flags & M_TCP_CSUM_OUT) {
 		if (!ifp || !(ifp->if_capabilities & IFCAP_CSUM_TCPv4) ||
 		    ifp->if_bridge != NULL) {
@@ -133,6 +133,8 @@ struct	ipstat {
 	u_long	ips_inhwcsum;		/* hardware checksummed on input */
 	u_long	ips_outhwcsum;		/* hardware checksummed on output */
 	u_long	ips_notmember;		/* multicasts for unregistered groups */
+	u_long	ips_rtcachehit;		/* forwarding route cache hits */
+	u_long	ips_rtcachemiss;	/* forwarding route cache misses */
 };
 
 #ifdef _KERNEL
@@ -185,6 +187,8 @@ void	 ip_stripoptions(struct mbuf *, struct mbuf *);
 int	 ip_sysctl(int *, u_int, void *, size_t *, void *, size_t);
 void	 ip_savecontrol(struct inpcb *, struct mbuf **, struct ip *,
 	    struct mbuf *);
+int	 ip_tso_output(struct ifnet *, struct mbuf *, struct sockaddr *,
+	    struct rtentry *, u_long);
 void	 ipintr(void);
 void	 ipv4_input(struct mbuf *);
 int	 rip_ctloutput(int, struct socket *, int, int, struct mbuf **);
@@ -127,5 +127,8 @@ struct tcphdr {
 #define	TCP_MAXSEG		0x02   /* set maximum segment size */
 #define	TCP_MD5SIG		0x04   /* enable TCP MD5 signature option */
 #define	TCP_SACK_ENABLE		0x08   /* enable SACKs (if disabled by def.) */
+#define	TCP_CONGCTL		0x10   /* congestion control algorithm */
+
+#define	TCP_CC_NAMELEN		16     /* max algorithm name incl. NUL */
 
 #endif /* _NETINET_TCP_H_ */
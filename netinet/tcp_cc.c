@@ -0,0 +1,171 @@
+/*	$OpenBSD$	*/
+
+/*
+ * Copyright (c) 2011 The OpenBSD Foundation
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+
+#include <net/if.h>
+#include <net/route.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/in_pcb.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_seq.h>
+#include <netinet/tcp_timer.h>
+#include <netinet/tcp_var.h>
+#include <netinet/tcp_cc.h>
+
+void	newreno_init(struct tcpcb *);
+void	newreno_ack_received(struct tcpcb *, u_int);
+void	newreno_cong_signal(struct tcpcb *, int);
+void	newreno_post_recovery(struct tcpcb *, tcp_seq);
+
+const struct tcp_cc tcp_cc_newreno = {
+	"newreno",
+	newreno_init,
+	newreno_ack_received,
+	newreno_cong_signal,
+	newreno_post_recovery
+};
+
+const struct tcp_cc *tcp_ccs[] = {
+	&tcp_cc_newreno,
+	&tcp_cc_cubic,
+	NULL
+};
+
+const struct tcp_cc *tcp_cc_default = &tcp_cc_newreno;
+
+const struct tcp_cc *
+tcp_cc_lookup(const char *name)
+{
+	int i;
+
+	for (i = 0; tcp_ccs[i] != NULL; i++)
+		if (strcmp(tcp_ccs[i]->cc_name, name) == 0)
+			return (tcp_ccs[i]);
+	return (NULL);
+}
+
+/*
+ * Switch tp to the algorithm cc.  The window is kept, the state of the
+ * previous algorithm is thrown away.
+ */
+void
+tcp_cc_set(struct tcpcb *tp, const struct tcp_cc *cc)
+{
+	tp->t_cc = cc;
+	bzero(&tp->t_ccu, sizeof(tp->t_ccu));
+	(*cc->cc_init)(tp);
+}
+
+/*
+ * net.inet.tcp.congctl: name of the algorithm new connections use.
+ */
+int
+tcp_cc_sysctl(void *oldp, size_t *oldlenp, void *newp, size_t newlen)
+{
+	const struct tcp_cc *cc;
+	char name[TCP_CC_NAMELEN];
+	int error;
+
+	strlcpy(name, tcp_cc_default->cc_name, sizeof(name));
+	error = sysctl_string(oldp, oldlenp, newp, newlen, name, sizeof(name));
+	if (error || newp == NULL)
+		return (error);
+	if ((cc = tcp_cc_lookup(name)) == NULL)
+		return (EINVAL);
+	tcp_cc_default = cc;
+	return (0);
+}
+
+/*
+ * NewReno: slow start up to ssthresh, then one segment per window.  A
+ * loss or ECN echo halves the window, a timeout starts over from one
+ * segment.
+ */
+void
+newreno_init(struct tcpcb *tp)
+{
+}
+
+/*
+ * If the window gives us less than ssthresh packets in flight, open
+ * exponentially (maxseg per packet).  Otherwise open linearly: maxseg
+ * per window (maxseg^2 / cwnd per packet).
+ */
+void
+newreno_ack_received(struct tcpcb *tp, u_int acked)
+{
+	u_int cw = tp->snd_cwnd;
+	u_int incr = tp->t_maxseg;
+
+	if (cw > tp->snd_ssthresh)
+		incr = incr * incr / cw;
+	tp->snd_cwnd = ulmin(cw + incr, TCP_MAXWIN << tp->snd_scale);
+}
+
+void
+newreno_cong_signal(struct tcpcb *tp, int type)
+{
+	u_long win;
+
+	switch (type) {
+	case TCP_CC_DUPACK:
+		win = ulmin(tp->snd_wnd, tp->snd_cwnd) / 2 / tp->t_maxseg;
+		if (win < 2)
+			win = 2;
+		tp->snd_ssthresh = win * tp->t_maxseg;
+		break;
+	case TCP_CC_ECN:
+		/* reduce cwnd by half but don't slow-start */
+		win = ulmin(tp->snd_wnd, tp->snd_cwnd) / tp->t_maxseg;
+		tp->snd_ssthresh = win / 2 * tp->t_maxseg;
+		tp->snd_cwnd = tp->snd_ssthresh;
+		break;
+	case TCP_CC_RTO:
+		/*
+		 * The minimum cwnd that will give us exponential growth
+		 * is 2 mss.  We don't allow the threshold to go below
+		 * this.
+		 */
+		win = ulmin(tp->snd_wnd, tp->snd_cwnd) / 2 / tp->t_maxseg;
+		if (win < 2)
+			win = 2;
+		tp->snd_cwnd = tp->t_maxseg;
+		tp->snd_ssthresh = win * tp->t_maxseg;
+		break;
+	}
+}
+
+/*
+ * Deflate the window inflated during fast recovery, but do not burst
+ * out more than what is still in flight.
+ */
+void
+newreno_post_recovery(struct tcpcb *tp, tcp_seq th_ack)
+{
+	u_long flight = tp->snd_max - th_ack;
+
+	tp->snd_cwnd = ulmin(tp->snd_ssthresh, flight);
+}
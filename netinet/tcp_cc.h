@@ -0,0 +1,55 @@
+/*	$OpenBSD$	*/
+
+/*
+ * Copyright (c) 2011 The OpenBSD Foundation
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _NETINET_TCP_CC_H_
+#define _NETINET_TCP_CC_H_
+
+/*
+ * Congestion control algorithms.  The loss recovery machinery (dup ack
+ * counting, window inflation, SACK and NewReno partial acks) stays in
+ * tcp_input(); an algorithm only decides how snd_cwnd and snd_ssthresh
+ * move:
+ *
+ *	cc_init		a connection starts using the algorithm
+ *	cc_ack_received	new data was acked outside of fast recovery
+ *	cc_cong_signal	fast retransmit, ECN echo or retransmit timeout
+ *	cc_post_recovery fast recovery ended with an ack of th_ack
+ */
+#define	TCP_CC_DUPACK		1	/* third duplicate ack */
+#define	TCP_CC_ECN		2	/* ECN echo from the peer */
+#define	TCP_CC_RTO		3	/* retransmit timer went off */
+
+struct tcp_cc {
+	const char	*cc_name;
+	void		(*cc_init)(struct tcpcb *);
+	void		(*cc_ack_received)(struct tcpcb *, u_int);
+	void		(*cc_cong_signal)(struct tcpcb *, int);
+	void		(*cc_post_recovery)(struct tcpcb *, tcp_seq);
+};
+
+#ifdef _KERNEL
+extern const struct tcp_cc tcp_cc_newreno;
+extern const struct tcp_cc tcp_cc_cubic;
+extern const struct tcp_cc *tcp_cc_default;
+
+const struct tcp_cc *tcp_cc_lookup(const char *);
+void	tcp_cc_set(struct tcpcb *, const struct tcp_cc *);
+int	tcp_cc_sysctl(void *, size_t *, void *, size_t);
+#endif /* _KERNEL */
+
+#endif /* _NETINET_TCP_CC_H_ */
@@ -0,0 +1,197 @@
+/*	$OpenBSD$	*/
+
+/*
+ * Copyright (c) 2011 The OpenBSD Foundation
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+
+#include <net/if.h>
+#include <net/route.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/in_pcb.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_seq.h>
+#include <netinet/tcp_timer.h>
+#include <netinet/tcp_var.h>
+#include <netinet/tcp_cc.h>
+
+/*
+ * CUBIC congestion control (Ha, Rhee and Xu).  After a reduction the
+ * window follows
+ *
+ *	W(t) = C * (t - K)^3 + Wmax
+ *
+ * which is concave up to the window of the last loss and convex beyond
+ * it, independent of the RTT.  On short paths the window never grows
+ * slower than an AIMD flow with the same decrease factor would.
+ *
+ * Windows are kept in bytes and time in milliseconds; C is 0.4
+ * segments/s^3 and the decrease factor beta is 0.7.
+ */
+#define	CUBIC_BETA_NUM		7	/* beta = 7/10 */
+#define	CUBIC_BETA_DEN		10
+#define	CUBIC_FC_NUM		17	/* (1 + beta) / 2 */
+#define	CUBIC_FC_DEN		20
+#define	CUBIC_ALPHA_NUM		529	/* 3 * (1 - beta) / (1 + beta) */
+#define	CUBIC_ALPHA_DEN		1000
+#define	CUBIC_MAXDELTA		(1 << 18)	/* ms, keeps W(t) in range */
+
+void	cubic_init(struct tcpcb *);
+void	cubic_ack_received(struct tcpcb *, u_int);
+void	cubic_cong_signal(struct tcpcb *, int);
+void	cubic_post_recovery(struct tcpcb *, tcp_seq);
+void	cubic_reduce(struct tcpcb *);
+u_int64_t cubic_cbrt(u_int64_t);
+
+const struct tcp_cc tcp_cc_cubic = {
+	"cubic",
+	cubic_init,
+	cubic_ack_received,
+	cubic_cong_signal,
+	cubic_post_recovery
+};
+
+/*
+ * Integer cube root, rounded down.
+ */
+u_int64_t
+cubic_cbrt(u_int64_t x)
+{
+	u_int64_t y = 0, b;
+	int s;
+
+	for (s = 63; s >= 0; s -= 3) {
+		y <<= 1;
+		b = 3 * y * (y + 1) + 1;
+		if ((x >> s) >= b) {
+			x -= b << s;
+			y++;
+		}
+	}
+	return (y);
+}
+
+void
+cubic_init(struct tcpcb *tp)
+{
+	tp->t_cubic.origin = 0;
+}
+
+void
+cubic_ack_received(struct tcpcb *tp, u_int acked)
+{
+	u_long cwnd = tp->snd_cwnd, mss = tp->t_maxseg;
+	int64_t t, target;
+	u_int64_t incr;
+
+	if (cwnd <= tp->snd_ssthresh) {
+		/* slow start, the next epoch begins once it is over */
+		tp->t_cubic.origin = 0;
+		tp->snd_cwnd = ulmin(cwnd + mss, TCP_MAXWIN << tp->snd_scale);
+		return;
+	}
+
+	if (tp->t_cubic.origin == 0) {
+		tp->t_cubic.epoch = ticks;
+		if (cwnd < tp->t_cubic.wmax) {
+			tp->t_cubic.origin = tp->t_cubic.wmax;
+			/* K = cbrt((Wmax - cwnd) / C) */
+			tp->t_cubic.k = cubic_cbrt(
+			    (u_int64_t)(tp->t_cubic.wmax - cwnd) *
+			    2500000000ULL / mss);
+		} else {
+			tp->t_cubic.origin = cwnd;
+			tp->t_cubic.k = 0;
+		}
+		tp->t_cubic.west = cwnd;
+	}
+
+	t = (int64_t)(ticks - tp->t_cubic.epoch) * 1000 / hz -
+	    tp->t_cubic.k;
+	if (t > CUBIC_MAXDELTA)
+		t = CUBIC_MAXDELTA;
+	else if (t < -CUBIC_MAXDELTA)
+		t = -CUBIC_MAXDELTA;
+	/* C * t^3 in millionths of a segment */
+	target = (int64_t)tp->t_cubic.origin +
+	    4 * t * t * t / 10000 * (int64_t)mss / 1000000;
+
+	/* what an AIMD flow would have by now */
+	tp->t_cubic.west += (u_int64_t)acked * mss * CUBIC_ALPHA_NUM /
+	    CUBIC_ALPHA_DEN / cwnd;
+	if (target < (int64_t)tp->t_cubic.west)
+		target = tp->t_cubic.west;
+
+	if (target > (int64_t)cwnd + (int64_t)cwnd / 2)
+		target = cwnd + cwnd / 2;
+	if (target > (int64_t)cwnd)
+		incr = (u_int64_t)(target - cwnd) * mss / cwnd;
+	else
+		incr = (u_int64_t)mss * mss / (100 * cwnd);
+	tp->snd_cwnd = ulmin(cwnd + incr, TCP_MAXWIN << tp->snd_scale);
+}
+
+/*
+ * Remember where the loss happened and cut the window by beta.  If the
+ * loss came before the previous plateau was reached, another flow is
+ * taking bandwidth, release some by aiming lower (fast convergence).
+ */
+void
+cubic_reduce(struct tcpcb *tp)
+{
+	u_long cwnd = ulmin(tp->snd_wnd, tp->snd_cwnd);
+
+	if (cwnd < tp->t_cubic.wmax)
+		tp->t_cubic.wmax = cwnd / CUBIC_FC_DEN * CUBIC_FC_NUM;
+	else
+		tp->t_cubic.wmax = cwnd;
+	tp->snd_ssthresh = ulmax(cwnd / CUBIC_BETA_DEN * CUBIC_BETA_NUM,
+	    2 * tp->t_maxseg);
+	tp->t_cubic.origin = 0;
+}
+
+void
+cubic_cong_signal(struct tcpcb *tp, int type)
+{
+	switch (type) {
+	case TCP_CC_DUPACK:
+		cubic_reduce(tp);
+		break;
+	case TCP_CC_ECN:
+		cubic_reduce(tp);
+		tp->snd_cwnd = tp->snd_ssthresh;
+		break;
+	case TCP_CC_RTO:
+		cubic_reduce(tp);
+		tp->snd_cwnd = tp->t_maxseg;
+		break;
+	}
+}
+
+void
+cubic_post_recovery(struct tcpcb *tp, tcp_seq th_ack)
+{
+	u_long flight = tp->snd_max - th_ack;
+
+	tp->snd_cwnd = ulmin(tp->snd_ssthresh, flight);
+}
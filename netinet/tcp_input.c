@@ -79,6 +79,8 @@
 
 #include <dev/rndvar.h>
 
+#include <crypto/md5.h>
+
 #include <net/if.h>
 #include <net/route.h>
 
@@ -92,6 +94,7 @@
 #include <netinet/tcp_seq.h>
 #include <netinet/tcp_timer.h>
 #include <netinet/tcp_var.h>
+#include <netinet/tcp_cc.h>
 #include <netinet/tcpip.h>
 #include <netinet/tcp_debug.h>
 
@@ -1612,8 +1615,8 @@ trimthenstep6:
 
 				win = min(tp->snd_wnd, tp->snd_cwnd) / tp->t_maxseg;
 				if (win > 1) {
-					tp->snd_ssthresh = win / 2 * tp->t_maxseg;
-					tp->snd_cwnd = tp->snd_ssthresh;
+					(*tp->t_cc->cc_cong_signal)(tp,
+					    TCP_CC_ECN);
 					tp->snd_last = tp->snd_max;
 					tp->t_flags |= TF_SEND_CWR;
 					tcpstat.tcps_cwr_ecn++;
@@ -1705,9 +1708,6 @@ trimthenstep6:
 				else if (++tp->t_dupacks == tcprexmtthresh) {
 #endif /* TCP_FACK */
 					tcp_seq onxt = tp->snd_nxt;
-					u_long win =
-					    ulmin(tp->snd_wnd, tp->snd_cwnd) /
-						2 / tp->t_maxseg;
 
 #if defined(TCP_SACK) || defined(TCP_ECN)
 					if (SEQ_LT(th->th_ack, tp->snd_last)){
@@ -1719,9 +1719,8 @@ trimthenstep6:
 						goto drop;
 					}
 #endif
-					if (win < 2)
-						win = 2;
-					tp->snd_ssthresh = win * tp->t_maxseg;
+					(*tp->t_cc->cc_cong_signal)(tp,
+					    TCP_CC_DUPACK);
 #ifdef TCP_SACK
 					tp->snd_last = tp->snd_max;
                     			if (tp->sack_enable) {
@@ -1814,12 +1813,8 @@ trimthenstep6:
 #endif /* TCP_FACK */
 				} else {
 					/* Out of fast recovery */
-					tp->snd_cwnd = tp->snd_ssthresh;
-					if (tcp_seq_subtract(tp->snd_max,
-					    th->th_ack) < tp->snd_ssthresh)
-						tp->snd_cwnd =
-						   tcp_seq_subtract(tp->snd_max,
-					           th->th_ack);
+					(*tp->t_cc->cc_post_recovery)(tp,
+					    th->th_ack);
 					tp->t_dupacks = 0;
 #if defined(TCP_SACK) && defined(TCP_FACK)
 					if (SEQ_GT(th->th_ack, tp->snd_fack))
@@ -1831,12 +1826,7 @@ trimthenstep6:
 			if (tp->t_dupacks >= tcprexmtthresh &&
 			    !tcp_newreno(tp, th)) {
 				/* Out of fast recovery */
-				tp->snd_cwnd = tp->snd_ssthresh;
-				if (tcp_seq_subtract(tp->snd_max, th->th_ack) <
-			  	    tp->snd_ssthresh)
-					tp->snd_cwnd =
-					    tcp_seq_subtract(tp->snd_max,
-					    th->th_ack);
+				(*tp->t_cc->cc_post_recovery)(tp, th->th_ack);
 				tp->t_dupacks = 0;
 			}
 		}
@@ -1882,23 +1872,13 @@ trimthenstep6:
 		} else if (TCP_TIMER_ISARMED(tp, TCPT_PERSIST) == 0)
 			TCP_TIMER_ARM(tp, TCPT_REXMT, tp->t_rxtcur);
 		/*
-		 * When new data is acked, open the congestion window.
-		 * If the window gives us less than ssthresh packets
-		 * in flight, open exponentially (maxseg per packet).
-		 * Otherwise open linearly: maxseg per window
-		 * (maxseg^2 / cwnd per packet).
+		 * When new data is acked, let the congestion control
+		 * algorithm open the congestion window.
 		 */
-		{
-		u_int cw = tp->snd_cwnd;
-		u_int incr = tp->t_maxseg;
-
-		if (cw > tp->snd_ssthresh)
-			incr = incr * incr / cw;
 #if defined (TCP_SACK)
 		if (tp->t_dupacks < tcprexmtthresh)
 #endif
-		tp->snd_cwnd = ulmin(cw + incr, TCP_MAXWIN<<tp->snd_scale);
-		}
+			(*tp->t_cc->cc_ack_received)(tp, acked);
 		ND6_HINT(tp);
 		if (acked > so->so_snd.sb_cc) {
 			tp->snd_wnd -= so->so_snd.sb_cc;
@@ -3340,42 +3320,165 @@ tcp_mss_adv(struct ifnet *ifp, int af)
  */
 
 u_long	syn_cache_count;
-u_int32_t syn_hash1, syn_hash2;
+u_int32_t syn_hash_key[4];
 
-#define SYN_HASH(sa, sp, dp) \
-	((((sa)->s_addr^syn_hash1)*(((((u_int32_t)(dp))<<16) + \
-				     ((u_int32_t)(sp)))^syn_hash2)))
-#ifndef INET6
-#define	SYN_HASHALL(hash, src, dst) \
-do {									\
-	hash = SYN_HASH(&((struct sockaddr_in *)(src))->sin_addr,	\
-		((struct sockaddr_in *)(src))->sin_port,		\
-		((struct sockaddr_in *)(dst))->sin_port);		\
-} while (/*CONSTCOND*/ 0)
-#else
-#define SYN_HASH6(sa, sp, dp) \
-	((((sa)->s6_addr32[0] ^ (sa)->s6_addr32[3] ^ syn_hash1) * \
-	  (((((u_int32_t)(dp))<<16) + ((u_int32_t)(sp)))^syn_hash2)) \
-	 & 0x7fffffff)
-
-#define SYN_HASHALL(hash, src, dst) \
+/*
+ * The bucket of an entry is picked by a keyed hash over both addresses
+ * and ports.  Every word is mixed with the secret key so that remote
+ * hosts cannot aim their SYNs at a single bucket.  The key is changed
+ * whenever the cache runs empty.
+ */
+#define	SYN_HASH_MIX(h, w, i)						\
 do {									\
-	switch ((src)->sa_family) {					\
-	case AF_INET:							\
-		hash = SYN_HASH(&((struct sockaddr_in *)(src))->sin_addr, \
-			((struct sockaddr_in *)(src))->sin_port,	\
-			((struct sockaddr_in *)(dst))->sin_port);	\
-		break;							\
-	case AF_INET6:							\
-		hash = SYN_HASH6(&((struct sockaddr_in6 *)(src))->sin6_addr, \
-			((struct sockaddr_in6 *)(src))->sin6_port,	\
-			((struct sockaddr_in6 *)(dst))->sin6_port);	\
-		break;							\
-	default:							\
-		hash = 0;						\
-	}								\
+	(h) += (w) ^ syn_hash_key[(i) & 3];				\
+	(h) ^= (h) >> 16;						\
+	(h) *= 0x85ebca6b;						\
+	(h) ^= (h) >> 13;						\
+	(h) *= 0xc2b2ae35;						\
+	(h) ^= (h) >> 16;						\
 } while (/*CONSTCOND*/0)
+
+u_int32_t
+syn_cache_hash(struct sockaddr *src, struct sockaddr *dst)
+{
+	u_int32_t hash = syn_hash_key[0];
+	int i = 0;
+
+	switch (src->sa_family) {
+	case AF_INET:
+		SYN_HASH_MIX(hash, satosin(src)->sin_addr.s_addr, i++);
+		SYN_HASH_MIX(hash, satosin(dst)->sin_addr.s_addr, i++);
+		SYN_HASH_MIX(hash, (u_int32_t)satosin(src)->sin_port << 16 |
+		    satosin(dst)->sin_port, i++);
+		break;
+#ifdef INET6
+	case AF_INET6:
+		for (; i < 4; i++)
+			SYN_HASH_MIX(hash,
+			    satosin6(src)->sin6_addr.s6_addr32[i], i);
+		for (; i < 8; i++)
+			SYN_HASH_MIX(hash,
+			    satosin6(dst)->sin6_addr.s6_addr32[i - 4], i);
+		SYN_HASH_MIX(hash, (u_int32_t)satosin6(src)->sin6_port << 16 |
+		    satosin6(dst)->sin6_port, i++);
+		break;
 #endif /* INET6 */
+	default:
+		hash = 0;
+	}
+	return (hash);
+}
+
+#define	SYN_HASHALL(hash, src, dst)					\
+	(hash) = syn_cache_hash((src), (dst))
+
+/*
+ * SYN cookies.  Once the cache is close to full we stop keeping state
+ * for new SYNs and encode it in the ISS of the SYN,ACK instead:
+ *
+ *	bits 31-3	MAC over the endpoints, the peer ISS, the rdomain
+ *			and the current 64 second period
+ *	bits 2-0	index into syn_cookie_mss
+ *
+ * A cookie is valid in the period it was made and the next one.  Only
+ * the MSS survives the round trip, window scaling, timestamps, SACK and
+ * ECN are not offered on connections made from a cookie.  An ACK
+ * without a cache entry is only checked for a cookie while cookies
+ * handed out could still be valid, i.e. the cache overflowed recently.
+ */
+#define	SYN_COOKIE_PERIOD(t)	((u_int32_t)(t) >> 6)
+#define	SYN_COOKIE_MSSMASK	0x7
+#define	SYN_COOKIE_ACTIVE()						\
+	(syn_cookie_keyed &&						\
+	    SYN_COOKIE_PERIOD(time_uptime) - syn_cookie_sent <= 1)
+
+const u_int16_t syn_cookie_mss[SYN_COOKIE_MSSMASK + 1] = {
+	216, 536, 1200, 1360, 1400, 1440, 1460, 8960
+};
+
+u_int8_t syn_cookie_secret[16];
+int	syn_cookie_keyed;
+u_int32_t syn_cookie_sent;	/* period the last cookie was made in */
+
+u_int32_t
+syn_cookie_mac(struct sockaddr *src, struct sockaddr *dst, tcp_seq irs,
+    u_int rtableid, u_int32_t period)
+{
+	MD5_CTX ctx;
+	u_int32_t digest[4];
+	u_int rdomain = rtable_l2(rtableid);
+
+	MD5Init(&ctx);
+	MD5Update(&ctx, syn_cookie_secret, sizeof(syn_cookie_secret));
+	MD5Update(&ctx, (u_int8_t *)&period, sizeof(period));
+	MD5Update(&ctx, (u_int8_t *)&irs, sizeof(irs));
+	MD5Update(&ctx, (u_int8_t *)&rdomain, sizeof(rdomain));
+	switch (src->sa_family) {
+	case AF_INET:
+		MD5Update(&ctx, (u_int8_t *)&satosin(src)->sin_addr,
+		    sizeof(struct in_addr));
+		MD5Update(&ctx, (u_int8_t *)&satosin(dst)->sin_addr,
+		    sizeof(struct in_addr));
+		MD5Update(&ctx, (u_int8_t *)&satosin(src)->sin_port,
+		    sizeof(in_port_t));
+		MD5Update(&ctx, (u_int8_t *)&satosin(dst)->sin_port,
+		    sizeof(in_port_t));
+		break;
+#ifdef INET6
+	case AF_INET6:
+		MD5Update(&ctx, (u_int8_t *)&satosin6(src)->sin6_addr,
+		    sizeof(struct in6_addr));
+		MD5Update(&ctx, (u_int8_t *)&satosin6(dst)->sin6_addr,
+		    sizeof(struct in6_addr));
+		MD5Update(&ctx, (u_int8_t *)&satosin6(src)->sin6_port,
+		    sizeof(in_port_t));
+		MD5Update(&ctx, (u_int8_t *)&satosin6(dst)->sin6_port,
+		    sizeof(in_port_t));
+		break;
+#endif /* INET6 */
+	}
+	MD5Final((u_int8_t *)digest, &ctx);
+	return (digest[0] ^ digest[1] ^ digest[2] ^ digest[3]);
+}
+
+tcp_seq
+syn_cookie_iss(struct sockaddr *src, struct sockaddr *dst, tcp_seq irs,
+    u_int rtableid, u_int16_t peermaxseg)
+{
+	int i;
+
+	if (!syn_cookie_keyed) {
+		arc4random_buf(syn_cookie_secret, sizeof(syn_cookie_secret));
+		syn_cookie_keyed = 1;
+	}
+	for (i = SYN_COOKIE_MSSMASK; i > 0; i--)
+		if (syn_cookie_mss[i] <= peermaxseg)
+			break;
+	syn_cookie_sent = SYN_COOKIE_PERIOD(time_uptime);
+	return ((syn_cookie_mac(src, dst, irs, rtableid,
+	    syn_cookie_sent) & ~SYN_COOKIE_MSSMASK) | i);
+}
+
+/*
+ * Check the cookie returned in the ACK of th and return the MSS it
+ * carries, or 0 if it is not ours.
+ */
+u_int16_t
+syn_cookie_check(struct sockaddr *src, struct sockaddr *dst,
+    struct tcphdr *th, u_int rtableid)
+{
+	tcp_seq cookie = th->th_ack - 1, irs = th->th_seq - 1;
+	u_int32_t period = SYN_COOKIE_PERIOD(time_uptime);
+
+	if (!SYN_COOKIE_ACTIVE())
+		return (0);
+	if (((syn_cookie_mac(src, dst, irs, rtableid, period) ^ cookie) &
+	    ~SYN_COOKIE_MSSMASK) == 0 ||
+	    ((syn_cookie_mac(src, dst, irs, rtableid, period - 1) ^ cookie) &
+	    ~SYN_COOKIE_MSSMASK) == 0)
+		return (syn_cookie_mss[cookie & SYN_COOKIE_MSSMASK]);
+	return (0);
+}
 
 void
 syn_cache_rm(struct syn_cache *sc)
@@ -3444,10 +3547,8 @@ syn_cache_insert(struct syn_cache *sc, struct tcpcb *tp)
 	 * If there are no entries in the hash table, reinitialize
 	 * the hash secrets.
 	 */
-	if (syn_cache_count == 0) {
-		syn_hash1 = arc4random();
-		syn_hash2 = arc4random();
-	}
+	if (syn_cache_count == 0)
+		arc4random_buf(syn_hash_key, sizeof(syn_hash_key));
 
 	SYN_HASHALL(sc->sc_hash, &sc->sc_src.sa, &sc->sc_dst.sa);
 	sc->sc_bucketidx = sc->sc_hash % tcp_syn_cache_size;
@@ -3680,20 +3781,13 @@ syn_cache_get(struct sockaddr *src, struct sockaddr *dst, struct tcphdr *th,
 {
 	struct syn_cache *sc;
 	struct syn_cache_head *scp;
-	struct inpcb *inp = NULL;
-	struct tcpcb *tp = 0;
-	struct mbuf *am;
 	int s;
-	struct socket *oso;
-#if NPF > 0
-	struct pf_divert *divert = NULL;
-#endif
 
 	s = splsoftnet();
 	if ((sc = syn_cache_lookup(src, dst, &scp,
 	    sotoinpcb(so)->inp_rtableid)) == NULL) {
 		splx(s);
-		return (NULL);
+		return (syn_cookie_get(src, dst, th, so, m));
 	}
 
 	/*
@@ -3712,6 +3806,71 @@ syn_cache_get(struct sockaddr *src, struct sockaddr *dst, struct tcphdr *th,
 	syn_cache_rm(sc);
 	splx(s);
 
+	return (syn_cache_accept(src, dst, th, sc, so, m));
+}
+
+/*
+ * The ACK of th carries no cache entry.  If it returns one of our
+ * cookies, rebuild the entry the SYN would have made and accept the
+ * connection from it.
+ */
+struct socket *
+syn_cookie_get(struct sockaddr *src, struct sockaddr *dst, struct tcphdr *th,
+    struct socket *so, struct mbuf *m)
+{
+	struct syn_cache *sc;
+	u_int rtableid = sotoinpcb(so)->inp_rtableid;
+	u_int16_t mss;
+	long win;
+
+	/* a stray ACK is no failed cookie while none are handed out */
+	if (!tcp_syn_use_cookies || !SYN_COOKIE_ACTIVE())
+		return (NULL);
+	if ((mss = syn_cookie_check(src, dst, th, rtableid)) == 0) {
+		tcpstat.tcps_sc_cookiefail++;
+		return (NULL);
+	}
+
+	sc = pool_get(&syn_cache_pool, PR_NOWAIT|PR_ZERO);
+	if (sc == NULL) {
+		tcpstat.tcps_sc_dropped++;
+		m_freem(m);
+		return ((struct socket *)(-1));
+	}
+	win = sbspace(&so->so_rcv);
+	if (win > TCP_MAXWIN)
+		win = TCP_MAXWIN;
+	bcopy(src, &sc->sc_src, src->sa_len);
+	bcopy(dst, &sc->sc_dst, dst->sa_len);
+	sc->sc_rtableid = rtableid;
+	sc->sc_irs = th->th_seq - 1;
+	sc->sc_iss = th->th_ack - 1;
+	sc->sc_peermaxseg = mss;
+	sc->sc_win = win;
+	sc->sc_requested_s_scale = 15;
+	sc->sc_request_r_scale = 15;
+	tcpstat.tcps_sc_cookierecv++;
+
+	return (syn_cache_accept(src, dst, th, sc, so, m));
+}
+
+/*
+ * Turn the entry sc, already off the cache, into a connection on a new
+ * socket cloned from the listening socket so.  Return values are those
+ * of syn_cache_get().
+ */
+struct socket *
+syn_cache_accept(struct sockaddr *src, struct sockaddr *dst, struct tcphdr *th,
+    struct syn_cache *sc, struct socket *so, struct mbuf *m)
+{
+	struct inpcb *inp = NULL;
+	struct tcpcb *tp = 0;
+	struct mbuf *am;
+	struct socket *oso;
+#if NPF > 0
+	struct pf_divert *divert = NULL;
+#endif
+
 	/*
 	 * Ok, create the full blown connection, and set things up
 	 * as they would have been set up if we had created the
@@ -3841,6 +4000,7 @@ syn_cache_get(struct sockaddr *src, struct sockaddr *dst, struct tcphdr *th,
 
 	tp = intotcpcb(inp);
 	tp->t_flags = sototcpcb(oso)->t_flags & TF_NODELAY;
+	tcp_cc_set(tp, sototcpcb(oso)->t_cc);
 	if (sc->sc_request_r_scale != 15) {
 		tp->requested_s_scale = sc->sc_requested_s_scale;
 		tp->request_r_scale = sc->sc_request_r_scale;
@@ -4097,6 +4257,49 @@ syn_cache_add(struct sockaddr *src, struct sockaddr *dst, struct tcphdr *th,
 		return (0);
 	}
 
+	/*
+	 * Past the high watermark, or if the bucket is full, answer with
+	 * a cookie instead of pushing out entries of other peers.  A peer
+	 * MSS below the smallest one a cookie can carry would come back
+	 * larger than offered, such peers still get a cache entry.
+	 */
+	if (tcp_syn_use_cookies &&
+#ifdef TCP_SIGNATURE
+	    (tb.t_flags & TF_SIGNATURE) == 0 &&
+#endif
+	    (oi->maxseg ? oi->maxseg : tcp_mssdflt) >= syn_cookie_mss[0] &&
+	    (syn_cache_count >= tcp_syn_cache_limit -
+	    tcp_syn_cache_limit / 4 ||
+	    scp->sch_length >= tcp_syn_bucket_limit)) {
+		struct syn_cache scs;
+
+		bzero(&scs, sizeof(scs));
+		bcopy(src, &scs.sc_src, src->sa_len);
+		bcopy(dst, &scs.sc_dst, dst->sa_len);
+		scs.sc_rtableid = sotoinpcb(so)->inp_rtableid;
+		scs.sc_ipopts = ipopts;
+		scs.sc_irs = th->th_seq;
+		scs.sc_iss = syn_cookie_iss(src, dst, th->th_seq,
+		    scs.sc_rtableid, oi->maxseg ? oi->maxseg : tcp_mssdflt);
+		scs.sc_ourmaxseg = tcp_mss_adv(m->m_flags & M_PKTHDR ?
+		    m->m_pkthdr.rcvif : NULL, scs.sc_src.sa.sa_family);
+		scs.sc_win = win;
+		scs.sc_requested_s_scale = 15;
+		scs.sc_request_r_scale = 15;
+		scs.sc_tp = tp;
+		if (syn_cache_respond(&scs, m) == 0) {
+			tcpstat.tcps_sc_cookiesent++;
+			tcpstat.tcps_sndacks++;
+			tcpstat.tcps_sndtotal++;
+		} else
+			tcpstat.tcps_sc_dropped++;
+		if (scs.sc_ipopts)
+			(void) m_free(scs.sc_ipopts);
+		if (scs.sc_route4.ro_rt != NULL)
+			RTFREE(scs.sc_route4.ro_rt);
+		return (0);
+	}
+
 	sc = pool_get(&syn_cache_pool, PR_NOWAIT|PR_ZERO);
 	if (sc == NULL) {
 		if (ipopts)
@@ -0,0 +1,280 @@
+/*	$OpenBSD$	*/
+
+/*
+ * Copyright (c) 2011 The OpenBSD Foundation
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+
+#include <net/if.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/ip_var.h>
+#include <netinet/if_ether.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_seq.h>
+#include <netinet/tcp_timer.h>
+#include <netinet/tcp_var.h>
+#include <netinet/tcp_lro.h>
+
+extern int ipforwarding;
+
+int	tcp_lro_parse(struct mbuf *, struct ip **, struct tcphdr **);
+int	tcp_lro_ok(struct mbuf *, struct ip *, struct tcphdr *);
+struct lro_entry *
+	tcp_lro_lookup(struct lro_ctrl *, struct mbuf *, struct ip *,
+	    struct tcphdr *);
+int	tcp_lro_append(struct lro_entry *, struct mbuf *, struct ip *,
+	    struct tcphdr *);
+void	tcp_lro_flush(struct lro_ctrl *, struct lro_entry *);
+
+void
+tcp_lro_init(struct lro_ctrl *lro, struct ifnet *ifp)
+{
+	bzero(lro, sizeof(*lro));
+	lro->lro_ifp = ifp;
+}
+
+/*
+ * Find the IPv4 and TCP headers of an untagged frame without IP
+ * options or fragmentation.  Anything else goes straight up.
+ */
+int
+tcp_lro_parse(struct mbuf *m, struct ip **ipp, struct tcphdr **thp)
+{
+	struct ether_header *eh;
+	struct ip *ip;
+
+	if (m->m_len < ETHER_HDR_LEN + sizeof(struct ip) +
+	    sizeof(struct tcphdr))
+		return (0);
+	eh = mtod(m, struct ether_header *);
+	if (eh->ether_type != htons(ETHERTYPE_IP))
+		return (0);
+	ip = (struct ip *)(eh + 1);
+	if (ip->ip_v != IPVERSION || ip->ip_hl != sizeof(struct ip) >> 2 ||
+	    ip->ip_p != IPPROTO_TCP ||
+	    (ip->ip_off & htons(IP_MF | IP_OFFMASK)))
+		return (0);
+
+	*ipp = ip;
+	*thp = (struct tcphdr *)(ip + 1);
+	return (1);
+}
+
+/*
+ * Only plain data segments are aggregated: ACK with an optional PUSH,
+ * no option but a timestamp, checksums verified by the hardware and
+ * no congestion mark, which tcp_input() has to see per segment.
+ */
+int
+tcp_lro_ok(struct mbuf *m, struct ip *ip, struct tcphdr *th)
+{
+	u_int32_t opt;
+	int thlen;
+
+	if ((m->m_pkthdr.csum_flags & (M_IPV4_CSUM_IN_OK|M_TCP_CSUM_IN_OK)) !=
+	    (M_IPV4_CSUM_IN_OK|M_TCP_CSUM_IN_OK))
+		return (0);
+	if ((ip->ip_tos & IPTOS_ECN_MASK) == IPTOS_ECN_CE)
+		return (0);
+	if ((th->th_flags & ~TH_PUSH) != TH_ACK)
+		return (0);
+
+	thlen = th->th_off << 2;
+	if (thlen == sizeof(struct tcphdr) + TCPOLEN_TSTAMP_APPA) {
+		if (m->m_len < ETHER_HDR_LEN + sizeof(struct ip) + thlen)
+			return (0);
+		bcopy(th + 1, &opt, sizeof(opt));
+		if (opt != htonl(TCPOPT_TSTAMP_HDR))
+			return (0);
+	} else if (thlen != sizeof(struct tcphdr))
+		return (0);
+
+	/* no pure ACKs, no ethernet padding */
+	if (ntohs(ip->ip_len) <= sizeof(struct ip) + thlen ||
+	    m->m_pkthdr.len != ETHER_HDR_LEN + ntohs(ip->ip_len))
+		return (0);
+
+	return (1);
+}
+
+struct lro_entry *
+tcp_lro_lookup(struct lro_ctrl *lro, struct mbuf *m, struct ip *ip,
+    struct tcphdr *th)
+{
+	struct lro_entry *le;
+	struct mbuf *h;
+	int i;
+
+	if (lro->lro_cnt == 0)
+		return (NULL);
+
+	for (i = 0; i < LRO_ENTRIES; i++) {
+		le = &lro->lro_ent[i];
+		if ((h = le->le_head) == NULL)
+			continue;
+		if (le->le_ip->ip_src.s_addr != ip->ip_src.s_addr ||
+		    le->le_ip->ip_dst.s_addr != ip->ip_dst.s_addr ||
+		    le->le_th->th_sport != th->th_sport ||
+		    le->le_th->th_dport != th->th_dport)
+			continue;
+		if ((h->m_flags & M_VLANTAG) != (m->m_flags & M_VLANTAG) ||
+		    ((m->m_flags & M_VLANTAG) &&
+		    h->m_pkthdr.ether_vtag != m->m_pkthdr.ether_vtag))
+			continue;
+		return (le);
+	}
+	return (NULL);
+}
+
+/*
+ * Chain the data of m onto the aggregate if it is the next segment
+ * of the flow.  The aggregate carries the newest ACK, window and
+ * timestamps.
+ */
+int
+tcp_lro_append(struct lro_entry *le, struct mbuf *m, struct ip *ip,
+    struct tcphdr *th)
+{
+	struct ip *hip = le->le_ip;
+	struct tcphdr *hth = le->le_th;
+	u_int32_t ts[2], hts[2];
+	int hlen, tlen;
+
+	hlen = sizeof(struct ip) + (th->th_off << 2);
+	tlen = ntohs(ip->ip_len) - hlen;
+	if (ntohl(th->th_seq) != le->le_next ||
+	    th->th_off != hth->th_off || ip->ip_tos != hip->ip_tos ||
+	    SEQ_LT(ntohl(th->th_ack), ntohl(hth->th_ack)) ||
+	    ntohs(hip->ip_len) + tlen > LRO_MAXLEN)
+		return (-1);
+
+	if (th->th_off << 2 != sizeof(struct tcphdr)) {
+		bcopy((u_int32_t *)(th + 1) + 1, ts, sizeof(ts));
+		bcopy((u_int32_t *)(hth + 1) + 1, hts, sizeof(hts));
+		if (SEQ_LT(ntohl(ts[0]), ntohl(hts[0])))
+			return (-1);
+		bcopy(ts, (u_int32_t *)(hth + 1) + 1, sizeof(ts));
+	}
+
+	hip->ip_len = htons(ntohs(hip->ip_len) + tlen);
+	hth->th_ack = th->th_ack;
+	hth->th_win = th->th_win;
+	hth->th_flags |= th->th_flags & TH_PUSH;
+	le->le_head->m_pkthdr.len += tlen;
+	le->le_next += tlen;
+	le->le_segs++;
+
+	m_adj(m, ETHER_HDR_LEN + hlen);
+	m_tag_delete_chain(m);
+	m->m_flags &= ~M_PKTHDR;
+	le->le_tail->m_next = m;
+	while (m->m_next != NULL)
+		m = m->m_next;
+	le->le_tail = m;
+
+	return (0);
+}
+
+void
+tcp_lro_flush(struct lro_ctrl *lro, struct lro_entry *le)
+{
+	struct mbuf *m = le->le_head;
+
+	if (le->le_segs > 1) {
+		/* the TCP checksum stays marked as verified */
+		le->le_ip->ip_sum = 0;
+		m->m_data += ETHER_HDR_LEN;
+		m->m_len -= ETHER_HDR_LEN;
+		le->le_ip->ip_sum = in_cksum(m, sizeof(struct ip));
+		m->m_data -= ETHER_HDR_LEN;
+		m->m_len += ETHER_HDR_LEN;
+		tcpstat.tcps_inlroaggr++;
+		tcpstat.tcps_inlrosegs += le->le_segs;
+	}
+
+	bzero(le, sizeof(*le));
+	lro->lro_cnt--;
+	ether_input_mbuf(lro->lro_ifp, m);
+}
+
+/*
+ * Take a received frame from the driver.  Forwarded packets must
+ * keep their size, so nothing is aggregated on a router or bridge.
+ */
+void
+tcp_lro_rx(struct lro_ctrl *lro, struct mbuf *m)
+{
+	struct lro_entry *le;
+	struct ip *ip;
+	struct tcphdr *th;
+	int i, ok;
+
+	if (ipforwarding || lro->lro_ifp->if_bridge != NULL ||
+	    !tcp_lro_parse(m, &ip, &th)) {
+		ether_input_mbuf(lro->lro_ifp, m);
+		return;
+	}
+
+	ok = tcp_lro_ok(m, ip, th);
+	if ((le = tcp_lro_lookup(lro, m, ip, th)) != NULL) {
+		if (ok && tcp_lro_append(le, m, ip, th) == 0) {
+			if (th->th_flags & TH_PUSH)
+				tcp_lro_flush(lro, le);
+			return;
+		}
+		/* keep the flow in order */
+		tcp_lro_flush(lro, le);
+	}
+	if (!ok || (th->th_flags & TH_PUSH)) {
+		ether_input_mbuf(lro->lro_ifp, m);
+		return;
+	}
+
+	if (lro->lro_cnt == LRO_ENTRIES)
+		tcp_lro_flush_all(lro);
+	for (i = 0; i < LRO_ENTRIES; i++) {
+		le = &lro->lro_ent[i];
+		if (le->le_head == NULL)
+			break;
+	}
+	KASSERT(i < LRO_ENTRIES);
+
+	le->le_head = le->le_tail = m;
+	while (le->le_tail->m_next != NULL)
+		le->le_tail = le->le_tail->m_next;
+	le->le_ip = ip;
+	le->le_th = th;
+	le->le_next = ntohl(th->th_seq) + ntohs(ip->ip_len) -
+	    sizeof(struct ip) - (th->th_off << 2);
+	le->le_segs = 1;
+	lro->lro_cnt++;
+}
+
+void
+tcp_lro_flush_all(struct lro_ctrl *lro)
+{
+	int i;
+
+	for (i = 0; i < LRO_ENTRIES && lro->lro_cnt > 0; i++)
+		if (lro->lro_ent[i].le_head != NULL)
+			tcp_lro_flush(lro, &lro->lro_ent[i]);
+}
@@ -0,0 +1,53 @@
+/*	$OpenBSD$	*/
+
+/*
+ * Copyright (c) 2011 The OpenBSD Foundation
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _NETINET_TCP_LRO_H_
+#define _NETINET_TCP_LRO_H_
+
+/*
+ * Software large receive offload.  A driver passes each received frame
+ * to tcp_lro_rx() and calls tcp_lro_flush_all() when its receive loop
+ * is done.  In order data segments of a flow are chained onto the
+ * first one, whose headers are rewritten to describe the aggregate, so
+ * the stack runs once per burst instead of once per frame.
+ */
+#define LRO_ENTRIES		8		/* flows aggregated at once */
+#define LRO_MAXLEN		IP_MAXPACKET	/* ip_len of an aggregate */
+
+struct lro_entry {
+	struct mbuf		*le_head;	/* first frame, carries headers */
+	struct mbuf		*le_tail;	/* last mbuf of the chain */
+	struct ip		*le_ip;
+	struct tcphdr		*le_th;
+	tcp_seq			 le_next;	/* next expected sequence */
+	u_int			 le_segs;	/* segments in the aggregate */
+};
+
+struct lro_ctrl {
+	struct ifnet		*lro_ifp;
+	int			 lro_cnt;	/* entries in use */
+	struct lro_entry	 lro_ent[LRO_ENTRIES];
+};
+
+#ifdef _KERNEL
+void	tcp_lro_init(struct lro_ctrl *, struct ifnet *);
+void	tcp_lro_rx(struct lro_ctrl *, struct mbuf *);
+void	tcp_lro_flush_all(struct lro_ctrl *);
+#endif /* _KERNEL */
+
+#endif /* _NETINET_TCP_LRO_H_ */
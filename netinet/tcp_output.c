@@ -108,6 +108,8 @@ extern struct mbuf *m_copypack();
 extern int tcprexmtthresh;
 #endif
 
+int tcp_tso_ok(struct tcpcb *, int);
+
 #ifdef TCP_SACK
 #ifdef TCP_SACK_DEBUG
 void tcp_print_holes(struct tcpcb *tp);
@@ -216,8 +218,8 @@ tcp_output(struct tcpcb *tp)
 	struct tcphdr *th;
 	u_int32_t optbuf[howmany(MAX_TCPOPTLEN, sizeof(u_int32_t))];
 	u_char *opt = (u_char *)optbuf;
-	unsigned int optlen, hdrlen, packetlen;
-	int idle, sendalot = 0;
+	unsigned int optlen, hdrlen, packetlen, segsz = 0;
+	int idle, sendalot = 0, tso;
 #ifdef TCP_SACK
 	int i, sack_rxmit = 0;
 	struct sackhole *p;
@@ -393,6 +395,24 @@ again:
          */
 	txmaxseg = ulmin(so->so_snd.sb_hiwat / 2, tp->t_maxseg);
 
+	/*
+	 * With segmentation offload hand IP a burst of several segments,
+	 * the interface or ip_output() cuts it back to t_maxseg.
+	 */
+	tso = 0;
+	if (len > txmaxseg && tcp_tso_ok(tp, flags)
+#ifdef TCP_SACK
+	    && !sack_rxmit
+#endif
+	    ) {
+		txmaxseg = ulmin(so->so_snd.sb_hiwat / 2, TCP_TSO_MAXLEN);
+		if (txmaxseg > tp->t_maxseg)
+			tso = 1;
+		else
+			txmaxseg = ulmin(so->so_snd.sb_hiwat / 2,
+			    tp->t_maxseg);
+	}
+
 	if (len > txmaxseg) {
 		len = txmaxseg;
 		sendalot = 1;
@@ -413,7 +433,7 @@ again:
 	 * to send into a small window), then must resend.
 	 */
 	if (len) {
-		if (len == txmaxseg)
+		if (len == txmaxseg || (tso && len >= tp->t_maxseg))
 			goto send;
 		if ((idle || tp->t_flags & TF_NODELAY) &&
 		    len + off >= so->so_snd.sb_cc && !soissending(so))
@@ -675,7 +695,19 @@ send:
 	 * Adjust data length if insertion of options will
 	 * bump the packet length beyond the t_maxopd length.
 	 */
-	if (len > tp->t_maxopd - optlen) {
+	if (tso) {
+		/* only the last segment of a burst may be short */
+		segsz = tp->t_maxopd - optlen;
+		if (len > segsz && len % segsz &&
+		    off + len < so->so_snd.sb_cc) {
+			len -= len % segsz;
+			sendalot = 1;
+			flags &= ~TH_FIN;
+		}
+		if (len <= segsz)
+			tso = 0;
+	}
+	if (!tso && len > tp->t_maxopd - optlen) {
 		len = tp->t_maxopd - optlen;
 		sendalot = 1;
 		flags &= ~TH_FIN;
@@ -958,7 +990,11 @@ send:
 	case AF_INET:
 		/* Defer checksumming until later (ip_output() or hardware) */
 		m->m_pkthdr.csum_flags |= M_TCP_CSUM_OUT;
-		if (len + optlen)
+		if (tso) {
+			/* segments get their length summed in later */
+			m->m_pkthdr.csum_flags |= M_TCP_TSO;
+			m->m_pkthdr.tso_segsz = segsz;
+		} else if (len + optlen)
 			th->th_sum = in_cksum_addword(th->th_sum,
 			    htons((u_int16_t)(len + optlen)));
 		break;
@@ -1093,6 +1129,8 @@ send:
 			ip = mtod(m, struct ip *);
 			ip->ip_len = htons(m->m_pkthdr.len);
 			packetlen = m->m_pkthdr.len;
+			if (tso)
+				packetlen = hdrlen + segsz;
 			ip->ip_ttl = tp->t_inpcb->inp_ip.ip_ttl;
 			ip->ip_tos = tp->t_inpcb->inp_ip.ip_tos;
 #ifdef TCP_ECN
@@ -1218,3 +1256,116 @@ tcp_setpersist(struct tcpcb *tp)
 	if (tp->t_rxtshift < TCP_MAXRXTSHIFT)
 		tp->t_rxtshift++;
 }
+
+/*
+ * Check whether the next segments may leave as one TSO burst.  Only
+ * plain IPv4 data qualifies; options, signatures and urgent data all
+ * differ per segment.
+ */
+int
+tcp_tso_ok(struct tcpcb *tp, int flags)
+{
+	if (!tcp_do_tso)
+		return (0);
+	if (tp->pf != 0 && tp->pf != AF_INET)
+		return (0);
+	if ((flags & (TH_SYN|TH_RST)) || tp->t_force)
+		return (0);
+	if (tp->t_flags & TF_SIGNATURE)
+		return (0);
+	if (tp->t_inpcb->inp_options != NULL)
+		return (0);
+	if (SEQ_GT(tp->snd_up, tp->snd_nxt))
+		return (0);
+#ifdef IPSEC
+	if (ipsec_in_use)
+		return (0);
+#endif
+	return (1);
+}
+
+/*
+ * Cut a TSO burst into segments of tso_segsz data bytes for an
+ * interface that cannot do it itself.  As with ip_fragment(), the
+ * segments are chained on m_nextpkt with m first, and the whole chain
+ * is freed on failure.
+ */
+int
+tcp_chop(struct mbuf *m, struct ifnet *ifp)
+{
+	struct ip *ip, *nip;
+	struct tcphdr *th, *nth;
+	struct mbuf *n, **mnext;
+	int hlen, thlen, off, len, tlen, segsz, error = 0;
+	tcp_seq seq;
+
+	ip = mtod(m, struct ip *);
+	hlen = ip->ip_hl << 2;
+	th = (struct tcphdr *)((caddr_t)ip + hlen);
+	thlen = th->th_off << 2;
+	tlen = ntohs(ip->ip_len);
+	segsz = m->m_pkthdr.tso_segsz;
+	seq = ntohl(th->th_seq);
+
+	m->m_pkthdr.csum_flags &= ~M_TCP_TSO;
+	mnext = &m->m_nextpkt;
+	for (off = hlen + thlen + segsz; off < tlen; off += segsz) {
+		len = min(segsz, tlen - off);
+		MGETHDR(n, M_DONTWAIT, MT_HEADER);
+		if (n == NULL) {
+			error = ENOBUFS;
+			goto bad;
+		}
+		*mnext = n;
+		mnext = &n->m_nextpkt;
+		if (max_linkhdr + hlen + thlen > MHLEN) {
+			MCLGET(n, M_DONTWAIT);
+			if ((n->m_flags & M_EXT) == 0) {
+				error = ENOBUFS;
+				goto bad;
+			}
+		}
+		n->m_data += max_linkhdr;
+		n->m_len = hlen + thlen;
+		bcopy(ip, mtod(n, caddr_t), hlen + thlen);
+		n->m_next = m_copym(m, off, len, M_DONTWAIT);
+		if (n->m_next == NULL) {
+			error = ENOBUFS;
+			goto bad;
+		}
+		n->m_pkthdr.len = hlen + thlen + len;
+		n->m_pkthdr.csum_flags = m->m_pkthdr.csum_flags;
+		n->m_pkthdr.rdomain = m->m_pkthdr.rdomain;
+		n->m_pkthdr.pf = m->m_pkthdr.pf;
+
+		nip = mtod(n, struct ip *);
+		nip->ip_len = htons(n->m_pkthdr.len);
+		nip->ip_id = htons(ip_randomid());
+		nth = (struct tcphdr *)((caddr_t)nip + hlen);
+		nth->th_seq = htonl(seq + off - hlen - thlen);
+		/* CWR goes out once, FIN and PUSH with the last segment */
+		nth->th_flags &= ~TH_CWR;
+		if (off + len < tlen)
+			nth->th_flags &= ~(TH_FIN|TH_PUSH);
+		nth->th_sum = in_cksum_phdr(nip->ip_src.s_addr,
+		    nip->ip_dst.s_addr, htons(thlen + len + IPPROTO_TCP));
+		in_proto_cksum_out(n, ifp);
+	}
+
+	m_adj(m, hlen + thlen + segsz - tlen);
+	m->m_pkthdr.len = hlen + thlen + segsz;
+	ip->ip_len = htons(m->m_pkthdr.len);
+	th->th_flags &= ~(TH_FIN|TH_PUSH);
+	th->th_sum = in_cksum_phdr(ip->ip_src.s_addr, ip->ip_dst.s_addr,
+	    htons(thlen + segsz + IPPROTO_TCP));
+	in_proto_cksum_out(m, ifp);
+	return (0);
+
+bad:
+	for (; m; m = n) {
+		n = m->m_nextpkt;
+		m->m_nextpkt = NULL;
+		m_freem(m);
+	}
+	return (error);
+}
@@ -92,6 +92,7 @@
 #include <netinet/tcp_seq.h>
 #include <netinet/tcp_timer.h>
 #include <netinet/tcp_var.h>
+#include <netinet/tcp_cc.h>
 #include <netinet/tcpip.h>
 #include <dev/rndvar.h>
 
@@ -116,6 +117,7 @@ int	tcp_ack_on_push = 0;	/* set to enable immediate ACK-on-PUSH */
 int	tcp_do_ecn = 0;		/* RFC3168 ECN enabled/disabled? */
 #endif
 int	tcp_do_rfc3390 = 1;	/* RFC3390 Increasing TCP's Initial Window */
+int	tcp_do_tso = 1;		/* send TSO bursts */
 
 u_int32_t	tcp_now = 1;
 
@@ -130,6 +132,7 @@ int	tcbhashsize = TCBHASHSIZE;
 int	tcp_syn_cache_size = TCP_SYN_HASH_SIZE;
 int	tcp_syn_cache_limit = TCP_SYN_HASH_SIZE*TCP_SYN_BUCKET_SIZE;
 int	tcp_syn_bucket_limit = 3*TCP_SYN_BUCKET_SIZE;
+int	tcp_syn_use_cookies = 1;
 struct	syn_cache_head tcp_syn_cache[TCP_SYN_HASH_SIZE];
 
 int tcp_reass_limit = NMBCLUSTERS / 2; /* hardlimit for tcpqe_pool */
@@ -455,7 +458,6 @@ struct tcpcb *
 tcp_newtcpcb(struct inpcb *inp)
 {
 	struct tcpcb *tp;
-	int i;
 
 	tp = pool_get(&tcpcb_pool, PR_NOWAIT|PR_ZERO);
 	if (tp == NULL)
@@ -465,8 +467,6 @@ tcp_newtcpcb(struct inpcb *inp)
 	tp->t_maxopd = 0;
 
 	TCP_INIT_DELACK(tp);
-	for (i = 0; i < TCPT_NTIMERS; i++)
-		TCP_TIMER_INIT(tp, i);
 	timeout_set(&tp->t_reap_to, tcp_reaper, tp);
 
 #ifdef TCP_SACK
@@ -487,6 +487,7 @@ tcp_newtcpcb(struct inpcb *inp)
 	    TCPTV_MIN, TCPTV_REXMTMAX);
 	tp->snd_cwnd = TCP_MAXWIN << TCP_MAX_WINSHIFT;
 	tp->snd_ssthresh = TCP_MAXWIN << TCP_MAX_WINSHIFT;
+	tcp_cc_set(tp, tcp_cc_default);
 	
 	tp->t_pmtud_mtu_sent = 0;
 	tp->t_pmtud_mss_acked = 0;
@@ -52,6 +52,7 @@
 #include <netinet/tcp_fsm.h>
 #include <netinet/tcp_timer.h>
 #include <netinet/tcp_var.h>
+#include <netinet/tcp_cc.h>
 #include <netinet/ip_icmp.h>
 #include <netinet/tcp_seq.h>
 
@@ -78,12 +79,25 @@ const tcp_timer_func_t tcp_timer_funcs[TCPT_NTIMERS] = {
 	tcp_timer_2msl,
 };
 
+struct tcp_wheelq tcp_wheel[TCP_WHEEL_SIZE];
+struct tcp_wheelq tcp_wheel_due;	/* slot being run */
+u_int	tcp_wheel_now;			/* wheel steps since boot */
+int	tcp_wheel_ticks;		/* ticks at the last step */
+int	tcp_wheel_period;		/* ticks per step */
+struct timeout tcp_wheel_to;
+
+void	tcp_wheel_insert(struct tcpcb *, u_int);
+void	tcp_wheel_remove(struct tcpcb *);
+void	tcp_wheel_expire(struct tcpcb *);
+void	tcp_wheel_tick(void *);
+
 /*
  * Timer state initialization, called from tcp_init().
  */
 void
 tcp_timer_init(void)
 {
+	int i;
 
 	if (tcp_keepidle == 0)
 		tcp_keepidle = TCPTV_KEEP_IDLE;
@@ -96,6 +110,123 @@ tcp_timer_init(void)
 
 	if (tcp_delack_ticks == 0)
 		tcp_delack_ticks = TCP_DELACK_TICKS;
+
+	for (i = 0; i < TCP_WHEEL_SIZE; i++)
+		TAILQ_INIT(&tcp_wheel[i]);
+	TAILQ_INIT(&tcp_wheel_due);
+	tcp_wheel_period = max(hz / TCP_WHEEL_HZ, 1);
+	tcp_wheel_ticks = ticks;
+	timeout_set(&tcp_wheel_to, tcp_wheel_tick, NULL);
+	timeout_add(&tcp_wheel_to, tcp_wheel_period);
+}
+
+/*
+ * Arm a timer to go off nsteps wheel steps from now.  The deadline is
+ * rounded up so that a timer never fires early.
+ */
+void
+tcp_timer_arm(struct tcpcb *tp, int timer, u_int nsteps)
+{
+	u_int deadline = tcp_wheel_now + nsteps + 1;
+
+	/* the reaper frees tp without looking at the wheel */
+	if (tp->t_flags & TF_DEAD)
+		return;
+	tp->t_deadline[timer] = deadline;
+	tp->t_timers |= 1 << timer;
+	if (tp->t_wheelhead == NULL || (int)(deadline - tp->t_wheeltime) < 0)
+		tcp_wheel_insert(tp, deadline);
+}
+
+void
+tcp_wheel_insert(struct tcpcb *tp, u_int when)
+{
+	tcp_wheel_remove(tp);
+	tp->t_wheeltime = when;
+	tp->t_wheelhead = &tcp_wheel[when & (TCP_WHEEL_SIZE - 1)];
+	TAILQ_INSERT_TAIL(tp->t_wheelhead, tp, t_wheelq);
+}
+
+void
+tcp_wheel_remove(struct tcpcb *tp)
+{
+	if (tp->t_wheelhead != NULL) {
+		TAILQ_REMOVE(tp->t_wheelhead, tp, t_wheelq);
+		tp->t_wheelhead = NULL;
+	}
+}
+
+/*
+ * Run the timers of tp that are due and put it back on the wheel for
+ * the earliest one left.  Disarmed and re-armed timers cost nothing
+ * until we get here.
+ */
+void
+tcp_wheel_expire(struct tcpcb *tp)
+{
+	u_int when = 0;
+	int i, armed = 0;
+
+	for (i = 0; i < TCPT_NTIMERS; i++) {
+		if (!TCP_TIMER_ISARMED(tp, i) ||
+		    (int)(tp->t_deadline[i] - tcp_wheel_now) > 0)
+			continue;
+		TCP_TIMER_DISARM(tp, i);
+		(*tcp_timer_funcs[i])(tp);
+		if (tp->t_flags & TF_DEAD)
+			return;
+	}
+
+	for (i = 0; i < TCPT_NTIMERS; i++) {
+		if (!TCP_TIMER_ISARMED(tp, i))
+			continue;
+		if (!armed || (int)(tp->t_deadline[i] - when) < 0)
+			when = tp->t_deadline[i];
+		armed = 1;
+	}
+	if (armed && (tp->t_wheelhead == NULL ||
+	    (int)(when - tp->t_wheeltime) < 0))
+		tcp_wheel_insert(tp, when);
+}
+
+void
+tcp_wheel_tick(void *arg)
+{
+	struct tcpcb *tp;
+	struct tcp_wheelq *slot;
+	int s, steps;
+
+	s = splsoftnet();
+	steps = (ticks - tcp_wheel_ticks) / tcp_wheel_period;
+	tcp_wheel_ticks += steps * tcp_wheel_period;
+	/* after a long stall one lap visits every slot */
+	if (steps > TCP_WHEEL_SIZE)
+		steps = TCP_WHEEL_SIZE;
+
+	while (steps-- > 0) {
+		tcp_wheel_now++;
+		slot = &tcp_wheel[tcp_wheel_now & (TCP_WHEEL_SIZE - 1)];
+
+		/* timers armed from here on must not join this run */
+		while ((tp = TAILQ_FIRST(slot)) != NULL) {
+			TAILQ_REMOVE(slot, tp, t_wheelq);
+			TAILQ_INSERT_TAIL(&tcp_wheel_due, tp, t_wheelq);
+			tp->t_wheelhead = &tcp_wheel_due;
+		}
+
+		while ((tp = TAILQ_FIRST(&tcp_wheel_due)) != NULL) {
+			tcp_wheel_remove(tp);
+			if ((int)(tp->t_wheeltime - tcp_wheel_now) > 0) {
+				/* due on a later lap */
+				tcp_wheel_insert(tp, tp->t_wheeltime);
+				continue;
+			}
+			tcp_wheel_expire(tp);
+		}
+	}
+	splx(s);
+
+	timeout_add(&tcp_wheel_to, tcp_wheel_period);
 }
 
 /*
@@ -147,10 +278,8 @@ void
 tcp_canceltimers(tp)
 	struct tcpcb *tp;
 {
-	int i;
-
-	for (i = 0; i < TCPT_NTIMERS; i++)
-		TCP_TIMER_DISARM(tp, i);
+	tp->t_timers = 0;
+	tcp_wheel_remove(tp);
 }
 
 int	tcp_backoff[TCP_MAXRXTSHIFT + 1] =
@@ -353,19 +482,11 @@ tcp_timer_rexmt(void *arg)
 	 * drops but still "push" the network to take advantage
 	 * of improving conditions, we switch from exponential
 	 * to linear window opening at some threshold size.
-	 * For a threshold, we use half the current window
-	 * size, truncated to a multiple of the mss.
-	 *
-	 * (the minimum cwnd that will give us exponential
-	 * growth is 2 mss.  We don't allow the threshold
-	 * to go below this.)
+	 * The congestion control algorithm picks the
+	 * threshold.
 	 */
 	{
-		u_long win = ulmin(tp->snd_wnd, tp->snd_cwnd) / 2 / tp->t_maxseg;
-		if (win < 2)
-			win = 2;
-		tp->snd_cwnd = tp->t_maxseg;
-		tp->snd_ssthresh = win * tp->t_maxseg;
+		(*tp->t_cc->cc_cong_signal)(tp, TCP_CC_RTO);
 		tp->t_dupacks = 0;
 #ifdef TCP_ECN
 		tp->snd_last = tp->snd_max;
@@ -113,19 +113,25 @@ const char *tcptimers[] =
 #endif /* TCPTIMERS */
 
 /*
- * Init, arm, disarm, and test TCP timers.
+ * The timers of all connections hang off one hashed timing wheel that
+ * moves TCP_WHEEL_HZ times a second.  Arming a timer stores its
+ * deadline in wheel steps; the tcpcb is only moved on the wheel when
+ * the new deadline is earlier than the slot it already sits in.
  */
-#define	TCP_TIMER_INIT(tp, timer)					\
-	timeout_set(&(tp)->t_timer[(timer)], tcp_timer_funcs[(timer)], tp)
+#define	TCP_WHEEL_HZ	10			/* wheel steps per second */
+#define	TCP_WHEEL_SIZE	512			/* slots, a power of 2 */
 
+/*
+ * Arm, disarm, and test TCP timers.
+ */
 #define	TCP_TIMER_ARM(tp, timer, nticks)				\
-	timeout_add(&(tp)->t_timer[(timer)], (nticks) * (hz / PR_SLOWHZ))
+	tcp_timer_arm((tp), (timer), (nticks) * (TCP_WHEEL_HZ / PR_SLOWHZ))
 
 #define	TCP_TIMER_DISARM(tp, timer)					\
-	timeout_del(&(tp)->t_timer[(timer)])
+	((tp)->t_timers &= ~(1 << (timer)))
 
 #define	TCP_TIMER_ISARMED(tp, timer)					\
-	timeout_pending(&(tp)->t_timer[(timer)])
+	((tp)->t_timers & (1 << (timer)))
 
 /*
  * Force a time value to be in a certain range.
@@ -152,5 +158,6 @@ extern int tcp_ttl;			/* time to live for TCP segs */
 extern int tcp_backoff[];
 
 void	tcp_timer_init(void);
+void	tcp_timer_arm(struct tcpcb *, int, u_int);
 #endif /* _KERNEL */
 #endif /* _NETINET_TCP_TIMER_H_ */
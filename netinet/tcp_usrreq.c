@@ -97,6 +97,7 @@
 #include <netinet/tcp_seq.h>
 #include <netinet/tcp_timer.h>
 #include <netinet/tcp_var.h>
+#include <netinet/tcp_cc.h>
 #include <netinet/tcpip.h>
 #include <netinet/tcp_debug.h>
 
@@ -120,6 +121,8 @@ u_int	tcp_sendspace = TCP_SENDSPACE;
 #endif
 u_int	tcp_recvspace = TCP_RECVSPACE;
 u_int	tcp_autorcvbuf_inc = 16 * 1024;
+int	tcp_autosndbuf_max = SB_MAX;	/* limit of send buffer scaling */
+int	tcp_autorcvbuf_max = SB_MAX;	/* limit of recv buffer scaling */
 
 int *tcpctl_vars[TCPCTL_MAXID] = TCPCTL_VARS;
 
@@ -601,6 +604,26 @@ tcp_ctloutput(op, so, level, optname, mp)
 				tp->t_flags &= ~TF_SIGNATURE;
 			break;
 #endif /* TCP_SIGNATURE */
+		case TCP_CONGCTL:
+		    {
+			const struct tcp_cc *cc;
+			char name[TCP_CC_NAMELEN];
+
+			if (m == NULL || m->m_len == 0 ||
+			    m->m_len >= sizeof(name)) {
+				error = EINVAL;
+				break;
+			}
+			bcopy(mtod(m, caddr_t), name, m->m_len);
+			name[m->m_len] = '\0';
+			if ((cc = tcp_cc_lookup(name)) == NULL) {
+				error = ENOENT;
+				break;
+			}
+			if (cc != tp->t_cc)
+				tcp_cc_set(tp, cc);
+			break;
+		    }
 		default:
 			error = ENOPROTOOPT;
 			break;
@@ -630,6 +653,10 @@ tcp_ctloutput(op, so, level, optname, mp)
 			*mtod(m, int *) = tp->t_flags & TF_SIGNATURE;
 			break;
 #endif
+		case TCP_CONGCTL:
+			m->m_len = strlcpy(mtod(m, caddr_t), tp->t_cc->cc_name,
+			    TCP_CC_NAMELEN) + 1;
+			break;
 		default:
 			error = ENOPROTOOPT;
 			break;
@@ -941,12 +968,38 @@ tcp_sysctl(name, namelen, oldp, oldlenp, newp, newlen)
 		return (0);
 #endif
 
+	case TCPCTL_SNDBUF_MAX:
+		nval = tcp_autosndbuf_max;
+		error = sysctl_int(oldp, oldlenp, newp, newlen, &nval);
+		if (error)
+			return (error);
+		if (nval <= 0 || nval > sb_max)
+			return (EINVAL);
+		tcp_autosndbuf_max = nval;
+		return (0);
+
+	case TCPCTL_RCVBUF_MAX:
+		nval = tcp_autorcvbuf_max;
+		error = sysctl_int(oldp, oldlenp, newp, newlen, &nval);
+		if (error)
+			return (error);
+		if (nval <= 0 || nval > sb_max)
+			return (EINVAL);
+		tcp_autorcvbuf_max = nval;
+		return (0);
+
 	case TCPCTL_STATS:
 		if (newp != NULL)
 			return (EPERM);
 		return (sysctl_struct(oldp, oldlenp, newp, newlen,
 		    &tcpstat, sizeof(tcpstat)));
 
+	case TCPCTL_PCBSTAT:
+		return (in_pcbstat_sysctl(&tcbtable, oldp, oldlenp, newp));
+
+	case TCPCTL_CONGCTL:
+		return (tcp_cc_sysctl(oldp, oldlenp, newp, newlen));
+
 	default:
 		if (name[0] < TCPCTL_MAXID)
 			return (sysctl_int_arr(tcpctl_vars, name, namelen,
@@ -960,7 +1013,8 @@ tcp_sysctl(name, namelen, oldp, oldlenp, newp, newlen)
  * Scale the send buffer so that inflight data is not accounted against
  * the limit. The buffer will scale with the congestion window, if the
  * the receiver stops acking data the window will shrink and therefor
- * the buffer size will shrink as well.
+ * the buffer size will shrink as well.  Room for a full window on top
+ * lets the application stay ahead of the sender.
  * In low memory situation try to shrink the buffer to the initial size
  * disabling the send buffer scaling as long as the situation persists.
  */
@@ -976,10 +1030,13 @@ tcp_update_sndspace(struct tcpcb *tp)
 	else if (so->so_snd.sb_wat != tcp_sendspace)
 		/* user requested buffer size, auto-scaling disabled */
 		nmax = so->so_snd.sb_wat;
-	else
+	else {
 		/* automatic buffer scaling */
-		nmax = MIN(sb_max, so->so_snd.sb_wat + tp->snd_max -
-		    tp->snd_una);
+		nmax = so->so_snd.sb_wat + ulmax(tp->snd_max - tp->snd_una,
+		    ulmin(tp->snd_cwnd, tp->snd_wnd));
+		nmax = MIN(nmax, MIN(sb_max, tcp_autosndbuf_max));
+		nmax = MAX(nmax, so->so_snd.sb_wat);
+	}
 
 	/* round to MSS boundary */
 	nmax = roundup(nmax, tp->t_maxseg);
@@ -991,7 +1048,8 @@ tcp_update_sndspace(struct tcpcb *tp)
 /*
  * Scale the recv buffer by looking at how much data was transfered in
  * on approximated RTT. If more then a big part of the recv buffer was
- * transfered during that time we increase the buffer by a constant.
+ * transfered during that time the sender is limited by our window, so
+ * make room for twice that amount, growing by at least a constant.
  * In low memory situation try to shrink the buffer to the initial size.
  */
 void
@@ -1009,8 +1067,11 @@ tcp_update_rcvspace(struct tcpcb *tp)
 	else {
 		/* automatic buffer scaling */
 		if (tp->rfbuf_cnt > so->so_rcv.sb_hiwat / 8 * 7)
-			nmax = MIN(sb_max, so->so_rcv.sb_hiwat +
-			    tcp_autorcvbuf_inc);
+			nmax = MIN(MIN(sb_max, tcp_autorcvbuf_max),
+			    ulmax(so->so_rcv.sb_hiwat + tcp_autorcvbuf_inc,
+			    2 * tp->rfbuf_cnt));
+		/* never shrink a buffer the peer may already be using */
+		nmax = MAX(nmax, so->so_rcv.sb_hiwat);
 	}
 
 	if (nmax == so->so_rcv.sb_hiwat)
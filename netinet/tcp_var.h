@@ -62,12 +62,18 @@ struct tcpqent {
 	struct mbuf	*tcpqe_m;	/* mbuf contains packet */
 };
 
+TAILQ_HEAD(tcp_wheelq, tcpcb);
+
 /*
  * Tcp control block, one per tcp; fields:
  */
 struct tcpcb {
 	struct tcpqehead t_segq;		/* sequencing queue */
-	struct timeout t_timer[TCPT_NTIMERS];	/* tcp timers */
+	TAILQ_ENTRY(tcpcb) t_wheelq;		/* on the timer wheel */
+	struct tcp_wheelq *t_wheelhead;		/* wheel slot, NULL if off */
+	u_int	t_wheeltime;			/* wheel time of that slot */
+	u_int	t_deadline[TCPT_NTIMERS];	/* timer deadlines */
+	u_int	t_timers;			/* armed timers */
 	short	t_state;		/* state of this connection */
 	short	t_rxtshift;		/* log(2) of rexmt exp. backoff */
 	short	t_rxtcur;		/* current retransmit value */
@@ -153,6 +159,17 @@ struct tcpcb {
 					 * for slow start exponential to
 					 * linear switch
 					 */
+	const struct tcp_cc *t_cc;	/* congestion control algorithm */
+	union {				/* per algorithm state */
+		struct {
+			u_long	wmax;	/* cwnd before the last reduction */
+			u_long	origin;	/* plateau of the curve, 0 if none */
+			u_long	west;	/* reno friendly cwnd estimate */
+			int	epoch;	/* ticks at the start of the epoch */
+			u_int	k;	/* ms from epoch start to plateau */
+		} ccu_cubic;
+	} t_ccu;
+#define	t_cubic		t_ccu.ccu_cubic
 
 /* auto-sizing variables */
 	u_int	rfbuf_cnt;	/* recv buffer autoscaling byte count */
@@ -446,6 +463,14 @@ struct	tcpstat {
 	u_int64_t tcps_sack_rexmit_bytes;	/* SACK rexmit bytes */
 	u_int64_t tcps_sack_rcv_opts;		/* SACK options received */
 	u_int64_t tcps_sack_snd_opts;		/* SACK options sent */
+
+	u_int64_t tcps_outhwtso;	/* output bursts segmented by hardware */
+	u_int64_t tcps_outswtso;	/* output bursts segmented in software */
+	u_int64_t tcps_inlroaggr;	/* input aggregates built by LRO */
+	u_int64_t tcps_inlrosegs;	/* input segments in LRO aggregates */
+	u_int64_t tcps_sc_cookiesent;	/* # of SYN,ACKs sent with a cookie */
+	u_int64_t tcps_sc_cookierecv;	/* # of connections from a cookie */
+	u_int64_t tcps_sc_cookiefail;	/* # of ACKs with a bad cookie */
 };
 
 /*
@@ -473,7 +498,13 @@ struct	tcpstat {
 #define	TCPCTL_DROP	       19 /* drop tcp connection */
 #define	TCPCTL_SACKHOLE_LIMIT  20 /* max entries for tcp sack queues */
 #define	TCPCTL_STATS	       21 /* TCP statistics */
-#define	TCPCTL_MAXID	       22
+#define	TCPCTL_TSO	       22 /* send TSO bursts */
+#define	TCPCTL_PCBSTAT	       23 /* pcb table lookup statistics */
+#define	TCPCTL_SYN_USE_COOKIES 24 /* SYN cookies when the cache is full */
+#define	TCPCTL_CONGCTL	       25 /* default congestion control */
+#define	TCPCTL_SNDBUF_MAX      26 /* limit of send buffer scaling */
+#define	TCPCTL_RCVBUF_MAX      27 /* limit of recv buffer scaling */
+#define	TCPCTL_MAXID	       28
 
 #define	TCPCTL_NAMES { \
 	{ 0, 0 }, \
@@ -497,7 +528,13 @@ struct	tcpstat {
 	{ "reasslimit", 	CTLTYPE_INT }, \
 	{ "drop", 	CTLTYPE_STRUCT }, \
 	{ "sackholelimit", 	CTLTYPE_INT }, \
-	{ "stats",	CTLTYPE_STRUCT } \
+	{ "stats",	CTLTYPE_STRUCT }, \
+	{ "tso",	CTLTYPE_INT }, \
+	{ "pcbstat",	CTLTYPE_STRUCT }, \
+	{ "syncookies",	CTLTYPE_INT }, \
+	{ "congctl",	CTLTYPE_STRING }, \
+	{ "sndbufmax",	CTLTYPE_INT }, \
+	{ "rcvbufmax",	CTLTYPE_INT } \
 }
 
 #define	TCPCTL_VARS { \
@@ -522,7 +559,13 @@ struct	tcpstat {
 	NULL, \
 	NULL, \
 	NULL, \
-	NULL \
+	NULL, \
+	&tcp_do_tso, \
+	NULL, \
+	&tcp_syn_use_cookies, \
+	NULL, \
+	&tcp_autosndbuf_max, \
+	&tcp_autorcvbuf_max \
 }
 
 struct tcp_ident_mapping {
@@ -545,12 +588,20 @@ extern	int tcp_sackhole_limit;	/* max entries for tcp sack queues */
 #endif
 extern	int tcp_do_ecn;		/* RFC3168 ECN enabled/disabled? */
 extern	int tcp_do_rfc3390;	/* RFC3390 Increasing TCP's Initial Window */
+extern	int tcp_do_tso;		/* send TSO bursts */
+
+/* data bytes in a TSO burst, leaving room for headers and options */
+#define	TCP_TSO_MAXLEN	(IP_MAXPACKET - sizeof(struct ip) - \
+			    sizeof(struct tcphdr) - MAX_TCPOPTLEN)
 
 extern	struct pool tcpqe_pool;
 extern	int tcp_reass_limit;	/* max entries for tcp reass queues */
 
 extern	int tcp_syn_cache_limit; /* max entries for compressed state engine */
 extern	int tcp_syn_bucket_limit;/* max entries per hash bucket */
+extern	int tcp_syn_use_cookies; /* SYN cookies when the cache is full */
+extern	int tcp_autosndbuf_max;	/* limit of send buffer scaling */
+extern	int tcp_autorcvbuf_max;	/* limit of recv buffer scaling */
 
 extern	int tcp_syn_cache_size;
 extern	struct syn_cache_head tcp_syn_cache[];
@@ -558,6 +609,7 @@ extern	u_long syn_cache_count;
 
 int	 tcp_attach(struct socket *);
 void	 tcp_canceltimers(struct tcpcb *);
+int	 tcp_chop(struct mbuf *, struct ifnet *);
 struct tcpcb *
 	 tcp_close(struct tcpcb *);
 void	 tcp_reaper(void *);
@@ -639,6 +691,10 @@ int	 syn_cache_add(struct sockaddr *, struct sockaddr *,
 		struct mbuf *, u_char *, int, struct tcp_opt_info *, tcp_seq *);
 void	 syn_cache_unreach(struct sockaddr *, struct sockaddr *,
 	   struct tcphdr *, u_int);
+struct socket *syn_cache_accept(struct sockaddr *, struct sockaddr *,
+		struct tcphdr *, struct syn_cache *, struct socket *,
+		struct mbuf *);
+u_int32_t syn_cache_hash(struct sockaddr *, struct sockaddr *);
 struct socket *syn_cache_get(struct sockaddr *, struct sockaddr *,
 		struct tcphdr *, unsigned int, unsigned int,
 		struct socket *so, struct mbuf *);
@@ -652,6 +708,14 @@ int	 syn_cache_respond(struct syn_cache *, struct mbuf *);
 void	 syn_cache_timer(void *);
 void	 syn_cache_cleanup(struct tcpcb *);
 void	 syn_cache_reaper(void *);
+struct socket *syn_cookie_get(struct sockaddr *, struct sockaddr *,
+		struct tcphdr *, struct socket *, struct mbuf *);
+u_int32_t syn_cookie_mac(struct sockaddr *, struct sockaddr *, tcp_seq,
+		u_int, u_int32_t);
+tcp_seq	 syn_cookie_iss(struct sockaddr *, struct sockaddr *, tcp_seq,
+		u_int, u_int16_t);
+u_int16_t syn_cookie_check(struct sockaddr *, struct sockaddr *,
+		struct tcphdr *, u_int);
 
 #endif /* _KERNEL */
 #endif /* _NETINET_TCP_VAR_H_ */
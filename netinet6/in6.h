@@ -665,7 +665,8 @@ struct ip6_mtuinfo {
 #define IPV6CTL_MAXIFDEFROUTERS 47
 #define IPV6CTL_MAXDYNROUTES	48
 #define IPV6CTL_DAD_PENDING	49
-#define IPV6CTL_MAXID		50
+#define IPV6CTL_IFQUEUE		50
+#define IPV6CTL_MAXID		51
 
 /* New entries should be added here from current IPV6CTL_MAXID value. */
 /* to define items, should talk with KAME guys first, for *BSD compatibility */
@@ -721,6 +722,7 @@ struct ip6_mtuinfo {
 	{ "maxifdefrouters", CTLTYPE_INT }, \
 	{ "maxdynroutes", CTLTYPE_INT }, \
 	{ "dad_pending", CTLTYPE_INT }, \
+	{ "ifq", CTLTYPE_NODE }, \
 }
 
 #define IPV6CTL_VARS { \
@@ -774,6 +776,7 @@ struct ip6_mtuinfo {
 	&ip6_maxifdefrouters, \
 	&ip6_maxdynroutes, \
 	NULL, \
+	NULL, \
 }
 
 #endif /* __BSD_VISIBLE */
@@ -459,6 +459,16 @@ do {								\
 } while (0)
 
 extern struct ifqueue ip6intrq;		/* IP6 packet input queue */
+extern struct ifqueue ip6intrq_flow[];	/* flow hashed input queues */
+
+/* Flow hashed input queues, like IPINTRQS for IPv4. */
+#define	IP6INTRQS	4
+#define	IP6INTR_BATCH	16
+#define	IP6INTRQ(i)	((i) == 0 ? &ip6intrq : &ip6intrq_flow[(i) - 1])
+#define	IP6INTRQ_SELECT(m)						\
+	(((m)->m_pkthdr.flowid & M_FLOWID_VALID) ?			\
+	    IP6INTRQ(((m)->m_pkthdr.flowid & M_FLOWID_MASK) % IP6INTRQS) : \
+	    &ip6intrq)
 extern struct in6_addr zeroin6_addr;
 extern u_char inet6ctlerrmap[];
 extern unsigned long in6_maxmtu;
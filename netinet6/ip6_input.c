@@ -125,6 +125,7 @@ u_char ip6_protox[IPPROTO_MAX];
 static int ip6qmaxlen = IFQ_MAXLEN;
 struct in6_ifaddr *in6_ifaddr;
 struct ifqueue ip6intrq;
+struct ifqueue ip6intrq_flow[IP6INTRQS - 1];
 
 struct ip6stat ip6stat;
 
@@ -155,7 +156,8 @@ ip6_init(void)
 		    pr->pr_protocol && pr->pr_protocol != IPPROTO_RAW &&
 		    pr->pr_protocol < IPPROTO_MAX)
 			ip6_protox[pr->pr_protocol] = pr - inet6sw;
-	ip6intrq.ifq_maxlen = ip6qmaxlen;
+	for (i = 0; i < IP6INTRQS; i++)
+		IP6INTRQ(i)->ifq_maxlen = ip6qmaxlen;
 	ip6_randomid_init();
 	nd6_init();
 	frag6_init();
@@ -178,17 +180,26 @@ ip6_init2(void *dummy)
 void
 ip6intr(void)
 {
-	int s;
+	struct ifqueue *ifq;
 	struct mbuf *m;
+	int i, n, s, more;
 
-	for (;;) {
-		s = splnet();
-		IF_DEQUEUE(&ip6intrq, m);
-		splx(s);
-		if (m == NULL)
-			return;
-		ip6_input(m);
-	}
+	do {
+		more = 0;
+		for (i = 0; i < IP6INTRQS; i++) {
+			ifq = IP6INTRQ(i);
+			for (n = 0; n < IP6INTR_BATCH; n++) {
+				s = splnet();
+				IF_DEQUEUE(ifq, m);
+				splx(s);
+				if (m == NULL)
+					break;
+				ip6_input(m);
+			}
+			if (n == IP6INTR_BATCH)
+				more = 1;
+		}
+	} while (more);
 }
 
 extern struct	route_in6 ip6_forward_rt;
@@ -1455,9 +1466,10 @@ ip6_sysctl(int *name, u_int namelen, void *oldp, size_t *oldlenp,
 	extern int ip6_mrtproto;
 	extern struct mrt6stat mrt6stat;
 #endif
+	int error, i;
 
-	/* All sysctl names at this level are terminal. */
-	if (namelen != 1)
+	/* Almost all sysctl names at this level are terminal. */
+	if (namelen != 1 && name[0] != IPV6CTL_IFQUEUE)
 		return ENOTDIR;
 
 	switch (name[0]) {
@@ -1487,6 +1499,23 @@ ip6_sysctl(int *name, u_int namelen, void *oldp, size_t *oldlenp,
 #else
 		return (EOPNOTSUPP);
 #endif
+	case IPV6CTL_IFQUEUE:
+		/* length and drops are reported over all input queues */
+		if (namelen == 2 &&
+		    (name[1] == IFQCTL_LEN || name[1] == IFQCTL_DROPS)) {
+			int sum = 0;
+
+			for (i = 0; i < IP6INTRQS; i++)
+				sum += (name[1] == IFQCTL_LEN) ?
+				    IP6INTRQ(i)->ifq_len :
+				    IP6INTRQ(i)->ifq_drops;
+			return (sysctl_rdint(oldp, oldlenp, newp, sum));
+		}
+		error = sysctl_ifq(name + 1, namelen - 1,
+		    oldp, oldlenp, newp, newlen, &ip6intrq);
+		for (i = 1; i < IP6INTRQS; i++)
+			IP6INTRQ(i)->ifq_maxlen = ip6intrq.ifq_maxlen;
+		return (error);
 	default:
 		if (name[0] < IPV6CTL_MAXID)
 			return (sysctl_int_arr(ipv6ctl_vars, name, namelen,
@@ -174,6 +174,8 @@ sdattach(struct device *parent, struct device *self, void *aux)
 	 */
 	sc->sc_dk.dk_name = sc->sc_dev.dv_xname;
 	bufq_init(&sc->sc_bufq, BUFQ_DEFAULT);
+	bufq_setkick(&sc->sc_bufq, (void (*)(void *))scsi_xsh_add,
+	    &sc->sc_xsh);
 
 	if ((sc_link->flags & SDEV_ATAPI) && (sc_link->flags & SDEV_REMOVABLE))
 		sc_link->quirks |= SDEV_NOSYNCCACHE;
@@ -993,6 +995,18 @@ sdioctl(dev_t dev, u_long cmd, caddr_t addr, int flag, struct proc *p)
 		error = sd_ioctl_cache(sc, cmd, (struct dk_cache *)addr);
 		goto exit;
 
+	case DIOCGBUFQ:
+		*(int *)addr = sc->sc_bufq.bufq_type;
+		goto exit;
+
+	case DIOCSBUFQ:
+		if ((flag & FWRITE) == 0) {
+			error = EBADF;
+			goto exit;
+		}
+		error = bufq_switch(&sc->sc_bufq, *(int *)addr);
+		goto exit;
+
 	default:
 		if (part != RAW_PART) {
 			error = ENOTTY;
@@ -65,8 +65,9 @@ LIST_HEAD(workhead, worklist);
  */
 #define BUFQ_DISKSORT	0
 #define	BUFQ_FIFO	1
+#define	BUFQ_DEADLINE	2
 #define BUFQ_DEFAULT	BUFQ_DISKSORT
-#define BUFQ_HOWMANY	2
+#define BUFQ_HOWMANY	3
 
 struct bufq_impl;
 
@@ -78,11 +79,14 @@ struct bufq {
 	int			 bufq_stop;
 	int			 bufq_type;
 	const struct bufq_impl	*bufq_impl;
+	void			(*bufq_kick)(void *);	/* restart driver */
+	void			*bufq_kickarg;
 };
 
 int		 bufq_init(struct bufq *, int);
 int		 bufq_switch(struct bufq *, int);
 void		 bufq_destroy(struct bufq *);
+void		 bufq_setkick(struct bufq *, void (*)(void *), void *);
 
 void		 bufq_queue(struct bufq *, struct buf *);
 struct buf	*bufq_dequeue(struct bufq *);
@@ -106,6 +110,13 @@ struct bufq_fifo {
 	SIMPLEQ_ENTRY(buf)	bqf_entries;
 };
 
+/* deadline */
+struct bufq_deadline {
+	RB_ENTRY(buf)		bqdl_sort;	/* by block number */
+	TAILQ_ENTRY(buf)	bqdl_fifo;	/* by arrival */
+	int			bqdl_expire;	/* deadline in ticks */
+};
+
 /* Abuse bufq_fifo, for swapping to regular files. */
 struct bufq_swapreg {
 	SIMPLEQ_ENTRY(buf)	bqf_entries;
@@ -117,6 +128,7 @@ struct bufq_swapreg {
 union bufq_data {
 	struct bufq_disksort	bufq_data_disksort;
 	struct bufq_fifo	bufq_data_fifo;
+	struct bufq_deadline	bufq_data_deadline;
 	struct bufq_swapreg	bufq_swapreg;
 };
 
@@ -169,6 +181,8 @@ struct buf {
 					 * Will be called at splbio(). */
 	void	(*b_iodone)(struct buf *);
 	struct	vnode *b_vp;		/* Device vnode. */
+	struct	mount *b_dirtymp;	/* Mount charged for dirty pages. */
+	long	b_dirtypages;		/* Pages charged to b_dirtymp. */
 	int	b_dirtyoff;		/* Offset in buffer of dirty region. */
 	int	b_dirtyend;		/* Offset of end of dirty region. */
 	int	b_validoff;		/* Offset in buffer of valid region. */
@@ -214,12 +228,15 @@ struct buf {
 #define	B_PDAEMON	0x00200000	/* I/O started by pagedaemon */
 #define	B_RELEASED	0x00400000	/* free this buffer after its kvm */
 #define	B_NOTMAPPED	0x00800000	/* BUSY, but not necessarily mapped */
+#define	B_HOT		0x01000000	/* on the hot clean queue */
+#define	B_READAHEAD	0x02000000	/* read ahead, not used yet */
 
 #define	B_BITS	"\20\001AGE\002NEEDCOMMIT\003ASYNC\004BAD\005BUSY" \
     "\006CACHE\007CALL\010DELWRI\011DONE\012EINTR\013ERROR" \
     "\014INVAL\015NOCACHE\016PHYS\017RAW\020READ" \
     "\021WANTED\022WRITEINPROG\023XXX(FORMAT)\024DEFERRED" \
-    "\025SCANNED\026DAEMON\027RELEASED\030NOTMAPPED"
+    "\025SCANNED\026DAEMON\027RELEASED\030NOTMAPPED\031HOT" \
+    "\032READAHEAD"
 
 /*
  * This structure describes a clustered I/O.  It is stored in the b_saveaddr
@@ -248,6 +265,18 @@ struct cluster_save {
 #define B_CLRBUF	0x01	/* Request allocated buffer be cleared. */
 #define B_SYNC		0x02	/* Do all allocations synchronously. */
 
+/*
+ * A sequential reader of a file, see bread_cluster().  Several of them
+ * are tracked per file so that interleaved streams keep their windows.
+ */
+#define	CI_NSTREAMS	4
+
+struct cluster_stream {
+	daddr64_t	cs_lastr;	/* last block read by the stream */
+	daddr64_t	cs_ranext;	/* first block not read ahead yet */
+	int		cs_ralen;	/* read-ahead window in blocks */
+};
+
 struct cluster_info {
 	daddr64_t	ci_lastr;	/* last read (read-ahead) */
 	daddr64_t	ci_lastw;	/* last write (write cluster) */
@@ -256,6 +285,7 @@ struct cluster_info {
 	int		ci_clen; 	/* length of current cluster */
 	int		ci_ralen;	/* Read-ahead length */
 	daddr64_t	ci_maxra;	/* last readahead block */
+	struct cluster_stream ci_rs[CI_NSTREAMS]; /* most recent first */
 };
 
 #ifdef _KERNEL
@@ -276,6 +306,8 @@ void	bremfree(struct buf *);
 void	bufinit(void);
 void	buf_dirty(struct buf *);
 void    buf_undirty(struct buf *);
+int	buf_toodirty(struct mount *);
+void	buf_throttle(struct mount *);
 int	bwrite(struct buf *);
 struct buf *getblk(struct vnode *, daddr64_t, int, int, int);
 struct buf *geteblk(int);
@@ -311,7 +343,8 @@ void  buf_replacevnode(struct buf *, struct vnode *);
 void  buf_daemon(struct proc *);
 void  buf_replacevnode(struct buf *, struct vnode *);
 void  buf_daemon(struct proc *);
-int bread_cluster(struct vnode *, daddr64_t, int, struct buf **);
+int bread_cluster(struct vnode *, struct cluster_info *, daddr64_t, int,
+    struct buf **);
 
 #ifdef DEBUG
 void buf_print(struct buf *);
@@ -84,4 +84,7 @@ struct dk_diskmap {
 
 #define	DIOCMAP		_IOWR('d', 119, struct dk_diskmap)
 
+#define DIOCGBUFQ	_IOR('d', 120, int)	/* get bufq discipline */
+#define DIOCSBUFQ	_IOW('d', 121, int)	/* set bufq discipline */
+
 #endif /* _SYS_DKIO_H_ */
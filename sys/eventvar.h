@@ -31,10 +31,17 @@
 #ifndef _SYS_EVENTVAR_H_
 #define _SYS_EVENTVAR_H_
 
-#define KQ_NEVENTS	8		/* minimize copy{in,out} calls */
+#define KQ_NEVENTS	32		/* minimize copy{in,out} calls */
 #define KQEXTENT	256		/* linear growth by this amount */
 
+#include <sys/mutex.h>
+
+/*
+ * kq_mtx protects the pending list, kq_count, kq_state and the
+ * kn_status of the knotes on this kqueue.
+ */
 struct kqueue {
+	struct		mutex kq_mtx;
 	TAILQ_HEAD(kqlist, knote) kq_head;	/* list of pending event */
 	int		kq_count;		/* number of pending events */
 	struct		selinfo kq_sel;
@@ -74,6 +74,7 @@ struct filedesc {
 	struct	klist *fd_knlist;	/* list of attached knotes */
 	u_long	fd_knhashmask;		/* size of knhash */
 	struct	klist *fd_knhash;	/* hash table for attached knotes */
+	u_long	fd_knhashcount;		/* knotes in knhash */
 
 	int fd_flags;			/* flags on the file descriptor table */
 };
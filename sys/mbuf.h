@@ -100,9 +100,10 @@ struct	pkthdr {
 	SLIST_HEAD(packet_tags, m_tag) tags; /* list of packet tags */
 	int			 len;		/* total packet length */
 	u_int16_t		 tagsset;	/* mtags attached */
-	u_int16_t		 pad;
+	u_int16_t		 flowid;	/* flow hash, see below */
 	u_int16_t		 csum_flags;	/* checksum flags */
 	u_int16_t		 ether_vtag;	/* Ethernet 802.1p+Q vlan tag */
+	u_int16_t		 tso_segsz;	/* TSO segment data size */
 	u_int			 rdomain;	/* routing domain id */
 	struct pkthdr_pf	 pf;
 };
@@ -159,6 +160,10 @@ struct mbuf {
 #define M_CLUSTER	0x0008	/* external storage is a cluster */
 #define	M_PROTO1	0x0010	/* protocol-specific */
 
+/* pkthdr flowid */
+#define	M_FLOWID_VALID	0x8000	/* flowid has been set */
+#define	M_FLOWID_MASK	0x7fff	/* hash bits of flowid */
+
 /* mbuf pkthdr flags, also in m_flags */
 #define M_VLANTAG	0x0020	/* ether_vtag is valid */
 #define M_LOOP		0x0040	/* for Mbuf statistics */
@@ -189,6 +194,7 @@ struct mbuf {
 #define	M_ICMP_CSUM_OUT		0x0200	/* ICMP checksum needed */
 #define	M_ICMP_CSUM_IN_OK	0x0400	/* ICMP checksum verified */
 #define	M_ICMP_CSUM_IN_BAD	0x0800	/* ICMP checksum bad */
+#define	M_TCP_TSO		0x1000	/* TCP segmentation needed */
 
 /* mbuf types */
 #define	MT_FREE		0	/* should be on free list */
@@ -368,6 +368,8 @@ struct mount {
 	int		mnt_maxsymlinklen;	/* max size of short symlink */
 	struct statfs	mnt_stat;		/* cache of filesystem stats */
 	void		*mnt_data;		/* private data */
+	long		mnt_dirtypages;		/* dirty buffer cache pages */
+	long		mnt_throttled;		/* writers delayed */
 };
 
 /*
@@ -459,11 +461,13 @@ typedef struct fhandle	fhandle_t;
 				   as next argument */
 #define VFS_BCACHESTAT	3	/* struct: buffer cache statistics given 
 				   as next argument */
+#define VFS_DIRTYSTAT	4	/* struct: dirty pages per mount point */
 #define	CTL_VFSGENCTL_NAMES { \
 	{ 0, 0 }, \
 	{ "maxtypenum", CTLTYPE_INT }, \
 	{ "conf", CTLTYPE_NODE }, \
-	{ "bcachestat", CTLTYPE_STRUCT } \
+	{ "bcachestat", CTLTYPE_STRUCT }, \
+	{ "dirtystat", CTLTYPE_STRUCT } \
 }
 
 /*
@@ -494,6 +498,24 @@ struct bcachestats {
 	int64_t numreads;		/* total reads started */
 	int64_t cachehits;		/* total reads found in cache */
 	int64_t busymapped;		/* number of busy and mapped buffers */
+	int64_t numhotpages;		/* clean pages seen more than once */
+	int64_t cachemisses;		/* total reads not found in cache */
+	int64_t ghosthits;		/* misses on recently evicted blocks */
+	int64_t numreadahead;		/* total blocks read ahead */
+	int64_t readaheadhits;		/* read ahead blocks later used */
+	int64_t readaheadwaste;		/* read ahead blocks freed unused */
+	int64_t throttled;		/* writers delayed for dirty pages */
+	int64_t writebehind;		/* clusters pushed early */
+};
+
+/*
+ * Dirty buffer cache pages per mount point, VFS_DIRTYSTAT.
+ */
+struct mntdirtystat {
+	fsid_t	md_fsid;			/* file system id */
+	int64_t	md_dirtypages;			/* dirty free pages */
+	int64_t	md_throttled;			/* writers delayed */
+	char	md_mntonname[MNAMELEN];		/* mounted on */
 };
 #ifdef _KERNEL
 extern struct bcachestats bcstats;
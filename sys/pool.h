@@ -43,6 +43,7 @@
 #define KERN_POOL_NPOOLS	1
 #define KERN_POOL_NAME		2
 #define KERN_POOL_POOL		3
+#define KERN_POOL_CACHE		4	/* kern.pool.cache.<number> */
 
 #include <sys/queue.h>
 #include <sys/time.h>
@@ -51,6 +52,42 @@
 
 struct pool;
 
+/*
+ * Per-CPU item caches.  Each CPU holds up to two magazines of free
+ * items; whole magazines are exchanged with the pool's depot, so the
+ * pool mutex is only taken when both the CPU and the depot run dry.
+ * The depot keeps at most POOL_CACHE_DEPOTMAX full and as many empty
+ * magazines, anything beyond that goes back to the pool.
+ */
+#define POOL_CACHE_MAGSIZE	15
+#define POOL_CACHE_DEPOTMAX	8
+
+struct pool_cache_mag {
+	SLIST_ENTRY(pool_cache_mag)
+			pm_list;
+	int		pm_nitems;	/* # of items in pm_items */
+	void		*pm_items[POOL_CACHE_MAGSIZE];
+};
+
+SLIST_HEAD(pool_cache_maglist, pool_cache_mag);
+
+struct pool_cache {
+	struct pool_cache_mag	*pc_cur;	/* magazine in use */
+	struct pool_cache_mag	*pc_prev;	/* full or empty spare */
+	unsigned long	pc_gethit;	/* # of gets served by the cache */
+	unsigned long	pc_getmiss;	/* # of gets passed to the pool */
+	unsigned long	pc_puthit;	/* # of puts kept in the cache */
+	unsigned long	pc_putmiss;	/* # of puts passed to the pool */
+};
+
+/* kern.pool.cache.<number> returns one of these per CPU */
+struct kinfo_pool_cache {
+	u_int64_t	pc_gethit;
+	u_int64_t	pc_getmiss;
+	u_int64_t	pc_puthit;
+	u_int64_t	pc_putmiss;
+};
+
 struct pool_allocator {
 	void *(*pa_alloc)(struct pool *, int, int *);
 	void (*pa_free)(struct pool *, void *);
@@ -99,6 +136,7 @@ struct pool {
 #define PR_PHINPAGE	0x0200
 #define PR_LOGGING	0x0400
 #define PR_DEBUG	0x0800
+#define PR_CACHE	0x1000	/* use per-CPU item caches */
 
 	int			pr_ipl;
 
@@ -133,6 +171,16 @@ struct pool {
 
 	/* Physical memory configuration. */
 	const struct kmem_pa_mode *pr_crange;
+
+	/* Per-CPU caches and magazine depot, only with PR_CACHE. */
+	struct pool_cache *pr_cache;	/* indexed by CPU_INFO_UNIT() */
+	struct mutex	pr_cache_mtx;	/* protects the depot */
+	struct pool_cache_maglist
+			pr_cache_full;	/* depot: full magazines */
+	struct pool_cache_maglist
+			pr_cache_empty;	/* depot: empty magazines */
+	unsigned int	pr_cache_nfull;	/* # of full magazines in depot */
+	unsigned int	pr_cache_nempty;/* # of empty magazines in depot */
 };
 
 #ifdef _KERNEL
@@ -146,6 +194,7 @@ void		pool_setipl(struct pool *, int);
 void		pool_setlowat(struct pool *, int);
 void		pool_sethiwat(struct pool *, int);
 int		pool_sethardlimit(struct pool *, u_int, const char *, int);
+u_int		pool_inuse(struct pool *);
 struct uvm_constraint_range; /* XXX */
 void		pool_set_constraints(struct pool *,
 		    const struct kmem_pa_mode *mode);
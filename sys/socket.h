@@ -40,6 +40,11 @@
  */
 #include <machine/param.h>
 
+/*
+ * needed for struct timeval in struct splice
+ */
+#include <sys/time.h>
+
 /*
  * Definitions related to sockets: types, address families, options.
  */
@@ -103,8 +108,12 @@ struct	linger {
 struct	splice {
 	int	sp_fd;			/* drain socket file descriptor */
 	off_t	sp_max;			/* if set, maximum bytes to splice */
+	struct	timeval sp_idle;	/* if set, unsplice when idle */
+	int	sp_flags;		/* see below */
 };
 
+#define	SPLICE_BIDIR	0x01		/* also splice drain back to source */
+
 /*
  * Level number for (get/set)sockopt() to apply to socket itself.
  */
@@ -503,6 +512,7 @@ ssize_t	send(int, const void *, size_t, int);
 ssize_t	sendto(int, const void *,
 	    size_t, int, const struct sockaddr *, socklen_t);
 ssize_t	sendmsg(int, const struct msghdr *, int);
+int	sendfile(int, int, off_t, size_t, off_t *, int);
 int	setsockopt(int, int, int, const void *, socklen_t);
 int	shutdown(int, int);
 int	socket(int, int, int);
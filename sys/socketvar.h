@@ -34,6 +34,7 @@
 
 #include <sys/selinfo.h>			/* for struct selinfo */
 #include <sys/queue.h>
+#include <sys/timeout.h>			/* for struct timeout */
 
 TAILQ_HEAD(soqhead, socket);
 
@@ -81,6 +82,9 @@ struct socket {
 	struct	socket *so_spliceback;	/* back ref for notify and cleanup */
 	off_t	so_splicelen;		/* number of bytes spliced so far */
 	off_t	so_splicemax;		/* maximum number of bytes to splice */
+	struct	timeval so_idletv;	/* idle timeout */
+	struct	timeout so_idleto;
+	short	so_spliceflags;		/* see below */
 #endif /* SOCKET_SPLICE */
 /*
  * Variables for socket buffering.
@@ -145,6 +149,12 @@ struct socket {
 #define	SS_CONNECTOUT		0x1000	/* connect, not accept, at this end */
 #define	SS_ISSENDING		0x2000	/* hint for lower layer */
 
+/*
+ * Splice flags.
+ */
+#define	SOSP_BIDIR		0x01	/* one half of a bidirectional splice */
+#define	SOSP_DONE		0x02	/* splicing finished, see so_error */
+
 /*
  * Macros for sockets and socket buffering.
  */
@@ -291,6 +301,7 @@ int	sbreserve(struct sockbuf *sb, u_long cc);
 int	sbwait(struct sockbuf *sb);
 int	sb_lock(struct sockbuf *sb);
 void	soinit(void);
+void	sendfile_init(void);
 int	soabort(struct socket *so);
 int	soaccept(struct socket *so, struct mbuf *nam);
 int	sobind(struct socket *so, struct mbuf *nam, struct proc *p);
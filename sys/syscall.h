@@ -688,4 +688,7 @@
 /* syscall: "getdirentries" ret: "int" args: "int" "char *" "int" "off_t *" */
 #define	SYS_getdirentries	312
 
-#define	SYS_MAXSYSCALL	313
+/* syscall: "sendfile" ret: "int" args: "int" "int" "off_t" "size_t" "off_t *" "int" */
+#define	SYS_sendfile	313
+
+#define	SYS_MAXSYSCALL	314
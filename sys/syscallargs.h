@@ -1222,6 +1222,15 @@ struct sys_getdirentries_args {
 	syscallarg(off_t *) basep;
 };
 
+struct sys_sendfile_args {
+	syscallarg(int) fd;
+	syscallarg(int) s;
+	syscallarg(off_t) offset;
+	syscallarg(size_t) nbytes;
+	syscallarg(off_t *) sbytes;
+	syscallarg(int) flags;
+};
+
 /*
  * System call prototypes.
  */
@@ -1534,3 +1543,4 @@ int	sys_fhstatfs(struct proc *, void *, register_t *);
 int	sys_setrtable(struct proc *, void *, register_t *);
 int	sys_getrtable(struct proc *, void *, register_t *);
 int	sys_getdirentries(struct proc *, void *, register_t *);
+int	sys_sendfile(struct proc *, void *, register_t *);
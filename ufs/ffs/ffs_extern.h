@@ -51,7 +51,11 @@
 #define	FFS_DIRHASH_DIRSIZE	17	/* min directory size, in bytes */
 #define	FFS_DIRHASH_MAXMEM	18	/* max kvm to use, in bytes */
 #define	FFS_DIRHASH_MEM		19	/* current mem usage, in bytes */
-#define	FFS_MAXID		20	/* number of valid ffs ids */
+#define	FFS_DIRHASH_BUILDCHUNK	20	/* bytes hashed per lookup */
+#define	FFS_DIRHASH_BUILDS	21	/* completed hash builds */
+#define	FFS_DIRHASH_BUILDTIME	22	/* total build time, in usec */
+#define	FFS_DIRHASH_RECYCLES	23	/* hashes recycled for memory */
+#define	FFS_MAXID		24	/* number of valid ffs ids */
 
 #define FFS_NAMES { \
 	{ 0, 0 }, \
@@ -74,6 +78,10 @@
 	{ "dirhash_dirsize", CTLTYPE_INT }, \
 	{ "dirhash_maxmem", CTLTYPE_INT }, \
 	{ "dirhash_mem", CTLTYPE_INT }, \
+	{ "dirhash_buildchunk", CTLTYPE_INT }, \
+	{ "dirhash_builds", CTLTYPE_INT }, \
+	{ "dirhash_buildtime", CTLTYPE_QUAD }, \
+	{ "dirhash_recycles", CTLTYPE_INT }, \
 }
 
 struct buf;
@@ -1573,6 +1573,25 @@ ffs_sysctl(int *name, u_int namelen, void *oldp, size_t *oldlenp, void *newp,
 		    &ufs_dirhashmaxmem));
 	case FFS_DIRHASH_MEM:
 		return (sysctl_rdint(oldp, oldlenp, newp, ufs_dirhashmem));
+	case FFS_DIRHASH_BUILDCHUNK: {
+		int chunk = ufs_dirhashbuildchunk, error;
+
+		error = sysctl_int(oldp, oldlenp, newp, newlen, &chunk);
+		if (error == 0 && newp != NULL) {
+			if (chunk < DIRBLKSIZ || chunk > DH_MAXBUILDCHUNK)
+				return (EINVAL);
+			ufs_dirhashbuildchunk = chunk;
+		}
+		return (error);
+	}
+	case FFS_DIRHASH_BUILDS:
+		return (sysctl_rdint(oldp, oldlenp, newp, ufs_dirhashbuilds));
+	case FFS_DIRHASH_BUILDTIME:
+		return (sysctl_rdquad(oldp, oldlenp, newp,
+		    ufs_dirhashbuildtime));
+	case FFS_DIRHASH_RECYCLES:
+		return (sysctl_rdint(oldp, oldlenp, newp,
+		    ufs_dirhashrecycles));
 #endif
 
 	default:
@@ -246,10 +246,8 @@ ffs_read(void *v)
 
 		if (lblktosize(fs, nextlbn) >= DIP(ip, size))
 			error = bread(vp, lbn, size, NOCRED, &bp);
-		else if (lbn - 1 == ip->i_ci.ci_lastr) {
-			error = bread_cluster(vp, lbn, size, &bp);
-		} else
-			error = bread(vp, lbn, size, NOCRED, &bp);
+		else
+			error = bread_cluster(vp, &ip->i_ci, lbn, size, &bp);
 
 		if (error)
 			break;
@@ -71,6 +71,24 @@
 #define DH_SCOREINIT	8	/* initial dh_score when dirhash built */
 #define DH_SCOREMAX	64	/* max dh_score value */
 
+/*
+ * The memory limit for all dirhashes scales with physical memory,
+ * within these bounds.
+ */
+#define DH_MINMEM	(2 * 1024 * 1024)
+#define DH_MAXMEM	(64 * 1024 * 1024)
+#define DH_MEMFRAC	256	/* use 1/DH_MEMFRAC of physical memory */
+
+/*
+ * Large directories are hashed a chunk at a time, on successive
+ * lookups; until the hash is complete, lookups do a linear scan.
+ * dh_buildoff is the offset up to which entries are in the hash.
+ */
+#define DH_BUILDCHUNK	(128 * 1024)	/* default bytes hashed per lookup */
+#define DH_MAXBUILDCHUNK (MAXBSIZE * 64) /* limit of bytes hashed per lookup */
+#define DH_BUILT(dh, off) \
+    ((dh)->dh_buildoff == -1 || (off) < (dh)->dh_buildoff)
+
 /*
  * The main hash table has 2 levels. It is an array of pointers to
  * blocks of DH_NBLKOFF offsets.
@@ -100,6 +118,9 @@ struct dirhash {
 
 	int	dh_score;	/* access count for this dirhash */
 
+	doff_t	dh_buildoff;	/* build progress; -1 once complete */
+	int64_t	dh_buildusec;	/* time spent building so far */
+
 	int	dh_onlist;	/* true if on the ufsdirhash_list chain */
 
 	/* Protected by ufsdirhash_mtx. */
@@ -109,6 +130,10 @@ struct dirhash {
 extern	int ufs_mindirhashsize;
 extern	int ufs_dirhashmaxmem;
 extern	int ufs_dirhashmem;
+extern	int ufs_dirhashbuildchunk;
+extern	int ufs_dirhashbuilds;
+extern	int64_t ufs_dirhashbuildtime;
+extern	int ufs_dirhashrecycles;
 
 /*
  * Dirhash functions.
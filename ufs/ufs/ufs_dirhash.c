@@ -62,6 +62,10 @@ int ufs_mindirhashsize;
 int ufs_dirhashmaxmem;
 int ufs_dirhashmem;
 int ufs_dirhashcheck;
+int ufs_dirhashbuildchunk = DH_BUILDCHUNK;
+int ufs_dirhashbuilds;
+int64_t ufs_dirhashbuildtime;
+int ufs_dirhashrecycles;
 
 
 int ufsdirhash_hash(struct dirhash *dh, char *name, int namelen);
@@ -71,6 +75,7 @@ int ufsdirhash_findslot(struct dirhash *dh, char *name, int namelen,
    doff_t offset);
 doff_t ufsdirhash_getprev(struct direct *dp, doff_t offset);
 int ufsdirhash_recycle(int wanted);
+int ufsdirhash_fill(struct inode *ip);
 
 struct pool		ufsdirhash_pool;
 
@@ -87,7 +92,10 @@ struct pool		ufsdirhash_pool;
 /* Dirhash list; recently-used entries are near the tail. */
 TAILQ_HEAD(, dirhash) ufsdirhash_list;
 
-/* Protects: ufsdirhash_list, `dh_list' field, ufs_dirhashmem. */
+/*
+ * Protects: ufsdirhash_list, `dh_list' field, ufs_dirhashmem and the
+ * build statistics.
+ */
 struct mutex ufsdirhash_mtx;
 
 /*
@@ -102,17 +110,15 @@ struct mutex ufsdirhash_mtx;
 
 /*
  * Attempt to build up a hash table for the directory contents in
- * inode 'ip'. Returns 0 on success, or -1 of the operation failed.
+ * inode 'ip'. Returns 0 on success, or -1 if the operation failed or
+ * the hash is not complete yet; either way the caller should revert
+ * to a linear search.
  */
 int
 ufsdirhash_build(struct inode *ip)
 {
 	struct dirhash *dh;
-	struct buf *bp = NULL;
-	struct direct *ep;
-	struct vnode *vp;
-	doff_t bmask, pos;
-	int dirblocks, i, j, memreqd, nblocks, narrays, nslots, slot;
+	int dirblocks, i, j, memreqd, nblocks, narrays, nslots;
 
 	/* Check if we can/should use dirhash. */
 	if (ip->i_dirhash == NULL) {
@@ -127,7 +133,7 @@ ufsdirhash_build(struct inode *ip)
 		}
 		/* Check if hash exists and is intact (note: unlocked read). */
 		if (ip->i_dirhash->dh_hash != NULL)
-			return (0);
+			return (ufsdirhash_fill(ip));
 		/* Free the old, recycled hash and build a new one. */
 		ufsdirhash_free(ip);
 	}
@@ -136,7 +142,6 @@ ufsdirhash_build(struct inode *ip)
 	if (ip->i_effnlink == 0)
 		return (-1);
 
-	vp = ip->i_vnode;
 	/* Allocate 50% more entries than this dir size could ever need. */
 	DIRHASH_ASSERT(DIP(ip, size) >= DIRBLKSIZ, ("ufsdirhash_build size"));
 	nslots = DIP(ip, size) / DIRECTSIZ(1);
@@ -201,45 +206,19 @@ ufsdirhash_build(struct inode *ip)
 	dh->dh_seqopt = 0;
 	dh->dh_seqoff = 0;
 	dh->dh_score = DH_SCOREINIT;
+	dh->dh_buildoff = 0;
+	dh->dh_buildusec = 0;
 	ip->i_dirhash = dh;
 
-	bmask = VFSTOUFS(vp->v_mount)->um_mountp->mnt_stat.f_iosize - 1;
-	pos = 0;
-	while (pos < DIP(ip, size)) {
-		/* If necessary, get the next directory block. */
-		if ((pos & bmask) == 0) {
-			if (bp != NULL)
-				brelse(bp);
-			if (UFS_BUFATOFF(ip, (off_t)pos, NULL, &bp) != 0)
-				goto fail;
-		}
-		/* Add this entry to the hash. */
-		ep = (struct direct *)((char *)bp->b_data + (pos & bmask));
-		if (ep->d_reclen == 0 || ep->d_reclen >
-		    DIRBLKSIZ - (pos & (DIRBLKSIZ - 1))) {
-			/* Corrupted directory. */
-			brelse(bp);
-			goto fail;
-		}
-		if (ep->d_ino != 0) {
-			/* Add the entry (simplified ufsdirhash_add). */
-			slot = ufsdirhash_hash(dh, ep->d_name, ep->d_namlen);
-			while (DH_ENTRY(dh, slot) != DIRHASH_EMPTY)
-				slot = WRAPINCR(slot, dh->dh_hlen);
-			dh->dh_hused++;
-			DH_ENTRY(dh, slot) = pos;
-			ufsdirhash_adjfree(dh, pos, -DIRSIZ(0, ep));
-		}
-		pos += ep->d_reclen;
-	}
-
-	if (bp != NULL)
-		brelse(bp);
+	/*
+	 * Put the hash on the list right away, so its memory can be
+	 * recycled even if the build is never completed.
+	 */
 	DIRHASHLIST_LOCK();
 	TAILQ_INSERT_TAIL(&ufsdirhash_list, dh, dh_list);
 	dh->dh_onlist = 1;
 	DIRHASHLIST_UNLOCK();
-	return (0);
+	return (ufsdirhash_fill(ip));
 
 fail:
 	if (dh->dh_hash != NULL) {
@@ -258,6 +237,101 @@ fail:
 	return (-1);
 }
 
+/*
+ * Add the next ufs_dirhashbuildchunk bytes of the directory to a hash
+ * under construction, so that no single lookup has to wait for all of
+ * a large directory to be read. Returns 0 once the hash is complete,
+ * or -1 if the caller should revert to a linear search.
+ */
+int
+ufsdirhash_fill(struct inode *ip)
+{
+	struct dirhash *dh = ip->i_dirhash;
+	struct timeval start, end;
+	struct buf *bp;
+	struct direct *ep;
+	struct vnode *vp;
+	doff_t bmask, blkend, pos, stop;
+	int64_t usec;
+	int slot;
+
+	/* Check if the hash is complete (note: unlocked read). */
+	if (dh->dh_buildoff == -1)
+		return (0);
+
+	microuptime(&start);
+	vp = ip->i_vnode;
+	bmask = VFSTOUFS(vp->v_mount)->um_mountp->mnt_stat.f_iosize - 1;
+	pos = dh->dh_buildoff;
+	/* Stop at the end of the chunk, without wrapping past INT_MAX. */
+	stop = pos + MIN(ufs_dirhashbuildchunk, INT_MAX - pos);
+	while (pos < DIP(ip, size) && pos < stop) {
+		if (UFS_BUFATOFF(ip, (off_t)pos, NULL, &bp) != 0)
+			goto fail;
+		blkend = MIN((pos | bmask) + 1, DIP(ip, size));
+
+		DIRHASH_LOCK(dh);
+		if (dh->dh_hash == NULL) {
+			/* Recycled while we were reading. */
+			DIRHASH_UNLOCK(dh);
+			brelse(bp);
+			goto fail;
+		}
+		for (; pos < blkend; pos += ep->d_reclen) {
+			ep = (struct direct *)((char *)bp->b_data +
+			    (pos & bmask));
+			if (ep->d_reclen == 0 || ep->d_reclen >
+			    DIRBLKSIZ - (pos & (DIRBLKSIZ - 1))) {
+				/* Corrupted directory. */
+				DIRHASH_UNLOCK(dh);
+				brelse(bp);
+				goto fail;
+			}
+			if (ep->d_ino == 0)
+				continue;
+			if (dh->dh_hused >= (dh->dh_hlen * 3) / 4) {
+				/* Directory grew too much during the build. */
+				DIRHASH_UNLOCK(dh);
+				brelse(bp);
+				goto fail;
+			}
+			/* Add the entry (simplified ufsdirhash_add). */
+			slot = ufsdirhash_hash(dh, ep->d_name, ep->d_namlen);
+			while (DH_ENTRY(dh, slot) >= 0)
+				slot = WRAPINCR(slot, dh->dh_hlen);
+			if (DH_ENTRY(dh, slot) == DIRHASH_EMPTY)
+				dh->dh_hused++;
+			DH_ENTRY(dh, slot) = pos;
+			ufsdirhash_adjfree(dh, pos, -DIRSIZ(0, ep));
+		}
+		dh->dh_buildoff = pos;
+		DIRHASH_UNLOCK(dh);
+		brelse(bp);
+	}
+
+	microuptime(&end);
+	timersub(&end, &start, &end);
+	DIRHASH_LOCK(dh);
+	dh->dh_buildusec += (int64_t)end.tv_sec * 1000000 + end.tv_usec;
+	if (pos < DIP(ip, size)) {
+		DIRHASH_UNLOCK(dh);
+		return (-1);
+	}
+	dh->dh_buildoff = -1;
+	usec = dh->dh_buildusec;
+	DIRHASH_UNLOCK(dh);
+
+	DIRHASHLIST_LOCK();
+	ufs_dirhashbuilds++;
+	ufs_dirhashbuildtime += usec;
+	DIRHASHLIST_UNLOCK();
+	return (0);
+
+fail:
+	ufsdirhash_free(ip);
+	return (-1);
+}
+
 /*
  * Free any hash table associated with inode 'ip'.
  */
@@ -608,6 +682,11 @@ ufsdirhash_add(struct inode *ip, struct direct *dirp, doff_t offset)
 
 	DIRHASH_ASSERT(offset < dh->dh_dirblks * DIRBLKSIZ,
 	    ("ufsdirhash_add: bad offset"));
+	/* Entries past the build offset are picked up by the build. */
+	if (!DH_BUILT(dh, offset)) {
+		DIRHASH_UNLOCK(dh);
+		return;
+	}
 	/*
 	 * Normal hash usage is < 66%. If the usage gets too high then
 	 * remove the hash entirely and let it be rebuilt later.
@@ -653,6 +732,10 @@ ufsdirhash_remove(struct inode *ip, struct direct *dirp, doff_t offset)
 
 	DIRHASH_ASSERT(offset < dh->dh_dirblks * DIRBLKSIZ,
 	    ("ufsdirhash_remove: bad offset"));
+	if (!DH_BUILT(dh, offset)) {
+		DIRHASH_UNLOCK(dh);
+		return;
+	}
 	/* Find the entry */
 	slot = ufsdirhash_findslot(dh, dirp->d_name, dirp->d_namlen, offset);
 
@@ -687,6 +770,11 @@ ufsdirhash_move(struct inode *ip, struct direct *dirp, doff_t oldoff,
 	DIRHASH_ASSERT(oldoff < dh->dh_dirblks * DIRBLKSIZ &&
 	    newoff < dh->dh_dirblks * DIRBLKSIZ,
 	    ("ufsdirhash_move: bad offset"));
+	/* Both offsets are in the same block, so on the same side. */
+	if (!DH_BUILT(dh, oldoff)) {
+		DIRHASH_UNLOCK(dh);
+		return;
+	}
 	/* Find the entry, and update the offset. */
 	slot = ufsdirhash_findslot(dh, dirp->d_name, dirp->d_namlen, oldoff);
 	DH_ENTRY(dh, slot) = newoff;
@@ -777,6 +865,8 @@ ufsdirhash_dirtrunc(struct inode *ip, doff_t offset)
 		if (dh->dh_firstfree[i] >= block)
 			panic("ufsdirhash_dirtrunc: first free corrupt");
 	dh->dh_dirblks = block;
+	if (dh->dh_buildoff > offset)
+		dh->dh_buildoff = offset;
 	DIRHASH_UNLOCK(dh);
 }
 
@@ -807,6 +897,12 @@ ufsdirhash_checkblock(struct inode *ip, char *buf, doff_t offset)
 		return;
 	}
 
+	/* The free space statistics are incomplete during a build. */
+	if (dh->dh_buildoff != -1) {
+		DIRHASH_UNLOCK(dh);
+		return;
+	}
+
 	block = offset / DIRBLKSIZ;
 	if ((offset & (DIRBLKSIZ - 1)) != 0 || block >= dh->dh_dirblks)
 		panic("ufsdirhash_checkblock: bad offset");
@@ -1026,6 +1122,7 @@ ufsdirhash_recycle(int wanted)
 		}
 
 		/* Remove it from the list and detach its memory. */
+		ufs_dirhashrecycles++;
 		TAILQ_REMOVE(&ufsdirhash_list, dh, dh_list);
 		dh->dh_onlist = 0;
 		hash = dh->dh_hash;
@@ -1067,7 +1164,10 @@ ufsdirhash_init()
 #elif defined (__vax__)
 	if (0)
 #endif
-		ufs_dirhashmaxmem = 2 * 1024 * 1024;
+		/* Scale with physical memory, within sane bounds. */
+		ufs_dirhashmaxmem = MAX(DH_MINMEM,
+		    MIN(physmem / DH_MEMFRAC, DH_MAXMEM / PAGE_SIZE) *
+		    PAGE_SIZE);
 	ufs_mindirhashsize = 5 * DIRBLKSIZ;
 }
 